@@ -0,0 +1,832 @@
+/**
+ * Copyright (C) 2013 Analog Devices, Inc.
+ *
+ * Licensed under the GPL-2.
+ *
+ **/
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <glib.h>
+
+#include "capture.h"
+#include "stats.h"
+
+/* Number of preallocated frames between a capture thread and its readers */
+#define CAPTURE_RING_FRAMES 4
+/* Kernel blocks requested for mmap capture, must be more than the ring holds */
+#define CAPTURE_MMAP_BLOCKS 8
+/* How long a capture thread waits in poll() before checking for stop */
+#define CAPTURE_POLL_TIMEOUT_MS 100
+
+/* Set to reopen the buffer of oneshot devices for every frame */
+bool capture_oneshot_reopen;
+
+G_LOCK_DEFINE_STATIC(trigger_cfg);
+G_LOCK_DEFINE_STATIC(recorder);
+
+/*
+ * Anything which changes the device setup bumps the generation, so the
+ * next oneshot frame starts over with a fresh buffer session.
+ */
+static volatile gint buffer_session_generation;
+
+bool capture_is_oneshot(const char *device)
+{
+	if (strncmp(device, "cf-ad9", 5) == 0)
+		return true;
+	if (strncmp(device, "axi-ad9", 6) == 0)
+		return true;
+	if (strncmp(device, "ad-mc-", 5) == 0)
+		return true;
+
+	return false;
+}
+
+void capture_session_invalidate(void)
+{
+	g_atomic_int_inc(&buffer_session_generation);
+}
+
+/*
+ * If mbuf is given, try to map the kernel block buffers (one block per
+ * frame of ctx->buffer.size bytes), so frames can be looked at in place.
+ * If the driver doesn't support that, or rounds the blocks to another
+ * size, mbuf is left unused and the caller falls back to read().
+ */
+static int buffer_open(struct capture_context *ctx, unsigned int length,
+		int flags, struct iio_mmap_buffer *mbuf)
+{
+	int ret;
+	int fd;
+
+	if (!ctx->device)
+		return -ENODEV;
+
+	set_dev_paths(ctx->device);
+
+	fd = iio_buffer_open(true, flags);
+	if (fd < 0) {
+		ret = -errno;
+		fprintf(stderr, "Failed to open buffer: %d\n", ret);
+		return ret;
+	}
+
+	if (mbuf) {
+		ret = iio_buffer_mmap_init(mbuf, fd, ctx->buffer.size,
+				CAPTURE_MMAP_BLOCKS);
+		/* a block is a frame, the ring holds on to some of them */
+		if (ret == 0 && (mbuf->num_blocks <= CAPTURE_RING_FRAMES ||
+				mbuf->block_size != ctx->buffer.size)) {
+			ret = -EINVAL;
+			iio_buffer_mmap_free(mbuf);
+		}
+		if (!mbuf->blocks)
+			printf("Block buffers not available (%d), using read()\n", ret);
+	}
+
+	/* Setup ring buffer parameters */
+	if (!mbuf || !mbuf->blocks) {
+		ret = write_devattr_int("buffer/length", length);
+		if (ret < 0) {
+			fprintf(stderr, "Failed to set buffer length: %d\n", ret);
+			goto err_close;
+		}
+
+		/*
+		 * Only wake up poll() once a whole frame is there. Not all
+		 * kernels have the attribute, poll() then wakes up earlier.
+		 */
+		write_devattr_int("buffer/watermark", length);
+	}
+
+	/* Enable the buffer */
+	ret = write_devattr_int("buffer/enable", 1);
+	if (ret < 0) {
+		fprintf(stderr, "Failed to enable buffer: %d\n", ret);
+		goto err_close;
+	}
+
+	return fd;
+
+err_close:
+	if (mbuf)
+		iio_buffer_mmap_free(mbuf);
+	close(fd);
+	return ret;
+}
+
+static void buffer_close(struct capture_context *ctx, unsigned int fd,
+		struct iio_mmap_buffer *mbuf)
+{
+	int ret;
+
+	if (!ctx->device)
+		return;
+
+	set_dev_paths(ctx->device);
+
+	/* Enable the buffer */
+	ret = write_devattr_int("buffer/enable", 0);
+	if (ret < 0) {
+		fprintf(stderr, "Failed to disable buffer: %d\n", ret);
+	}
+
+	if (mbuf)
+		iio_buffer_mmap_free(mbuf);
+
+	close(fd);
+}
+
+static void buffer_session_close(struct capture_context *ctx)
+{
+	struct buffer_session *session = &ctx->session;
+
+	if (session->fd < 0)
+		return;
+
+	if (session->armed)
+		buffer_close(ctx, session->fd, NULL);
+	else
+		close(session->fd);
+
+	session->fd = -1;
+	session->armed = false;
+}
+
+static int buffer_session_arm(struct capture_context *ctx, unsigned int length)
+{
+	struct buffer_session *session = &ctx->session;
+	gint generation = g_atomic_int_get(&buffer_session_generation);
+	int ret;
+
+	if (session->fd >= 0 && (session->generation != generation ||
+				session->length != length))
+		buffer_session_close(ctx);
+
+	if (session->fd < 0) {
+		ret = buffer_open(ctx, length, 0, NULL);
+		if (ret < 0)
+			return ret;
+
+		session->fd = ret;
+		session->length = length;
+		session->generation = generation;
+		session->armed = true;
+		return 0;
+	}
+
+	if (session->armed)
+		return 0;
+
+	/* dev paths were set up by buffer_open() in this thread */
+	ret = write_devattr_int("buffer/enable", 1);
+	if (ret < 0) {
+		fprintf(stderr, "Failed to enable buffer: %d\n", ret);
+		buffer_session_close(ctx);
+		return ret;
+	}
+	session->armed = true;
+
+	return 0;
+}
+
+static int buffer_session_disarm(struct capture_context *ctx)
+{
+	struct buffer_session *session = &ctx->session;
+	int ret;
+
+	ret = write_devattr_int("buffer/enable", 0);
+	session->armed = false;
+	if (ret < 0) {
+		fprintf(stderr, "Failed to disable buffer: %d\n", ret);
+		buffer_session_close(ctx);
+	}
+
+	return ret;
+}
+
+/* Hand raw data, as it came from the device, to the recorder if any */
+static void capture_record(struct capture_context *ctx, const void *data,
+		unsigned int len)
+{
+	G_LOCK(recorder);
+	if (ctx->recorder)
+		recorder_write(ctx->recorder, data, len);
+	G_UNLOCK(recorder);
+}
+
+static int sample_iio_data_continuous(int buffer_fd, struct buffer *buf)
+{
+	guint64 start = stats_now();
+	int ret;
+
+	ret = read(buffer_fd, buf->data + buf->available,
+			buf->size - buf->available);
+	if (ret == 0)
+		return 0;
+	if (ret < 0) {
+		if (errno == EAGAIN)
+			return 0;
+		else
+			return -errno;
+	}
+
+	stats_record(STATS_READ, start);
+	if ((unsigned int)ret < buf->size - buf->available)
+		stats_count(STATS_SHORT_READS);
+
+	buf->available += ret;
+
+	return 0;
+}
+
+static int sample_iio_data_oneshot(struct capture_context *ctx)
+{
+	struct buffer *buf = &ctx->buffer;
+	int fd, ret;
+
+	if (capture_oneshot_reopen) {
+		fd = buffer_open(ctx, buf->size, 0, NULL);
+		if (fd < 0)
+			return fd;
+
+		ret = sample_iio_data_continuous(fd, buf);
+
+		buffer_close(ctx, fd, NULL);
+
+		return ret;
+	}
+
+	ret = buffer_session_arm(ctx, buf->size);
+	if (ret < 0)
+		return ret;
+
+	ret = sample_iio_data_continuous(ctx->session.fd, buf);
+	if (ret == 0 && buf->available == buf->size)
+		ret = buffer_session_disarm(ctx);
+
+	return ret;
+}
+
+/*
+ * Replay sources hand out as many scans as the sample rate says should
+ * have come in since the capture started, or anything asked for when
+ * replaying as fast as possible. Returns the number of bytes.
+ */
+static unsigned int capture_replay_chunk(struct capture_context *ctx,
+		void *dst, unsigned int len)
+{
+	unsigned int scan = ctx->bytes_per_sample;
+	unsigned int num = len / scan;
+	guint64 due;
+
+	if (!replay_fast) {
+		due = (g_get_monotonic_time() - ctx->replay_start) *
+			ctx->replay->sample_rate / 1000000.0;
+		if (due <= ctx->replay_sent)
+			return 0;
+		if (num > due - ctx->replay_sent)
+			num = due - ctx->replay_sent;
+	}
+	if (!num)
+		return 0;
+
+	num = replay_read(ctx->replay, ctx->channels, &ctx->replay_pos,
+			dst, num);
+	ctx->replay_sent += num;
+
+	return num * scan;
+}
+
+static int sample_iio_data(struct capture_context *ctx)
+{
+	struct buffer *buf = &ctx->buffer;
+	int ret = 0;
+
+	if (ctx->replay)
+		buf->available += capture_replay_chunk(ctx,
+				(char *)buf->data + buf->available,
+				buf->size - buf->available);
+	else if (capture_is_oneshot(ctx->device))
+		ret = sample_iio_data_oneshot(ctx);
+	else
+		ret = sample_iio_data_continuous(ctx->fd, buf);
+
+	if (buf->available == buf->size) {
+		capture_record(ctx, buf->data, buf->size);
+		if (ctx->frame_done)
+			ctx->frame_done(ctx, buf->data);
+	}
+
+	return ret;
+}
+
+/*
+ * Wait for the buffer to have data, at most CAPTURE_POLL_TIMEOUT_MS so
+ * the capture thread still notices when it's asked to stop.
+ * Returns > 0 if there is data, 0 on timeout.
+ */
+static int buffer_poll(int fd)
+{
+	struct pollfd pfd = {
+		.fd = fd,
+		.events = POLLIN,
+	};
+	int ret;
+
+	ret = poll(&pfd, 1, CAPTURE_POLL_TIMEOUT_MS);
+	if (ret < 0)
+		return errno == EINTR ? 0 : -errno;
+	if (pfd.revents & (POLLERR | POLLHUP | POLLNVAL))
+		return -EIO;
+
+	return ret;
+}
+
+/*
+ * Zero copy capture: the frame points straight into a kernel block. The
+ * block the slot held before is handed back to the kernel first; since the
+ * ring gave us the slot, nobody is looking at it anymore.
+ * Returns 1 once the frame holds data, 0 if capture was stopped meanwhile.
+ */
+static int sample_iio_data_mmap(struct capture_context *ctx,
+		struct frame *frame)
+{
+	struct iio_mmap_buffer *mbuf = &ctx->mmap;
+	unsigned int bytes_used;
+	guint64 start;
+	int ret;
+
+	if (frame->block >= 0) {
+		ret = iio_buffer_mmap_enqueue(mbuf, frame->block);
+		frame->block = -1;
+		frame->data = NULL;
+		if (ret < 0)
+			return ret;
+	}
+
+	while (!g_atomic_int_get(&ctx->stop)) {
+		start = stats_now();
+		ret = iio_buffer_mmap_dequeue(mbuf, &bytes_used);
+		if (ret == -EAGAIN) {
+			ret = buffer_poll(mbuf->fd);
+			if (ret < 0)
+				return ret;
+			continue;
+		}
+		if (ret < 0)
+			return ret;
+
+		stats_record(STATS_READ, start);
+		if (bytes_used != mbuf->block_size) {
+			/* short block, give it back */
+			stats_count(STATS_SHORT_READS);
+			ret = iio_buffer_mmap_enqueue(mbuf, ret);
+			if (ret < 0)
+				return ret;
+			continue;
+		}
+
+		frame->block = ret;
+		frame->data = mbuf->blocks[ret];
+		capture_record(ctx, frame->data, bytes_used);
+		if (ctx->frame_done)
+			ctx->frame_done(ctx, frame->data);
+
+		return 1;
+	}
+
+	return 0;
+}
+
+/*
+ * Free running capture: every complete frame is published, straight from
+ * the buffer into the ring (or as a kernel block, in mmap mode).
+ */
+static int capture_free_run(struct capture_context *ctx)
+{
+	struct buffer *buf = &ctx->buffer;
+	struct frame *frame;
+	unsigned int prev;
+	int ret = 0;
+
+	while (!g_atomic_int_get(&ctx->stop)) {
+		frame = frame_ring_write_begin(ctx->ring);
+		if (!frame) {
+			/* the readers are holding everything, try again later */
+			stats_count(STATS_OVERRUNS);
+			usleep(1000);
+			continue;
+		}
+
+		if (ctx->mmap.blocks) {
+			ret = sample_iio_data_mmap(ctx, frame);
+			if (ret <= 0) {
+				frame_ring_write_cancel(ctx->ring, frame);
+				break;
+			}
+			frame_ring_write_end(ctx->ring, frame);
+			continue;
+		}
+
+		buf->data = frame->data;
+		buf->available = 0;
+
+		while (buf->available < buf->size &&
+				!g_atomic_int_get(&ctx->stop)) {
+			prev = buf->available;
+			ret = sample_iio_data(ctx);
+			if (ret < 0)
+				break;
+			if (buf->available != prev)
+				continue;
+
+			/* oneshot reads block, only the continuous fd polls */
+			if (ctx->fd >= 0) {
+				ret = buffer_poll(ctx->fd);
+				if (ret < 0)
+					break;
+			} else {
+				usleep(1000);
+			}
+		}
+
+		if (ret < 0 || buf->available < buf->size) {
+			frame_ring_write_cancel(ctx->ring, frame);
+			break;
+		}
+
+		frame_ring_write_end(ctx->ring, frame);
+	}
+
+	buf->data = NULL;
+
+	return ret;
+}
+
+/*
+ * Get whatever the buffer has, at most len bytes, into dst. In mmap mode
+ * that's one block, copied out and handed straight back to the kernel.
+ * Returns the number of bytes, 0 if nothing came in for a while.
+ */
+static int capture_read_chunk(struct capture_context *ctx, void *dst,
+		unsigned int len)
+{
+	struct iio_mmap_buffer *mbuf = &ctx->mmap;
+	unsigned int bytes_used;
+	guint64 start = stats_now();
+	int ret, block;
+
+	if (ctx->replay) {
+		ret = capture_replay_chunk(ctx, dst, len);
+		if (!ret)
+			usleep(1000);
+	} else if (mbuf->blocks) {
+		block = iio_buffer_mmap_dequeue(mbuf, &bytes_used);
+		if (block == -EAGAIN)
+			return buffer_poll(mbuf->fd) < 0 ? -EIO : 0;
+		if (block < 0)
+			return block;
+
+		ret = 0;
+		if (bytes_used == mbuf->block_size && bytes_used <= len) {
+			memcpy(dst, mbuf->blocks[block], bytes_used);
+			ret = bytes_used;
+		} else {
+			stats_count(STATS_SHORT_READS);
+		}
+
+		block = iio_buffer_mmap_enqueue(mbuf, block);
+		if (block < 0)
+			return block;
+	} else {
+		ret = read(ctx->fd, dst, len);
+		if (ret < 0) {
+			if (errno != EAGAIN)
+				return -errno;
+			ret = buffer_poll(ctx->fd);
+			return ret < 0 ? ret : 0;
+		}
+		if (ret > 0 && (unsigned int)ret < len)
+			stats_count(STATS_SHORT_READS);
+	}
+
+	if (ret > 0) {
+		stats_record(STATS_READ, start);
+		capture_record(ctx, dst, ret);
+	}
+
+	return ret;
+}
+
+static void capture_publish(struct capture_context *ctx, const void *data)
+{
+	struct frame *frame;
+
+	frame = frame_ring_write_begin(ctx->ring);
+	if (!frame) {
+		stats_count(STATS_OVERRUNS);
+		return;
+	}
+
+	memcpy(frame->data, data, ctx->buffer.size);
+	if (ctx->frame_done)
+		ctx->frame_done(ctx, frame->data);
+	frame_ring_write_end(ctx->ring, frame);
+}
+
+static void capture_load_trigger(struct capture_context *ctx)
+{
+	G_LOCK(trigger_cfg);
+	soft_trigger_reset(&ctx->trigger, &ctx->trigger_cfg);
+	G_UNLOCK(trigger_cfg);
+}
+
+/*
+ * Triggered capture: the stream goes into a history of two frames, which
+ * is demuxed and searched for the trigger as it comes in. A frame is
+ * published once there is enough data after the trigger, starting the
+ * configured pre-trigger amount before it. Positions below are in scans.
+ */
+static int capture_triggered(struct capture_context *ctx)
+{
+	const struct soft_trigger_config *cfg = &ctx->trigger.cfg;
+	unsigned int scan = ctx->demux.scan_size;
+	unsigned int frame_len = ctx->buffer.size / scan;
+	unsigned int hist_len = 2 * frame_len;
+	unsigned int hist_bytes = hist_len * scan;
+	unsigned int filled_bytes = 0, filled = 0, searched = 0;
+	unsigned int since_frame = 0, pre, keep_from, new;
+	uint8_t *hist = ctx->history;
+	bool single_done = false;
+	int pending = -1, idx, ret = 0;
+
+	capture_load_trigger(ctx);
+
+	while (!g_atomic_int_get(&ctx->stop)) {
+		if (g_atomic_int_compare_and_exchange(&ctx->trigger_cfg_changed, 1, 0)) {
+			capture_load_trigger(ctx);
+			pending = -1;
+		}
+		if (g_atomic_int_compare_and_exchange(&ctx->trigger_rearm, 1, 0))
+			single_done = false;
+
+		pre = (cfg->pretrigger > 100 ? 100 : cfg->pretrigger) *
+			frame_len / 100;
+
+		/* make room, keeping what a coming frame may still need */
+		if (hist_bytes - filled_bytes < (ctx->mmap.blocks ?
+					ctx->buffer.size : scan)) {
+			if (pending >= 0) {
+				keep_from = pending;
+			} else {
+				keep_from = searched > pre ? searched - pre : 0;
+				/* and the last frame, for the free-running publish */
+				keep_from = MIN(keep_from, filled > frame_len ?
+						filled - frame_len : 0);
+			}
+			if (!keep_from)
+				keep_from = filled;
+
+			memmove(hist, hist + keep_from * scan,
+					filled_bytes - keep_from * scan);
+			filled_bytes -= keep_from * scan;
+			filled -= keep_from;
+			searched -= keep_from;
+			if (pending >= 0)
+				pending -= keep_from;
+		}
+
+		ret = capture_read_chunk(ctx, hist + filled_bytes,
+				hist_bytes - filled_bytes);
+		if (ret < 0)
+			break;
+		if (ret == 0)
+			continue;
+
+		filled_bytes += ret;
+		new = filled_bytes / scan - filled;
+		filled += new;
+		since_frame += new;
+
+		if (single_done || cfg->mode == SOFT_TRIGGER_OFF ||
+				cfg->channel >= ctx->num_active_channels) {
+			searched = filled;
+		} else if (pending < 0 && searched < filled) {
+			demux_run(&ctx->demux, hist + searched * scan,
+					ctx->trigger_data, filled - searched,
+					searched, hist_len);
+			idx = soft_trigger_search(&ctx->trigger,
+					ctx->trigger_data[cfg->channel] + searched,
+					filled - searched);
+			if (idx >= 0) {
+				idx += searched;
+				pending = (unsigned int)idx > pre ? idx - pre : 0;
+				searched = idx + 1;
+			} else {
+				searched = filled;
+			}
+		}
+
+		if (pending >= 0 && filled >= pending + frame_len) {
+			capture_publish(ctx, hist + pending * scan);
+			pending = -1;
+			since_frame = 0;
+			if (cfg->mode == SOFT_TRIGGER_SINGLE)
+				single_done = true;
+		} else if (pending < 0 && since_frame >= frame_len &&
+				filled >= frame_len &&
+				(cfg->mode == SOFT_TRIGGER_AUTO ||
+				 cfg->mode == SOFT_TRIGGER_OFF)) {
+			/* nothing triggered for a whole frame, show what's there */
+			capture_publish(ctx, hist + (filled - frame_len) * scan);
+			since_frame = 0;
+		}
+	}
+
+	return ret < 0 ? ret : 0;
+}
+
+/*
+ * The capture thread owns the buffer while capture is running: it fills
+ * complete frames and publishes them into the context's ring. Readers only
+ * ever look at published frames, at their own pace.
+ */
+static gpointer capture_thread_func(gpointer data)
+{
+	struct capture_context *ctx = data;
+	int ret;
+
+	if (ctx->triggered)
+		ret = capture_triggered(ctx);
+	else
+		ret = capture_free_run(ctx);
+
+	if (ret < 0)
+		g_atomic_int_set(&ctx->error, ret);
+
+	iio_thread_clear(g_thread_self());
+
+	return NULL;
+}
+
+void capture_context_init(struct capture_context *ctx, const char *device,
+		struct iio_channel_info *channels, unsigned int num_channels)
+{
+	unsigned int i;
+
+	ctx->device = device;
+	ctx->channels = channels;
+	ctx->num_channels = num_channels;
+	ctx->num_active_channels = 0;
+	ctx->bytes_per_sample = 0;
+	for (i = 0; i < num_channels; i++) {
+		if (channels[i].enabled) {
+			ctx->bytes_per_sample += channels[i].bytes;
+			ctx->num_active_channels++;
+		}
+	}
+
+	demux_init(&ctx->demux, channels, num_channels);
+
+	ctx->buffer.available = 0;
+	ctx->fd = -1;
+	ctx->mmap.fd = -1;
+	ctx->session.fd = -1;
+	ctx->ring = NULL;
+	ctx->thread = NULL;
+	ctx->triggered = false;
+	ctx->history = NULL;
+	ctx->trigger_data = NULL;
+	ctx->recorder = NULL;
+	ctx->replay = replay_find(device);
+}
+
+/*
+ * Continuous devices get their buffer opened and enabled here, oneshot
+ * devices are armed by the capture thread for every frame.
+ */
+int capture_context_start(struct capture_context *ctx, unsigned int length)
+{
+	int ret;
+
+	ctx->length = length;
+
+	if (ctx->replay) {
+		ctx->replay_start = g_get_monotonic_time();
+		ctx->replay_sent = 0;
+		ctx->replay_pos = 0;
+	} else if (!capture_is_oneshot(ctx->device)) {
+		ret = buffer_open(ctx, length, O_NONBLOCK, &ctx->mmap);
+		if (ret < 0)
+			return ret;
+		ctx->fd = ret;
+	}
+
+	/*
+	 * Oneshot bursts aren't a continuous stream, there is nothing to
+	 * search across; those devices rely on their hardware trigger.
+	 */
+	G_LOCK(trigger_cfg);
+	ctx->triggered = ctx->trigger_cfg.mode != SOFT_TRIGGER_OFF &&
+		!capture_is_oneshot(ctx->device) && ctx->demux.scan_size;
+	G_UNLOCK(trigger_cfg);
+
+	if (ctx->triggered) {
+		unsigned int i, hist_len = 2 * ctx->buffer.size / ctx->demux.scan_size;
+
+		ctx->history = g_malloc(2 * ctx->buffer.size);
+		ctx->trigger_data = g_new(float *, ctx->num_active_channels);
+		for (i = 0; i < ctx->num_active_channels; i++)
+			ctx->trigger_data[i] = g_new(float, hist_len);
+	}
+
+	/* in mmap mode the frames live in the kernel blocks */
+	ctx->ring = frame_ring_new(CAPTURE_RING_FRAMES,
+			(ctx->mmap.blocks && !ctx->triggered) ? 0 : ctx->buffer.size);
+	if (!ctx->ring) {
+		capture_context_stop(ctx);
+		return -ENOMEM;
+	}
+
+	g_atomic_int_set(&ctx->stop, 0);
+	g_atomic_int_set(&ctx->error, 0);
+	ctx->thread = g_thread_new("Capture thread", capture_thread_func, ctx);
+
+	return 0;
+}
+
+void capture_context_stop(struct capture_context *ctx)
+{
+	if (ctx->thread) {
+		g_atomic_int_set(&ctx->stop, 1);
+		g_thread_join(ctx->thread);
+		ctx->thread = NULL;
+	}
+
+	if (ctx->fd >= 0) {
+		buffer_close(ctx, ctx->fd, &ctx->mmap);
+		ctx->fd = -1;
+	}
+	buffer_session_close(ctx);
+
+	frame_ring_free(ctx->ring);
+	ctx->ring = NULL;
+
+	if (ctx->trigger_data) {
+		unsigned int i;
+
+		for (i = 0; i < ctx->num_active_channels; i++)
+			g_free(ctx->trigger_data[i]);
+		g_free(ctx->trigger_data);
+		ctx->trigger_data = NULL;
+	}
+	g_free(ctx->history);
+	ctx->history = NULL;
+	ctx->triggered = false;
+}
+
+int capture_context_error(struct capture_context *ctx)
+{
+	return g_atomic_int_get(&ctx->error);
+}
+
+void capture_context_set_trigger(struct capture_context *ctx,
+		const struct soft_trigger_config *cfg)
+{
+	G_LOCK(trigger_cfg);
+	ctx->trigger_cfg = *cfg;
+	G_UNLOCK(trigger_cfg);
+	g_atomic_int_set(&ctx->trigger_cfg_changed, 1);
+}
+
+/* Single mode: take one more triggered frame */
+void capture_context_trigger_rearm(struct capture_context *ctx)
+{
+	g_atomic_int_set(&ctx->trigger_rearm, 1);
+}
+
+/*
+ * Start (or with NULL, stop) recording everything the capture thread
+ * gets. Returns the recorder which was attached before, it's safe to free
+ * once this returns.
+ */
+struct recorder * capture_context_set_recorder(struct capture_context *ctx,
+		struct recorder *rec)
+{
+	struct recorder *old;
+
+	G_LOCK(recorder);
+	old = ctx->recorder;
+	ctx->recorder = rec;
+	G_UNLOCK(recorder);
+
+	return old;
+}
@@ -0,0 +1,109 @@
+/**
+ * Copyright (C) 2013 Analog Devices, Inc.
+ *
+ * Licensed under the GPL-2.
+ *
+ **/
+
+#ifndef __CAPTURE_H__
+#define __CAPTURE_H__
+
+#include <stdbool.h>
+#include <glib.h>
+
+#include "iio_utils.h"
+#include "frame_ring.h"
+#include "demux.h"
+#include "soft_trigger.h"
+#include "recorder.h"
+#include "replay.h"
+
+struct buffer {
+	void *data;
+	unsigned int available;
+	unsigned int size;
+};
+
+/*
+ * The oneshot devices capture one burst each time their buffer is enabled.
+ * Rather than opening and configuring the buffer for every frame, a session
+ * keeps it open and configured, and only toggles buffer/enable to re-arm.
+ */
+struct buffer_session {
+	int fd;
+	unsigned int length;
+	gint generation;
+	bool armed;
+};
+
+/*
+ * Everything needed to capture from one device: its buffer, channel
+ * layout, demux and the thread which fills the frame ring. Several
+ * contexts can run at the same time, one per device.
+ *
+ * buffer.size (bytes per frame) must be set before capture_context_start().
+ * frame_done, if set, is called from the capture thread for every
+ * complete frame, before it is published.
+ */
+struct capture_context {
+	const char *device;
+	struct iio_channel_info *channels;
+	unsigned int num_channels;
+	unsigned int num_active_channels;
+	unsigned int bytes_per_sample;
+	unsigned int length;
+
+	struct buffer buffer;
+	struct demux demux;
+	int fd;
+	struct iio_mmap_buffer mmap;
+	struct buffer_session session;
+
+	struct frame_ring *ring;
+	GThread *thread;
+	volatile gint stop;
+	volatile gint error;
+
+	void (*frame_done)(struct capture_context *ctx, const void *data);
+
+	/*
+	 * Software trigger. trigger_cfg is what the GUI asked for, the
+	 * capture thread picks it up when trigger_cfg_changed is set.
+	 * Whether frames go through the trigger at all is decided when the
+	 * capture starts.
+	 */
+	struct soft_trigger_config trigger_cfg;
+	volatile gint trigger_cfg_changed;
+	volatile gint trigger_rearm;
+	bool triggered;
+	struct soft_trigger trigger;
+	void *history;
+	float **trigger_data;
+
+	/* if set, gets every byte of raw data as it comes in */
+	struct recorder *recorder;
+
+	/* set if device is a replay source rather than a real device */
+	struct replay_source *replay;
+	gint64 replay_start;
+	guint64 replay_sent;
+	size_t replay_pos;
+};
+
+extern bool capture_oneshot_reopen;
+
+bool capture_is_oneshot(const char *device);
+void capture_session_invalidate(void);
+
+void capture_context_init(struct capture_context *ctx, const char *device,
+		struct iio_channel_info *channels, unsigned int num_channels);
+int capture_context_start(struct capture_context *ctx, unsigned int length);
+void capture_context_stop(struct capture_context *ctx);
+int capture_context_error(struct capture_context *ctx);
+void capture_context_set_trigger(struct capture_context *ctx,
+		const struct soft_trigger_config *cfg);
+void capture_context_trigger_rearm(struct capture_context *ctx);
+struct recorder * capture_context_set_recorder(struct capture_context *ctx,
+		struct recorder *rec);
+
+#endif
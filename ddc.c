@@ -0,0 +1,372 @@
+/**
+ * Copyright (C) 2013 Analog Devices, Inc.
+ *
+ * Licensed under the GPL-2.
+ *
+ **/
+
+#include <errno.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#include <xmmintrin.h>
+#elif defined(__ARM_NEON__) || defined(__ARM_NEON)
+#include <arm_neon.h>
+#define HAVE_NEON 1
+#endif
+
+#include "ddc.h"
+
+/*
+ * The NCO phase is worked out exactly at the start of every block and
+ * stepped by multiplication within it, so the rounding can't add up.
+ */
+#define DDC_NCO_BLOCK	256
+
+/*
+ * Half-band stages: every other tap but the middle one is zero, only the
+ * others are kept. What they let alias is folded onto the far ends of the
+ * next stage's band, which the stages after that take out.
+ */
+#define DDC_HB_TAPS	23
+
+/* Last stage, cut at the output Nyquist */
+#define DDC_FIR_TAPS	64
+
+/* Outputs of a stage worked out together, kept in the L1 cache */
+#define DDC_STAGE_BLOCK	512
+
+/*
+ * Taps folded two by two, the filters being symmetric: pos[t] and
+ * pos2[t] share coef[t]. The middle tap of an odd filter is a pair with
+ * itself, at half its weight.
+ */
+struct ddc_filter {
+	unsigned int num;
+	unsigned int pos[DDC_FIR_TAPS / 2], pos2[DDC_FIR_TAPS / 2];
+	float coef[DDC_FIR_TAPS / 2];
+};
+
+static struct ddc_filter halfband, last_stage;
+
+static double blackman(unsigned int i, unsigned int num)
+{
+	return 0.42 - 0.5 * cos(2 * M_PI * i / (num - 1)) +
+		0.08 * cos(4 * M_PI * i / (num - 1));
+}
+
+/* Windowed sinc cut at fc (over the input rate), unity gain at DC */
+static void ddc_filter_init(struct ddc_filter *f, unsigned int num, double fc)
+{
+	double h[DDC_FIR_TAPS], x, sum = 0.0;
+	unsigned int i, j;
+
+	for (i = 0; i < num; i++) {
+		x = i - (num - 1) / 2.0;
+		h[i] = blackman(i, num) * (x == 0.0 ? 2 * fc :
+				sin(2 * M_PI * fc * x) / (M_PI * x));
+		sum += h[i];
+	}
+
+	f->num = 0;
+	for (i = 0, j = num - 1; i <= j; i++, j--) {
+		if (fabs(h[i]) < 1e-12)
+			continue;
+		f->pos[f->num] = i;
+		f->pos2[f->num] = j;
+		f->coef[f->num++] = (i == j ? 0.5 : 1.0) * h[i] / sum;
+	}
+}
+
+static void ddc_filters_init(void)
+{
+	if (halfband.num)
+		return;
+
+	ddc_filter_init(&halfband, DDC_HB_TAPS, 0.25);
+	ddc_filter_init(&last_stage, DDC_FIR_TAPS, 0.25);
+}
+
+/* The largest decimation, a power of two, that ratio allows */
+unsigned int ddc_decimation(double ratio)
+{
+	unsigned int decimation = 1;
+
+	while (decimation < DDC_MAX_DECIMATION && 2.0 * decimation <= ratio)
+		decimation *= 2;
+
+	return decimation;
+}
+
+unsigned int ddc_input_len(unsigned int decimation, unsigned int num_out)
+{
+	unsigned int len = num_out;
+
+	if (decimation < 2)
+		return len;
+
+	len = 2 * (len - 1) + DDC_FIR_TAPS;
+	for (decimation /= 2; decimation > 1; decimation /= 2)
+		len = 2 * (len - 1) + DDC_HB_TAPS;
+
+	return len;
+}
+
+void ddc_free(struct ddc *ddc)
+{
+	free(ddc->mix_i);
+	free(ddc->mix_q);
+	free(ddc->tmp);
+	free(ddc->out);
+	memset(ddc, 0, sizeof(*ddc));
+}
+
+/*
+ * (Re)build the buffers if anything changed, does nothing otherwise so it
+ * can be called for every frame. Not from more than one thread at a time.
+ */
+int ddc_setup(struct ddc *ddc, unsigned int num_channels, double freq,
+		unsigned int decimation, unsigned int num_out)
+{
+	if (ddc->out && ddc->num_channels == num_channels &&
+			ddc->freq == freq && ddc->decimation == decimation &&
+			ddc->num_out == num_out)
+		return 0;
+
+	ddc_free(ddc);
+
+	if (!decimation || decimation > DDC_MAX_DECIMATION ||
+			(decimation & (decimation - 1)) || !num_out)
+		return -EINVAL;
+
+	ddc_filters_init();
+
+	ddc->num_in = ddc_input_len(decimation, num_out);
+	ddc->mix_i = malloc(sizeof(float) * ddc->num_in);
+	ddc->mix_q = malloc(sizeof(float) * ddc->num_in);
+	ddc->tmp = malloc(sizeof(float) * (ddc->num_in + 1));
+	ddc->out = malloc(sizeof(float) * 2 * num_out);
+	if (!ddc->mix_i || !ddc->mix_q || !ddc->tmp || !ddc->out) {
+		ddc_free(ddc);
+		return -ENOMEM;
+	}
+
+	ddc->decimation = decimation;
+	ddc->num_channels = num_channels;
+	ddc->freq = freq;
+	ddc->num_out = num_out;
+
+	return 0;
+}
+
+/*
+ * A real channel has half its power at the negative frequencies, which
+ * are filtered out here, so it's taken twice to read the same level as
+ * on the real FFT.
+ */
+static void ddc_gather(struct ddc *ddc, const int16_t *data,
+		unsigned int stride)
+{
+	float *re = ddc->mix_i, *im = ddc->mix_q;
+	unsigned int i;
+
+	if (ddc->num_channels == 2) {
+		for (i = 0; i < ddc->num_in; i++, data += stride) {
+			re[i] = data[0];
+			im[i] = data[1];
+		}
+	} else {
+		for (i = 0; i < ddc->num_in; i++, data += stride) {
+			re[i] = 2.0f * data[0];
+			im[i] = 0.0f;
+		}
+	}
+}
+
+/* (re + j im) *= exp(-j 2 pi freq n), the center of the zoom to DC */
+static void ddc_mix(struct ddc *ddc)
+{
+	float *re = ddc->mix_i, *im = ddc->mix_q;
+	double w = -2 * M_PI * ddc->freq;
+	unsigned int n, i, end;
+	float c, s, sc, ss, x, y;
+#if defined(__SSE2__)
+	__m128 vc, vs, vsc, vss, vx, vy;
+#elif HAVE_NEON
+	float32x4_t vc, vs, vsc, vss, vx, vy;
+	float c4[4], s4[4];
+	unsigned int k;
+#endif
+
+	for (n = 0; n < ddc->num_in; n += DDC_NCO_BLOCK) {
+		end = n + DDC_NCO_BLOCK < ddc->num_in ? n + DDC_NCO_BLOCK :
+			ddc->num_in;
+		i = n;
+#if defined(__SSE2__)
+		vc = _mm_setr_ps(cos(w * i), cos(w * (i + 1)),
+				cos(w * (i + 2)), cos(w * (i + 3)));
+		vs = _mm_setr_ps(sin(w * i), sin(w * (i + 1)),
+				sin(w * (i + 2)), sin(w * (i + 3)));
+		vsc = _mm_set1_ps(cos(4 * w));
+		vss = _mm_set1_ps(sin(4 * w));
+
+		for (; i + 4 <= end; i += 4) {
+			vx = _mm_loadu_ps(re + i);
+			vy = _mm_loadu_ps(im + i);
+			_mm_storeu_ps(re + i, _mm_sub_ps(_mm_mul_ps(vx, vc),
+					_mm_mul_ps(vy, vs)));
+			_mm_storeu_ps(im + i, _mm_add_ps(_mm_mul_ps(vx, vs),
+					_mm_mul_ps(vy, vc)));
+
+			vx = vc;
+			vc = _mm_sub_ps(_mm_mul_ps(vc, vsc), _mm_mul_ps(vs, vss));
+			vs = _mm_add_ps(_mm_mul_ps(vx, vss), _mm_mul_ps(vs, vsc));
+		}
+#elif HAVE_NEON
+		for (k = 0; k < 4; k++) {
+			c4[k] = cos(w * (i + k));
+			s4[k] = sin(w * (i + k));
+		}
+		vc = vld1q_f32(c4);
+		vs = vld1q_f32(s4);
+		vsc = vdupq_n_f32(cos(4 * w));
+		vss = vdupq_n_f32(sin(4 * w));
+
+		for (; i + 4 <= end; i += 4) {
+			vx = vld1q_f32(re + i);
+			vy = vld1q_f32(im + i);
+			vst1q_f32(re + i, vmlsq_f32(vmulq_f32(vx, vc), vy, vs));
+			vst1q_f32(im + i, vmlaq_f32(vmulq_f32(vx, vs), vy, vc));
+
+			vx = vc;
+			vc = vmlsq_f32(vmulq_f32(vc, vsc), vs, vss);
+			vs = vmlaq_f32(vmulq_f32(vx, vss), vs, vsc);
+		}
+#endif
+		c = cos(w * i);
+		s = sin(w * i);
+		sc = cos(w);
+		ss = sin(w);
+		for (; i < end; i++) {
+			x = re[i];
+			y = im[i];
+			re[i] = x * c - y * s;
+			im[i] = x * s + y * c;
+
+			x = c;
+			c = c * sc - s * ss;
+			s = x * ss + s * sc;
+		}
+	}
+}
+
+/* x[0, len) to its even samples at even, its odd ones at odd */
+static void ddc_split(const float *x, unsigned int len, float *even,
+		float *odd)
+{
+	unsigned int i = 0;
+#if defined(__SSE2__)
+	__m128 a, b;
+
+	for (; i + 8 <= len; i += 8) {
+		a = _mm_loadu_ps(x + i);
+		b = _mm_loadu_ps(x + i + 4);
+		_mm_storeu_ps(even + i / 2, _mm_shuffle_ps(a, b,
+					_MM_SHUFFLE(2, 0, 2, 0)));
+		_mm_storeu_ps(odd + i / 2, _mm_shuffle_ps(a, b,
+					_MM_SHUFFLE(3, 1, 3, 1)));
+	}
+#elif HAVE_NEON
+	float32x4x2_t v;
+
+	for (; i + 8 <= len; i += 8) {
+		v = vld2q_f32(x + i);
+		vst1q_f32(even + i / 2, v.val[0]);
+		vst1q_f32(odd + i / 2, v.val[1]);
+	}
+#endif
+	for (; i + 2 <= len; i += 2) {
+		even[i / 2] = x[i];
+		odd[i / 2] = x[i + 1];
+	}
+	if (i < len)
+		even[i / 2] = x[i];
+}
+
+/*
+ * Filter and decimate by two: x[k] = sum of coef * x[2k + pos], for the
+ * len_out outputs kept only. The input is split in its two phases first,
+ * which makes every tap a run of consecutive samples. The outputs are
+ * then worked out a block at a time, one tap after the other, so that
+ * nothing waits on the sum before.
+ */
+static void ddc_decimate2(float *x, unsigned int len_in, float *tmp,
+		unsigned int len_out, const struct ddc_filter *f)
+{
+	unsigned int k, k0, end, t, half = (len_in + 1) / 2;
+	const float *p, *p2;
+#if defined(__SSE2__)
+	__m128 c;
+#elif HAVE_NEON
+	float32x4_t c;
+#endif
+
+	ddc_split(x, len_in, tmp, tmp + half);
+	memset(x, 0, sizeof(float) * len_out);
+
+	for (k0 = 0; k0 < len_out; k0 += DDC_STAGE_BLOCK) {
+		end = k0 + DDC_STAGE_BLOCK < len_out ? k0 + DDC_STAGE_BLOCK :
+			len_out;
+
+		for (t = 0; t < f->num; t++) {
+			p = tmp + (f->pos[t] & 1) * half + f->pos[t] / 2;
+			p2 = tmp + (f->pos2[t] & 1) * half + f->pos2[t] / 2;
+			k = k0;
+#if defined(__SSE2__)
+			c = _mm_set1_ps(f->coef[t]);
+			for (; k + 4 <= end; k += 4)
+				_mm_storeu_ps(x + k, _mm_add_ps(_mm_loadu_ps(x + k),
+						_mm_mul_ps(c, _mm_add_ps(
+							_mm_loadu_ps(p + k),
+							_mm_loadu_ps(p2 + k)))));
+#elif HAVE_NEON
+			c = vdupq_n_f32(f->coef[t]);
+			for (; k + 4 <= end; k += 4)
+				vst1q_f32(x + k, vmlaq_f32(vld1q_f32(x + k), c,
+						vaddq_f32(vld1q_f32(p + k),
+							vld1q_f32(p2 + k))));
+#endif
+			for (; k < end; k++)
+				x[k] += f->coef[t] * (p[k] + p2[k]);
+		}
+	}
+}
+
+/*
+ * Down-convert the first ddc_input_len() scans of data (stride samples
+ * each) into ddc->out.
+ */
+void ddc_run(struct ddc *ddc, const int16_t *data, unsigned int stride)
+{
+	unsigned int d, k, len_out, len = ddc->num_in;
+	const struct ddc_filter *f;
+
+	ddc_gather(ddc, data, stride);
+	ddc_mix(ddc);
+
+	for (d = ddc->decimation; d > 1; d /= 2) {
+		f = d > 2 ? &halfband : &last_stage;
+		len_out = (len - (d > 2 ? DDC_HB_TAPS : DDC_FIR_TAPS)) / 2 + 1;
+		ddc_decimate2(ddc->mix_i, len, ddc->tmp, len_out, f);
+		ddc_decimate2(ddc->mix_q, len, ddc->tmp, len_out, f);
+		len = len_out;
+	}
+
+	for (k = 0; k < ddc->num_out; k++) {
+		ddc->out[2 * k] = ddc->mix_i[k];
+		ddc->out[2 * k + 1] = ddc->mix_q[k];
+	}
+}
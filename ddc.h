@@ -0,0 +1,47 @@
+/**
+ * Copyright (C) 2013 Analog Devices, Inc.
+ *
+ * Licensed under the GPL-2.
+ *
+ **/
+
+#ifndef __DDC_H__
+#define __DDC_H__
+
+#include <stdint.h>
+
+/*
+ * Digital down-converter for the zoom FFT: the samples (I/Q, or one real
+ * channel) are mixed with an NCO so the center of the zoom goes to DC,
+ * low-pass filtered and decimated, which leaves num_out complex samples of
+ * a band sample rate / decimation wide around the center.
+ *
+ * The decimation is a power of two, done by halves: half-band filters
+ * first, which only have to keep what is left of the band, and a sharper
+ * filter cut at the output Nyquist last. The last few percent at both
+ * ends of the band roll off.
+ */
+#define DDC_MAX_DECIMATION	256
+
+struct ddc {
+	unsigned int decimation;
+	unsigned int num_channels;	/* 2 for I/Q, 1 for real */
+	unsigned int num_out;
+	unsigned int num_in;		/* ddc_input_len() */
+	double freq;			/* center, over the sample rate */
+
+	float *mix_i, *mix_q;		/* the input once mixed, then each stage */
+	float *tmp;			/* a stage's input, even then odd samples */
+	float *out;			/* interleaved I/Q, num_out of them */
+};
+
+unsigned int ddc_decimation(double ratio);
+unsigned int ddc_input_len(unsigned int decimation, unsigned int num_out);
+
+int ddc_setup(struct ddc *ddc, unsigned int num_channels, double freq,
+		unsigned int decimation, unsigned int num_out);
+void ddc_free(struct ddc *ddc);
+
+void ddc_run(struct ddc *ddc, const int16_t *data, unsigned int stride);
+
+#endif
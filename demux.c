@@ -0,0 +1,347 @@
+/**
+ * Copyright (C) 2013 Analog Devices, Inc.
+ *
+ * Licensed under the GPL-2.
+ *
+ **/
+
+#include <errno.h>
+#include <endian.h>
+#include <stdint.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#include <xmmintrin.h>
+#elif defined(__ARM_NEON__) || defined(__ARM_NEON)
+#include <arm_neon.h>
+#define HAVE_NEON 1
+#endif
+
+#include "iio_utils.h"
+#include "demux.h"
+
+static int sign_extend(unsigned int val, unsigned int bits)
+{
+	unsigned int shift = 32 - bits;
+	return ((int)(val << shift)) >> shift;
+}
+
+/* Any layout: per sample, per channel decode */
+static void demux_generic(const struct demux *d, const void *data_in,
+		float **data_out, unsigned int pos, unsigned int num)
+{
+	const struct iio_channel_info *channels = d->channels;
+	const uint8_t *in = data_in;
+	unsigned int i, j, k;
+	unsigned int val;
+
+	for (i = 0; i < num; i++, pos++) {
+		k = 0;
+		for (j = 0; j < d->num_channels; j++) {
+			if (!channels[j].enabled)
+				continue;
+			switch (channels[j].bytes) {
+			case 1:
+				val = *(uint8_t *)in;
+				break;
+			case 2:
+				switch (channels[j].endianness) {
+				case IIO_BE:
+					val = be16toh(*(uint16_t *)in);
+					break;
+				case IIO_LE:
+					val = le16toh(*(uint16_t *)in);
+					break;
+				default:
+					val = 0;
+					break;
+				}
+				break;
+			case 4:
+				switch (channels[j].endianness) {
+				case IIO_BE:
+					val = be32toh(*(uint32_t *)in);
+					break;
+				case IIO_LE:
+					val = le32toh(*(uint32_t *)in);
+					break;
+				default:
+					val = 0;
+					break;
+				}
+				break;
+			default:
+				continue;
+			}
+			in += channels[j].bytes;
+			val >>= channels[j].shift;
+			val &= channels[j].mask;
+			if (channels[j].is_signed)
+				data_out[k][pos] = sign_extend(val, channels[j].bits_used);
+			else
+				data_out[k][pos] = val;
+			k++;
+		}
+	}
+}
+
+/*
+ * Signed little endian samples stored in 16 bits. lshift moves the top of
+ * the field to bit 15, rshift sign extends it back down, so one pair of
+ * shifts covers both full 16 bit and e.g. 12 or 14 bit converters.
+ */
+static inline float s16_decode(int16_t val, unsigned int lshift, unsigned int rshift)
+{
+	return (int16_t)(val << lshift) >> rshift;
+}
+
+#if defined(__SSE2__)
+/* 8 x int16 -> 2 x (4 x float), low and high half */
+#define SSE_S16_TO_PS(v, lsh, rsh, lo, hi) do { \
+	__m128i _v = _mm_sra_epi16(_mm_sll_epi16((v), (lsh)), (rsh)); \
+	(lo) = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(_v, _v), 16)); \
+	(hi) = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpackhi_epi16(_v, _v), 16)); \
+} while (0)
+#endif
+
+#if HAVE_NEON
+/* 8 x int16 -> 2 x (4 x float), low and high half */
+#define NEON_S16_TO_F32(v, lsh, rsh, lo, hi) do { \
+	int16x8_t _v = vshlq_s16(vshlq_s16((v), (lsh)), (rsh)); \
+	(lo) = vcvtq_f32_s32(vmovl_s16(vget_low_s16(_v))); \
+	(hi) = vcvtq_f32_s32(vmovl_s16(vget_high_s16(_v))); \
+} while (0)
+#endif
+
+static void demux_1x_s16le(const struct demux *d, const void *data_in,
+		float **data_out, unsigned int pos, unsigned int num)
+{
+	const int16_t *in = data_in;
+	float *out0 = data_out[0] + pos;
+	unsigned int i = 0;
+#if defined(__SSE2__)
+	__m128i lsh = _mm_cvtsi32_si128(d->lshift);
+	__m128i rsh = _mm_cvtsi32_si128(d->rshift);
+	__m128 lo, hi;
+
+	for (; i + 8 <= num; i += 8) {
+		SSE_S16_TO_PS(_mm_loadu_si128((const __m128i *)(in + i)), lsh, rsh, lo, hi);
+		_mm_storeu_ps(out0 + i, lo);
+		_mm_storeu_ps(out0 + i + 4, hi);
+	}
+#elif HAVE_NEON
+	int16x8_t lsh = vdupq_n_s16(d->lshift);
+	int16x8_t rsh = vdupq_n_s16(-(int)d->rshift);
+	float32x4_t lo, hi;
+
+	for (; i + 8 <= num; i += 8) {
+		NEON_S16_TO_F32(vld1q_s16(in + i), lsh, rsh, lo, hi);
+		vst1q_f32(out0 + i, lo);
+		vst1q_f32(out0 + i + 4, hi);
+	}
+#endif
+	for (; i < num; i++)
+		out0[i] = s16_decode(in[i], d->lshift, d->rshift);
+}
+
+static void demux_2x_s16le(const struct demux *d, const void *data_in,
+		float **data_out, unsigned int pos, unsigned int num)
+{
+	const int16_t *in = data_in;
+	float *out0 = data_out[0] + pos;
+	float *out1 = data_out[1] + pos;
+	unsigned int i = 0;
+#if defined(__SSE2__)
+	__m128i lsh = _mm_cvtsi32_si128(d->lshift);
+	__m128i rsh = _mm_cvtsi32_si128(d->rshift);
+	__m128 lo, hi;
+
+	/* I0 Q0 I1 Q1 | I2 Q2 I3 Q3 */
+	for (; i + 4 <= num; i += 4) {
+		SSE_S16_TO_PS(_mm_loadu_si128((const __m128i *)(in + 2 * i)), lsh, rsh, lo, hi);
+		_mm_storeu_ps(out0 + i, _mm_shuffle_ps(lo, hi, _MM_SHUFFLE(2, 0, 2, 0)));
+		_mm_storeu_ps(out1 + i, _mm_shuffle_ps(lo, hi, _MM_SHUFFLE(3, 1, 3, 1)));
+	}
+#elif HAVE_NEON
+	int16x8_t lsh = vdupq_n_s16(d->lshift);
+	int16x8_t rsh = vdupq_n_s16(-(int)d->rshift);
+	float32x4_t lo, hi;
+	int16x8x2_t v;
+
+	for (; i + 8 <= num; i += 8) {
+		v = vld2q_s16(in + 2 * i);
+		NEON_S16_TO_F32(v.val[0], lsh, rsh, lo, hi);
+		vst1q_f32(out0 + i, lo);
+		vst1q_f32(out0 + i + 4, hi);
+		NEON_S16_TO_F32(v.val[1], lsh, rsh, lo, hi);
+		vst1q_f32(out1 + i, lo);
+		vst1q_f32(out1 + i + 4, hi);
+	}
+#endif
+	for (; i < num; i++) {
+		out0[i] = s16_decode(in[2 * i], d->lshift, d->rshift);
+		out1[i] = s16_decode(in[2 * i + 1], d->lshift, d->rshift);
+	}
+}
+
+static void demux_4x_s16le(const struct demux *d, const void *data_in,
+		float **data_out, unsigned int pos, unsigned int num)
+{
+	const int16_t *in = data_in;
+	float *out0 = data_out[0] + pos;
+	float *out1 = data_out[1] + pos;
+	float *out2 = data_out[2] + pos;
+	float *out3 = data_out[3] + pos;
+	unsigned int i = 0;
+#if defined(__SSE2__)
+	__m128i lsh = _mm_cvtsi32_si128(d->lshift);
+	__m128i rsh = _mm_cvtsi32_si128(d->rshift);
+	__m128 r0, r1, r2, r3;
+
+	/* one scan per register, then transpose to one channel per register */
+	for (; i + 4 <= num; i += 4) {
+		SSE_S16_TO_PS(_mm_loadu_si128((const __m128i *)(in + 4 * i)), lsh, rsh, r0, r1);
+		SSE_S16_TO_PS(_mm_loadu_si128((const __m128i *)(in + 4 * i + 8)), lsh, rsh, r2, r3);
+		_MM_TRANSPOSE4_PS(r0, r1, r2, r3);
+		_mm_storeu_ps(out0 + i, r0);
+		_mm_storeu_ps(out1 + i, r1);
+		_mm_storeu_ps(out2 + i, r2);
+		_mm_storeu_ps(out3 + i, r3);
+	}
+#elif HAVE_NEON
+	int16x8_t lsh = vdupq_n_s16(d->lshift);
+	int16x8_t rsh = vdupq_n_s16(-(int)d->rshift);
+	float32x4_t lo, hi;
+	int16x8x4_t v;
+
+	for (; i + 8 <= num; i += 8) {
+		v = vld4q_s16(in + 4 * i);
+		NEON_S16_TO_F32(v.val[0], lsh, rsh, lo, hi);
+		vst1q_f32(out0 + i, lo);
+		vst1q_f32(out0 + i + 4, hi);
+		NEON_S16_TO_F32(v.val[1], lsh, rsh, lo, hi);
+		vst1q_f32(out1 + i, lo);
+		vst1q_f32(out1 + i + 4, hi);
+		NEON_S16_TO_F32(v.val[2], lsh, rsh, lo, hi);
+		vst1q_f32(out2 + i, lo);
+		vst1q_f32(out2 + i + 4, hi);
+		NEON_S16_TO_F32(v.val[3], lsh, rsh, lo, hi);
+		vst1q_f32(out3 + i, lo);
+		vst1q_f32(out3 + i + 4, hi);
+	}
+#endif
+	for (; i < num; i++) {
+		out0[i] = s16_decode(in[4 * i], d->lshift, d->rshift);
+		out1[i] = s16_decode(in[4 * i + 1], d->lshift, d->rshift);
+		out2[i] = s16_decode(in[4 * i + 2], d->lshift, d->rshift);
+		out3[i] = s16_decode(in[4 * i + 3], d->lshift, d->rshift);
+	}
+}
+
+void demux_init_generic(struct demux *d,
+		const struct iio_channel_info *channels, unsigned int num_channels)
+{
+	unsigned int i;
+
+	d->name = "generic";
+	d->run = demux_generic;
+	d->channels = channels;
+	d->num_channels = num_channels;
+	d->num_active = 0;
+	d->scan_size = 0;
+	d->lshift = 0;
+	d->rshift = 0;
+
+	for (i = 0; i < num_channels; i++) {
+		if (!channels[i].enabled)
+			continue;
+		switch (channels[i].bytes) {
+		case 1:
+		case 2:
+		case 4:
+			d->scan_size += channels[i].bytes;
+			d->num_active++;
+			break;
+		default:
+			break;
+		}
+	}
+}
+
+/*
+ * The specialized routines handle 1, 2 (I/Q) or 4 enabled channels, all
+ * signed little endian in 16 bits, all sharing the same bits/shift.
+ */
+void demux_init(struct demux *d, const struct iio_channel_info *channels,
+		unsigned int num_channels)
+{
+	const struct iio_channel_info *first = NULL;
+	unsigned int i;
+
+	demux_init_generic(d, channels, num_channels);
+
+#if __BYTE_ORDER == __LITTLE_ENDIAN
+	for (i = 0; i < num_channels; i++) {
+		if (!channels[i].enabled)
+			continue;
+		if (channels[i].bytes != 2 || channels[i].endianness != IIO_LE ||
+				!channels[i].is_signed ||
+				channels[i].bits_used == 0 ||
+				channels[i].bits_used + channels[i].shift > 16)
+			return;
+		if (!first)
+			first = &channels[i];
+		else if (channels[i].bits_used != first->bits_used ||
+				channels[i].shift != first->shift)
+			return;
+	}
+
+	if (!first || d->scan_size != d->num_active * 2)
+		return;
+
+	switch (d->num_active) {
+	case 1:
+		d->name = "1x int16 le";
+		d->run = demux_1x_s16le;
+		break;
+	case 2:
+		d->name = "2x int16 le (I/Q)";
+		d->run = demux_2x_s16le;
+		break;
+	case 4:
+		d->name = "4x int16 le";
+		d->run = demux_4x_s16le;
+		break;
+	default:
+		return;
+	}
+
+	d->lshift = 16 - first->bits_used - first->shift;
+	d->rshift = 16 - first->bits_used;
+#endif
+}
+
+/*
+ * Demux num_samples scans from in, writing them to out starting at
+ * offset, wrapping around at out_size.
+ */
+void demux_run(const struct demux *d, const void *in, float **out,
+		unsigned int num_samples, unsigned int offset, unsigned int out_size)
+{
+	const uint8_t *data = in;
+	unsigned int pos, num;
+
+	if (!out_size)
+		return;
+
+	pos = offset % out_size;
+	while (num_samples) {
+		num = out_size - pos;
+		if (num > num_samples)
+			num = num_samples;
+		d->run(d, data, out, pos, num);
+		data += num * d->scan_size;
+		num_samples -= num;
+		pos = 0;
+	}
+}
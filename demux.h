@@ -0,0 +1,38 @@
+/**
+ * Copyright (C) 2013 Analog Devices, Inc.
+ *
+ * Licensed under the GPL-2.
+ *
+ **/
+
+#ifndef __DEMUX_H__
+#define __DEMUX_H__
+
+struct iio_channel_info;
+
+/*
+ * A demux splits the raw, interleaved scans coming out of the buffer into
+ * one float array per enabled channel. demux_init() looks at the channel
+ * layout once, when capture starts, and picks a routine specialized for
+ * it (SSE2/NEON where available), falling back to the generic one.
+ */
+struct demux {
+	const char *name;
+	void (*run)(const struct demux *d, const void *in, float **out,
+			unsigned int pos, unsigned int num);
+	const struct iio_channel_info *channels;
+	unsigned int num_channels;
+	unsigned int num_active;
+	unsigned int scan_size;
+	unsigned int lshift;
+	unsigned int rshift;
+};
+
+void demux_init(struct demux *d, const struct iio_channel_info *channels,
+		unsigned int num_channels);
+void demux_init_generic(struct demux *d,
+		const struct iio_channel_info *channels, unsigned int num_channels);
+void demux_run(const struct demux *d, const void *in, float **out,
+		unsigned int num_samples, unsigned int offset, unsigned int out_size);
+
+#endif
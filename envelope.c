@@ -0,0 +1,163 @@
+/**
+ * Copyright (C) 2013 Analog Devices, Inc.
+ *
+ * Licensed under the GPL-2.
+ *
+ **/
+
+#include <string.h>
+
+#include "envelope.h"
+
+static void envelope_pad(unsigned int num, unsigned int max_points,
+		float *x, float *y)
+{
+	float last_x = num ? x[num - 1] : 0.0f;
+	float last_y = num ? y[num - 1] : 0.0f;
+
+	for (; num < max_points; num++) {
+		x[num] = last_x;
+		y[num] = last_y;
+	}
+}
+
+/*
+ * Reduce data[first, last) to a min/max pair per column. The pair is
+ * emitted in sample order, so the line keeps following the signal; if
+ * the window has few enough samples they are copied as they are.
+ */
+unsigned int envelope_minmax(const float *data, unsigned int first,
+		unsigned int last, unsigned int columns, unsigned int max_points,
+		float *x, float *y)
+{
+	unsigned int num, col, start, end, i, j = 0;
+	unsigned int min_i, max_i;
+	float min, max;
+
+	if (last <= first) {
+		envelope_pad(0, max_points, x, y);
+		return 0;
+	}
+
+	num = last - first;
+	if (num <= max_points) {
+		for (i = first; i < last; i++, j++) {
+			x[j] = i;
+			y[j] = data[i];
+		}
+		envelope_pad(j, max_points, x, y);
+		return j;
+	}
+
+	if (columns > max_points / 2)
+		columns = max_points / 2;
+	if (!columns)
+		columns = 1;
+
+	for (col = 0; col < columns; col++) {
+		start = first + (unsigned long long)num * col / columns;
+		end = first + (unsigned long long)num * (col + 1) / columns;
+		if (start == end)
+			continue;
+
+		min = max = data[start];
+		min_i = max_i = start;
+		for (i = start + 1; i < end; i++) {
+			if (data[i] < min) {
+				min = data[i];
+				min_i = i;
+			} else if (data[i] > max) {
+				max = data[i];
+				max_i = i;
+			}
+		}
+
+		if (min_i <= max_i) {
+			x[j] = min_i;
+			y[j++] = min;
+			x[j] = max_i;
+			y[j++] = max;
+		} else {
+			x[j] = max_i;
+			y[j++] = max;
+			x[j] = min_i;
+			y[j++] = min;
+		}
+	}
+
+	envelope_pad(j, max_points, x, y);
+	return j;
+}
+
+/*
+ * Keep one point per pixel of the visible window; whatever else lands on
+ * an already drawn pixel is dropped. occupied must hold width * height
+ * bytes.
+ */
+unsigned int envelope_scatter(const float *data_x, const float *data_y,
+		unsigned int num, float left, float right, float top, float bottom,
+		unsigned int width, unsigned int height, unsigned char *occupied,
+		unsigned int max_points, float *x, float *y)
+{
+	float x_scale, y_scale, tmp;
+	unsigned int i, j = 0;
+	int px, py;
+
+	if (left > right) {
+		tmp = left;
+		left = right;
+		right = tmp;
+	}
+	if (bottom > top) {
+		tmp = top;
+		top = bottom;
+		bottom = tmp;
+	}
+
+	x_scale = right > left ? width / (right - left) : 0.0f;
+	y_scale = top > bottom ? height / (top - bottom) : 0.0f;
+
+	memset(occupied, 0, width * height);
+
+	for (i = 0; i < num && j < max_points; i++) {
+		if (data_x[i] < left || data_x[i] > right ||
+				data_y[i] < bottom || data_y[i] > top)
+			continue;
+
+		px = (data_x[i] - left) * x_scale;
+		py = (data_y[i] - bottom) * y_scale;
+		if (px >= (int)width)
+			px = width - 1;
+		if (py >= (int)height)
+			py = height - 1;
+
+		if (occupied[py * width + px])
+			continue;
+		occupied[py * width + px] = 1;
+
+		x[j] = data_x[i];
+		y[j++] = data_y[i];
+	}
+
+	envelope_pad(j, max_points, x, y);
+	return j;
+}
+
+void envelope_extrema(const float *data, unsigned int num,
+		float *min, float *max)
+{
+	unsigned int i;
+
+	if (!num) {
+		*min = *max = 0.0f;
+		return;
+	}
+
+	*min = *max = data[0];
+	for (i = 1; i < num; i++) {
+		if (data[i] < *min)
+			*min = data[i];
+		else if (data[i] > *max)
+			*max = data[i];
+	}
+}
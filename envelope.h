@@ -0,0 +1,30 @@
+/**
+ * Copyright (C) 2013 Analog Devices, Inc.
+ *
+ * Licensed under the GPL-2.
+ *
+ **/
+
+#ifndef __ENVELOPE_H__
+#define __ENVELOPE_H__
+
+/*
+ * Level of detail reduction for plotting: the plot widget can't show more
+ * than a couple of points per pixel, so drawing more is wasted time.
+ * Both functions fill x/y with at most max_points points, pad the rest of
+ * the arrays with the last point and return the number of real points.
+ */
+
+unsigned int envelope_minmax(const float *data, unsigned int first,
+		unsigned int last, unsigned int columns, unsigned int max_points,
+		float *x, float *y);
+
+unsigned int envelope_scatter(const float *data_x, const float *data_y,
+		unsigned int num, float left, float right, float top, float bottom,
+		unsigned int width, unsigned int height, unsigned char *occupied,
+		unsigned int max_points, float *x, float *y);
+
+void envelope_extrema(const float *data, unsigned int num,
+		float *min, float *max);
+
+#endif
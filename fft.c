@@ -0,0 +1,1358 @@
+/**
+ * Copyright (C) 2013 Analog Devices, Inc.
+ *
+ * Licensed under the GPL-2.
+ *
+ **/
+
+#include <stdio.h>
+#include <errno.h>
+#include <float.h>
+#include <limits.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <glib.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#include <xmmintrin.h>
+#elif defined(__ARM_NEON__) || defined(__ARM_NEON)
+#include <arm_neon.h>
+#define HAVE_NEON 1
+#endif
+
+#include "fft.h"
+
+/*
+ * Plans are kept for as long as the program runs, one per size, real or
+ * complex and alignment of the buffers, so going back to an FFT size
+ * doesn't mean planning again. A plan is made for whatever buffers asked
+ * first and executed on any buffer with the same alignment.
+ *
+ * Measuring takes long, so the GUI starts with an estimated plan (unless
+ * the wisdom has a measured one) and the planning thread makes the
+ * measured plans for every size, which are picked up as they come in.
+ *
+ * Without FFTW a plan is the int_fft tables of the size, made when first
+ * asked for. The alignment doesn't matter to those.
+ */
+struct fft_plan {
+	unsigned int size;
+	bool complex;
+	int alignment;
+#if NO_FFTW
+	struct int_fft engine;
+#else
+	fftwf_plan estimate;
+	fftwf_plan measured;
+#endif
+	struct fft_plan *next;
+};
+
+#if NO_FFTW
+/* Nothing spreads over the cores by itself */
+#define FFT_THREADS_MIN_SIZE	UINT_MAX
+
+#define fft_buf_alloc(size)	malloc(size)
+#define fft_buf_free(ptr)	free(ptr)
+#else
+/* Per plan, in seconds. Quitting waits for the plan being measured. */
+#define FFT_PLAN_TIME_LIMIT	10.0
+
+/*
+ * From this size on a plan runs on FFTW's own threads, one per core. The
+ * smaller ones are better off on one core each, spread by job_pool.
+ */
+#define FFT_THREADS_MIN_SIZE	131072
+
+/* Aligned the way FFTW's SIMD code likes it */
+#define fft_buf_alloc(size)	fftwf_malloc(size)
+#define fft_buf_free(ptr)	fftwf_free(ptr)
+#endif
+
+static struct fft_plan *plans;
+G_LOCK_DEFINE_STATIC(plans);
+
+#if !NO_FFTW
+/* Only fftwf_execute*() are thread safe, everything else goes under this */
+G_LOCK_DEFINE_STATIC(planner);
+
+static unsigned int plan_flags = FFTW_MEASURE;
+static char *wisdom_path;
+static GThread *plan_thread;
+static volatile gint plan_thread_stop;
+static unsigned int *plan_sizes, plan_num_sizes;
+static int plan_threads = 1;
+#endif
+
+/*
+ * Workers for fft_compute_jobs(), one less than there are cores as the
+ * caller does a share too. Only one batch runs at a time.
+ */
+static GThreadPool *job_pool;
+static GMutex job_lock;
+static GCond job_done;
+static unsigned int job_pending;
+static unsigned int num_workers = 1;
+
+/* Buffers for a share of the Welch segments of a frame */
+struct fft_lane {
+	float *in;
+	fft_complex *out;
+	float *pwr;
+	struct fft_plan *plan;
+};
+
+/*
+ * A job, or one lane of a Welch job, as handed to the workers; or, with
+ * average set, the averaging of a whole job once it is transformed.
+ */
+struct fft_task {
+	struct fft_job *job;
+	unsigned int lane;
+	unsigned int num_lanes;		/* 0 if not Welch */
+	bool average;
+};
+
+static struct fft_task *tasks;
+static unsigned int tasks_size;
+
+#if !NO_FFTW
+static double win_hanning(int j, int n)
+{
+	double a = 2.0*M_PI/(n-1), w;
+
+	w = 0.5 * (1.0 - cos(a*j));
+
+	return (w);
+}
+
+/*
+ * One entry per input sample, I and Q each get their own. The 1/m
+ * normalization is in there too, so the transform comes out scaled.
+ */
+static int fft_window_setup(struct fft_state *fft, unsigned int size,
+		unsigned int num_channels)
+{
+	unsigned int i;
+
+	fft->win = fft_buf_alloc(sizeof(float) * size * num_channels);
+	if (!fft->win)
+		return -ENOMEM;
+
+	for (i = 0; i < size * num_channels; i++)
+		fft->win[i] = win_hanning(i / num_channels, size) / fft->m;
+
+	return 0;
+}
+#endif
+
+static struct fft_plan * fft_plan_find(unsigned int size, bool complex,
+		int alignment)
+{
+	struct fft_plan *p;
+
+	for (p = plans; p; p = p->next)
+		if (p->size == size && p->complex == complex &&
+				p->alignment == alignment)
+			return p;
+
+	return NULL;
+}
+
+static void fft_job_func(gpointer data, gpointer user_data);
+
+/* The workers of fft_compute_jobs() */
+static void fft_jobs_init(long cpus)
+{
+	if (!job_pool && cpus > 1) {
+		job_pool = g_thread_pool_new(fft_job_func, NULL, cpus - 1,
+				TRUE, NULL);
+		if (job_pool)
+			num_workers = cpus;
+	}
+}
+
+static void fft_jobs_cleanup(void)
+{
+	if (job_pool) {
+		g_thread_pool_free(job_pool, FALSE, TRUE);
+		job_pool = NULL;
+		num_workers = 1;
+	}
+	g_free(tasks);
+	tasks = NULL;
+	tasks_size = 0;
+}
+
+#if NO_FFTW
+
+static struct fft_plan * fft_plan_get(unsigned int size, bool complex,
+		void *in, fft_complex *out)
+{
+	struct fft_plan *p;
+
+	G_LOCK(plans);
+	p = fft_plan_find(size, complex, 0);
+	if (!p) {
+		p = g_new0(struct fft_plan, 1);
+		if (int_fft_setup(&p->engine, size, complex) < 0) {
+			g_free(p);
+			p = NULL;
+		} else {
+			p->size = size;
+			p->complex = complex;
+			p->next = plans;
+			plans = p;
+		}
+	}
+	G_UNLOCK(plans);
+
+	return p;
+}
+
+/* There's no wisdom and no planner flags, only the workers to start */
+void fft_plans_init(const char *wisdom_file, unsigned int flags)
+{
+	fft_jobs_init(sysconf(_SC_NPROCESSORS_ONLN));
+}
+
+int fft_wisdom_save(void)
+{
+	return 0;
+}
+
+/* The tables take no time, they are made right away */
+void fft_plans_prepare(const unsigned int *sizes, unsigned int num,
+		bool background)
+{
+	unsigned int i;
+
+	for (i = 0; i < 2 * num; i++)
+		fft_plan_get(sizes[i / 2], i & 1, NULL, NULL);
+}
+
+void fft_plans_cleanup(void)
+{
+	struct fft_plan *p;
+
+	fft_jobs_cleanup();
+
+	G_LOCK(plans);
+	while (plans) {
+		p = plans;
+		plans = p->next;
+		int_fft_free(&p->engine);
+		g_free(p);
+	}
+	G_UNLOCK(plans);
+}
+
+#else
+
+static int fft_alignment(const void *in, const void *out)
+{
+	return fftwf_alignment_of((float *)in) << 8 |
+		fftwf_alignment_of((float *)out);
+}
+
+/* Must hold the planner lock */
+static fftwf_plan fft_plan_create(unsigned int size, bool complex,
+		void *in, fftwf_complex *out, unsigned int flags)
+{
+	/* FFTW doesn't take this before fftwf_init_threads() */
+	if (plan_threads > 1)
+		fftwf_plan_with_nthreads(size >= FFT_THREADS_MIN_SIZE ?
+				plan_threads : 1);
+
+	if (complex)
+		return fftwf_plan_dft_1d(size, in, out, FFTW_FORWARD, flags);
+	else
+		return fftwf_plan_dft_r2c_1d(size, in, out, flags);
+}
+
+/*
+ * Put a new plan in the cache. If it's already there (the planning thread
+ * and the GUI can race for one) the plan that's there wins. Returns the
+ * cache entry.
+ */
+static struct fft_plan * fft_plan_add(unsigned int size, bool complex,
+		int alignment, fftwf_plan plan, bool measured)
+{
+	struct fft_plan *p;
+	bool used = true;
+
+	G_LOCK(plans);
+	p = fft_plan_find(size, complex, alignment);
+	if (!p) {
+		p = g_new0(struct fft_plan, 1);
+		p->size = size;
+		p->complex = complex;
+		p->alignment = alignment;
+		p->next = plans;
+		plans = p;
+	}
+
+	if (measured && !p->measured)
+		g_atomic_pointer_set(&p->measured, plan);
+	else if (!measured && !p->estimate && !p->measured)
+		p->estimate = plan;
+	else
+		used = false;
+	G_UNLOCK(plans);
+
+	if (!used) {
+		G_LOCK(planner);
+		fftwf_destroy_plan(plan);
+		G_UNLOCK(planner);
+	}
+
+	return p;
+}
+
+static struct fft_plan * fft_plan_get(unsigned int size, bool complex,
+		void *in, fftwf_complex *out)
+{
+	int alignment = fft_alignment(in, out);
+	struct fft_plan *p;
+	fftwf_plan plan;
+	bool measured;
+
+	G_LOCK(plans);
+	p = fft_plan_find(size, complex, alignment);
+	G_UNLOCK(plans);
+	if (p)
+		return p;
+
+	/*
+	 * This waits if the planning thread is measuring, but it does the
+	 * small sizes first, which take no time.
+	 */
+	G_LOCK(planner);
+	plan = fft_plan_create(size, complex, in, out,
+			plan_flags | FFTW_WISDOM_ONLY);
+	measured = plan != NULL;
+	if (!plan)
+		plan = fft_plan_create(size, complex, in, out, FFTW_ESTIMATE);
+	G_UNLOCK(planner);
+
+	if (!plan)
+		return NULL;
+
+	return fft_plan_add(size, complex, alignment, plan, measured);
+}
+
+/* Make the measured plans for plan_sizes, unless they are there already */
+static void fft_plans_measure(void)
+{
+	unsigned int i, size;
+	struct fft_plan *p;
+	fftwf_complex *in, *out;
+	fftwf_plan plan;
+	bool complex;
+	int alignment;
+
+	for (i = 0; i < 2 * plan_num_sizes; i++) {
+		if (g_atomic_int_get(&plan_thread_stop))
+			break;
+
+		size = plan_sizes[i / 2];
+		complex = i & 1;
+
+		in = fftwf_malloc(sizeof(fftwf_complex) * size);
+		out = fftwf_malloc(sizeof(fftwf_complex) * (size + 1));
+		if (!in || !out) {
+			fftwf_free(in);
+			fftwf_free(out);
+			continue;
+		}
+		alignment = fft_alignment(in, out);
+
+		G_LOCK(plans);
+		p = fft_plan_find(size, complex, alignment);
+		G_UNLOCK(plans);
+
+		if (!p || !p->measured) {
+			G_LOCK(planner);
+			plan = fft_plan_create(size, complex, in, out, plan_flags);
+			G_UNLOCK(planner);
+			if (plan)
+				fft_plan_add(size, complex, alignment, plan, true);
+		}
+
+		fftwf_free(in);
+		fftwf_free(out);
+	}
+
+	fft_wisdom_save();
+}
+
+static gpointer fft_plan_thread_func(gpointer data)
+{
+	fft_plans_measure();
+	return NULL;
+}
+
+static int size_cmp(const void *a, const void *b)
+{
+	return *(const unsigned int *)a - *(const unsigned int *)b;
+}
+
+/*
+ * Load the wisdom from wisdom_file (if not NULL) and set the planner flags
+ * for the measured plans, FFTW_MEASURE or FFTW_PATIENT.
+ */
+void fft_plans_init(const char *wisdom_file, unsigned int flags)
+{
+	long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+	plan_flags = flags;
+
+	fft_jobs_init(cpus);
+
+	g_free(wisdom_path);
+	wisdom_path = g_strdup(wisdom_file);
+
+	G_LOCK(planner);
+	if (cpus > 1 && plan_threads == 1 && fftwf_init_threads())
+		plan_threads = cpus;
+	fftwf_set_timelimit(FFT_PLAN_TIME_LIMIT);
+	if (wisdom_path)
+		fftwf_import_wisdom_from_filename(wisdom_path);
+	G_UNLOCK(planner);
+}
+
+int fft_wisdom_save(void)
+{
+	char *dir;
+	int ret;
+
+	if (!wisdom_path)
+		return 0;
+
+	dir = g_path_get_dirname(wisdom_path);
+	g_mkdir_with_parents(dir, 0755);
+	g_free(dir);
+
+	G_LOCK(planner);
+	ret = fftwf_export_wisdom_to_filename(wisdom_path);
+	G_UNLOCK(planner);
+
+	if (!ret) {
+		fprintf(stderr, "Failed to save FFTW wisdom to %s\n", wisdom_path);
+		return -EIO;
+	}
+
+	return 0;
+}
+
+/*
+ * Measure plans for the given sizes, real and complex, in the background
+ * or right away. The wisdom is saved when done.
+ */
+void fft_plans_prepare(const unsigned int *sizes, unsigned int num,
+		bool background)
+{
+	if (plan_thread)
+		return;
+
+	g_free(plan_sizes);
+	plan_sizes = g_memdup(sizes, num * sizeof(*sizes));
+	plan_num_sizes = num;
+	qsort(plan_sizes, num, sizeof(*plan_sizes), size_cmp);
+
+	if (!background) {
+		fft_plans_measure();
+		return;
+	}
+
+	g_atomic_int_set(&plan_thread_stop, 0);
+	plan_thread = g_thread_new("FFT planner", fft_plan_thread_func, NULL);
+}
+
+/* Nothing may use an FFT after this */
+void fft_plans_cleanup(void)
+{
+	struct fft_plan *p;
+
+	if (plan_thread) {
+		g_atomic_int_set(&plan_thread_stop, 1);
+		g_thread_join(plan_thread);
+		plan_thread = NULL;
+	}
+
+	fft_jobs_cleanup();
+
+	fft_wisdom_save();
+
+	G_LOCK(planner);
+	while (plans) {
+		p = plans;
+		plans = p->next;
+		if (p->estimate)
+			fftwf_destroy_plan(p->estimate);
+		if (p->measured)
+			fftwf_destroy_plan(p->measured);
+		g_free(p);
+	}
+	if (plan_threads > 1) {
+		fftwf_cleanup_threads();
+		plan_threads = 1;
+	}
+	G_UNLOCK(planner);
+
+	g_free(plan_sizes);
+	plan_sizes = NULL;
+	g_free(wisdom_path);
+	wisdom_path = NULL;
+}
+
+#endif
+
+/* Lane 0 works in the buffers of the fft_state, it only has its own pwr */
+static void fft_lanes_free(struct fft_state *fft)
+{
+	unsigned int i;
+
+	for (i = 0; i < fft->num_lanes; i++) {
+		if (i) {
+			fft_buf_free(fft->lanes[i].in);
+			fft_buf_free(fft->lanes[i].out);
+		}
+		fft_buf_free(fft->lanes[i].pwr);
+	}
+	g_free(fft->lanes);
+	fft->lanes = NULL;
+	fft->num_lanes = 0;
+}
+
+static int fft_lanes_setup(struct fft_state *fft, unsigned int num)
+{
+	bool complex = fft->num_channels == 2;
+	struct fft_lane *l;
+	unsigned int i;
+
+	if (fft->num_lanes >= num)
+		return 0;
+
+	fft_lanes_free(fft);
+	fft->lanes = g_new0(struct fft_lane, num);
+	fft->num_lanes = num;
+
+	for (i = 0; i < num; i++) {
+		l = &fft->lanes[i];
+		if (i) {
+			l->in = fft_buf_alloc(sizeof(float) * fft->size *
+					fft->num_channels);
+			l->out = fft_buf_alloc(sizeof(fft_complex) * (fft->m + 1));
+			if (l->in && l->out)
+				l->plan = fft_plan_get(fft->size, complex,
+						l->in, l->out);
+		} else {
+			l->in = complex ? (float *)fft->in_c : fft->in;
+			l->out = fft->out;
+			l->plan = fft->plan;
+		}
+		l->pwr = fft_buf_alloc(sizeof(float) * fft->m);
+
+		if (!l->plan || !l->pwr) {
+			fft_lanes_free(fft);
+			return -ENOMEM;
+		}
+	}
+
+	return 0;
+}
+
+void fft_free(struct fft_state *fft)
+{
+	fft_lanes_free(fft);
+	fft_buf_free(fft->win);
+	fft_buf_free(fft->in);
+	fft_buf_free(fft->in_c);
+	fft_buf_free(fft->out);
+	fft_buf_free(fft->db);
+	fft_buf_free(fft->avg_hist);
+	fft_buf_free(fft->avg_sum);
+	memset(fft, 0, sizeof(*fft));
+}
+
+/*
+ * (Re)build the buffers and the plan if the size or the number of channels
+ * changed, does nothing otherwise so it can be called for every frame.
+ */
+int fft_setup(struct fft_state *fft, unsigned int size,
+		unsigned int num_channels)
+{
+	if (fft->plan && fft->size == size && fft->num_channels == num_channels)
+		return 0;
+
+	fft_free(fft);
+
+	/*
+	 * Without FFTW the input buffers are the int_fft work buffers, which
+	 * are INT_FFT_WORK_LEN() samples: the same size.
+	 */
+	if (num_channels == 2) {
+		fft->m = size;
+		fft->in_c = fft_buf_alloc(sizeof(fft_complex) * size);
+		fft->out = fft_buf_alloc(sizeof(fft_complex) * (fft->m + 1));
+		if (fft->in_c && fft->out)
+			fft->plan = fft_plan_get(size, true, fft->in_c, fft->out);
+	} else {
+		fft->m = size / 2;
+		fft->in = fft_buf_alloc(sizeof(float) * size);
+		fft->out = fft_buf_alloc(sizeof(fft_complex) * (fft->m + 1));
+		if (fft->in && fft->out)
+			fft->plan = fft_plan_get(size, false, fft->in, fft->out);
+	}
+
+	fft->db = fft_buf_alloc(sizeof(float) * fft->m);
+
+	if (!fft->plan || !fft->db) {
+		fft_free(fft);
+		return -ENOMEM;
+	}
+
+#if !NO_FFTW
+	if (fft_window_setup(fft, size, num_channels) < 0) {
+		fft_free(fft);
+		return -ENOMEM;
+	}
+#endif
+
+	fft->size = size;
+	fft->num_channels = num_channels;
+
+	return 0;
+}
+
+/* Scans in a frame for num_segments half overlapping segments of size */
+unsigned int fft_welch_len(unsigned int size, unsigned int num_segments)
+{
+	if (!num_segments)
+		num_segments = 1;
+
+	return size + (num_segments - 1) * (size / 2);
+}
+
+#if !NO_FFTW
+/* int_fft windows the samples itself as it loads them */
+
+/* Same for one channel, or one I/Q pair, out of scans of stride samples */
+static void fft_window_s16_strided(const int16_t *data, unsigned int stride,
+		unsigned int num_channels, const float *win, float *out,
+		unsigned int num)
+{
+	unsigned int i;
+
+	if (num_channels == 2) {
+		for (i = 0; i < num; i++, data += stride) {
+			out[2 * i] = data[0] * win[2 * i];
+			out[2 * i + 1] = data[1] * win[2 * i + 1];
+		}
+	} else {
+		for (i = 0; i < num; i++, data += stride)
+			out[i] = data[0] * win[i];
+	}
+}
+
+/* int16 to float and window (with the normalization) in one go */
+static void fft_window_s16(const int16_t *data, const float *win, float *out,
+		unsigned int num)
+{
+	unsigned int i = 0;
+#if defined(__SSE2__)
+	__m128i v;
+
+	for (; i + 8 <= num; i += 8) {
+		v = _mm_loadu_si128((const __m128i *)(data + i));
+		_mm_storeu_ps(out + i, _mm_mul_ps(_mm_loadu_ps(win + i),
+			_mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(v, v), 16))));
+		_mm_storeu_ps(out + i + 4, _mm_mul_ps(_mm_loadu_ps(win + i + 4),
+			_mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpackhi_epi16(v, v), 16))));
+	}
+#elif HAVE_NEON
+	int16x8_t v;
+
+	for (; i + 8 <= num; i += 8) {
+		v = vld1q_s16(data + i);
+		vst1q_f32(out + i, vmulq_f32(vld1q_f32(win + i),
+			vcvtq_f32_s32(vmovl_s16(vget_low_s16(v)))));
+		vst1q_f32(out + i + 4, vmulq_f32(vld1q_f32(win + i + 4),
+			vcvtq_f32_s32(vmovl_s16(vget_high_s16(v)))));
+	}
+#endif
+	for (; i < num; i++)
+		out[i] = data[i] * win[i];
+}
+
+/* Same for samples already in float, interleaved I/Q */
+static void fft_window_f32(const float *data, const float *win, float *out,
+		unsigned int num)
+{
+	unsigned int i = 0;
+#if defined(__SSE2__)
+	for (; i + 4 <= num; i += 4)
+		_mm_storeu_ps(out + i, _mm_mul_ps(_mm_loadu_ps(data + i),
+				_mm_loadu_ps(win + i)));
+#elif HAVE_NEON
+	for (; i + 4 <= num; i += 4)
+		vst1q_f32(out + i, vmulq_f32(vld1q_f32(data + i),
+				vld1q_f32(win + i)));
+#endif
+	for (; i < num; i++)
+		out[i] = data[i] * win[i];
+}
+#endif
+
+/*
+ * log2() for the dB conversion: exponent plus a polynomial for the
+ * mantissa, at most 1e-4 off, which is 0.0003 dB. Zero and denormals
+ * are taken as FLT_MIN.
+ */
+#define LOG2_C1	1.43901482f
+#define LOG2_C2	-0.67994509f
+#define LOG2_C3	0.32559782f
+#define LOG2_C4	-0.08476994f
+
+/* 10 * log10(2) */
+#define DB_PER_LOG2	3.01029996f
+
+static inline float fast_log2f(float x)
+{
+	union { float f; uint32_t i; } u;
+	float e, t;
+
+	u.f = x < FLT_MIN ? FLT_MIN : x;
+	e = (float)(int)(u.i >> 23) - 127;
+	u.i = (u.i & 0x007fffff) | 0x3f800000;
+	t = u.f - 1.0f;
+
+	return e + t * (LOG2_C1 + t * (LOG2_C2 + t * (LOG2_C3 + t * LOG2_C4)));
+}
+
+/* fast_log2f() of four floats, and |in|^2 of four complex ones */
+#if defined(__SSE2__)
+static inline __m128 log2_ps(__m128 x)
+{
+	const __m128 one = _mm_set1_ps(1.0f);
+	__m128 e, t, y;
+
+	x = _mm_max_ps(x, _mm_set1_ps(FLT_MIN));
+	e = _mm_cvtepi32_ps(_mm_sub_epi32(
+			_mm_srli_epi32(_mm_castps_si128(x), 23),
+			_mm_set1_epi32(127)));
+	t = _mm_sub_ps(_mm_or_ps(_mm_and_ps(x,
+			_mm_castsi128_ps(_mm_set1_epi32(0x007fffff))), one), one);
+
+	y = _mm_add_ps(_mm_set1_ps(LOG2_C3),
+			_mm_mul_ps(t, _mm_set1_ps(LOG2_C4)));
+	y = _mm_add_ps(_mm_set1_ps(LOG2_C2), _mm_mul_ps(t, y));
+	y = _mm_add_ps(_mm_set1_ps(LOG2_C1), _mm_mul_ps(t, y));
+
+	return _mm_add_ps(e, _mm_mul_ps(t, y));
+}
+
+static inline __m128 power_ps(const float *p)
+{
+	__m128 a = _mm_loadu_ps(p), b = _mm_loadu_ps(p + 4);
+
+	a = _mm_mul_ps(a, a);
+	b = _mm_mul_ps(b, b);
+
+	return _mm_add_ps(_mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0)),
+			_mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1)));
+}
+#elif HAVE_NEON
+static inline float32x4_t log2q_f32(float32x4_t x)
+{
+	const float32x4_t one = vdupq_n_f32(1.0f);
+	float32x4_t e, t, y;
+	uint32x4_t bits;
+
+	bits = vreinterpretq_u32_f32(vmaxq_f32(x, vdupq_n_f32(FLT_MIN)));
+	e = vcvtq_f32_s32(vsubq_s32(vreinterpretq_s32_u32(vshrq_n_u32(bits, 23)),
+			vdupq_n_s32(127)));
+	t = vsubq_f32(vreinterpretq_f32_u32(vorrq_u32(
+			vandq_u32(bits, vdupq_n_u32(0x007fffff)),
+			vreinterpretq_u32_f32(one))), one);
+
+	y = vmlaq_f32(vdupq_n_f32(LOG2_C3), t, vdupq_n_f32(LOG2_C4));
+	y = vmlaq_f32(vdupq_n_f32(LOG2_C2), t, y);
+	y = vmlaq_f32(vdupq_n_f32(LOG2_C1), t, y);
+
+	return vmlaq_f32(e, t, y);
+}
+
+static inline float32x4_t powerq_f32(const float *p)
+{
+	float32x4x2_t v = vld2q_f32(p);
+
+	return vmlaq_f32(vmulq_f32(v.val[0], v.val[0]), v.val[1], v.val[1]);
+}
+#endif
+
+/* db[i] = 10 * log10(|in[i]|^2) + offset */
+static void fft_power_db(const fft_complex *in, float *db, unsigned int num,
+		float offset)
+{
+	const float *p = (const float *)in;
+	unsigned int i = 0;
+#if defined(__SSE2__)
+	for (; i + 4 <= num; i += 4)
+		_mm_storeu_ps(db + i, _mm_add_ps(_mm_set1_ps(offset),
+				_mm_mul_ps(log2_ps(power_ps(p + 2 * i)),
+					_mm_set1_ps(DB_PER_LOG2))));
+#elif HAVE_NEON
+	for (; i + 4 <= num; i += 4)
+		vst1q_f32(db + i, vmlaq_f32(vdupq_n_f32(offset),
+				log2q_f32(powerq_f32(p + 2 * i)),
+				vdupq_n_f32(DB_PER_LOG2)));
+#endif
+	for (; i < num; i++)
+		db[i] = fast_log2f(p[2 * i] * p[2 * i] + p[2 * i + 1] * p[2 * i + 1]) *
+			DB_PER_LOG2 + offset;
+}
+
+/* pwr[i] += |in[i]|^2 */
+static void fft_power_add(const fft_complex *in, float *pwr,
+		unsigned int num)
+{
+	const float *p = (const float *)in;
+	unsigned int i = 0;
+#if defined(__SSE2__)
+	for (; i + 4 <= num; i += 4)
+		_mm_storeu_ps(pwr + i, _mm_add_ps(_mm_loadu_ps(pwr + i),
+				power_ps(p + 2 * i)));
+#elif HAVE_NEON
+	for (; i + 4 <= num; i += 4)
+		vst1q_f32(pwr + i, vaddq_f32(vld1q_f32(pwr + i),
+				powerq_f32(p + 2 * i)));
+#endif
+	for (; i < num; i++)
+		pwr[i] += p[2 * i] * p[2 * i] + p[2 * i + 1] * p[2 * i + 1];
+}
+
+/* db[i] = 10 * log10(pwr[i]) + offset */
+static void fft_db(const float *pwr, float *db, unsigned int num, float offset)
+{
+	unsigned int i = 0;
+#if defined(__SSE2__)
+	for (; i + 4 <= num; i += 4)
+		_mm_storeu_ps(db + i, _mm_add_ps(_mm_set1_ps(offset),
+				_mm_mul_ps(log2_ps(_mm_loadu_ps(pwr + i)),
+					_mm_set1_ps(DB_PER_LOG2))));
+#elif HAVE_NEON
+	for (; i + 4 <= num; i += 4)
+		vst1q_f32(db + i, vmlaq_f32(vdupq_n_f32(offset),
+				log2q_f32(vld1q_f32(pwr + i)),
+				vdupq_n_f32(DB_PER_LOG2)));
+#endif
+	for (; i < num; i++)
+		db[i] = fast_log2f(pwr[i]) * DB_PER_LOG2 + offset;
+}
+
+static void fft_transform_into(struct fft_state *fft, const int16_t *data,
+		unsigned int stride, float *in, fft_complex *out,
+		struct fft_plan *p)
+{
+#if NO_FFTW
+	int_fft_run(&p->engine, data, stride, (int16_t *)in, (float *)out,
+			1.0f / fft->m);
+#else
+	fftwf_plan plan;
+
+	if (stride == fft->num_channels)
+		fft_window_s16(data, fft->win, in,
+				fft->size * fft->num_channels);
+	else
+		fft_window_s16_strided(data, stride, fft->num_channels,
+				fft->win, in, fft->size);
+
+	/* the measured plan, as soon as there is one */
+	plan = g_atomic_pointer_get(&p->measured);
+	if (!plan)
+		plan = p->estimate;
+
+	if (fft->num_channels == 2)
+		fftwf_execute_dft(plan, (fftwf_complex *)in, out);
+	else
+		fftwf_execute_dft_r2c(plan, in, out);
+#endif
+}
+
+/*
+ * Window and transform a frame of raw samples (interleaved I/Q for two),
+ * taken out of scans of stride samples.
+ */
+void fft_transform(struct fft_state *fft, const int16_t *data,
+		unsigned int stride)
+{
+	fft_transform_into(fft, data, stride, fft->num_channels == 2 ?
+			(float *)fft->in_c : fft->in, fft->out, fft->plan);
+}
+
+/* The same for complex float samples, fft has to be a complex one */
+void fft_transform_c(struct fft_state *fft, const float *data)
+{
+#if NO_FFTW
+	int_fft_run_f32(&fft->plan->engine, data, (int16_t *)fft->in_c,
+			(float *)fft->out, 1.0f / fft->m);
+#else
+	fftwf_plan plan;
+
+	fft_window_f32(data, fft->win, (float *)fft->in_c, 2 * fft->size);
+
+	plan = g_atomic_pointer_get(&fft->plan->measured);
+	if (!plan)
+		plan = fft->plan->estimate;
+
+	fftwf_execute_dft(plan, fft->in_c, fft->out);
+#endif
+}
+
+/*
+ * The averaging kernels, one per mode so the loops have no branches. d is
+ * the new frame and is only read.
+ */
+
+/* s += w * (d - s), which is (1 - w) * s + w * d */
+static void avg_exponential(float *s, const float *d, unsigned int num,
+		float w)
+{
+	unsigned int i = 0;
+#if defined(__SSE2__)
+	const __m128 vw = _mm_set1_ps(w);
+	__m128 vs;
+
+	for (; i + 4 <= num; i += 4) {
+		vs = _mm_loadu_ps(s + i);
+		_mm_storeu_ps(s + i, _mm_add_ps(vs, _mm_mul_ps(vw,
+				_mm_sub_ps(_mm_loadu_ps(d + i), vs))));
+	}
+#elif HAVE_NEON
+	const float32x4_t vw = vdupq_n_f32(w);
+	float32x4_t vs;
+
+	for (; i + 4 <= num; i += 4) {
+		vs = vld1q_f32(s + i);
+		vst1q_f32(s + i, vmlaq_f32(vs, vw,
+				vsubq_f32(vld1q_f32(d + i), vs)));
+	}
+#endif
+	for (; i < num; i++)
+		s[i] += w * (d[i] - s[i]);
+}
+
+static void avg_peak_hold(float *s, const float *d, unsigned int num)
+{
+	unsigned int i = 0;
+#if defined(__SSE2__)
+	for (; i + 4 <= num; i += 4)
+		_mm_storeu_ps(s + i, _mm_max_ps(_mm_loadu_ps(s + i),
+				_mm_loadu_ps(d + i)));
+#elif HAVE_NEON
+	for (; i + 4 <= num; i += 4)
+		vst1q_f32(s + i, vmaxq_f32(vld1q_f32(s + i), vld1q_f32(d + i)));
+#endif
+	for (; i < num; i++)
+		if (d[i] > s[i])
+			s[i] = d[i];
+}
+
+static void avg_min_hold(float *s, const float *d, unsigned int num)
+{
+	unsigned int i = 0;
+#if defined(__SSE2__)
+	for (; i + 4 <= num; i += 4)
+		_mm_storeu_ps(s + i, _mm_min_ps(_mm_loadu_ps(s + i),
+				_mm_loadu_ps(d + i)));
+#elif HAVE_NEON
+	for (; i + 4 <= num; i += 4)
+		vst1q_f32(s + i, vminq_f32(vld1q_f32(s + i), vld1q_f32(d + i)));
+#endif
+	for (; i < num; i++)
+		if (d[i] < s[i])
+			s[i] = d[i];
+}
+
+/*
+ * Linear average over a window of frames: the oldest frame in the history
+ * slot (zeroes while the window fills up) goes out of the sum, the new one
+ * takes its place and s is the sum scaled by 1/frames.
+ */
+static void avg_linear(float *s, float *sum, float *old, const float *d,
+		unsigned int num, float scale)
+{
+	unsigned int i = 0;
+#if defined(__SSE2__)
+	const __m128 vscale = _mm_set1_ps(scale);
+	__m128 vd, vsum;
+
+	for (; i + 4 <= num; i += 4) {
+		vd = _mm_loadu_ps(d + i);
+		vsum = _mm_add_ps(_mm_loadu_ps(sum + i),
+				_mm_sub_ps(vd, _mm_loadu_ps(old + i)));
+		_mm_storeu_ps(old + i, vd);
+		_mm_storeu_ps(sum + i, vsum);
+		_mm_storeu_ps(s + i, _mm_mul_ps(vsum, vscale));
+	}
+#elif HAVE_NEON
+	const float32x4_t vscale = vdupq_n_f32(scale);
+	float32x4_t vd, vsum;
+
+	for (; i + 4 <= num; i += 4) {
+		vd = vld1q_f32(d + i);
+		vsum = vaddq_f32(vld1q_f32(sum + i),
+				vsubq_f32(vd, vld1q_f32(old + i)));
+		vst1q_f32(old + i, vd);
+		vst1q_f32(sum + i, vsum);
+		vst1q_f32(s + i, vmulq_f32(vsum, vscale));
+	}
+#endif
+	for (; i < num; i++) {
+		sum[i] += d[i] - old[i];
+		old[i] = d[i];
+		s[i] = sum[i] * scale;
+	}
+}
+
+static void avg_add(float *sum, const float *d, unsigned int num)
+{
+	unsigned int i = 0;
+#if defined(__SSE2__)
+	for (; i + 4 <= num; i += 4)
+		_mm_storeu_ps(sum + i, _mm_add_ps(_mm_loadu_ps(sum + i),
+				_mm_loadu_ps(d + i)));
+#elif HAVE_NEON
+	for (; i + 4 <= num; i += 4)
+		vst1q_f32(sum + i, vaddq_f32(vld1q_f32(sum + i),
+				vld1q_f32(d + i)));
+#endif
+	for (; i < num; i++)
+		sum[i] += d[i];
+}
+
+/* Start the linear average over, with a history of len frames */
+static int avg_linear_reset(struct fft_state *fft, unsigned int len)
+{
+	unsigned int m = fft->m;
+
+	if (!fft->avg_hist || fft->avg_len != len) {
+		fft_buf_free(fft->avg_hist);
+		fft_buf_free(fft->avg_sum);
+		fft->avg_hist = fft_buf_alloc(sizeof(float) * m * len);
+		fft->avg_sum = fft_buf_alloc(sizeof(float) * m);
+		if (!fft->avg_hist || !fft->avg_sum) {
+			fft_buf_free(fft->avg_hist);
+			fft_buf_free(fft->avg_sum);
+			fft->avg_hist = NULL;
+			fft->avg_sum = NULL;
+			fft->avg_len = 0;
+			return -ENOMEM;
+		}
+		fft->avg_len = len;
+	}
+
+	memset(fft->avg_hist, 0, sizeof(float) * m * len);
+	memset(fft->avg_sum, 0, sizeof(float) * m);
+	fft->avg_count = 0;
+	fft->avg_pos = 0;
+
+	return 0;
+}
+
+static void avg_linear_frame(struct fft_state *fft, float *spectrum)
+{
+	unsigned int i, m = fft->m;
+
+	if (fft->avg_count < fft->avg_len)
+		fft->avg_count++;
+
+	avg_linear(spectrum, fft->avg_sum, fft->avg_hist + fft->avg_pos * m,
+			fft->db, m, 1.0f / fft->avg_count);
+
+	if (++fft->avg_pos < fft->avg_len)
+		return;
+	fft->avg_pos = 0;
+
+	/*
+	 * Once per window, add up the history again so the rounding of the
+	 * running sum can't build up.
+	 */
+	memcpy(fft->avg_sum, fft->avg_hist, sizeof(float) * m);
+	for (i = 1; i < fft->avg_len; i++)
+		avg_add(fft->avg_sum, fft->avg_hist + i * m, m);
+}
+
+/*
+ * Fold the last transform, in dB plus offset, into spectrum. A spectrum
+ * starting with FLT_MAX is taken as the first frame, which (re)starts the
+ * averaging. The kernel is picked once for the whole frame.
+ */
+void fft_average(struct fft_state *fft, float *spectrum, double offset,
+		enum fft_avg_mode avg_mode, unsigned int avg_n)
+{
+	static bool warned;
+	unsigned int m = fft->m;
+	bool first = spectrum[0] == FLT_MAX;
+
+	if (!avg_n)
+		avg_n = 1;
+
+	/* move DC to the middle for I/Q */
+	if (fft->num_channels == 2) {
+		fft_power_db(fft->out + m / 2, fft->db, m - m / 2, offset);
+		fft_power_db(fft->out, fft->db + m - m / 2, m / 2, offset);
+	} else {
+		fft_power_db(fft->out, fft->db, m, offset);
+	}
+
+	if (avg_mode == FFT_AVG_LINEAR && (first ||
+				fft->avg_mode != FFT_AVG_LINEAR ||
+				fft->avg_len != avg_n)) {
+		if (avg_linear_reset(fft, avg_n) < 0) {
+			if (!warned)
+				fprintf(stderr, "No memory for a %u frame average, "
+						"averaging exponentially\n", avg_n);
+			warned = true;
+			avg_mode = FFT_AVG_EXPONENTIAL;
+		}
+	}
+	fft->avg_mode = avg_mode;
+
+	if (first && avg_mode != FFT_AVG_LINEAR) {
+		memcpy(spectrum, fft->db, sizeof(float) * m);
+		return;
+	}
+
+	switch (avg_mode) {
+	case FFT_AVG_LINEAR:
+		avg_linear_frame(fft, spectrum);
+		break;
+	case FFT_AVG_PEAK_HOLD:
+		avg_peak_hold(spectrum, fft->db, m);
+		break;
+	case FFT_AVG_MIN_HOLD:
+		avg_min_hold(spectrum, fft->db, m);
+		break;
+	default:
+		avg_exponential(spectrum, fft->db, m, 1.0f / avg_n);
+		break;
+	}
+}
+
+void fft_compute(struct fft_state *fft, const int16_t *data,
+		float *spectrum, double offset, enum fft_avg_mode avg_mode,
+		unsigned int avg_n)
+{
+	fft_transform(fft, data, fft->num_channels);
+	fft_average(fft, spectrum, offset, avg_mode, avg_n);
+}
+
+/*
+ * Welch: the power of every num_lanes-th segment, starting with this
+ * lane's, is added up in the lane's pwr.
+ */
+static void fft_welch_lane(struct fft_job *job, unsigned int lane,
+		unsigned int num_lanes)
+{
+	struct fft_state *fft = job->fft;
+	struct fft_lane *l = &fft->lanes[lane];
+	unsigned int s, hop = fft->size / 2;
+
+	memset(l->pwr, 0, sizeof(float) * fft->m);
+
+	for (s = lane; s < job->avg_n; s += num_lanes) {
+		fft_transform_into(fft, job->data + (size_t)s * hop * job->stride,
+				job->stride, l->in, l->out, l->plan);
+		fft_power_add(l->out, l->pwr, fft->m);
+	}
+}
+
+/* Once all lanes are done: their sum, as a mean in dB, is the spectrum */
+static void fft_welch_finish(struct fft_job *job, unsigned int num_lanes)
+{
+	struct fft_state *fft = job->fft;
+	float *pwr = fft->lanes[0].pwr;
+	unsigned int i, m = fft->m;
+	float offset;
+
+	for (i = 1; i < num_lanes; i++)
+		avg_add(pwr, fft->lanes[i].pwr, m);
+
+	offset = job->offset - 10 * log10(job->avg_n);
+	if (fft->num_channels == 2) {
+		fft_db(pwr + m / 2, job->spectrum, m - m / 2, offset);
+		fft_db(pwr, job->spectrum + m - m / 2, m / 2, offset);
+	} else {
+		fft_db(pwr, job->spectrum, m, offset);
+	}
+	fft->avg_mode = FFT_AVG_WELCH;
+}
+
+/*
+ * How many lanes a Welch job gets: its share of the cores, none of them
+ * for the sizes FFTW spreads over the cores itself. 0 for other jobs, or
+ * when there is no memory, and then it's averaged exponentially.
+ */
+static unsigned int fft_job_lanes(struct fft_job *job, unsigned int num_jobs)
+{
+	static bool warned;
+	unsigned int num;
+
+	if (job->avg_mode != FFT_AVG_WELCH || job->ddc)
+		return 0;
+
+	if (!job->avg_n)
+		job->avg_n = 1;
+
+	if (job->fft->size >= FFT_THREADS_MIN_SIZE)
+		num = 1;
+	else
+		num = MIN(job->avg_n, (num_workers + num_jobs - 1) / num_jobs);
+
+	if (fft_lanes_setup(job->fft, num) < 0) {
+		num = 1;
+		if (fft_lanes_setup(job->fft, num) < 0) {
+			if (!warned)
+				fprintf(stderr, "No memory for Welch averaging, "
+						"averaging exponentially\n");
+			warned = true;
+			job->avg_mode = FFT_AVG_EXPONENTIAL;
+			return 0;
+		}
+	}
+
+	return num;
+}
+
+static void fft_job_run(struct fft_job *job)
+{
+	if (job->ddc) {
+		ddc_run(job->ddc, job->data, job->stride);
+		fft_transform_c(job->fft, job->ddc->out);
+	} else {
+		fft_transform(job->fft, job->data, job->stride);
+	}
+}
+
+static void fft_task_run(struct fft_task *task)
+{
+	struct fft_job *job = task->job;
+
+	if (task->average && task->num_lanes)
+		fft_welch_finish(job, task->num_lanes);
+	else if (task->average)
+		fft_average(job->fft, job->spectrum, job->offset,
+				job->avg_mode, job->avg_n);
+	else if (task->num_lanes)
+		fft_welch_lane(job, task->lane, task->num_lanes);
+	else
+		fft_job_run(job);
+}
+
+static void fft_job_func(gpointer data, gpointer user_data)
+{
+	fft_task_run(data);
+
+	g_mutex_lock(&job_lock);
+	if (!--job_pending)
+		g_cond_signal(&job_done);
+	g_mutex_unlock(&job_lock);
+}
+
+static void fft_tasks_grow(unsigned int size)
+{
+	if (size > tasks_size) {
+		tasks_size = size;
+		tasks = g_renew(struct fft_task, tasks, tasks_size);
+	}
+}
+
+/* The first n tasks, spread over the cores */
+static void fft_tasks_run(unsigned int n, unsigned int size)
+{
+	unsigned int i;
+
+	if (!job_pool || n < 2 || size >= FFT_THREADS_MIN_SIZE) {
+		for (i = 0; i < n; i++)
+			fft_task_run(&tasks[i]);
+		return;
+	}
+
+	g_mutex_lock(&job_lock);
+	job_pending = n - 1;
+	g_mutex_unlock(&job_lock);
+
+	for (i = 1; i < n; i++)
+		g_thread_pool_push(job_pool, &tasks[i], NULL);
+
+	fft_task_run(&tasks[0]);
+
+	g_mutex_lock(&job_lock);
+	while (job_pending)
+		g_cond_wait(&job_done, &job_lock);
+	g_mutex_unlock(&job_lock);
+}
+
+/*
+ * Transform every spectrum of a frame, spread over the cores, for
+ * fft_average_jobs() to average after. Each job needs its own fft_state.
+ * Returns when all of them are done.
+ */
+void fft_transform_jobs(struct fft_job *jobs, unsigned int num)
+{
+	unsigned int i, j, lanes, n = 0;
+
+	/* a task per job, or per lane for Welch */
+	for (i = 0; i < num; i++) {
+		lanes = fft_job_lanes(&jobs[i], num);
+		jobs[i].num_lanes = lanes;
+
+		fft_tasks_grow(n + MAX(lanes, 1) + num);
+
+		j = 0;
+		do {
+			tasks[n].job = &jobs[i];
+			tasks[n].lane = j;
+			tasks[n].num_lanes = lanes;
+			tasks[n++].average = false;
+		} while (++j < lanes);
+	}
+
+	if (num)
+		fft_tasks_run(n, jobs[0].fft->size);
+}
+
+/* The spectra of the jobs fft_transform_jobs() was just given */
+void fft_average_jobs(struct fft_job *jobs, unsigned int num)
+{
+	unsigned int i;
+
+	fft_tasks_grow(num);
+
+	for (i = 0; i < num; i++) {
+		tasks[i].job = &jobs[i];
+		tasks[i].lane = 0;
+		tasks[i].num_lanes = jobs[i].num_lanes;
+		tasks[i].average = true;
+	}
+
+	if (num)
+		fft_tasks_run(num, jobs[0].fft->size);
+}
+
+/*
+ * Transform and average every spectrum of a frame, spread over the cores.
+ * Each job needs its own fft_state. Returns when all of them are done.
+ */
+void fft_compute_jobs(struct fft_job *jobs, unsigned int num)
+{
+	fft_transform_jobs(jobs, num);
+	fft_average_jobs(jobs, num);
+}
@@ -0,0 +1,120 @@
+/**
+ * Copyright (C) 2013 Analog Devices, Inc.
+ *
+ * Licensed under the GPL-2.
+ *
+ **/
+
+#ifndef __FFT_H__
+#define __FFT_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "ddc.h"
+
+/*
+ * Built with NO_FFTW, the transforms are the fixed-point ones of int_fft.c
+ * and the rest stays the same.
+ */
+#if NO_FFTW
+#include "int_fft.h"
+typedef float fft_complex[2];
+#else
+#include <fftw3.h>
+typedef fftwf_complex fft_complex;
+#endif
+
+/*
+ * How fft_average() folds a frame into the spectrum, avg_n is the N of the
+ * first two and ignored by the holds:
+ * exponential - every frame weighted 1/N, the older ones fading away
+ * linear      - the plain mean of the last N frames
+ * welch       - the mean power of N half overlapping segments of one frame,
+ *               which has to be fft_welch_len() samples long
+ */
+enum fft_avg_mode {
+	FFT_AVG_EXPONENTIAL,
+	FFT_AVG_LINEAR,
+	FFT_AVG_PEAK_HOLD,
+	FFT_AVG_MIN_HOLD,
+	FFT_AVG_WELCH,
+	FFT_AVG_NUM_MODES,
+};
+
+/*
+ * The part of the FFT plot which doesn't need the GUI: window, transform,
+ * magnitude in dB and averaging. With two channels the samples are taken
+ * as I/Q and the spectrum is centered around DC, with one channel it's the
+ * real half spectrum.
+ */
+struct fft_state {
+	unsigned int size;		/* samples per channel */
+	unsigned int num_channels;
+	unsigned int m;			/* bins in the spectrum */
+
+	float *win;
+	float *in;
+	fft_complex *in_c;
+	fft_complex *out;
+	float *db;
+	struct fft_plan *plan;
+
+	/* linear averaging: the last avg_len frames and their sum */
+	enum fft_avg_mode avg_mode;
+	float *avg_hist;
+	float *avg_sum;
+	unsigned int avg_len;
+	unsigned int avg_count;
+	unsigned int avg_pos;
+
+	/* Welch: buffers for each thread taking a share of the segments */
+	struct fft_lane *lanes;
+	unsigned int num_lanes;
+};
+
+void fft_plans_init(const char *wisdom_file, unsigned int flags);
+void fft_plans_prepare(const unsigned int *sizes, unsigned int num,
+		bool background);
+void fft_plans_cleanup(void);
+int fft_wisdom_save(void);
+
+int fft_setup(struct fft_state *fft, unsigned int size,
+		unsigned int num_channels);
+void fft_free(struct fft_state *fft);
+unsigned int fft_welch_len(unsigned int size, unsigned int num_segments);
+
+/*
+ * One spectrum of a multichannel frame for fft_compute_jobs(): data points
+ * to the first (I) sample of the channel(s), stride is the number of
+ * samples in a scan. Welch jobs are split over the cores segment-wise.
+ * With a ddc the data is down-converted first, fft then has to be a
+ * complex one of ddc->num_out points; no Welch for those, it's taken as
+ * exponential.
+ */
+struct fft_job {
+	struct fft_state *fft;
+	const int16_t *data;
+	unsigned int stride;
+	float *spectrum;
+	double offset;
+	enum fft_avg_mode avg_mode;
+	unsigned int avg_n;
+	struct ddc *ddc;
+
+	unsigned int num_lanes;		/* set by fft_transform_jobs() */
+};
+
+void fft_transform(struct fft_state *fft, const int16_t *data,
+		unsigned int stride);
+void fft_transform_c(struct fft_state *fft, const float *data);
+void fft_average(struct fft_state *fft, float *spectrum, double offset,
+		enum fft_avg_mode avg_mode, unsigned int avg_n);
+void fft_compute(struct fft_state *fft, const int16_t *data,
+		float *spectrum, double offset, enum fft_avg_mode avg_mode,
+		unsigned int avg_n);
+void fft_compute_jobs(struct fft_job *jobs, unsigned int num);
+void fft_transform_jobs(struct fft_job *jobs, unsigned int num);
+void fft_average_jobs(struct fft_job *jobs, unsigned int num);
+
+#endif
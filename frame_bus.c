@@ -0,0 +1,633 @@
+/**
+ * Copyright (C) 2013 Analog Devices, Inc.
+ *
+ * Licensed under the GPL-2.
+ *
+ **/
+
+#include <errno.h>
+#include <stdbool.h>
+#include <string.h>
+#include <glib.h>
+
+#include "frame_bus.h"
+
+/* Spare buffers kept per frame type, anything past that is freed */
+#define FRAME_BUS_POOL_MAX	8
+
+/*
+ * The frame as the bus sees it. mem holds the channels one after the
+ * other, chan points at each; both only ever grow, as the buffer goes
+ * round the pool.
+ */
+struct frame_buf {
+	struct osc_frame frame;
+	volatile gint refs;
+	struct frame_bus *bus;
+	void *mem;
+	size_t size;
+	float **chan;
+	unsigned int num_chan;
+	struct frame_buf *next;
+};
+
+/*
+ * Frames are rate limited with a leaky bucket: no more than max_rate on
+ * average, but a frame a little early still goes through. Skipping it
+ * would halve the rate whenever the capture runs at about max_rate.
+ */
+struct frame_sub {
+	struct frame_bus *bus;
+	char *device;			/* NULL for any */
+	unsigned int types;
+	gint64 interval;		/* us, 0 for every frame */
+	gint64 due[OSC_FRAME_NUM_TYPES];
+
+	osc_frame_func func;
+	void *user_data;
+	bool dead;			/* unsubscribed during a publish */
+
+	/*
+	 * under wait_lock, gen counts the frames put in the mailbox and
+	 * epoch the interrupts of the device alone
+	 */
+	const struct osc_frame *mailbox[OSC_FRAME_NUM_TYPES];
+	unsigned long gen[OSC_FRAME_NUM_TYPES];
+	unsigned int epoch;
+};
+
+struct frame_cancel {
+	struct frame_bus *bus;
+	volatile gint set;
+};
+
+/*
+ * lock is held while the frames go out, so once frame_bus_unsubscribe()
+ * returns the callback isn't running anymore. It's recursive so that a
+ * callback can unsubscribe, itself or any other subscription: while
+ * publishing is nonzero those are only marked dead, and freed once the
+ * outermost frame_bus_publish() is done with the list.
+ *
+ * The mailboxes are under wait_lock, cond is broadcast whenever one gets
+ * a frame, a cancellation token is set or the bus is interrupted (which
+ * bumps epoch).
+ */
+struct frame_bus {
+	GRecMutex lock;
+	GSList *subs;
+	unsigned int publishing;
+	bool reap;
+
+	GMutex wait_lock;
+	GCond cond;
+	unsigned int epoch;
+
+	GMutex pool_lock;
+	struct frame_buf *pool[OSC_FRAME_NUM_TYPES];
+	unsigned int pool_len[OSC_FRAME_NUM_TYPES];
+
+	/* one for the owner, one for every frame out there */
+	volatile gint refs;
+};
+
+static void frame_buf_free(struct frame_buf *buf)
+{
+	g_free(buf->mem);
+	g_free(buf->chan);
+	g_free(buf);
+}
+
+static void frame_bus_unref(struct frame_bus *bus)
+{
+	struct frame_buf *buf;
+	unsigned int i;
+
+	if (!g_atomic_int_dec_and_test(&bus->refs))
+		return;
+
+	for (i = 0; i < OSC_FRAME_NUM_TYPES; i++) {
+		while (bus->pool[i]) {
+			buf = bus->pool[i];
+			bus->pool[i] = buf->next;
+			frame_buf_free(buf);
+		}
+	}
+
+	g_rec_mutex_clear(&bus->lock);
+	g_mutex_clear(&bus->wait_lock);
+	g_cond_clear(&bus->cond);
+	g_mutex_clear(&bus->pool_lock);
+	g_free(bus);
+}
+
+const struct osc_frame * osc_frame_ref(const struct osc_frame *frame)
+{
+	struct frame_buf *buf = (struct frame_buf *)frame;
+
+	g_atomic_int_inc(&buf->refs);
+
+	return frame;
+}
+
+/* The last reference gives the buffer back to the pool */
+void osc_frame_unref(const struct osc_frame *frame)
+{
+	struct frame_buf *buf = (struct frame_buf *)frame;
+	struct frame_bus *bus;
+	unsigned int type;
+
+	if (!frame || !g_atomic_int_dec_and_test(&buf->refs))
+		return;
+
+	bus = buf->bus;
+	type = frame->type;
+
+	g_mutex_lock(&bus->pool_lock);
+	if (bus->pool_len[type] < FRAME_BUS_POOL_MAX) {
+		buf->next = bus->pool[type];
+		bus->pool[type] = buf;
+		bus->pool_len[type]++;
+		buf = NULL;
+	}
+	g_mutex_unlock(&bus->pool_lock);
+
+	if (buf)
+		frame_buf_free(buf);
+
+	frame_bus_unref(bus);
+}
+
+struct frame_bus * frame_bus_new(void)
+{
+	struct frame_bus *bus;
+
+	bus = g_new0(struct frame_bus, 1);
+	if (!bus)
+		return NULL;
+
+	g_rec_mutex_init(&bus->lock);
+	g_mutex_init(&bus->wait_lock);
+	g_cond_init(&bus->cond);
+	g_mutex_init(&bus->pool_lock);
+	bus->refs = 1;
+
+	return bus;
+}
+
+static void frame_sub_free(struct frame_sub *sub)
+{
+	unsigned int i;
+
+	for (i = 0; i < OSC_FRAME_NUM_TYPES; i++)
+		osc_frame_unref(sub->mailbox[i]);
+	g_free(sub->device);
+	g_free(sub);
+}
+
+/* Drops every subscription, the frames still out there stay valid */
+void frame_bus_free(struct frame_bus *bus)
+{
+	if (!bus)
+		return;
+
+	g_rec_mutex_lock(&bus->lock);
+	g_slist_free_full(bus->subs, (GDestroyNotify)frame_sub_free);
+	bus->subs = NULL;
+	g_rec_mutex_unlock(&bus->lock);
+
+	frame_bus_unref(bus);
+}
+
+/*
+ * Get the frames of device (NULL for every device) whose type is in the
+ * types mask, at most max_rate of each a second (0 for all of them).
+ * With a func, it is called for each one. Without, the newest frame of
+ * each type waits in the subscription for frame_bus_take() or
+ * frame_bus_wait().
+ */
+struct frame_sub * frame_bus_subscribe(struct frame_bus *bus,
+		const char *device, unsigned int types, double max_rate,
+		osc_frame_func func, void *user_data)
+{
+	struct frame_sub *sub;
+
+	if (!bus || !types || max_rate < 0.0)
+		return NULL;
+
+	sub = g_new0(struct frame_sub, 1);
+	if (!sub)
+		return NULL;
+
+	sub->bus = bus;
+	sub->device = g_strdup(device);
+	sub->types = types;
+	sub->interval = max_rate > 0.0 ? (gint64)(1e6 / max_rate) : 0;
+	sub->func = func;
+	sub->user_data = user_data;
+
+	g_rec_mutex_lock(&bus->lock);
+	bus->subs = g_slist_append(bus->subs, sub);
+	g_rec_mutex_unlock(&bus->lock);
+
+	return sub;
+}
+
+/* Nobody may be waiting on sub anymore */
+void frame_bus_unsubscribe(struct frame_sub *sub)
+{
+	struct frame_bus *bus;
+
+	if (!sub)
+		return;
+
+	bus = sub->bus;
+	g_rec_mutex_lock(&bus->lock);
+	if (bus->publishing) {
+		sub->dead = true;
+		bus->reap = true;
+		g_rec_mutex_unlock(&bus->lock);
+		return;
+	}
+	bus->subs = g_slist_remove(bus->subs, sub);
+	g_rec_mutex_unlock(&bus->lock);
+
+	frame_sub_free(sub);
+}
+
+/* Free what was unsubscribed during a publish, with lock held */
+static void frame_bus_reap(struct frame_bus *bus)
+{
+	struct frame_sub *sub;
+	GSList *node, *next;
+
+	for (node = bus->subs; node; node = next) {
+		next = g_slist_next(node);
+		sub = node->data;
+		if (!sub->dead)
+			continue;
+		bus->subs = g_slist_delete_link(bus->subs, node);
+		frame_sub_free(sub);
+	}
+	bus->reap = false;
+}
+
+/*
+ * Change the types of frame sub gets, 0 to park it without giving it up:
+ * nothing is made for it then, and there's no allocation either way. The
+ * frames of the types it no longer gets leave its mailbox.
+ */
+void frame_bus_set_types(struct frame_sub *sub, unsigned int types)
+{
+	const struct osc_frame *old[OSC_FRAME_NUM_TYPES];
+	struct frame_bus *bus;
+	unsigned int i;
+
+	if (!sub)
+		return;
+
+	bus = sub->bus;
+	g_rec_mutex_lock(&bus->lock);
+	sub->types = types;
+	g_rec_mutex_unlock(&bus->lock);
+
+	g_mutex_lock(&bus->wait_lock);
+	for (i = 0; i < OSC_FRAME_NUM_TYPES; i++) {
+		old[i] = NULL;
+		if (!(types & OSC_FRAME_MASK(i))) {
+			old[i] = sub->mailbox[i];
+			sub->mailbox[i] = NULL;
+		}
+	}
+	g_mutex_unlock(&bus->wait_lock);
+
+	for (i = 0; i < OSC_FRAME_NUM_TYPES; i++)
+		osc_frame_unref(old[i]);
+}
+
+/*
+ * The newest frame of type that came in since the last call, or NULL.
+ * The reference is the caller's, to drop with osc_frame_unref().
+ */
+const struct osc_frame * frame_bus_take(struct frame_sub *sub,
+		enum osc_frame_type type)
+{
+	const struct osc_frame *frame;
+
+	if (!sub || type >= OSC_FRAME_NUM_TYPES)
+		return NULL;
+
+	g_mutex_lock(&sub->bus->wait_lock);
+	frame = sub->mailbox[type];
+	sub->mailbox[type] = NULL;
+	g_mutex_unlock(&sub->bus->wait_lock);
+
+	return frame;
+}
+
+/*
+ * Wait for a frame of type: the first one captured after the time after
+ * (g_get_monotonic_time(), a frame already in the mailbox will do), or
+ * with after 0, the next one to come in. The reference to *frame is the
+ * caller's. timeout_ms < 0 waits for as long as it takes.
+ * Returns 0, -ETIMEDOUT, -ECANCELED once cancel is set, or -EINTR if the
+ * bus was interrupted, e.g. because the capture stopped.
+ */
+int frame_bus_wait(struct frame_sub *sub, enum osc_frame_type type,
+		gint64 after, int timeout_ms, struct frame_cancel *cancel,
+		const struct osc_frame **frame)
+{
+	struct frame_bus *bus;
+	const struct osc_frame *f;
+	bool timed_out = false;
+	unsigned long gen;
+	unsigned int epoch, sub_epoch;
+	gint64 end;
+	int ret;
+
+	*frame = NULL;
+	if (!sub || type >= OSC_FRAME_NUM_TYPES || sub->func ||
+			!(sub->types & OSC_FRAME_MASK(type)))
+		return -EINVAL;
+
+	bus = sub->bus;
+	end = g_get_monotonic_time() + (gint64)timeout_ms * 1000;
+
+	g_mutex_lock(&bus->wait_lock);
+	gen = sub->gen[type];
+	epoch = bus->epoch;
+	sub_epoch = sub->epoch;
+
+	for (;;) {
+		f = sub->mailbox[type];
+		if (f && (after ? f->timestamp > after : sub->gen[type] != gen)) {
+			sub->mailbox[type] = NULL;
+			*frame = f;
+			ret = 0;
+			break;
+		}
+
+		if (cancel && g_atomic_int_get(&cancel->set)) {
+			ret = -ECANCELED;
+			break;
+		}
+		if (bus->epoch != epoch || sub->epoch != sub_epoch) {
+			ret = -EINTR;
+			break;
+		}
+		/* one more look at the mailbox after the timeout, then give up */
+		if (timed_out) {
+			ret = -ETIMEDOUT;
+			break;
+		}
+
+		if (timeout_ms < 0)
+			g_cond_wait(&bus->cond, &bus->wait_lock);
+		else
+			timed_out = !g_cond_wait_until(&bus->cond,
+					&bus->wait_lock, end);
+	}
+	g_mutex_unlock(&bus->wait_lock);
+
+	return ret;
+}
+
+/* Wake up every frame_bus_wait() with -EINTR */
+void frame_bus_interrupt(struct frame_bus *bus)
+{
+	if (!bus)
+		return;
+
+	g_mutex_lock(&bus->wait_lock);
+	bus->epoch++;
+	g_cond_broadcast(&bus->cond);
+	g_mutex_unlock(&bus->wait_lock);
+}
+
+/*
+ * Wake up with -EINTR the frame_bus_wait() of the subscriptions to device
+ * only, e.g. because its capture stopped while the others go on.
+ */
+void frame_bus_interrupt_device(struct frame_bus *bus, const char *device)
+{
+	struct frame_sub *sub;
+	GSList *node;
+
+	if (!bus || !device)
+		return;
+
+	g_rec_mutex_lock(&bus->lock);
+	g_mutex_lock(&bus->wait_lock);
+	for (node = bus->subs; node; node = g_slist_next(node)) {
+		sub = node->data;
+		if (sub->device && !strcmp(sub->device, device))
+			sub->epoch++;
+	}
+	g_cond_broadcast(&bus->cond);
+	g_mutex_unlock(&bus->wait_lock);
+	g_rec_mutex_unlock(&bus->lock);
+}
+
+struct frame_cancel * frame_cancel_new(struct frame_bus *bus)
+{
+	struct frame_cancel *cancel;
+
+	if (!bus)
+		return NULL;
+
+	cancel = g_new0(struct frame_cancel, 1);
+	if (!cancel)
+		return NULL;
+
+	cancel->bus = bus;
+	g_atomic_int_inc(&bus->refs);
+
+	return cancel;
+}
+
+void frame_cancel_free(struct frame_cancel *cancel)
+{
+	if (!cancel)
+		return;
+
+	frame_bus_unref(cancel->bus);
+	g_free(cancel);
+}
+
+void frame_cancel_set(struct frame_cancel *cancel)
+{
+	struct frame_bus *bus = cancel->bus;
+
+	g_atomic_int_set(&cancel->set, 1);
+
+	g_mutex_lock(&bus->wait_lock);
+	g_cond_broadcast(&bus->cond);
+	g_mutex_unlock(&bus->wait_lock);
+}
+
+void frame_cancel_reset(struct frame_cancel *cancel)
+{
+	g_atomic_int_set(&cancel->set, 0);
+}
+
+bool frame_cancel_is_set(const struct frame_cancel *cancel)
+{
+	return g_atomic_int_get(&cancel->set);
+}
+
+static bool frame_sub_due(const struct frame_sub *sub, const char *device,
+		unsigned int type, gint64 timestamp)
+{
+	if (sub->dead || !(sub->types & OSC_FRAME_MASK(type)))
+		return false;
+	if (sub->device && strcmp(sub->device, device))
+		return false;
+
+	return timestamp >= sub->due[type] - sub->interval / 2;
+}
+
+/*
+ * Which types of frame of device captured at timestamp someone is waiting
+ * for, as a mask. The rest don't need to be made at all.
+ */
+unsigned int frame_bus_wanted(struct frame_bus *bus, const char *device,
+		gint64 timestamp)
+{
+	unsigned int type, mask = 0;
+	struct frame_sub *sub;
+	GSList *node;
+
+	if (!bus)
+		return 0;
+
+	g_rec_mutex_lock(&bus->lock);
+	for (node = bus->subs; node; node = g_slist_next(node)) {
+		sub = node->data;
+		for (type = 0; type < OSC_FRAME_NUM_TYPES; type++)
+			if (frame_sub_due(sub, device, type, timestamp))
+				mask |= OSC_FRAME_MASK(type);
+	}
+	g_rec_mutex_unlock(&bus->lock);
+
+	return mask;
+}
+
+/*
+ * A frame to fill in and publish: num_channels buffers of len elements of
+ * elem_size bytes, which frame_bus_frame_bufs() gives out. Returns NULL if
+ * there's no memory for it.
+ */
+struct osc_frame * frame_bus_frame_new(struct frame_bus *bus,
+		enum osc_frame_type type, unsigned int num_channels,
+		unsigned int len, size_t elem_size)
+{
+	size_t chan_size = (size_t)len * elem_size;
+	struct frame_buf *buf;
+	unsigned int i;
+	float **chan;
+	void *mem;
+
+	g_mutex_lock(&bus->pool_lock);
+	buf = bus->pool[type];
+	if (buf) {
+		bus->pool[type] = buf->next;
+		bus->pool_len[type]--;
+	}
+	g_mutex_unlock(&bus->pool_lock);
+
+	if (!buf) {
+		buf = g_new0(struct frame_buf, 1);
+		if (!buf)
+			return NULL;
+	}
+
+	if (buf->size < num_channels * chan_size) {
+		mem = g_try_malloc(num_channels * chan_size);
+		if (!mem) {
+			frame_buf_free(buf);
+			return NULL;
+		}
+		g_free(buf->mem);
+		buf->mem = mem;
+		buf->size = num_channels * chan_size;
+	}
+
+	if (buf->num_chan < num_channels) {
+		chan = g_try_renew(float *, buf->chan, num_channels);
+		if (!chan) {
+			frame_buf_free(buf);
+			return NULL;
+		}
+		buf->chan = chan;
+		buf->num_chan = num_channels;
+	}
+
+	for (i = 0; i < num_channels; i++)
+		buf->chan[i] = (void *)((char *)buf->mem + i * chan_size);
+
+	memset(&buf->frame, 0, sizeof(buf->frame));
+	buf->frame.type = type;
+	buf->frame.num_channels = num_channels;
+	buf->frame.len = len;
+	buf->frame.data = buf->mem;
+	buf->frame.channel = (const float * const *)buf->chan;
+	if (type == OSC_FRAME_MARKERS)
+		buf->frame.markers = buf->mem;
+
+	buf->refs = 1;
+	buf->bus = bus;
+	g_atomic_int_inc(&bus->refs);
+
+	return &buf->frame;
+}
+
+/*
+ * Where the publisher fills in the channels, until the frame is published.
+ * For raw and marker frames, the one buffer isn't floats.
+ */
+float ** frame_bus_frame_bufs(struct osc_frame *frame)
+{
+	return ((struct frame_buf *)frame)->chan;
+}
+
+/*
+ * Hand the frame to every subscription of device that is due for it. The
+ * publisher's reference goes with it, the frame mustn't be touched after.
+ */
+void frame_bus_publish(struct frame_bus *bus, const char *device,
+		struct osc_frame *frame)
+{
+	unsigned int type = frame->type;
+	const struct osc_frame *old;
+	struct frame_sub *sub;
+	GSList *node;
+
+	g_rec_mutex_lock(&bus->lock);
+	bus->publishing++;
+	for (node = bus->subs; node; node = g_slist_next(node)) {
+		sub = node->data;
+		if (!frame_sub_due(sub, device, type, frame->timestamp))
+			continue;
+
+		sub->due[type] = MAX(sub->due[type], frame->timestamp) +
+			sub->interval;
+
+		if (sub->func) {
+			sub->func(frame, sub->user_data);
+			continue;
+		}
+
+		g_mutex_lock(&bus->wait_lock);
+		old = sub->mailbox[type];
+		sub->mailbox[type] = osc_frame_ref(frame);
+		sub->gen[type]++;
+		g_cond_broadcast(&bus->cond);
+		g_mutex_unlock(&bus->wait_lock);
+
+		osc_frame_unref(old);
+	}
+	if (!--bus->publishing && bus->reap)
+		frame_bus_reap(bus);
+	g_rec_mutex_unlock(&bus->lock);
+
+	osc_frame_unref(frame);
+}
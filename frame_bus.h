@@ -0,0 +1,110 @@
+/**
+ * Copyright (C) 2013 Analog Devices, Inc.
+ *
+ * Licensed under the GPL-2.
+ *
+ **/
+
+#ifndef __FRAME_BUS_H__
+#define __FRAME_BUS_H__
+
+#include <stdbool.h>
+#include <glib.h>
+
+struct marker_type;
+
+/*
+ * What a capture turns into, as the plugins see it. A subscriber asks for
+ * any mix of these, as a mask of OSC_FRAME_MASK() bits.
+ */
+enum osc_frame_type {
+	OSC_FRAME_RAW,		/* the interleaved scans, as captured */
+	OSC_FRAME_COOKED,	/* one float array per active channel */
+	OSC_FRAME_SPECTRUM,	/* one dB array per spectrum shown */
+	OSC_FRAME_MARKERS,	/* the markers of the first spectrum */
+	OSC_FRAME_NUM_TYPES,
+};
+
+#define OSC_FRAME_MASK(type)	(1U << (type))
+
+/*
+ * A published frame. It is shared by every subscriber that gets it and
+ * never changes after that, so it is only ever handed out as const. Take
+ * a reference with osc_frame_ref() to keep it past the callback.
+ *
+ * raw:      data is len bytes
+ * cooked:   channel[] is num_channels arrays of len samples
+ * spectrum: channel[] is num_channels arrays of len bins
+ * markers:  markers[] is len markers
+ */
+struct osc_frame {
+	enum osc_frame_type type;
+	unsigned long seq;		/* of the capture it comes from */
+	gint64 timestamp;		/* g_get_monotonic_time() of that */
+
+	unsigned int num_channels;
+	unsigned int len;
+	const void *data;
+	const float * const *channel;
+	const struct marker_type *markers;
+};
+
+/*
+ * Called for every frame the subscription is due for, from the thread
+ * which made it: the capture thread for raw and cooked frames, the GUI
+ * for spectra and markers. It must not block, nor take the GDK lock.
+ * It may subscribe and unsubscribe, any subscription including its own;
+ * one it unsubscribes gets no more frames, and is freed once the publish
+ * is over.
+ */
+typedef void (*osc_frame_func)(const struct osc_frame *frame,
+		void *user_data);
+
+struct frame_bus;
+struct frame_sub;
+struct frame_cancel;
+
+const struct osc_frame * osc_frame_ref(const struct osc_frame *frame);
+void osc_frame_unref(const struct osc_frame *frame);
+
+/*
+ * Publish/subscribe of frames, per device. The frame buffers come out of
+ * a pool kept by the bus and go back to it once the last reference is
+ * gone, so in the steady state nothing is allocated.
+ */
+struct frame_bus * frame_bus_new(void);
+void frame_bus_free(struct frame_bus *bus);
+
+struct frame_sub * frame_bus_subscribe(struct frame_bus *bus,
+		const char *device, unsigned int types, double max_rate,
+		osc_frame_func func, void *user_data);
+void frame_bus_unsubscribe(struct frame_sub *sub);
+void frame_bus_set_types(struct frame_sub *sub, unsigned int types);
+const struct osc_frame * frame_bus_take(struct frame_sub *sub,
+		enum osc_frame_type type);
+int frame_bus_wait(struct frame_sub *sub, enum osc_frame_type type,
+		gint64 after, int timeout_ms, struct frame_cancel *cancel,
+		const struct osc_frame **frame);
+void frame_bus_interrupt(struct frame_bus *bus);
+void frame_bus_interrupt_device(struct frame_bus *bus, const char *device);
+
+/*
+ * Cancellation token for frame_bus_wait(): setting it wakes up, for good,
+ * every wait given that token, until it is reset.
+ */
+struct frame_cancel * frame_cancel_new(struct frame_bus *bus);
+void frame_cancel_free(struct frame_cancel *cancel);
+void frame_cancel_set(struct frame_cancel *cancel);
+void frame_cancel_reset(struct frame_cancel *cancel);
+bool frame_cancel_is_set(const struct frame_cancel *cancel);
+
+unsigned int frame_bus_wanted(struct frame_bus *bus, const char *device,
+		gint64 timestamp);
+struct osc_frame * frame_bus_frame_new(struct frame_bus *bus,
+		enum osc_frame_type type, unsigned int num_channels,
+		unsigned int len, size_t elem_size);
+float ** frame_bus_frame_bufs(struct osc_frame *frame);
+void frame_bus_publish(struct frame_bus *bus, const char *device,
+		struct osc_frame *frame);
+
+#endif
@@ -0,0 +1,163 @@
+/**
+ * Copyright (C) 2013 Analog Devices, Inc.
+ *
+ * Licensed under the GPL-2.
+ *
+ **/
+
+#include <stdint.h>
+#include <glib.h>
+
+#include "frame_ring.h"
+
+/* At least: one slot being written, one published, one being displayed */
+#define FRAME_RING_MIN_FRAMES 3
+
+struct frame_ring * frame_ring_new(unsigned int num_frames, unsigned int frame_size)
+{
+	struct frame_ring *ring;
+	unsigned int i;
+
+	if (num_frames < FRAME_RING_MIN_FRAMES)
+		num_frames = FRAME_RING_MIN_FRAMES;
+
+	ring = g_new0(struct frame_ring, 1);
+	if (!ring)
+		return NULL;
+
+	ring->frames = g_new0(struct frame, num_frames);
+	if (!ring->frames) {
+		g_free(ring);
+		return NULL;
+	}
+
+	ring->num_frames = num_frames;
+	ring->latest = -1;
+	ring->owns_data = frame_size != 0;
+
+	for (i = 0; i < num_frames; i++) {
+		ring->frames[i].block = -1;
+		if (!ring->owns_data)
+			continue;
+		ring->frames[i].data = g_new(int8_t, frame_size);
+		if (!ring->frames[i].data) {
+			frame_ring_free(ring);
+			return NULL;
+		}
+		ring->frames[i].size = frame_size;
+	}
+
+	return ring;
+}
+
+void frame_ring_free(struct frame_ring *ring)
+{
+	unsigned int i;
+
+	if (!ring)
+		return;
+
+	if (ring->owns_data)
+		for (i = 0; i < ring->num_frames; i++)
+			g_free(ring->frames[i].data);
+	g_free(ring->frames);
+	g_free(ring);
+}
+
+/*
+ * Grab a slot for the producer. The newest published frame is never
+ * handed out, so consumers always have something to look at.
+ * Returns NULL (and counts an overrun) if every other slot is busy.
+ */
+struct frame * frame_ring_write_begin(struct frame_ring *ring)
+{
+	gint latest = g_atomic_int_get(&ring->latest);
+	unsigned int i, idx;
+
+	for (i = 1; i <= ring->num_frames; i++) {
+		idx = (latest + i) % ring->num_frames;
+		if ((gint)idx == latest)
+			continue;
+		if (g_atomic_int_compare_and_exchange(&ring->frames[idx].readers, 0, -1)) {
+			if (ring->frames[idx].seq &&
+					!g_atomic_int_get(&ring->frames[idx].picked))
+				g_atomic_int_inc(&ring->drops);
+
+			/* not a valid frame until write_end() */
+			ring->frames[idx].seq = 0;
+			return &ring->frames[idx];
+		}
+	}
+
+	g_atomic_int_inc(&ring->overruns);
+
+	return NULL;
+}
+
+void frame_ring_write_end(struct frame_ring *ring, struct frame *frame)
+{
+	frame->seq = ++ring->seq;
+	frame->timestamp = g_get_monotonic_time();
+	g_atomic_int_set(&frame->picked, 0);
+
+	g_atomic_int_set(&frame->readers, 0);
+	g_atomic_int_set(&ring->latest, frame - ring->frames);
+}
+
+void frame_ring_write_cancel(struct frame_ring *ring, struct frame *frame)
+{
+	g_atomic_int_set(&frame->readers, 0);
+}
+
+/*
+ * Take a reference on the newest frame, if it is newer than *last_seq.
+ * Returns NULL if nothing new has been published since the last call.
+ */
+struct frame * frame_ring_read_latest(struct frame_ring *ring,
+		unsigned long *last_seq)
+{
+	struct frame *frame;
+	gint idx, readers;
+
+	for (;;) {
+		idx = g_atomic_int_get(&ring->latest);
+		if (idx < 0)
+			return NULL;
+
+		frame = &ring->frames[idx];
+		readers = g_atomic_int_get(&frame->readers);
+		if (readers < 0) {
+			/* recycled under our feet, go look again */
+			continue;
+		}
+		if (g_atomic_int_compare_and_exchange(&frame->readers,
+					readers, readers + 1))
+			break;
+	}
+
+	if (last_seq && frame->seq <= *last_seq) {
+		frame_ring_read_end(ring, frame);
+		return NULL;
+	}
+
+	if (last_seq)
+		*last_seq = frame->seq;
+	g_atomic_int_set(&frame->picked, 1);
+
+	return frame;
+}
+
+void frame_ring_read_end(struct frame_ring *ring, struct frame *frame)
+{
+	g_atomic_int_add(&frame->readers, -1);
+}
+
+unsigned int frame_ring_get_overruns(struct frame_ring *ring)
+{
+	return ring ? g_atomic_int_get(&ring->overruns) : 0;
+}
+
+unsigned int frame_ring_get_drops(struct frame_ring *ring)
+{
+	return ring ? g_atomic_int_get(&ring->drops) : 0;
+}
@@ -0,0 +1,68 @@
+/**
+ * Copyright (C) 2013 Analog Devices, Inc.
+ *
+ * Licensed under the GPL-2.
+ *
+ **/
+
+#ifndef __FRAME_RING_H__
+#define __FRAME_RING_H__
+
+#include <glib.h>
+
+/*
+ * A frame is one complete capture (size bytes of raw, interleaved samples).
+ * readers is the ownership word of the slot:
+ *   -1 : the producer is filling the slot
+ *    0 : free (may hold an old, already published frame)
+ *   >0 : number of consumers currently looking at the frame
+ * block is free for the producer to use, e.g. to remember which kernel
+ * block data points into when the ring doesn't own the frame memory.
+ * picked is set once any consumer got the frame.
+ */
+struct frame {
+	void *data;
+	unsigned int size;
+	unsigned long seq;
+	gint64 timestamp;
+	volatile gint readers;
+	volatile gint picked;
+	int block;
+};
+
+/*
+ * Single producer, multiple consumer ring of preallocated frames.
+ * The producer never blocks: if every slot is in use, the frame is counted
+ * as an overrun. Consumers only ever look at the newest published frame;
+ * frames which were published but never picked up by any consumer are
+ * counted as drops, once by the producer when it reuses their slot.
+ * Every published frame carries a g_get_monotonic_time() timestamp taken
+ * when it was completed, so frames from different rings can be matched.
+ * A ring created with a frame_size of zero doesn't own any frame memory,
+ * the producer attaches its own data to each frame.
+ */
+struct frame_ring {
+	struct frame *frames;
+	unsigned int num_frames;
+	gboolean owns_data;
+	volatile gint latest;
+	unsigned long seq;
+	volatile gint overruns;
+	volatile gint drops;
+};
+
+struct frame_ring * frame_ring_new(unsigned int num_frames, unsigned int frame_size);
+void frame_ring_free(struct frame_ring *ring);
+
+struct frame * frame_ring_write_begin(struct frame_ring *ring);
+void frame_ring_write_end(struct frame_ring *ring, struct frame *frame);
+void frame_ring_write_cancel(struct frame_ring *ring, struct frame *frame);
+
+struct frame * frame_ring_read_latest(struct frame_ring *ring,
+		unsigned long *last_seq);
+void frame_ring_read_end(struct frame_ring *ring, struct frame *frame);
+
+unsigned int frame_ring_get_overruns(struct frame_ring *ring);
+unsigned int frame_ring_get_drops(struct frame_ring *ring);
+
+#endif
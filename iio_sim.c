@@ -0,0 +1,485 @@
+/**
+ * Copyright (C) 2013 Analog Devices, Inc.
+ *
+ * Licensed under the GPL-2.
+ *
+ **/
+
+/*
+ * Builds a fake IIO device tree, so osc and the plugins can be started
+ * and benchmarked without hardware:
+ *
+ *   iio_sim /tmp/iio &
+ *   OSC_IIO_ROOT=/tmp/iio osc
+ *
+ * Every device gets a sysfs directory with its attributes and, if it
+ * streams, scan_elements and buffer/ attributes. Its /dev node is a FIFO
+ * which a generator process keeps feeding with a tone on every channel.
+ * debugfs direct_reg_access is a FIFO as well, answered from a register
+ * map held by another process. Attribute files are plain files: writes
+ * stick, but nothing reacts to them.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#define SIM_MAX_ATTRS 16
+/* scans in one period of the generated tone */
+#define SIM_PERIOD 1000
+#define SIM_CYCLES 10
+#define SIM_NUM_REGS 0x10000
+
+struct sim_device {
+	const char *name;
+	unsigned int num_channels;	/* streaming channels, none if 0 */
+	const char *type;		/* scan_elements type of all of them */
+	bool debugfs;
+	const char *attrs[SIM_MAX_ATTRS];	/* "name=value" */
+};
+
+static const struct sim_device sim_devices[] = {
+	{
+		.name = "ad9361-phy",
+		.debugfs = true,
+		.attrs = {
+			"in_voltage_sampling_frequency=30720000",
+			"out_voltage_sampling_frequency=30720000",
+			"in_voltage_rf_bandwidth=18000000",
+			"out_voltage_rf_bandwidth=18000000",
+			"out_altvoltage0_RX_LO_frequency=2400000000",
+			"out_altvoltage1_TX_LO_frequency=2450000000",
+			"in_voltage0_hardwaregain=71.000000 dB",
+			"in_voltage1_hardwaregain=71.000000 dB",
+			"in_voltage0_gain_control_mode=slow_attack",
+			"in_voltage1_gain_control_mode=slow_attack",
+			"in_voltage_gain_control_mode_available=manual fast_attack slow_attack hybrid",
+			"out_voltage0_hardwaregain=-10.000000 dB",
+			"out_voltage1_hardwaregain=-10.000000 dB",
+			"ensm_mode=fdd",
+			"ensm_mode_available=sleep wait alert fdd pinctrl",
+			"calib_mode=auto",
+		},
+	}, {
+		.name = "cf-ad9361-lpc",
+		.num_channels = 4,
+		.type = "le:s12/16>>0",
+		.debugfs = true,
+		.attrs = {
+			"in_voltage_sampling_frequency=30720000",
+		},
+	}, {
+		.name = "cf-ad9361-dds-core-lpc",
+		.debugfs = true,
+		.attrs = {
+			"out_altvoltage0_TX1_I_F1_frequency=1000000",
+			"out_altvoltage0_TX1_I_F1_scale=0.250000",
+			"out_altvoltage0_TX1_I_F1_raw=1",
+		},
+	}, {
+		.name = "cf-ad9643-core-lpc",
+		.num_channels = 2,
+		.type = "le:s14/16>>0",
+		.debugfs = true,
+		.attrs = {
+			"in_voltage_sampling_frequency=250000000",
+			"in_voltage_scale=0.033500",
+			"in_voltage_scale_available=0.033500 0.032000",
+		},
+	}, {
+		.name = "cf-ad9122-core-lpc",
+		.debugfs = true,
+		.attrs = {
+			"out_altvoltage0_1A_frequency=10000000",
+			"out_altvoltage0_1A_scale=0.250000",
+			"out_altvoltage0_1A_raw=1",
+			"out_voltage_sampling_frequency=491520000",
+		},
+	}, {
+		.name = "adf4351-rx-lpc",
+		.attrs = {
+			"out_altvoltage0_frequency=2400000000",
+			"out_altvoltage0_powerdown=0",
+		},
+	}, {
+		.name = "adf4351-tx-lpc",
+		.attrs = {
+			"out_altvoltage0_frequency=2450000000",
+			"out_altvoltage0_powerdown=0",
+		},
+	}, {
+		.name = "ad7476",
+		.num_channels = 1,
+		.type = "be:u12/16>>0",
+		.attrs = {
+			"in_voltage_scale=0.805664",
+		},
+	},
+};
+
+#define NUM_SIM_DEVICES (sizeof(sim_devices) / sizeof(sim_devices[0]))
+
+static int write_file(const char *dir, const char *name, const char *value)
+{
+	char path[512];
+	FILE *f;
+
+	snprintf(path, sizeof(path), "%s/%s", dir, name);
+	f = fopen(path, "w");
+	if (!f) {
+		fprintf(stderr, "Failed to create %s: %s\n", path, strerror(errno));
+		return -errno;
+	}
+	fprintf(f, "%s\n", value);
+	fclose(f);
+
+	return 0;
+}
+
+static int make_dir(const char *path)
+{
+	char tmp[512], *p;
+
+	snprintf(tmp, sizeof(tmp), "%s", path);
+	for (p = tmp + 1; *p; p++) {
+		if (*p != '/')
+			continue;
+		*p = '\0';
+		if (mkdir(tmp, 0755) < 0 && errno != EEXIST)
+			return -errno;
+		*p = '/';
+	}
+	if (mkdir(tmp, 0755) < 0 && errno != EEXIST)
+		return -errno;
+
+	return 0;
+}
+
+static int make_fifo(const char *path)
+{
+	unlink(path);
+	if (mkfifo(path, 0666) < 0) {
+		fprintf(stderr, "Failed to create %s: %s\n", path, strerror(errno));
+		return -errno;
+	}
+
+	return 0;
+}
+
+static int write_all(int fd, const void *data, size_t len)
+{
+	const char *p = data;
+	ssize_t ret;
+
+	while (len) {
+		ret = write(fd, p, len);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			return -errno;
+		}
+		p += ret;
+		len -= ret;
+	}
+
+	return 0;
+}
+
+/*
+ * One period of a tone, I/Q on channel pairs, a bit of noise, stored the
+ * way the scan_elements type says.
+ */
+static void *generate_period(const struct sim_device *dev, size_t *len)
+{
+	unsigned int bits, storage, shift, i, c;
+	char endian[3], sign;
+	uint8_t *data, *p;
+	double amp, phase;
+	int64_t val;
+
+	sscanf(dev->type, "%2s:%c%u/%u>>%u", endian, &sign, &bits, &storage,
+			&shift);
+	storage /= 8;
+	amp = (1 << (bits - 1)) * 0.7;
+
+	*len = SIM_PERIOD * dev->num_channels * storage;
+	data = malloc(*len);
+	if (!data)
+		return NULL;
+
+	p = data;
+	for (i = 0; i < SIM_PERIOD; i++) {
+		for (c = 0; c < dev->num_channels; c++) {
+			phase = 2 * M_PI * SIM_CYCLES * i / SIM_PERIOD;
+			val = amp * ((c & 1) ? sin(phase) : cos(phase)) / (c / 2 + 1);
+			val += rand() % 16 - 8;
+			if (sign == 'u')
+				val += 1 << (bits - 1);
+			val = (uint64_t)(val & ((1ULL << bits) - 1)) << shift;
+
+			if (!strcmp(endian, "be")) {
+				if (storage == 2) {
+					p[0] = val >> 8;
+					p[1] = val;
+				} else {
+					p[0] = val;
+				}
+			} else {
+				memcpy(p, &val, storage);
+			}
+			p += storage;
+		}
+	}
+
+	return data;
+}
+
+/* Keep the buffer node fed, for as many readers as come along */
+static void run_generator(const struct sim_device *dev, const char *fifo)
+{
+	size_t len;
+	void *data;
+	int fd;
+
+	data = generate_period(dev, &len);
+	if (!data)
+		exit(1);
+
+	for (;;) {
+		fd = open(fifo, O_WRONLY);
+		if (fd < 0) {
+			if (errno == EINTR)
+				continue;
+			fprintf(stderr, "Failed to open %s: %s\n", fifo, strerror(errno));
+			exit(1);
+		}
+
+		/* until the reader goes away (EPIPE) */
+		while (!write_all(fd, data, len))
+			;
+		close(fd);
+	}
+}
+
+/*
+ * debugfs direct_reg_access: writing "addr val" sets a register, writing
+ * "addr" selects the one the next read returns.
+ */
+static void run_registers(const char *fifo)
+{
+	unsigned int addr, val, selected = 0;
+	uint32_t *regs;
+	char line[128];
+	FILE *f;
+	int ret;
+
+	regs = calloc(SIM_NUM_REGS, sizeof(*regs));
+	if (!regs)
+		exit(1);
+
+	for (;;) {
+		f = fopen(fifo, "r");
+		if (!f)
+			exit(1);
+		ret = fgets(line, sizeof(line), f) ? sscanf(line, "%i %i",
+				&addr, &val) : 0;
+		fclose(f);
+
+		if (ret == 2) {
+			regs[addr % SIM_NUM_REGS] = val;
+		} else if (ret == 1) {
+			selected = addr % SIM_NUM_REGS;
+			f = fopen(fifo, "w");
+			if (!f)
+				exit(1);
+			fprintf(f, "0x%X\n", regs[selected]);
+			fclose(f);
+		}
+	}
+}
+
+/*
+ * The generator and register processes, and only those, go down with
+ * us: iio_sim usually runs in the background of a script, in the same
+ * process group, which must be left alone.
+ */
+static pid_t sim_children[2 * NUM_SIM_DEVICES];
+static volatile sig_atomic_t num_sim_children;
+
+static void sim_kill_children(void)
+{
+	int i;
+
+	for (i = 0; i < num_sim_children; i++)
+		kill(sim_children[i], SIGTERM);
+}
+
+static void sim_exit(int sig)
+{
+	sim_kill_children();
+	_exit(0);
+}
+
+/* fork() for a child to record, without sim_exit() missing it */
+static pid_t sim_fork(void)
+{
+	sigset_t set, old;
+	pid_t pid;
+
+	sigemptyset(&set);
+	sigaddset(&set, SIGTERM);
+	sigaddset(&set, SIGINT);
+	sigprocmask(SIG_BLOCK, &set, &old);
+
+	pid = fork();
+	if (pid == 0) {
+		signal(SIGTERM, SIG_DFL);
+		signal(SIGINT, SIG_DFL);
+	} else if (pid > 0) {
+		sim_children[num_sim_children] = pid;
+		num_sim_children++;
+	}
+
+	sigprocmask(SIG_SETMASK, &old, NULL);
+	return pid;
+}
+
+static int create_device(const char *root, unsigned int num,
+		const struct sim_device *dev)
+{
+	char dir[384], path[512], name[128], value[128];
+	const char *eq;
+	unsigned int i;
+	pid_t pid;
+	int ret;
+
+	snprintf(dir, sizeof(dir), "%s/sys/bus/iio/devices/iio:device%u", root, num);
+	ret = make_dir(dir);
+	if (ret < 0)
+		return ret;
+
+	ret = write_file(dir, "name", dev->name);
+	if (ret < 0)
+		return ret;
+
+	for (i = 0; i < SIM_MAX_ATTRS && dev->attrs[i]; i++) {
+		eq = strchr(dev->attrs[i], '=');
+		snprintf(name, sizeof(name), "%.*s",
+				(int)(eq - dev->attrs[i]), dev->attrs[i]);
+		ret = write_file(dir, name, eq + 1);
+		if (ret < 0)
+			return ret;
+	}
+
+	if (dev->num_channels) {
+		snprintf(path, sizeof(path), "%s/scan_elements", dir);
+		make_dir(path);
+		for (i = 0; i < dev->num_channels; i++) {
+			snprintf(name, sizeof(name), "in_voltage%u_en", i);
+			write_file(path, name, "1");
+			snprintf(name, sizeof(name), "in_voltage%u_index", i);
+			snprintf(value, sizeof(value), "%u", i);
+			write_file(path, name, value);
+			snprintf(name, sizeof(name), "in_voltage%u_type", i);
+			write_file(path, name, dev->type);
+		}
+
+		snprintf(path, sizeof(path), "%s/buffer", dir);
+		make_dir(path);
+		write_file(path, "length", "4096");
+		write_file(path, "enable", "0");
+		write_file(path, "watermark", "1");
+
+		snprintf(path, sizeof(path), "%s/dev", root);
+		make_dir(path);
+		snprintf(path, sizeof(path), "%s/dev/iio:device%u", root, num);
+		ret = make_fifo(path);
+		if (ret < 0)
+			return ret;
+		pid = sim_fork();
+		if (pid < 0)
+			return -errno;
+		if (pid == 0)
+			run_generator(dev, path);
+	}
+
+	if (dev->debugfs) {
+		snprintf(path, sizeof(path), "%s/sys/kernel/debug/iio/iio:device%u",
+				root, num);
+		make_dir(path);
+		snprintf(path + strlen(path), sizeof(path) - strlen(path),
+				"/direct_reg_access");
+		ret = make_fifo(path);
+		if (ret < 0)
+			return ret;
+		pid = sim_fork();
+		if (pid < 0)
+			return -errno;
+		if (pid == 0)
+			run_registers(path);
+	}
+
+	return 0;
+}
+
+static void usage(const char *program)
+{
+	unsigned int i;
+
+	printf("Usage: %s <root> [device]...\n\n"
+		"Builds a simulated IIO tree under root and keeps it running;\n"
+		"point osc at it with OSC_IIO_ROOT=<root>.\n\n"
+		"Devices (default: all):\n", program);
+	for (i = 0; i < NUM_SIM_DEVICES; i++)
+		printf("\t%s\n", sim_devices[i].name);
+	exit(-1);
+}
+
+int main(int argc, char *argv[])
+{
+	unsigned int i, num = 0;
+	int j, ret;
+	bool want;
+
+	if (argc < 2 || argv[1][0] == '-')
+		usage(argv[0]);
+
+	signal(SIGPIPE, SIG_IGN);
+	/* take the generators down along with us */
+	signal(SIGTERM, sim_exit);
+	signal(SIGINT, sim_exit);
+
+	for (i = 0; i < NUM_SIM_DEVICES; i++) {
+		want = argc == 2;
+		for (j = 2; j < argc; j++)
+			want |= !strcmp(argv[j], sim_devices[i].name);
+		if (!want)
+			continue;
+
+		ret = create_device(argv[1], num, &sim_devices[i]);
+		if (ret < 0) {
+			sim_kill_children();
+			return 1;
+		}
+		printf("iio:device%u: %s\n", num, sim_devices[i].name);
+		num++;
+	}
+
+	if (!num)
+		usage(argv[0]);
+
+	while (wait(NULL) > 0 || errno == EINTR)
+		;
+
+	return 0;
+}
@@ -15,6 +15,8 @@
 #include <stdbool.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
 #include <unistd.h>
 #ifdef IIO_THREADS
 #include <glib/gthread.h>
@@ -24,11 +26,17 @@
 
 #define MAX_STR_LEN		512
 
+const char *iio_dir = "/sys/bus/iio/devices/";
+const char *iio_debug_dir = "/sys/kernel/debug/iio/";
+const char *iio_dev_dir = "/dev/";
+
 #ifndef IIO_THREADS
 # define MAX_THREADS             1
 #else
 # define MAX_THREADS             10
 static GThread *thread_ids[MAX_THREADS];
+/* several capture threads may register at the same time */
+G_LOCK_DEFINE_STATIC(thread_ids);
 #endif
 
 static char dev_dir_name[MAX_THREADS][MAX_STR_LEN];
@@ -57,9 +65,11 @@ static int thread_index()
 	}
 
 	/* No existing threads, so let's see if an empty one exists */
+	G_LOCK(thread_ids);
 	for (i = 0; i < MAX_THREADS; i++) {
 		if (!thread_ids[i]) {
 			thread_ids[i] = t;
+			G_UNLOCK(thread_ids);
 			/* First time, so clear everything */
 			dev_dir_name[i][0] = '\0';
 			buffer_access[i][0] = '\0';
@@ -71,6 +81,8 @@ static int thread_index()
 		}
 	}
 
+	G_UNLOCK(thread_ids);
+
 	printf("Too many threads - sorry\n");
 	exit(0);
 	return 0;
@@ -80,15 +92,44 @@ void iio_thread_clear(GThread *thread)
 {
 	size_t i;
 
+	G_LOCK(thread_ids);
 	for (i = 0; i < MAX_THREADS; i++) {
 		if (thread_ids[i] == thread) {
 			thread_ids[i] = 0;
-			return;
+			break;
 		}
 	}
+	G_UNLOCK(thread_ids);
 }
 #endif
 
+/*
+ * Look for everything under root instead of /, e.g. in a tree built by
+ * iio_sim. Must be called before any paths are set up.
+ */
+int iio_set_root(const char *root)
+{
+	char *dir, *debug_dir, *dev_dir;
+
+	if (asprintf(&dir, "%s/sys/bus/iio/devices/", root) < 0)
+		return -ENOMEM;
+	if (asprintf(&debug_dir, "%s/sys/kernel/debug/iio/", root) < 0) {
+		free(dir);
+		return -ENOMEM;
+	}
+	if (asprintf(&dev_dir, "%s/dev/", root) < 0) {
+		free(dir);
+		free(debug_dir);
+		return -ENOMEM;
+	}
+
+	iio_dir = dir;
+	iio_debug_dir = debug_dir;
+	iio_dev_dir = dev_dir;
+
+	return 0;
+}
+
 const char * dev_name_dir(void) {
 	return dev_dir_name[thread_index()];
 }
@@ -123,8 +164,8 @@ int set_dev_paths(const char *device_name)
 			}
 			snprintf(dev_dir_name[thr], MAX_STR_LEN, "%siio:device%d",
 					iio_dir, dev_num);
-			snprintf(buffer_access[thr], MAX_STR_LEN, "/dev/iio:device%d",
-					dev_num);
+			snprintf(buffer_access[thr], MAX_STR_LEN, "%siio:device%d",
+					iio_dev_dir, dev_num);
 			strcpy(last_device_name[thr], device_name);
 		} else {
 			dev_num = find_type_by_name(device_name, "trigger");
@@ -725,3 +766,155 @@ int iio_buffer_open(bool read, int flags)
 
 	return open(buffer_access[thread_index()], flags);
 }
+
+/*
+ * Block based (mmap) buffer interface, as implemented by the ADI kernel
+ * for the DMA based converter cores. Instead of read()ing into a user
+ * buffer, blocks are dequeued, looked at in place, and handed back.
+ */
+struct iio_block_alloc_req {
+	uint32_t type;
+	uint32_t size;
+	uint32_t count;
+	uint32_t id;
+};
+
+struct iio_block {
+	uint32_t id;
+	uint32_t size;
+	uint32_t bytes_used;
+	uint32_t type;
+	uint32_t flags;
+	uint32_t offset;
+	uint64_t timestamp;
+};
+
+#define IIO_BLOCK_ALLOC_IOCTL	_IOWR('i', 0xa0, struct iio_block_alloc_req)
+#define IIO_BLOCK_FREE_IOCTL	_IO('i', 0xa1)
+#define IIO_BLOCK_QUERY_IOCTL	_IOWR('i', 0xa2, struct iio_block)
+#define IIO_BLOCK_ENQUEUE_IOCTL	_IOWR('i', 0xa3, struct iio_block)
+#define IIO_BLOCK_DEQUEUE_IOCTL	_IOWR('i', 0xa4, struct iio_block)
+
+/*
+ * Must be called before the buffer is enabled. Returns -ENOTTY (or another
+ * negative error code) if the driver doesn't support the block interface,
+ * in which case the caller should fall back to read().
+ */
+int iio_buffer_mmap_init(struct iio_mmap_buffer *mbuf, int fd,
+		unsigned int block_size, unsigned int num_blocks)
+{
+	struct iio_block_alloc_req req;
+	struct iio_block block;
+	unsigned int i;
+	int ret;
+
+	memset(mbuf, 0, sizeof(*mbuf));
+	mbuf->fd = fd;
+
+	memset(&req, 0, sizeof(req));
+	req.size = block_size;
+	req.count = num_blocks;
+
+	ret = ioctl(fd, IIO_BLOCK_ALLOC_IOCTL, &req);
+	if (ret < 0)
+		return -errno;
+
+	mbuf->blocks = calloc(req.count, sizeof(*mbuf->blocks));
+	if (!mbuf->blocks) {
+		ret = -ENOMEM;
+		goto err_free_blocks;
+	}
+
+	for (i = 0; i < req.count; i++) {
+		memset(&block, 0, sizeof(block));
+		block.id = i;
+
+		ret = ioctl(fd, IIO_BLOCK_QUERY_IOCTL, &block);
+		if (ret < 0) {
+			ret = -errno;
+			goto err_unmap;
+		}
+
+		/* the driver may round the size, but it has to be the same for all */
+		if (i == 0) {
+			mbuf->block_size = block.size;
+		} else if (block.size != mbuf->block_size) {
+			ret = -EINVAL;
+			goto err_unmap;
+		}
+
+		mbuf->blocks[i] = mmap(NULL, mbuf->block_size, PROT_READ | PROT_WRITE,
+				MAP_SHARED, fd, block.offset);
+		if (mbuf->blocks[i] == MAP_FAILED) {
+			mbuf->blocks[i] = NULL;
+			ret = -errno;
+			goto err_unmap;
+		}
+		mbuf->num_blocks++;
+
+		ret = iio_buffer_mmap_enqueue(mbuf, i);
+		if (ret < 0)
+			goto err_unmap;
+	}
+
+	return 0;
+
+err_unmap:
+	for (i = 0; i < mbuf->num_blocks; i++)
+		munmap(mbuf->blocks[i], mbuf->block_size);
+	free(mbuf->blocks);
+err_free_blocks:
+	ioctl(fd, IIO_BLOCK_FREE_IOCTL, 0);
+	memset(mbuf, 0, sizeof(*mbuf));
+	mbuf->fd = -1;
+	return ret;
+}
+
+void iio_buffer_mmap_free(struct iio_mmap_buffer *mbuf)
+{
+	unsigned int i;
+
+	if (!mbuf->blocks)
+		return;
+
+	for (i = 0; i < mbuf->num_blocks; i++)
+		munmap(mbuf->blocks[i], mbuf->block_size);
+	free(mbuf->blocks);
+	ioctl(mbuf->fd, IIO_BLOCK_FREE_IOCTL, 0);
+
+	memset(mbuf, 0, sizeof(*mbuf));
+	mbuf->fd = -1;
+}
+
+/* Returns the id of the next filled block, or a negative error code */
+int iio_buffer_mmap_dequeue(struct iio_mmap_buffer *mbuf, unsigned int *bytes_used)
+{
+	struct iio_block block;
+
+	memset(&block, 0, sizeof(block));
+	if (ioctl(mbuf->fd, IIO_BLOCK_DEQUEUE_IOCTL, &block) < 0)
+		return -errno;
+
+	if (block.id >= mbuf->num_blocks)
+		return -EIO;
+
+	if (bytes_used)
+		*bytes_used = block.bytes_used;
+
+	return block.id;
+}
+
+int iio_buffer_mmap_enqueue(struct iio_mmap_buffer *mbuf, unsigned int id)
+{
+	struct iio_block block;
+
+	memset(&block, 0, sizeof(block));
+	block.id = id;
+	block.size = mbuf->block_size;
+	block.bytes_used = mbuf->block_size;
+
+	if (ioctl(mbuf->fd, IIO_BLOCK_ENQUEUE_IOCTL, &block) < 0)
+		return -errno;
+
+	return 0;
+}
@@ -7,6 +7,9 @@
  * the Free Software Foundation.
 */
 
+#ifndef __IIO_UTILS_H__
+#define __IIO_UTILS_H__
+
 /* Made up value to limit allocation sizes */
 #include <string.h>
 #include <stdlib.h>
@@ -25,8 +28,13 @@
 #define ACCESS_NORM 0
 #define ACCESS_DBFS 1
 
-static const char *iio_dir = "/sys/bus/iio/devices/";
-static const char *iio_debug_dir = "/sys/kernel/debug/iio/";
+/*
+ * Where the IIO sysfs and debugfs trees and the buffer device nodes are.
+ * All of them end with a '/'. See iio_set_root().
+ */
+extern const char *iio_dir;
+extern const char *iio_debug_dir;
+extern const char *iio_dev_dir;
 
 /**
  * iioutils_break_up_name() - extract generic name from full channel name
@@ -759,6 +767,7 @@ void iio_thread_clear(GThread *thread);
 #endif
 int read_sysfs_string(const char *filename, const char *basedir, char **str);
 int set_debugfs_paths(const char *device_name);
+int iio_set_root(const char *root);
 int read_reg(unsigned int address);
 int write_reg(unsigned int address, unsigned int val);
 int write_devattr(const char *attr, const char *str);
@@ -772,6 +781,28 @@ int read_devattr_slonglong(const char *attr, long long *value);
 int write_devattr_slonglong(const char *attr, long long value);
 bool iio_devattr_exists(const char *device, const char *attr);
 int iio_buffer_open(bool read, int flags);
+
+/**
+ * struct iio_mmap_buffer - kernel block buffers mapped into user space
+ * @fd: the buffer character device the blocks belong to
+ * @blocks: user space address of each block
+ * @block_size: size of each block in bytes, as the kernel reports it
+ * @num_blocks: number of blocks the kernel actually allocated
+ **/
+struct iio_mmap_buffer {
+	int fd;
+	void **blocks;
+	unsigned int block_size;
+	unsigned int num_blocks;
+};
+
+int iio_buffer_mmap_init(struct iio_mmap_buffer *mbuf, int fd,
+		unsigned int block_size, unsigned int num_blocks);
+void iio_buffer_mmap_free(struct iio_mmap_buffer *mbuf);
+int iio_buffer_mmap_dequeue(struct iio_mmap_buffer *mbuf, unsigned int *bytes_used);
+int iio_buffer_mmap_enqueue(struct iio_mmap_buffer *mbuf, unsigned int id);
 int find_scan_elements(char *dev, char **elements, unsigned access);
 void scan_elements_sort(char **elements);
 void scan_elements_insert(char **elements, char *token, char *end);
+
+#endif
@@ -1,444 +1,709 @@
-/*      fix_fft.c - Fixed-point Fast Fourier Transform  */
-/*
-        fix_fft()       perform FFT or inverse FFT
-        window()        applies a Hanning window to the (time) input
-        fix_loud()      calculates the loudness of the signal, for
-                        each freq point. Result is an integer array,
-                        units are dB (values will be negative).
-        iscale()        scale an integer value by (numer/denom).
-        fix_mpy()       perform fixed-point multiplication.
-        Sinewave[1024]  sinewave normalized to 32767 (= 1.0).
-        Loudampl[100]   Amplitudes for lopudnesses from 0 to -99 dB.
-        Low_pass        Low-pass filter, cutoff at sample_freq / 4.
-
-
-        All data are fixed-point short integers, in which
-        -32768 to +32768 represent -1.0 to +1.0. Integer arithmetic
-        is used for speed, instead of the more natural floating-point.
-
-        For the forward FFT (time -> freq), fixed scaling is
-        performed to prevent arithmetic overflow, and to map a 0dB
-        sine/cosine wave (i.e. amplitude = 32767) to two -6dB freq
-        coefficients; the one in the lower half is reported as 0dB
-        by fix_loud(). The return value is always 0.
-
-        For the inverse FFT (freq -> time), fixed scaling cannot be
-        done, as two 0dB coefficients would sum to a peak amplitude of
-        64K, overflowing the 32k range of the fixed-point integers.
-        Thus, the fix_fft() routine performs variable scaling, and
-        returns a value which is the number of bits LEFT by which
-        the output must be shifted to get the actual amplitude
-        (i.e. if fix_fft() returns 3, each value of fr[] and fi[]
-        must be multiplied by 8 (2**3) for proper scaling.
-        Clearly, this cannot be done within the fixed-point short
-        integers. In practice, if the result is to be used as a
-        filter, the scale_shift can usually be ignored, as the
-        result will be approximately correctly normalized as is.
-
-
-        TURBO C, any memory model; uses inline assembly for speed
-        and for carefully-scaled arithmetic.
-
-        Written by:  Tom Roberts  11/8/89
-        Made portable:  Malcolm Slaney 12/15/94 malcolm@interval.com
-
-                Timing on a Macintosh PowerBook 180.... (using Symantec C6.0)
-                        fix_fft (1024 points)             8 ticks
-                        fft (1024 points - Using SANE)  112 Ticks
-                        fft (1024 points - Using FPU)    11
-
-*/
-
-#undef  MAIN
-
-/* FIX_MPY() - fixed-point multiplication macro.
-   This macro is a statement, not an expression (uses asm).
-   BEWARE: make sure _DX is not clobbered by evaluating (A) or DEST.
-   args are all of type fixed.
-   Scaling ensures that 32767*32767 = 32767. */
-#define dosFIX_MPY(DEST,A,B)       {       \
-        _DX = (B);                      \
-        _AX = (A);                      \
-        asm imul dx;                    \
-        asm add ax,ax;                  \
-        asm adc dx,dx;                  \
-        DEST = _DX;             }
-
-#define FIX_MPY(DEST,A,B)       DEST = ((long)(A) * (long)(B))>>15
-
-#define N_WAVE          1024	/* dimension of Sinewave[] */
-#define LOG2_N_WAVE     10	/* log2(N_WAVE) */
-#define N_LOUD          100	/* dimension of Loudampl[] */
-#ifndef fixed
-#define fixed short
+/**
+ * Copyright (C) 2013 Analog Devices, Inc.
+ *
+ * Licensed under the GPL-2.
+ *
+ **/
+
+#include <errno.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON__) || defined(__ARM_NEON)
+#include <arm_neon.h>
+#define HAVE_NEON 1
 #endif
 
-extern fixed Sinewave[N_WAVE];	/* placed at end of this file for clarity */
-extern fixed Loudampl[N_LOUD];
-int db_from_ampl (fixed re, fixed im);
-fixed fix_mpy (fixed a, fixed b);
+#include "int_fft.h"
 
 /*
-        fix_fft() - perform fast Fourier transform.
-
-        if n>0 FFT is done, if n<0 inverse FFT is done
-        fr[n],fi[n] are real,imaginary arrays, INPUT AND RESULT.
-        size of data = 2**m
-        set inverse to 0=dft, 1=idft
-*/
-int
-fix_fft (fixed fr[], fixed fi[], int m, int inverse)
+ * The largest sample a stage takes without overflowing: a radix-4
+ * butterfly adds four samples up and its twiddle can turn the sum by 45
+ * degrees, 4 * sqrt(2) in all. The radix-2 one only doubles.
+ */
+#define RADIX4_MAX	5792
+#define RADIX2_MAX	16383
+
+static double win_hanning(int j, int n)
 {
-  int mr, nn, i, j, l, k, istep, n, scale, shift;
-  fixed qr, qi, tr, ti, wr, wi;
+	double a = 2.0*M_PI/(n-1), w;
 
-  n = 1 << m;
+	w = 0.5 * (1.0 - cos(a*j));
 
-  if (n > N_WAVE)
-    return -1;
+	return (w);
+}
 
-  mr = 0;
-  nn = n - 1;
-  scale = 0;
+void int_fft_free(struct int_fft *f)
+{
+	free(f->win);
+	free(f->twiddle);
+	free(f->split);
+	memset(f, 0, sizeof(*f));
+}
 
-  /* decimation in time - re-order data */
-  for (m = 1; m <= nn; ++m)
-    {
-      l = n;
-      do
-	{
-	  l >>= 1;
+int int_fft_setup(struct int_fft *f, unsigned int size, bool complex)
+{
+	unsigned int i, k, p, m, len, n = complex ? size : size / 2;
+	unsigned int num_win = complex ? 2 * size : size;
+	int16_t *tw;
+	double a;
+
+	memset(f, 0, sizeof(*f));
+
+	if (n < 4 || (n & (n - 1)))
+		return -EINVAL;
+
+	f->win = malloc(sizeof(*f->win) * num_win);
+	f->twiddle = malloc(sizeof(*f->twiddle) * 2 * n);
+	if (!complex)
+		f->split = malloc(sizeof(*f->split) * 2 * n);
+	if (!f->win || !f->twiddle || (!complex && !f->split)) {
+		int_fft_free(f);
+		return -ENOMEM;
 	}
-      while (mr + l > nn);
-      mr = (mr & (l - 1)) + l;
-
-      if (mr <= m)
-	continue;
-      tr = fr[m];
-      fr[m] = fr[mr];
-      fr[mr] = tr;
-      ti = fi[m];
-      fi[m] = fi[mr];
-      fi[mr] = ti;
-    }
-
-  l = 1;
-  k = LOG2_N_WAVE - 1;
-  while (l < n)
-    {
-      if (inverse)
-	{
-	  /* variable scaling, depending upon data */
-	  shift = 0;
-	  for (i = 0; i < n; ++i)
-	    {
-	      j = fr[i];
-	      if (j < 0)
-		j = -j;
-	      m = fi[i];
-	      if (m < 0)
-		m = -m;
-	      if (j > 16383 || m > 16383)
-		{
-		  shift = 1;
-		  break;
+
+	/* I and Q each get their own entry */
+	for (i = 0; i < num_win; i++)
+		f->win[i] = lrint(32767 * win_hanning(complex ? i / 2 : i, size));
+
+	/*
+	 * A stage of len points has m = len / 4 of each of W^p, W^2p and
+	 * W^3p, W = exp(-j 2 pi / len), the real parts then the imaginary
+	 * ones. Next stage right after.
+	 */
+	tw = f->twiddle;
+	for (len = n; len >= 4; len /= 4) {
+		m = len / 4;
+		for (k = 1; k <= 3; k++) {
+			for (p = 0; p < m; p++) {
+				a = -2 * M_PI * k * p / len;
+				tw[p] = lrint(32767 * cos(a));
+				tw[m + p] = lrint(32767 * sin(a));
+			}
+			tw += 2 * m;
 		}
-	    }
-	  if (shift)
-	    ++scale;
 	}
-      else
-	{
-	  /* fixed scaling, for proper normalization -
-	     there will be log2(n) passes, so this
-	     results in an overall factor of 1/n,
-	     distributed to maximize arithmetic accuracy. */
-	  shift = 1;
-	}
-      /* it may not be obvious, but the shift will be performed
-         on each data point exactly once, during this pass. */
-      istep = l << 1;
-      for (m = 0; m < l; ++m)
-	{
-	  j = m << k;
-	  /* 0 <= j < N_WAVE/2 */
-	  wr = Sinewave[j + N_WAVE / 4];
-	  wi = -Sinewave[j];
-	  if (inverse)
-	    wi = -wi;
-	  if (shift)
-	    {
-	      wr >>= 1;
-	      wi >>= 1;
-	    }
-	  for (i = m; i < n; i += istep)
-	    {
-	      j = i + l;
-	      tr = fix_mpy (wr, fr[j]) - fix_mpy (wi, fi[j]);
-	      ti = fix_mpy (wr, fi[j]) + fix_mpy (wi, fr[j]);
-	      qr = fr[i];
-	      qi = fi[i];
-	      if (shift)
-		{
-		  qr >>= 1;
-		  qi >>= 1;
+
+	if (!complex) {
+		for (k = 0; k < n; k++) {
+			f->split[2 * k] = cos(M_PI * k / n);
+			f->split[2 * k + 1] = -sin(M_PI * k / n);
 		}
-	      fr[j] = qr - tr;
-	      fi[j] = qi - ti;
-	      fr[i] = qr + tr;
-	      fi[i] = qi + ti;
-	    }
 	}
-      --k;
-      l = istep;
-    }
 
-  return scale;
+	f->size = size;
+	f->complex = complex;
+	f->n = n;
+
+	return 0;
 }
 
+/* The shift, rounding, that takes max down to lim */
+static int int_fft_shift(int max, int lim)
+{
+	int sh = 0;
+
+	while (((max + ((1 << sh) >> 1)) >> sh) > lim)
+		sh++;
+
+	return sh;
+}
 
-/*      window() - apply a Hanning window       */
-void
-window (fixed fr[], int n)
+static inline int q15_mul(int v, int w)
 {
-  int i, j, k;
-
-  j = N_WAVE / n;
-  n >>= 1;
-  for (i = 0, k = N_WAVE / 4; i < n; ++i, k += j)
-    FIX_MPY (fr[i], fr[i], 16384 - (Sinewave[k] >> 1));
-  n <<= 1;
-  for (k -= j; i < n; ++i, k -= j)
-    FIX_MPY (fr[i], fr[i], 16384 - (Sinewave[k] >> 1));
+	return (v * w + 0x4000) >> 15;
 }
 
-/*      fix_loud() - compute loudness of freq-spectrum components.
-        n should be ntot/2, where ntot was passed to fix_fft();
-        6 dB is added to account for the omitted alias components.
-        scale_shift should be the result of fix_fft(), if the time-series
-        was obtained from an inverse FFT, 0 otherwise.
-        loud[] is the loudness, in dB wrt 32767; will be +10 to -N_LOUD.
-*/
-void
-fix_loud (fixed loud[], fixed fr[], fixed fi[], int n, int scale_shift)
+static inline int max_abs(int max, int v)
 {
-  int i, max;
-
-  max = 0;
-  if (scale_shift > 0)
-    max = 10;
-  scale_shift = (scale_shift + 1) * 6;
-
-  for (i = 0; i < n; ++i)
-    {
-      loud[i] = db_from_ampl (fr[i], fi[i]) + scale_shift;
-      if (loud[i] > max)
-	loud[i] = max;
-    }
+	if (v < 0)
+		v = -v;
+
+	return v > max ? v : max;
 }
 
-/*      db_from_ampl() - find loudness (in dB) from
-        the complex amplitude.
-*/
-int
-db_from_ampl (fixed re, fixed im)
+#if defined(__SSE2__)
+/* Complex samples as I/Q pairs of int16, four to a vector */
+static inline int max_abs_epi16(int max, __m128i vmax, __m128i vmin)
 {
-  static long loud2[N_LOUD] = { 0 };
-  long v;
-  int i;
-
-  if (loud2[0] == 0)
-    {
-      loud2[0] = (long) Loudampl[0] * (long) Loudampl[0];
-      for (i = 1; i < N_LOUD; ++i)
-	{
-	  v = (long) Loudampl[i] * (long) Loudampl[i];
-	  loud2[i] = v;
-	  loud2[i - 1] = (loud2[i - 1] + v) / 2;
+	int16_t hi[8], lo[8];
+	unsigned int i;
+
+	_mm_storeu_si128((__m128i *)hi, vmax);
+	_mm_storeu_si128((__m128i *)lo, vmin);
+	for (i = 0; i < 8; i++) {
+		max = max_abs(max, hi[i]);
+		max = max_abs(max, lo[i]);
 	}
-    }
 
-  v = (long) re *(long) re + (long) im *(long) im;
+	return max;
+}
 
-  for (i = 0; i < N_LOUD; ++i)
-    if (loud2[i] <= v)
-      break;
+/* (v + 2^(sh - 1)) >> sh without overflowing, for sh > 0 */
+static inline __m128i round_shift_epi16(__m128i v, __m128i sh, __m128i sh1)
+{
+	return _mm_add_epi16(_mm_sra_epi16(v, sh), _mm_and_si128(
+				_mm_sra_epi16(v, sh1), _mm_set1_epi16(1)));
+}
+
+/* wa is (wr, -wi), wb (wi, wr) for each sample */
+static inline __m128i cmul_epi16(__m128i x, __m128i wa, __m128i wb)
+{
+	const __m128i rnd = _mm_set1_epi32(0x4000);
+	__m128i re, im;
+
+	re = _mm_srai_epi32(_mm_add_epi32(_mm_madd_epi16(x, wa), rnd), 15);
+	im = _mm_srai_epi32(_mm_add_epi32(_mm_madd_epi16(x, wb), rnd), 15);
 
-  return (-i);
+	return _mm_or_si128(_mm_and_si128(re, _mm_set1_epi32(0xffff)),
+			_mm_slli_epi32(im, 16));
 }
 
-/*
-        fix_mpy() - fixed-point multiplication
-*/
-fixed
-fix_mpy (fixed a, fixed b)
+static inline __m128i twiddle_epi32(int lo, int hi)
+{
+	return _mm_set1_epi32((uint16_t)lo | (uint32_t)(uint16_t)hi << 16);
+}
+
+/* w: wa, wb of W^p, W^2p, W^3p */
+static inline void bfly4_epi16(__m128i a, __m128i b, __m128i c, __m128i d,
+		const __m128i *w, __m128i *y)
+{
+	const __m128i neg_q = _mm_set1_epi32(0xffff0000);
+	__m128i apc, amc, bpd, bmd;
+
+	apc = _mm_add_epi16(a, c);
+	amc = _mm_sub_epi16(a, c);
+	bpd = _mm_add_epi16(b, d);
+	bmd = _mm_sub_epi16(b, d);
+
+	/* -j (b - d) */
+	bmd = _mm_shufflehi_epi16(_mm_shufflelo_epi16(bmd,
+				_MM_SHUFFLE(2, 3, 0, 1)), _MM_SHUFFLE(2, 3, 0, 1));
+	bmd = _mm_sub_epi16(_mm_xor_si128(bmd, neg_q), neg_q);
+
+	y[0] = _mm_add_epi16(apc, bpd);
+	y[1] = cmul_epi16(_mm_add_epi16(amc, bmd), w[0], w[1]);
+	y[2] = cmul_epi16(_mm_sub_epi16(apc, bpd), w[2], w[3]);
+	y[3] = cmul_epi16(_mm_sub_epi16(amc, bmd), w[4], w[5]);
+}
+#elif HAVE_NEON
+/* Complex samples as I and Q vectors, four to a pair */
+static inline int max_abs_s16(int max, int16x4_t vmax, int16x4_t vmin)
+{
+	int16_t hi[4], lo[4];
+	unsigned int i;
+
+	vst1_s16(hi, vmax);
+	vst1_s16(lo, vmin);
+	for (i = 0; i < 4; i++) {
+		max = max_abs(max, hi[i]);
+		max = max_abs(max, lo[i]);
+	}
+
+	return max;
+}
+
+static inline int16x4x2_t cmul_s16(int16x4x2_t x, int16x4_t wr,
+		int16x4_t wi)
 {
-  FIX_MPY (a, a, b);
-  return a;
+	int16x4x2_t y;
+
+	y.val[0] = vrshrn_n_s32(vmlsl_s16(vmull_s16(x.val[0], wr),
+				x.val[1], wi), 15);
+	y.val[1] = vrshrn_n_s32(vmlal_s16(vmull_s16(x.val[0], wi),
+				x.val[1], wr), 15);
+
+	return y;
+}
+
+/* w: wr, wi of W^p, W^2p, W^3p */
+static inline void bfly4_s16(int16x4x2_t a, int16x4x2_t b, int16x4x2_t c,
+		int16x4x2_t d, const int16x4_t *w, int16x4x2_t *y)
+{
+	int16x4x2_t apc, amc, bpd, bmd, t;
+
+	apc.val[0] = vadd_s16(a.val[0], c.val[0]);
+	apc.val[1] = vadd_s16(a.val[1], c.val[1]);
+	amc.val[0] = vsub_s16(a.val[0], c.val[0]);
+	amc.val[1] = vsub_s16(a.val[1], c.val[1]);
+	bpd.val[0] = vadd_s16(b.val[0], d.val[0]);
+	bpd.val[1] = vadd_s16(b.val[1], d.val[1]);
+	bmd.val[0] = vsub_s16(b.val[0], d.val[0]);
+	bmd.val[1] = vsub_s16(b.val[1], d.val[1]);
+
+	y[0].val[0] = vadd_s16(apc.val[0], bpd.val[0]);
+	y[0].val[1] = vadd_s16(apc.val[1], bpd.val[1]);
+
+	t.val[0] = vadd_s16(amc.val[0], bmd.val[1]);
+	t.val[1] = vsub_s16(amc.val[1], bmd.val[0]);
+	y[1] = cmul_s16(t, w[0], w[1]);
+
+	t.val[0] = vsub_s16(apc.val[0], bpd.val[0]);
+	t.val[1] = vsub_s16(apc.val[1], bpd.val[1]);
+	y[2] = cmul_s16(t, w[2], w[3]);
+
+	t.val[0] = vsub_s16(amc.val[0], bmd.val[1]);
+	t.val[1] = vadd_s16(amc.val[1], bmd.val[0]);
+	y[3] = cmul_s16(t, w[4], w[5]);
+}
+
+static inline int16x4x2_t round_shift_s16(int16x4x2_t v, int16x4_t sh)
+{
+	v.val[0] = vrshl_s16(v.val[0], sh);
+	v.val[1] = vrshl_s16(v.val[1], sh);
+
+	return v;
 }
+#endif
 
 /*
-        iscale() - scale an integer value by (numer/denom)
-*/
-int
-iscale (int value, int numer, int denom)
+ * Window the samples into x, the largest magnitude is returned. Real
+ * samples simply go in a row, which makes the even ones I and the odd
+ * ones Q.
+ */
+static int int_fft_load(const struct int_fft *f, const int16_t *data,
+		unsigned int stride, int16_t *x)
 {
-#ifdef  DOS
-  asm mov ax, value
-    asm imul WORD PTR numer asm idiv WORD PTR denom return _AX;
-#else
-  return (long) value *(long) numer / (long) denom;
+	unsigned int i = 0, num = 2 * f->n;
+	int max = 0;
+
+	if (stride == (f->complex ? 2 : 1)) {
+#if defined(__SSE2__)
+		const __m128i rnd = _mm_set1_epi32(0x4000);
+		__m128i d, w, lo, hi, vmax, vmin;
+
+		vmax = vmin = _mm_setzero_si128();
+		for (; i + 8 <= num; i += 8) {
+			d = _mm_loadu_si128((const __m128i *)(data + i));
+			w = _mm_loadu_si128((const __m128i *)(f->win + i));
+			lo = _mm_mullo_epi16(d, w);
+			hi = _mm_mulhi_epi16(d, w);
+			d = _mm_packs_epi32(
+				_mm_srai_epi32(_mm_add_epi32(
+					_mm_unpacklo_epi16(lo, hi), rnd), 15),
+				_mm_srai_epi32(_mm_add_epi32(
+					_mm_unpackhi_epi16(lo, hi), rnd), 15));
+			_mm_storeu_si128((__m128i *)(x + i), d);
+			vmax = _mm_max_epi16(vmax, d);
+			vmin = _mm_min_epi16(vmin, d);
+		}
+		max = max_abs_epi16(max, vmax, vmin);
+#elif HAVE_NEON
+		int16x8_t d, vmax, vmin;
+
+		vmax = vmin = vdupq_n_s16(0);
+		for (; i + 8 <= num; i += 8) {
+			d = vqrdmulhq_s16(vld1q_s16(data + i),
+					vld1q_s16(f->win + i));
+			vst1q_s16(x + i, d);
+			vmax = vmaxq_s16(vmax, d);
+			vmin = vminq_s16(vmin, d);
+		}
+		max = max_abs_s16(max, vmax_s16(vget_low_s16(vmax),
+					vget_high_s16(vmax)),
+				vmin_s16(vget_low_s16(vmin),
+					vget_high_s16(vmin)));
 #endif
+		for (; i < num; i++) {
+			x[i] = q15_mul(data[i], f->win[i]);
+			max = max_abs(max, x[i]);
+		}
+	} else if (f->complex) {
+		for (; i < num; i += 2, data += stride) {
+			x[i] = q15_mul(data[0], f->win[i]);
+			x[i + 1] = q15_mul(data[1], f->win[i + 1]);
+			max = max_abs(max, x[i]);
+			max = max_abs(max, x[i + 1]);
+		}
+	} else {
+		for (; i < num; i++, data += stride) {
+			x[i] = q15_mul(data[0], f->win[i]);
+			max = max_abs(max, x[i]);
+		}
+	}
+
+	return max;
+}
+
+/*
+ * One radix-4 stage of len points, s of them interleaved: x[q + s (p +
+ * k m)] go into y[q + s (4p + k)], m = len / 4. The input is shifted down
+ * by sh first, the largest magnitude put out is returned.
+ */
+static int stage4_c(const int16_t *x, int16_t *y, unsigned int len,
+		unsigned int s, const int16_t *tw, int sh)
+{
+	unsigned int m = len / 4, p, q, i, o, k;
+	int r = (1 << sh) >> 1, max = 0;
+	int a[2], b[2], c[2], d[2], t[4][2], wr, wi;
+
+	for (p = 0; p < m; p++) {
+		for (q = 0; q < s; q++) {
+			i = 2 * (q + s * p);
+			for (k = 0; k < 2; k++) {
+				a[k] = (x[i + k] + r) >> sh;
+				b[k] = (x[i + 2 * s * m + k] + r) >> sh;
+				c[k] = (x[i + 4 * s * m + k] + r) >> sh;
+				d[k] = (x[i + 6 * s * m + k] + r) >> sh;
+			}
+
+			t[0][0] = a[0] + c[0] + b[0] + d[0];
+			t[0][1] = a[1] + c[1] + b[1] + d[1];
+			t[1][0] = a[0] - c[0] + b[1] - d[1];
+			t[1][1] = a[1] - c[1] - b[0] + d[0];
+			t[2][0] = a[0] + c[0] - b[0] - d[0];
+			t[2][1] = a[1] + c[1] - b[1] - d[1];
+			t[3][0] = a[0] - c[0] - b[1] + d[1];
+			t[3][1] = a[1] - c[1] + b[0] - d[0];
+
+			o = 2 * (q + s * 4 * p);
+			for (k = 0; k < 4; k++, o += 2 * s) {
+				if (k) {
+					wr = tw[2 * (k - 1) * m + p];
+					wi = tw[(2 * k - 1) * m + p];
+					y[o] = (t[k][0] * wr - t[k][1] * wi +
+							0x4000) >> 15;
+					y[o + 1] = (t[k][0] * wi + t[k][1] * wr +
+							0x4000) >> 15;
+				} else {
+					y[o] = t[k][0];
+					y[o + 1] = t[k][1];
+				}
+				max = max_abs(max, y[o]);
+				max = max_abs(max, y[o + 1]);
+			}
+		}
+	}
+
+	return max;
+}
+
+#if defined(__SSE2__)
+/* The same, four values of q at a time, s a multiple of 4 */
+static int stage4_q(const int16_t *x, int16_t *y, unsigned int len,
+		unsigned int s, const int16_t *tw, int sh)
+{
+	unsigned int m = len / 4, p, q, k;
+	const __m128i vsh = _mm_cvtsi32_si128(sh);
+	const __m128i vsh1 = _mm_cvtsi32_si128(sh - 1);
+	__m128i v[4], w[6], vmax, vmin;
+	int wr, wi;
+
+	vmax = vmin = _mm_setzero_si128();
+	for (p = 0; p < m; p++) {
+		for (k = 0; k < 3; k++) {
+			wr = tw[2 * k * m + p];
+			wi = tw[(2 * k + 1) * m + p];
+			w[2 * k] = twiddle_epi32(wr, -wi);
+			w[2 * k + 1] = twiddle_epi32(wi, wr);
+		}
+
+		for (q = 0; q < s; q += 4) {
+			for (k = 0; k < 4; k++) {
+				v[k] = _mm_loadu_si128((const __m128i *)
+						(x + 2 * (q + s * (p + k * m))));
+				if (sh)
+					v[k] = round_shift_epi16(v[k], vsh, vsh1);
+			}
+
+			bfly4_epi16(v[0], v[1], v[2], v[3], w, v);
+
+			for (k = 0; k < 4; k++) {
+				_mm_storeu_si128((__m128i *)
+						(y + 2 * (q + s * (4 * p + k))), v[k]);
+				vmax = _mm_max_epi16(vmax, v[k]);
+				vmin = _mm_min_epi16(vmin, v[k]);
+			}
+		}
+	}
+
+	return max_abs_epi16(0, vmax, vmin);
+}
+
+/*
+ * The first stage, s = 1, four values of p at a time: each p puts out
+ * four samples in a row, so they are transposed on the way out.
+ */
+static int stage4_p(const int16_t *x, int16_t *y, unsigned int len,
+		const int16_t *tw, int sh)
+{
+	unsigned int m = len / 4, p, k;
+	const __m128i vsh = _mm_cvtsi32_si128(sh);
+	const __m128i vsh1 = _mm_cvtsi32_si128(sh - 1);
+	__m128i v[4], w[6], t[4], wr, wi, vmax, vmin;
+
+	vmax = vmin = _mm_setzero_si128();
+	for (p = 0; p < m; p += 4) {
+		for (k = 0; k < 4; k++) {
+			v[k] = _mm_loadu_si128((const __m128i *)
+					(x + 2 * (p + k * m)));
+			if (sh)
+				v[k] = round_shift_epi16(v[k], vsh, vsh1);
+		}
+
+		for (k = 0; k < 3; k++) {
+			wr = _mm_loadl_epi64((const __m128i *)
+					(tw + 2 * k * m + p));
+			wi = _mm_loadl_epi64((const __m128i *)
+					(tw + (2 * k + 1) * m + p));
+			w[2 * k] = _mm_unpacklo_epi16(wr,
+					_mm_sub_epi16(_mm_setzero_si128(), wi));
+			w[2 * k + 1] = _mm_unpacklo_epi16(wi, wr);
+		}
+
+		bfly4_epi16(v[0], v[1], v[2], v[3], w, v);
+
+		for (k = 0; k < 4; k++) {
+			vmax = _mm_max_epi16(vmax, v[k]);
+			vmin = _mm_min_epi16(vmin, v[k]);
+		}
+
+		t[0] = _mm_unpacklo_epi32(v[0], v[1]);
+		t[1] = _mm_unpacklo_epi32(v[2], v[3]);
+		t[2] = _mm_unpackhi_epi32(v[0], v[1]);
+		t[3] = _mm_unpackhi_epi32(v[2], v[3]);
+		_mm_storeu_si128((__m128i *)(y + 8 * p),
+				_mm_unpacklo_epi64(t[0], t[1]));
+		_mm_storeu_si128((__m128i *)(y + 8 * p + 8),
+				_mm_unpackhi_epi64(t[0], t[1]));
+		_mm_storeu_si128((__m128i *)(y + 8 * p + 16),
+				_mm_unpacklo_epi64(t[2], t[3]));
+		_mm_storeu_si128((__m128i *)(y + 8 * p + 24),
+				_mm_unpackhi_epi64(t[2], t[3]));
+	}
+
+	return max_abs_epi16(0, vmax, vmin);
 }
+#elif HAVE_NEON
+static int stage4_q(const int16_t *x, int16_t *y, unsigned int len,
+		unsigned int s, const int16_t *tw, int sh)
+{
+	unsigned int m = len / 4, p, q, k;
+	const int16x4_t vsh = vdup_n_s16(-sh);
+	int16x4_t w[6], vmax, vmin;
+	int16x4x2_t v[4];
+
+	vmax = vmin = vdup_n_s16(0);
+	for (p = 0; p < m; p++) {
+		for (k = 0; k < 6; k++)
+			w[k] = vdup_n_s16(tw[k * m + p]);
+
+		for (q = 0; q < s; q += 4) {
+			for (k = 0; k < 4; k++) {
+				v[k] = vld2_s16(x + 2 * (q + s * (p + k * m)));
+				if (sh)
+					v[k] = round_shift_s16(v[k], vsh);
+			}
+
+			bfly4_s16(v[0], v[1], v[2], v[3], w, v);
+
+			for (k = 0; k < 4; k++) {
+				vst2_s16(y + 2 * (q + s * (4 * p + k)), v[k]);
+				vmax = vmax_s16(vmax, vmax_s16(v[k].val[0],
+							v[k].val[1]));
+				vmin = vmin_s16(vmin, vmin_s16(v[k].val[0],
+							v[k].val[1]));
+			}
+		}
+	}
+
+	return max_abs_s16(0, vmax, vmin);
+}
+
+static int stage4_p(const int16_t *x, int16_t *y, unsigned int len,
+		const int16_t *tw, int sh)
+{
+	unsigned int m = len / 4, p, k;
+	const int16x4_t vsh = vdup_n_s16(-sh);
+	int16x4_t w[6], vmax, vmin;
+	int16x4x2_t v[4], z[4];
+	int32x2x4_t out;
+
+	vmax = vmin = vdup_n_s16(0);
+	for (p = 0; p < m; p += 4) {
+		for (k = 0; k < 4; k++) {
+			v[k] = vld2_s16(x + 2 * (p + k * m));
+			if (sh)
+				v[k] = round_shift_s16(v[k], vsh);
+		}
+
+		for (k = 0; k < 6; k++)
+			w[k] = vld1_s16(tw + k * m + p);
+
+		bfly4_s16(v[0], v[1], v[2], v[3], w, v);
+
+		for (k = 0; k < 4; k++) {
+			vmax = vmax_s16(vmax, vmax_s16(v[k].val[0], v[k].val[1]));
+			vmin = vmin_s16(vmin, vmin_s16(v[k].val[0], v[k].val[1]));
+			z[k] = vzip_s16(v[k].val[0], v[k].val[1]);
+		}
+
+		for (k = 0; k < 4; k++)
+			out.val[k] = vreinterpret_s32_s16(z[k].val[0]);
+		vst4_s32((int32_t *)(y + 8 * p), out);
+		for (k = 0; k < 4; k++)
+			out.val[k] = vreinterpret_s32_s16(z[k].val[1]);
+		vst4_s32((int32_t *)(y + 8 * p + 16), out);
+	}
+
+	return max_abs_s16(0, vmax, vmin);
+}
+#endif
 
-#if N_WAVE != 1024
-ERROR:N_WAVE != 1024
+static int int_fft_stage4(const int16_t *x, int16_t *y, unsigned int len,
+		unsigned int s, const int16_t *tw, int sh)
+{
+#if defined(__SSE2__) || HAVE_NEON
+	if (s % 4 == 0)
+		return stage4_q(x, y, len, s, tw, sh);
+	if (s == 1 && len % 16 == 0)
+		return stage4_p(x, y, len, tw, sh);
 #endif
-  fixed Sinewave[1024] =
+	return stage4_c(x, y, len, s, tw, sh);
+}
+
+/* The last stage for odd powers of two: x[q], x[q + s] to y[q], y[q + s] */
+static void int_fft_stage2(const int16_t *x, int16_t *y, unsigned int s,
+		int sh)
 {
-0, 201, 402, 603, 804, 1005, 1206, 1406,
-    1607, 1808, 2009, 2209, 2410, 2610, 2811, 3011,
-    3211, 3411, 3611, 3811, 4011, 4210, 4409, 4608,
-    4807, 5006, 5205, 5403, 5601, 5799, 5997, 6195,
-    6392, 6589, 6786, 6982, 7179, 7375, 7571, 7766,
-    7961, 8156, 8351, 8545, 8739, 8932, 9126, 9319,
-    9511, 9703, 9895, 10087, 10278, 10469, 10659, 10849,
-    11038, 11227, 11416, 11604, 11792, 11980, 12166, 12353,
-    12539, 12724, 12909, 13094, 13278, 13462, 13645, 13827,
-    14009, 14191, 14372, 14552, 14732, 14911, 15090, 15268,
-    15446, 15623, 15799, 15975, 16150, 16325, 16499, 16672,
-    16845, 17017, 17189, 17360, 17530, 17699, 17868, 18036,
-    18204, 18371, 18537, 18702, 18867, 19031, 19194, 19357,
-    19519, 19680, 19840, 20000, 20159, 20317, 20474, 20631,
-    20787, 20942, 21096, 21249, 21402, 21554, 21705, 21855,
-    22004, 22153, 22301, 22448, 22594, 22739, 22883, 23027,
-    23169, 23311, 23452, 23592, 23731, 23869, 24006, 24143,
-    24278, 24413, 24546, 24679, 24811, 24942, 25072, 25201,
-    25329, 25456, 25582, 25707, 25831, 25954, 26077, 26198,
-    26318, 26437, 26556, 26673, 26789, 26905, 27019, 27132,
-    27244, 27355, 27466, 27575, 27683, 27790, 27896, 28001,
-    28105, 28208, 28309, 28410, 28510, 28608, 28706, 28802,
-    28897, 28992, 29085, 29177, 29268, 29358, 29446, 29534,
-    29621, 29706, 29790, 29873, 29955, 30036, 30116, 30195,
-    30272, 30349, 30424, 30498, 30571, 30643, 30713, 30783,
-    30851, 30918, 30984, 31049,
-    31113, 31175, 31236, 31297,
-    31356, 31413, 31470, 31525, 31580, 31633, 31684, 31735,
-    31785, 31833, 31880, 31926, 31970, 32014, 32056, 32097,
-    32137, 32176, 32213, 32249, 32284, 32318, 32350, 32382,
-    32412, 32441, 32468, 32495, 32520, 32544, 32567, 32588,
-    32609, 32628, 32646, 32662, 32678, 32692, 32705, 32717,
-    32727, 32736, 32744, 32751, 32757, 32761, 32764, 32766,
-    32767, 32766, 32764, 32761, 32757, 32751, 32744, 32736,
-    32727, 32717, 32705, 32692, 32678, 32662, 32646, 32628,
-    32609, 32588, 32567, 32544, 32520, 32495, 32468, 32441,
-    32412, 32382, 32350, 32318, 32284, 32249, 32213, 32176,
-    32137, 32097, 32056, 32014, 31970, 31926, 31880, 31833,
-    31785, 31735, 31684, 31633, 31580, 31525, 31470, 31413,
-    31356, 31297, 31236, 31175, 31113, 31049, 30984, 30918,
-    30851, 30783, 30713, 30643, 30571, 30498, 30424, 30349,
-    30272, 30195, 30116, 30036, 29955, 29873, 29790, 29706,
-    29621, 29534, 29446, 29358, 29268, 29177, 29085, 28992,
-    28897, 28802, 28706, 28608, 28510, 28410, 28309, 28208,
-    28105, 28001, 27896, 27790, 27683, 27575, 27466, 27355,
-    27244, 27132, 27019, 26905, 26789, 26673, 26556, 26437,
-    26318, 26198, 26077, 25954, 25831, 25707, 25582, 25456,
-    25329, 25201, 25072, 24942, 24811, 24679, 24546, 24413,
-    24278, 24143, 24006, 23869, 23731, 23592, 23452, 23311,
-    23169, 23027, 22883, 22739, 22594, 22448, 22301, 22153,
-    22004, 21855, 21705, 21554, 21402, 21249, 21096, 20942,
-    20787, 20631, 20474, 20317, 20159, 20000, 19840, 19680,
-    19519, 19357, 19194, 19031, 18867, 18702, 18537, 18371,
-    18204, 18036, 17868, 17699, 17530, 17360, 17189, 17017,
-    16845, 16672, 16499, 16325, 16150, 15975, 15799, 15623,
-    15446, 15268, 15090, 14911, 14732, 14552, 14372, 14191,
-    14009, 13827, 13645, 13462, 13278, 13094, 12909, 12724,
-    12539, 12353, 12166, 11980, 11792, 11604, 11416, 11227,
-    11038, 10849, 10659, 10469, 10278, 10087, 9895, 9703,
-    9511, 9319, 9126, 8932, 8739, 8545, 8351, 8156,
-    7961, 7766, 7571, 7375, 7179, 6982, 6786, 6589,
-    6392, 6195, 5997, 5799, 5601, 5403, 5205, 5006,
-    4807, 4608, 4409, 4210, 4011, 3811, 3611, 3411,
-    3211, 3011, 2811, 2610, 2410, 2209, 2009, 1808,
-    1607, 1406, 1206, 1005, 804, 603, 402, 201,
-    0, -201, -402, -603, -804, -1005, -1206, -1406,
-    -1607, -1808, -2009, -2209, -2410, -2610, -2811, -3011,
-    -3211, -3411, -3611, -3811, -4011, -4210, -4409, -4608,
-    -4807, -5006, -5205, -5403, -5601, -5799, -5997, -6195,
-    -6392, -6589, -6786, -6982, -7179, -7375, -7571, -7766,
-    -7961, -8156, -8351, -8545, -8739, -8932, -9126, -9319,
-    -9511, -9703, -9895, -10087, -10278, -10469, -10659, -10849,
-    -11038, -11227, -11416, -11604, -11792, -11980, -12166, -12353,
-    -12539, -12724, -12909, -13094, -13278, -13462, -13645, -13827,
-    -14009, -14191, -14372, -14552, -14732, -14911, -15090, -15268,
-    -15446, -15623, -15799, -15975, -16150, -16325, -16499, -16672,
-    -16845, -17017, -17189, -17360, -17530, -17699, -17868, -18036,
-    -18204, -18371, -18537, -18702, -18867, -19031, -19194, -19357,
-    -19519, -19680, -19840, -20000, -20159, -20317, -20474, -20631,
-    -20787, -20942, -21096, -21249, -21402, -21554, -21705, -21855,
-    -22004, -22153, -22301, -22448, -22594, -22739, -22883, -23027,
-    -23169, -23311, -23452, -23592, -23731, -23869, -24006, -24143,
-    -24278, -24413, -24546, -24679, -24811, -24942, -25072, -25201,
-    -25329, -25456, -25582, -25707, -25831, -25954, -26077, -26198,
-    -26318, -26437, -26556, -26673, -26789, -26905, -27019, -27132,
-    -27244, -27355, -27466, -27575, -27683, -27790, -27896, -28001,
-    -28105, -28208, -28309, -28410, -28510, -28608, -28706, -28802,
-    -28897, -28992, -29085, -29177, -29268, -29358, -29446, -29534,
-    -29621, -29706, -29790, -29873, -29955, -30036, -30116, -30195,
-    -30272, -30349, -30424, -30498, -30571, -30643, -30713, -30783,
-    -30851, -30918, -30984, -31049, -31113, -31175, -31236, -31297,
-    -31356, -31413, -31470, -31525, -31580, -31633, -31684, -31735,
-    -31785, -31833, -31880, -31926, -31970, -32014, -32056, -32097,
-    -32137, -32176, -32213, -32249, -32284, -32318, -32350, -32382,
-    -32412, -32441, -32468, -32495, -32520, -32544, -32567, -32588,
-    -32609, -32628, -32646, -32662, -32678, -32692, -32705, -32717,
-    -32727, -32736, -32744, -32751, -32757, -32761, -32764, -32766,
-    -32767, -32766, -32764, -32761, -32757, -32751, -32744, -32736,
-    -32727, -32717, -32705, -32692, -32678, -32662, -32646, -32628,
-    -32609, -32588, -32567, -32544, -32520, -32495, -32468, -32441,
-    -32412, -32382, -32350, -32318, -32284, -32249, -32213, -32176,
-    -32137, -32097, -32056, -32014, -31970, -31926, -31880, -31833,
-    -31785, -31735, -31684, -31633, -31580, -31525, -31470, -31413,
-    -31356, -31297, -31236, -31175, -31113, -31049, -30984, -30918,
-    -30851, -30783, -30713, -30643, -30571, -30498, -30424, -30349,
-    -30272, -30195, -30116, -30036, -29955, -29873, -29790, -29706,
-    -29621, -29534, -29446, -29358, -29268, -29177, -29085, -28992,
-    -28897, -28802, -28706, -28608, -28510, -28410, -28309, -28208,
-    -28105, -28001, -27896, -27790, -27683, -27575, -27466, -27355,
-    -27244, -27132, -27019, -26905, -26789, -26673, -26556, -26437,
-    -26318, -26198, -26077, -25954, -25831, -25707, -25582, -25456,
-    -25329, -25201, -25072, -24942, -24811, -24679, -24546, -24413,
-    -24278, -24143, -24006, -23869, -23731, -23592, -23452, -23311,
-    -23169, -23027, -22883, -22739, -22594, -22448, -22301, -22153,
-    -22004, -21855, -21705, -21554, -21402, -21249, -21096, -20942,
-    -20787, -20631, -20474, -20317, -20159, -20000, -19840, -19680,
-    -19519, -19357, -19194, -19031, -18867, -18702, -18537, -18371,
-    -18204, -18036, -17868, -17699, -17530, -17360, -17189, -17017,
-    -16845, -16672, -16499, -16325, -16150, -15975, -15799, -15623,
-    -15446, -15268, -15090, -14911, -14732, -14552, -14372, -14191,
-    -14009, -13827, -13645, -13462, -13278, -13094, -12909, -12724,
-    -12539, -12353, -12166, -11980, -11792, -11604, -11416, -11227,
-    -11038, -10849, -10659, -10469, -10278, -10087, -9895, -9703,
-    -9511, -9319, -9126, -8932, -8739, -8545, -8351, -8156,
-    -7961, -7766, -7571, -7375, -7179, -6982, -6786, -6589,
-    -6392, -6195, -5997, -5799, -5601, -5403, -5205, -5006,
-    -4807, -4608, -4409, -4210, -4011, -3811, -3611, -3411,
-    -3211, -3011, -2811, -2610, -2410, -2209, -2009, -1808,
-    -1607, -1406, -1206, -1005, -804, -603, -402, -201,};
-
-#if N_LOUD != 100
-ERROR:N_LOUD != 100
+	unsigned int i = 0;
+	int r = (1 << sh) >> 1, a, b;
+#if defined(__SSE2__)
+	const __m128i vsh = _mm_cvtsi32_si128(sh);
+	const __m128i vsh1 = _mm_cvtsi32_si128(sh - 1);
+	__m128i va, vb;
+
+	for (; i + 8 <= 2 * s; i += 8) {
+		va = _mm_loadu_si128((const __m128i *)(x + i));
+		vb = _mm_loadu_si128((const __m128i *)(x + 2 * s + i));
+		if (sh) {
+			va = round_shift_epi16(va, vsh, vsh1);
+			vb = round_shift_epi16(vb, vsh, vsh1);
+		}
+		_mm_storeu_si128((__m128i *)(y + i), _mm_add_epi16(va, vb));
+		_mm_storeu_si128((__m128i *)(y + 2 * s + i),
+				_mm_sub_epi16(va, vb));
+	}
+#elif HAVE_NEON
+	const int16x8_t vsh = vdupq_n_s16(-sh);
+	int16x8_t va, vb;
+
+	for (; i + 8 <= 2 * s; i += 8) {
+		va = vrshlq_s16(vld1q_s16(x + i), vsh);
+		vb = vrshlq_s16(vld1q_s16(x + 2 * s + i), vsh);
+		vst1q_s16(y + i, vaddq_s16(va, vb));
+		vst1q_s16(y + 2 * s + i, vsubq_s16(va, vb));
+	}
 #endif
-  fixed Loudampl[100] =
+	for (; i < 2 * s; i++) {
+		a = (x[i] + r) >> sh;
+		b = (x[2 * s + i] + r) >> sh;
+		y[i] = a + b;
+		y[2 * s + i] = a - b;
+	}
+}
+
+/*
+ * x * 2^e * scale into out. For a real input the spectrum is E + W^k O,
+ * E and O being the transforms of the even and the odd samples, which
+ * are (Z[k] + conj(Z[n - k])) / 2 and (Z[k] - conj(Z[n - k])) / 2j.
+ */
+static void int_fft_store(const struct int_fft *f, const int16_t *x, int e,
+		float *out, float scale)
+{
+	unsigned int k, j, n = f->n;
+	float g = ldexpf(scale, e);
+	float er, ei, dr, di, cr, ci;
+
+	if (f->complex) {
+		for (k = 0; k < 2 * n; k++)
+			out[k] = x[k] * g;
+		return;
+	}
+
+	for (k = 0; k < n; k++) {
+		j = (n - k) & (n - 1);
+		er = x[2 * k] + x[2 * j];
+		ei = x[2 * k + 1] - x[2 * j + 1];
+		dr = x[2 * k] - x[2 * j];
+		di = x[2 * k + 1] + x[2 * j + 1];
+		cr = f->split[2 * k];
+		ci = f->split[2 * k + 1];
+
+		out[2 * k] = (er + cr * di + ci * dr) * 0.5f * g;
+		out[2 * k + 1] = (ei - cr * dr + ci * di) * 0.5f * g;
+	}
+	out[2 * n] = (x[0] - x[1]) * g;
+	out[2 * n + 1] = 0.0f;
+}
+
+static void int_fft_transform(const struct int_fft *f, int16_t *work,
+		int max, int e, float *out, float scale)
 {
-32767, 29203, 26027, 23197, 20674, 18426, 16422, 14636,
-    13044, 11626, 10361, 9234, 8230, 7335, 6537, 5826,
-    5193, 4628, 4125, 3676, 3276, 2920, 2602, 2319,
-    2067, 1842, 1642, 1463, 1304, 1162, 1036, 923,
-    823, 733, 653, 582, 519, 462, 412, 367,
-    327, 292, 260, 231, 206, 184, 164, 146,
-    130, 116, 103, 92, 82, 73, 65, 58,
-    51, 46, 41, 36, 32, 29, 26, 23,
-    20, 18, 16, 14, 13, 11, 10, 9,
-    8, 7, 6, 5, 5, 4, 4, 3,
-    3, 2, 2, 2, 2, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0, 0, 0, 0, 0,};
+	int16_t *x = work, *y = work + 2 * f->n, *t;
+	const int16_t *tw = f->twiddle;
+	unsigned int len, n = f->n;
+	int sh;
+
+	for (len = n; len >= 4; len /= 4) {
+		sh = int_fft_shift(max, RADIX4_MAX);
+		max = int_fft_stage4(x, y, len, n / len, tw, sh);
+		e += sh;
+		tw += 6 * (len / 4);
+		t = x;
+		x = y;
+		y = t;
+	}
+
+	if (len == 2) {
+		sh = int_fft_shift(max, RADIX2_MAX);
+		int_fft_stage2(x, y, n / 2, sh);
+		e += sh;
+		x = y;
+	}
+
+	int_fft_store(f, x, e, out, scale);
+}
+
+/*
+ * Window and transform a frame of raw samples (interleaved I/Q for a
+ * complex one) out of scans of stride samples. out gets the n bins, n + 1
+ * for a real input, in float and times scale, as interleaved I/Q.
+ */
+void int_fft_run(const struct int_fft *f, const int16_t *data,
+		unsigned int stride, int16_t *work, float *out, float scale)
+{
+	int_fft_transform(f, work, int_fft_load(f, data, stride, work), 0,
+			out, scale);
+}
+
+/*
+ * The same for complex float samples, which are first scaled into 14 bits
+ * by a power of two that goes into the exponent.
+ */
+void int_fft_run_f32(const struct int_fft *f, const float *data,
+		int16_t *work, float *out, float scale)
+{
+	unsigned int i, num = 2 * f->n;
+	float peak = 0.0f, g;
+	int e, max = 0;
+
+	if (!f->complex)
+		return;
+
+	for (i = 0; i < num; i++)
+		if (fabsf(data[i]) > peak)
+			peak = fabsf(data[i]);
+
+	e = peak > 0.0f ? ilogbf(peak) - 13 : 0;
+	g = ldexpf(1.0f, -15 - e);
+	for (i = 0; i < num; i++) {
+		work[i] = lrintf(data[i] * f->win[i] * g);
+		max = max_abs(max, work[i]);
+	}
+
+	int_fft_transform(f, work, max, e, out, scale);
+}
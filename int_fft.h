@@ -1,10 +1,53 @@
+/**
+ * Copyright (C) 2013 Analog Devices, Inc.
+ *
+ * Licensed under the GPL-2.
+ *
+ **/
 
-#ifndef fixed
-#define fixed short
-#endif
+#ifndef __INT_FFT_H__
+#define __INT_FFT_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * Fixed-point FFT, for the builds without FFTW. A radix-4 Stockham
+ * transform (plus one radix-2 stage for the odd powers of two) of 16 bit
+ * complex samples, going back and forth between the two halves of the
+ * work buffer, so there is no bit reversal pass.
+ *
+ * The data is block floating point: before each stage it is shifted down
+ * by just what that stage could grow it by, given the largest sample the
+ * stage before put out. The shifts add up to the exponent of the result,
+ * which comes out in float, windowed and scaled like the FFTW path.
+ *
+ * A real input of size samples is a complex FFT of size / 2, the even
+ * samples taken as I and the odd ones as Q. The size / 2 + 1 bins of the
+ * real spectrum are pulled out of it in the float conversion.
+ *
+ * The tables are made once per size and only read after that: one
+ * int_fft can run in any number of threads, each with its own work
+ * buffer of INT_FFT_WORK_LEN() samples.
+ */
+struct int_fft {
+	unsigned int size;		/* samples per channel */
+	bool complex;
+	unsigned int n;			/* points of the complex FFT */
+
+	int16_t *win;			/* Q15, one per input sample */
+	int16_t *twiddle;		/* Q15, per radix-4 stage */
+	float *split;			/* exp(-j pi k / n), real input only */
+};
 
-extern int fix_fft (fixed *, fixed *, int, int);
-extern int iscale (int, int, int);
-extern void window (fixed *, int);
-extern void fix_loud (fixed loud[], fixed fr[], fixed fi[], int n, int scale_shift);
+#define INT_FFT_WORK_LEN(f)	(4 * (f)->n)
 
+int int_fft_setup(struct int_fft *f, unsigned int size, bool complex);
+void int_fft_free(struct int_fft *f);
+
+void int_fft_run(const struct int_fft *f, const int16_t *data,
+		unsigned int stride, int16_t *work, float *out, float scale);
+void int_fft_run_f32(const struct int_fft *f, const float *data,
+		int16_t *work, float *out, float scale);
+
+#endif
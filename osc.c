@@ -23,19 +23,28 @@
 #include <sys/stat.h>
 #include <unistd.h>
 
-#include <fftw3.h>
-
 #include "osc.h"
 #include "iio_widget.h"
 #include "iio_utils.h"
-#include "int_fft.h"
 #include "config.h"
 #include "osc_plugin.h"
+#include "capture.h"
+#include "envelope.h"
+#include "fft.h"
+#include "ddc.h"
+#include "peaks.h"
+#include "waterfall.h"
+#include "stats.h"
 #include "ini/ini.h"
 
 #define SAMPLE_COUNT_MIN_VALUE 10
 #define SAMPLE_COUNT_MAX_VALUE 1000000ul
 
+/* Default upper limit on how often the display picks up the newest frame */
+#define DISPLAY_RATE_DEFAULT 25
+/* Upper bound on plot columns/rows the time and XY plots are reduced to */
+#define LOD_MAX_COLUMNS 4096
+
 extern char * get_filename_from_path(const char *path);
 
 GSList *plugin_list = NULL;
@@ -46,29 +55,36 @@ static gfloat fft_corr = 0.0;
 gfloat plugin_fft_corr = 0.0;
 
 gint capture_function = 0;
-static int buffer_fd = -1;
 
-static struct buffer data_buffer;
+/* The device shown in the main window */
+static struct capture_context capture_ctx;
+/* Other devices captured at the same time, on behalf of plugins */
+static GSList *extra_captures;
+/* Frames for the plugins which subscribed to them */
+static struct frame_bus *frame_bus;
+static unsigned long display_seq;
+static unsigned int display_interval_ms = 1000 / DISPLAY_RATE_DEFAULT;
+
 unsigned int num_samples;
 unsigned int num_samples_ploted;
 struct iio_channel_info *channels;
 unsigned int num_active_channels;
-int cached_num_active_channels = -1;
 static unsigned int num_channels;
 gfloat **channel_data;
-static unsigned int current_sample;
 static unsigned int bytes_per_sample;
 
 static GtkWidget *databox;
 static GtkWidget *time_interval_widget;
 static GtkWidget *sample_count_widget;
-static GtkWidget *fft_size_widget, *fft_avg_widget, *fft_pwr_offset_widget;
+static GtkWidget *fft_size_widget, *fft_avg_widget, *fft_avg_mode_widget;
+static GtkWidget *fft_pwr_offset_widget, *fft_zoom_widget;
 GtkWidget *plot_domain;
 
 static GtkWidget *show_grid;
 static GtkWidget *enable_auto_scale;
 static GtkWidget *device_list_widget;
 static GtkWidget *capture_button;
+static GtkWidget *record_button;
 static GtkWidget *hor_scale;
 static GtkWidget *plot_type;
 static GtkWidget *time_unit_lbl;
@@ -78,16 +94,71 @@ static GtkWidget *notebook;
 
 GtkWidget *capture_graph;
 
-static GtkWidget *rx_lo_freq_label, *adc_freq_label;
+static GtkWidget *rx_lo_freq_label, *adc_freq_label, *capture_stats_label;
 
 static GtkDataboxGraph *fft_graph;
+
+/* Spectrogram of fft_channel under the plot */
+#define WATERFALL_WIDTH		1024
+#define WATERFALL_HEIGHT	200
+#define WATERFALL_KILOROWS_DEFAULT	1
+#define WATERFALL_KILOROWS_MAX	64
+
+static struct waterfall waterfall;
+static unsigned int waterfall_kilorows = WATERFALL_KILOROWS_DEFAULT;
+static GtkWidget *waterfall_box, *waterfall_area, *show_waterfall;
+static GtkAdjustment *waterfall_adj;
+
+/*
+ * One spectrum per FFT channel: every I/Q pair if the enabled channels pair
+ * up, every channel on its own otherwise. The first one is fft_channel and
+ * has the markers the user and the plugins deal with, the others follow it.
+ */
+struct fft_spectrum {
+	struct fft_state fft;
+	struct ddc ddc;
+	gfloat *data;
+	GtkDataboxGraph *graph;
+	struct marker_type *markers;
+};
+
+static struct fft_spectrum *spectra;
+static struct fft_job *fft_jobs;
+static unsigned int num_spectra;
+static bool fft_iq;
+
+/*
+ * Welch segments in a frame, 1 unless the capture started in Welch mode.
+ * Frames are kept below FFT_CAPTURE_MAX scans, fewer segments if need be.
+ */
+#define FFT_CAPTURE_MAX	(1 << 21)
+static unsigned int fft_segments = 1;
+
+/*
+ * Zoom: the band of zoom_span around zoom_center (in the units of the
+ * plot, without the LO) is down-converted and shown at the FFT size. They
+ * come from the plot when zoom is turned on, or from the profile. The
+ * decimation is 0 while not zoomed.
+ */
+static double zoom_center, zoom_span;
+static unsigned int zoom_decimation;
 static GtkDataboxGraph *grid;
 
 static GtkDataboxGraph **channel_graph;
 
+/* Reduced copies of channel_data, which is what the graphs actually draw */
+static gfloat **lod_x, **lod_y;
+static unsigned int lod_num_graphs;
+static unsigned int lod_points;
+static bool lod_scatter;
+static guchar *lod_occupied;
+
 static struct marker_type markers[MAX_MARKERS + 2];
-static struct marker_type *markers_copy;
 static GtkWidget *marker_label;
+static GtkWidget *trigger_mode_widget, *trigger_type_widget, *trigger_edge_widget;
+static GtkWidget *trigger_channel_widget, *trigger_level_widget;
+static GtkWidget *trigger_hysteresis_widget, *trigger_pretrigger_widget;
+static GtkWidget *trigger_holdoff_widget;
 static enum marker_types marker_type;
 
 struct detachable_plugin {
@@ -160,8 +231,6 @@ static GdkColor color_marker = {
 	.blue = 0xFFFF,
 };
 
-G_LOCK_DEFINE_STATIC(buffer_full);
-G_LOCK_DEFINE_STATIC(markers_copy);
 
 /* Couple helper functions from fru parsing */
 void printf_warn (const char * fmt, ...)
@@ -190,176 +259,339 @@ void * x_calloc (size_t nmemb, size_t size)
 }
 
 
-struct buffer {
-	void *data;
-	void *data_copy;
-	unsigned int available;
-	unsigned int size;
-};
-
-static bool is_oneshot_mode(void)
+/*
+ * Raw and cooked frames for the subscribers of the device, only made if
+ * one of them is due for it. Runs in the capture thread, the ring
+ * publishes the frame right after this, with the next seq.
+ */
+static void capture_frame_done(struct capture_context *ctx,
+		const void *data)
 {
-	if (strncmp(current_device, "cf-ad9", 5) == 0)
-		return true;
-	if (strncmp(current_device, "axi-ad9", 6) == 0)
-		return true;
-	if (strncmp(current_device, "ad-mc-", 5) == 0)
-		return true;
+	gint64 now = g_get_monotonic_time();
+	unsigned int wanted, num_scans;
+	struct osc_frame *frame;
+
+	wanted = frame_bus_wanted(frame_bus, ctx->device, now);
+
+	if (wanted & OSC_FRAME_MASK(OSC_FRAME_RAW)) {
+		frame = frame_bus_frame_new(frame_bus, OSC_FRAME_RAW, 1,
+				ctx->buffer.size, 1);
+		if (frame) {
+			memcpy(frame_bus_frame_bufs(frame)[0], data,
+					ctx->buffer.size);
+			frame->seq = ctx->ring->seq + 1;
+			frame->timestamp = now;
+			frame_bus_publish(frame_bus, ctx->device, frame);
+		}
+	}
 
-	return false;
+	if ((wanted & OSC_FRAME_MASK(OSC_FRAME_COOKED)) &&
+			ctx->demux.scan_size) {
+		num_scans = ctx->buffer.size / ctx->demux.scan_size;
+		frame = frame_bus_frame_new(frame_bus, OSC_FRAME_COOKED,
+				ctx->num_active_channels, num_scans, sizeof(float));
+		if (frame) {
+			demux_run(&ctx->demux, data, frame_bus_frame_bufs(frame),
+					num_scans, 0, num_scans);
+			frame->seq = ctx->ring->seq + 1;
+			frame->timestamp = now;
+			frame_bus_publish(frame_bus, ctx->device, frame);
+		}
+	}
 }
 
-static int buffer_open(unsigned int length, int flags)
-{
-	int ret;
-	int fd;
 
-	if (!current_device)
-		return -ENODEV;
+static int frame_counter;
 
-	set_dev_paths(current_device);
+static void fps_counter(void)
+{
+	static time_t last_update;
+	static clock_t last_cpu;
+	clock_t cpu;
+	time_t t;
 
-	fd = iio_buffer_open(true, flags);
-	if (fd < 0) {
-		ret = -errno;
-		fprintf(stderr, "Failed to open buffer: %d\n", ret);
-		return ret;
+	frame_counter++;
+	stats_count(STATS_FRAMES);
+	t = time(NULL);
+	if (t - last_update >= 10) {
+		cpu = clock();
+		printf("FPS: %d, CPU: %.1f%%\n", frame_counter / 10,
+				100.0 * (cpu - last_cpu) / CLOCKS_PER_SEC / (t - last_update));
+		frame_counter = 0;
+		last_update = t;
+		last_cpu = cpu;
 	}
+}
 
-	/* Setup ring buffer parameters */
-	ret = write_devattr_int("buffer/length", length);
-	if (ret < 0) {
-		fprintf(stderr, "Failed to set buffer length: %d\n", ret);
-		goto err_close;
-	}
+static void capture_stats_update(void)
+{
+	static time_t last_update;
+	struct recorder_stats stats;
+	char buf[160];
+	size_t len;
+	time_t t;
 
-	/* Enable the buffer */
-	ret = write_devattr_int("buffer/enable", 1);
-	if (ret < 0) {
-		fprintf(stderr, "Failed to enable buffer: %d\n", ret);
-		goto err_close;
+	t = time(NULL);
+	if (t == last_update)
+		return;
+	last_update = t;
+
+	len = snprintf(buf, sizeof(buf), "%u dropped, %u overruns",
+			frame_ring_get_drops(capture_ctx.ring),
+			frame_ring_get_overruns(capture_ctx.ring));
+
+	if (capture_ctx.recorder) {
+		recorder_get_stats(capture_ctx.recorder, &stats);
+		snprintf(buf + len, sizeof(buf) - len,
+				"\nRecording: %.1f MB/s, %.1f MB, %.1f MB dropped%s",
+				stats.rate / 1e6, stats.written / 1e6,
+				stats.dropped / 1e6, stats.error ? ", failed" : "");
 	}
 
-	return fd;
-
-err_close:
-	close(fd);
-	return ret;
+	gtk_label_set_text(GTK_LABEL(capture_stats_label), buf);
 }
 
-static void buffer_close(unsigned int fd)
+/* Have measured FFT plans ready, in the background, for every size offered */
+static void fft_plans_start(void)
 {
-	int ret;
+	GtkTreeModel *model;
+	GtkTreeIter iter;
+	unsigned int sizes[32], num = 0;
+	gboolean loop;
+	char *path, *text;
 
-	if (!current_device)
-		return;
+	path = g_build_filename(g_get_user_config_dir(), "osc", "fftwf_wisdom",
+			NULL);
+#if NO_FFTW
+	fft_plans_init(path, 0);
+#else
+	fft_plans_init(path, getenv("OSC_FFTW_PATIENT") ?
+			FFTW_PATIENT : FFTW_MEASURE);
+#endif
+	g_free(path);
+
+	model = gtk_combo_box_get_model(GTK_COMBO_BOX(fft_size_widget));
+	loop = gtk_tree_model_get_iter_first(model, &iter);
+	while (loop && num < sizeof(sizes) / sizeof(sizes[0])) {
+		gtk_tree_model_get(model, &iter, 0, &text, -1);
+		sizes[num++] = atoi(text);
+		g_free(text);
+		loop = gtk_tree_model_iter_next(model, &iter);
+	}
 
-	set_dev_paths(current_device);
+	fft_plans_prepare(sizes, num, true);
+}
 
-	/* Enable the buffer */
-	ret = write_devattr_int("buffer/enable", 0);
-	if (ret < 0) {
-		fprintf(stderr, "Failed to disable buffer: %d\n", ret);
-	}
+/* The databox draws in expose, long after the frame queued the redraw */
+static guint64 redraw_start;
+
+static gboolean redraw_begin(GtkWidget *widget, GdkEventExpose *event,
+		gpointer data)
+{
+	redraw_start = stats_now();
+	return FALSE;
+}
 
-	close(fd);
+static gboolean redraw_end(GtkWidget *widget, GdkEventExpose *event,
+		gpointer data)
+{
+	if (redraw_start)
+		stats_record(STATS_REDRAW, redraw_start);
+	redraw_start = 0;
+	return FALSE;
 }
 
-#if DEBUG
+static GtkWidget *diagnostics_window, *diagnostics_label;
+static guint diagnostics_timeout;
 
-static int sample_iio_data_continuous(int buffer_fd, struct buffer *buf)
+static gboolean diagnostics_update(gpointer data)
 {
-	static int offset;
-	int i;
+	char buf[2048];
 
-	for (i = 0; i < num_samples; i++) {
-		((int16_t *)(buf->data))[i*2] = 4096.0f * cos((i + offset) * G_PI / 100) + (rand() % 500 - 250);
-		((int16_t *)(buf->data))[i*2+1] = 4096.0f * sin((i + offset) * G_PI / 100) + (rand() % 1000 - 500);
+	if (!gtk_widget_get_visible(diagnostics_window)) {
+		diagnostics_timeout = 0;
+		return FALSE;
 	}
 
-	buf->available = 10;
-	offset += 10;
+	stats_format(buf, sizeof(buf));
+	gtk_label_set_text(GTK_LABEL(diagnostics_label), buf);
 
-	return 0;
+	return TRUE;
 }
-static int sample_iio_data(struct buffer *buf);
 
-static int sample_iio_data_oneshot(struct buffer *buf)
+static void diagnostics_reset_clicked(GtkButton *btn, gpointer data)
 {
-	return sample_iio_data(buf);
+	stats_reset();
+	diagnostics_update(NULL);
 }
 
-#else
+static void diagnostics_show(GtkMenuItem *item, gpointer data)
+{
+	PangoFontDescription *font;
+	GtkWidget *vbox, *reset;
+
+	if (diagnostics_window)
+		goto show;
+
+	diagnostics_window = gtk_window_new(GTK_WINDOW_TOPLEVEL);
+	gtk_window_set_title(GTK_WINDOW(diagnostics_window),
+			"Diagnostics (latency in us)");
+	gtk_container_set_border_width(GTK_CONTAINER(diagnostics_window), 6);
+	g_signal_connect(diagnostics_window, "delete-event",
+			G_CALLBACK(gtk_widget_hide_on_delete), NULL);
+
+	vbox = gtk_vbox_new(FALSE, 6);
+	diagnostics_label = gtk_label_new(NULL);
+	gtk_misc_set_alignment(GTK_MISC(diagnostics_label), 0.0, 0.0);
+	font = pango_font_description_from_string("Monospace");
+	gtk_widget_modify_font(diagnostics_label, font);
+	pango_font_description_free(font);
+	reset = gtk_button_new_with_label("Reset");
+	g_signal_connect(reset, "clicked",
+			G_CALLBACK(diagnostics_reset_clicked), NULL);
+
+	gtk_box_pack_start(GTK_BOX(vbox), diagnostics_label, TRUE, TRUE, 0);
+	gtk_box_pack_start(GTK_BOX(vbox), reset, FALSE, FALSE, 0);
+	gtk_container_add(GTK_CONTAINER(diagnostics_window), vbox);
+	gtk_widget_show_all(vbox);
 
-static int sample_iio_data_continuous(int buffer_fd, struct buffer *buf)
+show:
+	gtk_window_present(GTK_WINDOW(diagnostics_window));
+	diagnostics_update(NULL);
+	if (!diagnostics_timeout)
+		diagnostics_timeout = g_timeout_add(1000, diagnostics_update, NULL);
+}
+
+static gboolean waterfall_expose(GtkWidget *widget, GdkEventExpose *event,
+		gpointer data)
 {
-	int ret;
+	GtkAllocation alloc;
+	cairo_t *cr;
 
-	ret = read(buffer_fd, buf->data + buf->available,
-			buf->size - buf->available);
-	if (ret == 0)
-		return 0;
-	if (ret < 0) {
-		if (errno == EAGAIN)
-			return 0;
-		else
-			return -errno;
-	}
+	gtk_widget_get_allocation(widget, &alloc);
 
-	buf->available += ret;
+	cr = gdk_cairo_create(gtk_widget_get_window(widget));
+	gdk_cairo_rectangle(cr, &event->area);
+	cairo_clip(cr);
+	cairo_set_source_rgb(cr, 0.0, 0.0, 0.0);
+	cairo_paint(cr);
+	waterfall_draw(&waterfall, cr, alloc.width,
+			(unsigned int)gtk_adjustment_get_value(waterfall_adj),
+			alloc.height);
+	cairo_destroy(cr);
 
-	return 0;
+	return TRUE;
 }
 
-static int sample_iio_data_oneshot(struct buffer *buf)
+static void waterfall_size_allocate(GtkWidget *widget, GtkAllocation *alloc,
+		gpointer data)
 {
-	int fd, ret;
-
-	fd = buffer_open(buf->size, 0);
-	if (fd < 0)
-		return fd;
-
-	ret = sample_iio_data_continuous(fd, buf);
+	gtk_adjustment_set_page_size(waterfall_adj, alloc->height);
+	gtk_adjustment_set_page_increment(waterfall_adj, alloc->height);
+}
 
-	buffer_close(fd);
+static void waterfall_scrolled(GtkAdjustment *adj, gpointer data)
+{
+	gtk_widget_queue_draw(waterfall_area);
+}
 
-	return ret;
+static void waterfall_visibility_update(void)
+{
+	gtk_widget_set_visible(waterfall_box, waterfall.pixels &&
+			gtk_toggle_button_get_active(GTK_TOGGLE_BUTTON(show_waterfall)) &&
+			gtk_combo_box_get_active(GTK_COMBO_BOX(plot_domain)) == FFT_PLOT);
 }
 
-#endif
+static void show_waterfall_toggled(GtkToggleButton *btn, gpointer data)
+{
+	waterfall_visibility_update();
+}
 
-static int sample_iio_data(struct buffer *buf)
+/* Add the visible part of fft_channel, in the plot's colour range */
+static void waterfall_update(void)
 {
-	int ret;
+	gfloat left, right, top, bottom, step;
+	double value;
+	unsigned int first, last;
 
-	if (is_oneshot_mode())
-		ret = sample_iio_data_oneshot(buf);
-	else
-		ret = sample_iio_data_continuous(buffer_fd, buf);
+	if (!gtk_widget_get_visible(waterfall_box) || num_samples_ploted < 2)
+		return;
 
-	if ((buf->data_copy) && (buf->available == buf->size)) {
-		memcpy(buf->data_copy, buf->data, buf->size);
-		buf->data_copy = NULL;
-		G_UNLOCK(buffer_full);
+	gtk_databox_get_visible_limits(GTK_DATABOX(databox),
+			&left, &right, &top, &bottom);
+	if (left > right) {
+		step = left;
+		left = right;
+		right = step;
 	}
 
-	return ret;
-}
+	step = X[1] - X[0];
+	first = left <= X[0] ? 0 : MIN((unsigned int)((left - X[0]) / step),
+			num_samples_ploted - 1);
+	last = right <= X[0] ? 1 : MIN((unsigned int)((right - X[0]) / step) + 1,
+			num_samples_ploted);
 
-static int frame_counter;
+	waterfall_add(&waterfall, fft_channel, first, last,
+			MIN(top, bottom), MAX(top, bottom));
 
-static void fps_counter(void)
+	/* looking back in the history, keep the same rows in view */
+	value = gtk_adjustment_get_value(waterfall_adj);
+	if (value > 0)
+		gtk_adjustment_set_value(waterfall_adj, MIN(value + 1,
+				gtk_adjustment_get_upper(waterfall_adj) -
+				gtk_adjustment_get_page_size(waterfall_adj)));
+
+	gtk_widget_queue_draw(waterfall_area);
+}
+
+/* Under the plot, the history memory is taken once here */
+static void waterfall_create(void)
 {
-	static time_t last_update;
-	time_t t;
+	GtkWidget *scrollbar;
+	unsigned int depth = waterfall_kilorows * 1000;
 
-	frame_counter++;
-	t = time(NULL);
-	if (t - last_update >= 10) {
-		printf("FPS: %d\n", frame_counter / 10);
-		frame_counter = 0;
-		last_update = t;
+	if (waterfall_init(&waterfall, WATERFALL_WIDTH, depth) < 0) {
+		fprintf(stderr, "No memory for a waterfall of %u rows\n", depth);
+		gtk_widget_set_sensitive(show_waterfall, FALSE);
 	}
+
+	waterfall_adj = GTK_ADJUSTMENT(gtk_adjustment_new(0, 0, depth, 1,
+			WATERFALL_HEIGHT, WATERFALL_HEIGHT));
+	waterfall_area = gtk_drawing_area_new();
+	gtk_widget_set_size_request(waterfall_area, -1, WATERFALL_HEIGHT);
+	scrollbar = gtk_vscrollbar_new(waterfall_adj);
+
+	waterfall_box = gtk_hbox_new(FALSE, 0);
+	gtk_box_pack_start(GTK_BOX(waterfall_box), waterfall_area, TRUE, TRUE, 0);
+	gtk_box_pack_start(GTK_BOX(waterfall_box), scrollbar, FALSE, FALSE, 0);
+	gtk_box_pack_start(GTK_BOX(capture_graph), waterfall_box, FALSE, TRUE, 0);
+	gtk_widget_show_all(waterfall_box);
+	gtk_widget_set_no_show_all(waterfall_box, TRUE);
+
+	g_signal_connect(waterfall_area, "expose-event",
+			G_CALLBACK(waterfall_expose), NULL);
+	g_signal_connect(waterfall_area, "size-allocate",
+			G_CALLBACK(waterfall_size_allocate), NULL);
+	g_signal_connect(waterfall_adj, "value-changed",
+			G_CALLBACK(waterfall_scrolled), NULL);
+	g_signal_connect(show_waterfall, "toggled",
+			G_CALLBACK(show_waterfall_toggled), NULL);
+	g_signal_connect_swapped(plot_domain, "changed",
+			G_CALLBACK(waterfall_visibility_update), NULL);
+
+	waterfall_visibility_update();
+}
+
+static void record_stop(void)
+{
+	recorder_free(capture_context_set_recorder(&capture_ctx, NULL));
+}
+
+static void capture_stop(void)
+{
+	gtk_toggle_tool_button_set_active(GTK_TOGGLE_TOOL_BUTTON(record_button),
+			FALSE);
+	capture_context_stop(&capture_ctx);
 }
 
 /*
@@ -410,10 +642,133 @@ static void add_grid(void)
 }
 
 
+static void plot_lod_free(void)
+{
+	unsigned int i;
+
+	for (i = 0; i < lod_num_graphs; i++) {
+		g_free(lod_x[i]);
+		g_free(lod_y[i]);
+	}
+	g_free(lod_x);
+	g_free(lod_y);
+	g_free(lod_occupied);
+	lod_x = NULL;
+	lod_y = NULL;
+	lod_occupied = NULL;
+	lod_num_graphs = 0;
+}
+
+static void plot_lod_alloc(unsigned int num_graphs, unsigned int points,
+		bool scatter)
+{
+	unsigned int i;
+
+	plot_lod_free();
+
+	lod_x = g_new(gfloat *, num_graphs);
+	lod_y = g_new(gfloat *, num_graphs);
+	for (i = 0; i < num_graphs; i++) {
+		lod_x[i] = g_new0(gfloat, points);
+		lod_y[i] = g_new0(gfloat, points);
+	}
+	lod_num_graphs = num_graphs;
+	lod_points = points;
+	lod_scatter = scatter;
+}
+
+static void plot_lod_set_length(GtkDataboxGraph *graph, unsigned int length)
+{
+	g_object_set(G_OBJECT(graph), "length", MAX(length, 1), NULL);
+}
+
+/*
+ * Rebuild what the graphs draw from channel_data, for the given window
+ * only: a min/max pair per pixel column in time domain, one point per
+ * pixel for constellations.
+ */
+static void plot_lod_compute(gfloat left, gfloat right, gfloat top, gfloat bottom)
+{
+	GtkAllocation alloc;
+	unsigned int width, height, first, last, i, n;
+	gfloat tmp;
+
+	if (!lod_num_graphs || !channel_data)
+		return;
+
+	gtk_widget_get_allocation(databox, &alloc);
+	width = CLAMP(alloc.width, 1, LOD_MAX_COLUMNS);
+	height = CLAMP(alloc.height, 1, LOD_MAX_COLUMNS);
+
+	if (lod_scatter) {
+		lod_occupied = g_renew(guchar, lod_occupied, width * height);
+		n = envelope_scatter(channel_data[0], channel_data[1], num_samples,
+				left, right, top, bottom, width, height,
+				lod_occupied, lod_points, lod_x[0], lod_y[0]);
+		plot_lod_set_length(fft_graph, n);
+		return;
+	}
+
+	if (left > right) {
+		tmp = left;
+		left = right;
+		right = tmp;
+	}
+	first = left <= 0 ? 0 : MIN((unsigned int)left, num_samples);
+	last = right < 0 ? 0 : MIN((unsigned int)right + 2, num_samples);
+
+	for (i = 0; i < lod_num_graphs; i++) {
+		n = envelope_minmax(channel_data[i], first, last, width,
+				lod_points, lod_x[i], lod_y[i]);
+		plot_lod_set_length(channel_graph[i], n);
+	}
+}
+
+static void plot_lod_update(void)
+{
+	gfloat left, right, top, bottom;
+
+	if (!lod_num_graphs)
+		return;
+
+	gtk_databox_get_visible_limits(GTK_DATABOX(databox),
+			&left, &right, &top, &bottom);
+	plot_lod_compute(left, right, top, bottom);
+}
+
+/*
+ * The databox is zoomed from the buttons, with the mouse or by auto
+ * scaling, all of which emit "zoomed"; the scrollbars only move the
+ * adjustments.
+ */
+static void plot_lod_view_changed(GObject *obj, gpointer data)
+{
+	plot_lod_update();
+}
+
+/* Used before auto scaling, which looks at what the graphs hold */
+static void plot_lod_update_full(void)
+{
+	gfloat min_x, max_x, min_y, max_y;
+
+	if (!lod_num_graphs)
+		return;
+
+	if (lod_scatter) {
+		envelope_extrema(channel_data[0], num_samples, &min_x, &max_x);
+		envelope_extrema(channel_data[1], num_samples, &min_y, &max_y);
+		plot_lod_compute(min_x, max_x, max_y, min_y);
+	} else {
+		plot_lod_compute(0, num_samples, 0, 0);
+	}
+}
+
 static void rescale_databox(GtkDatabox *box, gfloat border)
 {
 	bool fixed_aspect = gtk_combo_box_get_active(GTK_COMBO_BOX(plot_domain)) == XY_PLOT;
 
+	plot_lod_update_full();
+
 	if (fixed_aspect) {
 		gfloat min_x;
 		gfloat max_x;
@@ -456,488 +811,382 @@ static void auto_scale_databox(GtkDatabox *box)
 	}
 }
 
-static int sign_extend(unsigned int val, unsigned int bits)
+static void abort_sampling(void)
 {
-	unsigned int shift = 32 - bits;
-	return ((int)(val << shift)) >> shift;
+	capture_stop();
+	gtk_toggle_tool_button_set_active(GTK_TOGGLE_TOOL_BUTTON(capture_button),
+			FALSE);
+	frame_bus_interrupt(frame_bus);
 }
 
-static void demux_data_stream(void *data_in, gfloat **data_out,
-	unsigned int num_sam, unsigned int offset, unsigned int data_out_size,
-	struct iio_channel_info *channels, unsigned int num_channels)
+static bool capture_failed(void)
 {
-	unsigned int i, j, n;
-	unsigned int val;
-	unsigned int k;
+	int ret = capture_context_error(&capture_ctx);
 
-	for (i = 0; i < num_sam; i++) {
-		n = (offset + i) % data_out_size;
-		k = 0;
-		for (j = 0; j < num_channels; j++) {
-			if (!channels[j].enabled)
-				continue;
-			switch (channels[j].bytes) {
-			case 1:
-				val = *(uint8_t *)data_in;
-				break;
-			case 2:
-				switch (channels[j].endianness) {
-				case IIO_BE:
-					val = be16toh(*(uint16_t *)data_in);
-					break;
-				case IIO_LE:
-					val = le16toh(*(uint16_t *)data_in);
-					break;
-				default:
-					val = 0;
-					break;
-				}
-				break;
-			case 4:
-				switch (channels[j].endianness) {
-				case IIO_BE:
-					val = be32toh(*(uint32_t *)data_in);
-					break;
-				case IIO_LE:
-					val = le32toh(*(uint32_t *)data_in);
-					break;
-				default:
-					val = 0;
-					break;
-				}
-				break;
-			default:
-				continue;
-			}
-			data_in += channels[j].bytes;
-			val >>= channels[j].shift;
-			val &= channels[j].mask;
-			if (channels[j].is_signed)
-				data_out[k][n] = sign_extend(val, channels[j].bits_used);
-			else
-				data_out[k][n] = val;
-			k++;
-		}
-	}
+	if (!ret)
+		return false;
 
-}
+	abort_sampling();
+	fprintf(stderr, "Failed to capture samples: %s\n", strerror(-ret));
 
-static void abort_sampling(void)
-{
-	if (buffer_fd >= 0) {
-		buffer_close(buffer_fd);
-		buffer_fd = -1;
-	}
-	gtk_toggle_tool_button_set_active(GTK_TOGGLE_TOOL_BUTTON(capture_button),
-			FALSE);
-	G_TRYLOCK(buffer_full);
-	G_UNLOCK(buffer_full);
-	G_TRYLOCK(markers_copy);
-	G_UNLOCK(markers_copy);
+	return true;
 }
 
 static gboolean time_capture_func(GtkDatabox *box)
 {
-	unsigned int n;
-	int ret;
+	struct frame *frame;
+	guint64 t;
 
 	if (!GTK_IS_DATABOX(box))
 		return FALSE;
 
-	ret = sample_iio_data(&data_buffer);
-	if (ret < 0) {
-		abort_sampling();
-		fprintf(stderr, "Failed to capture samples: %s\n", strerror(-ret));
+	if (capture_failed())
 		return FALSE;
-	}
 
-	n = data_buffer.available / bytes_per_sample;
+	frame = frame_ring_read_latest(capture_ctx.ring, &display_seq);
+	if (!frame)
+		return TRUE;
+
+	t = stats_now();
+	demux_run(&capture_ctx.demux, frame->data, channel_data, num_samples, 0,
+			num_samples);
+	stats_record(STATS_DEMUX, t);
+	frame_ring_read_end(capture_ctx.ring, frame);
 
-	demux_data_stream(data_buffer.data, channel_data, n, current_sample,
-			num_samples, channels, num_channels);
-	current_sample = (current_sample + n) % num_samples;
-	data_buffer.available -= n * bytes_per_sample;
-	if (data_buffer.available != 0) {
-		memmove(data_buffer.data, data_buffer.data +  n * bytes_per_sample,
-			data_buffer.available);
-	}
-/*
-	for (j = 1; j < num_samples; j++) {
-		if (data[j * 2 - 2] < trigger && data[j * 2] >= trigger)
-			break;
-	}
-*/
 	auto_scale_databox(box);
+	plot_lod_update();
 
 	gtk_widget_queue_draw(GTK_WIDGET(box));
-	usleep(50000);
 
 	fps_counter();
+	capture_stats_update();
 
 	return TRUE;
 }
 
-#if NO_FFTW
-
-static void do_fft()
+/* Keep the markers of the other spectra in step with the first one */
+static void fft_markers_sync(struct marker_type *mk)
 {
-	unsigned int fft_size = num_samples;
-	short *real, *imag, *amp, *fft_buf;
-	unsigned int cnt, i;
-	double avg;
+	bool active;
+	int j;
 
-	fft_buf = malloc((fft_size * 2 + fft_size / 2) * sizeof(short));
-	if (fft_buf == NULL){
-		fprintf(stderr, "malloc failed (%d)\n", __LINE__);
-		return;
+	for (j = 0; j <= MAX_MARKERS; j++) {
+		active = markers[j].active && marker_type != MARKER_OFF;
+		if (mk[j].active != active && mk[j].graph)
+			gtk_databox_graph_set_hide(mk[j].graph, !active);
+		mk[j].active = active;
+		if (marker_type == MARKER_FIXED)
+			mk[j].bin = markers[j].bin;
 	}
+}
 
-	real = fft_buf;
-	imag = real + fft_size;
-	amp = imag+ fft_size;
+/* Place the markers of one spectrum and add them to the marker text */
+static void fft_markers_update(struct fft_spectrum *sp, unsigned int idx,
+		GString *text)
+{
+	struct marker_type *mk = sp->markers;
+	const gfloat *spectrum = sp->data;
+	unsigned int m = sp->fft.m, num_peaks, num_found;
+	struct peak peaks[MAX_MARKERS + 1];
+	int i, j, k;
 
-	cnt = 0;
-	for (i = 0; i < fft_size * 2; i += 2) {
-		real[cnt] = ((int16_t *)(buf->data))[i];
-		imag[cnt] = 0;
-		cnt++;
+	if (idx)
+		fft_markers_sync(mk);
+
+	num_found = 0;
+	if (marker_type == MARKER_PEAK ||
+			marker_type == MARKER_ONE_TONE ||
+			marker_type == MARKER_IMAGE) {
+		for (num_peaks = 0; num_peaks <= MAX_MARKERS &&
+				mk[num_peaks].active; num_peaks++);
+		/* the tone markers want the two highest */
+		if (marker_type != MARKER_PEAK && num_peaks < 2)
+			num_peaks = 2;
+		num_found = peaks_find(spectrum, m, peaks, num_peaks);
 	}
 
-	window(real, fft_size);
+	/* not enough peaks, the rest go to the first bin */
+	for (j = num_found; j <= MAX_MARKERS; j++) {
+		peaks[j].bin = 0;
+		peaks[j].offset = 0.0f;
+		peaks[j].level = spectrum[0];
+	}
 
-	fix_fft(real, imag, (int)log2f(fft_size), 0);
-	fix_loud(amp, real, imag, fft_size / 2, 2); /* scale 14->16 bit */
+	if ((marker_type == MARKER_ONE_TONE || marker_type == MARKER_IMAGE) &&
+			((!fft_iq && peaks[0].bin == 0) ||
+			 (fft_iq && peaks[0].bin == m/2))) {
+		struct peak peak_tmp;
 
-	avg = 1.0f / gtk_spin_button_get_value(GTK_SPIN_BUTTON(fft_avg_widget));
+		peak_tmp = peaks[1];
+		peaks[1] = peaks[0];
+		peaks[0] = peak_tmp;
+	}
 
-	for (i = 0; i < fft_size / 2; ++i)
-		fft_channel[i] = ((1 - avg) * fft_channel[i]) + (avg * amp[i]);
+	for (j = 0; j <= MAX_MARKERS && mk[j].active; j++) {
+		if (marker_type == MARKER_PEAK) {
+			/* between the bins, where the peak really is */
+			mk[j].x = (gfloat)X[peaks[j].bin] +
+				peaks[j].offset * (X[1] - X[0]);
+			mk[j].y = peaks[j].level;
+			mk[j].bin = peaks[j].bin;
+		} else if (marker_type == MARKER_FIXED) {
+			mk[j].x = (gfloat)X[mk[j].bin];
+			mk[j].y = (gfloat)spectrum[mk[j].bin];
+		} else if (marker_type == MARKER_ONE_TONE) {
+			/* assume peak is the tone */
+			if (j == 0) {
+				mk[j].bin = peaks[j].bin;
+				i = 1;
+			} else if (j == 1) {
+				/* keep DC */
+				if (fft_iq)
+					mk[j].bin = m / 2;
+				else
+					mk[j].bin = 0;
+			} else {
+				/* where should the spurs be? */
+				i++;
+				if (fft_iq) {
+					mk[j].bin = (mk[0].bin - (m / 2)) * i + (m / 2);
+					if (mk[j].bin > m)
+						mk[j].bin -= 2 * (mk[j].bin - m);
+					if (mk[j].bin < ( m/2 ))
+						mk[j].bin += 2 * ((m / 2) - mk[j].bin);
+				} else {
+					mk[j].bin = mk[0].bin * i;
+					if (mk[j].bin > (m))
+						mk[j].bin -=  2 * (mk[j].bin - (m));
+					if (mk[j].bin < 0)
+						mk[j].bin += -mk[j].bin;
+				}
+			}
+			/* make sure we don't need to nudge things one way or the other */
+			k = mk[j].bin;
+			while (spectrum[k] < spectrum[k + 1]) {
+				k++;
+			}
 
-	free(fft_buf);
-}
+			while (mk[j].bin != 0 &&
+					spectrum[mk[j].bin] < spectrum[mk[j].bin - 1]) {
+				mk[j].bin--;
+			}
 
-#else
+			if (spectrum[k] > spectrum[mk[j].bin])
+				mk[j].bin = k;
 
-static double win_hanning(int j, int n)
-{
-	double a = 2.0*M_PI/(n-1), w;
+			mk[j].x = (gfloat)X[mk[j].bin];
+			mk[j].y = (gfloat)spectrum[mk[j].bin];
+		} else if (marker_type == MARKER_IMAGE) {
+			/* keep DC, fundamental, and image
+			 * the spectrum always needs to be I/Q for images */
+			if (j == 0) {
+				/* Fundamental */
+				mk[j].bin = peaks[j].bin;
+			} else if (j == 1) {
+				/* DC */
+				mk[j].bin = m / 2;
+			} else if (j == 2) {
+				/* Image */
+				mk[j].bin = m / 2 - (mk[0].bin - m/2);
+			} else
+				continue;
+			mk[j].x = (gfloat)X[mk[j].bin];
+			mk[j].y = (gfloat)spectrum[mk[j].bin];
 
-	w = 0.5 * (1.0 - cos(a*j));
+		}
 
-	return (w);
+		if (text->len)
+			g_string_append_c(text, '\n');
+		if (num_spectra > 1)
+			g_string_append_printf(text, "%u.", idx);
+		g_string_append_printf(text, "M%i: %2.2f dBFS @ %2.3f %sHz",
+				j, mk[j].y, lo_freq + mk[j].x, adc_scale);
+	}
 }
 
-static void do_fft(struct buffer *buf)
+static void do_fft(const void *data)
 {
-	unsigned int fft_size = num_samples;
-	static unsigned int m;
-	int i, j, k;
-	int cnt;
-	static double *in;
-	static fftw_complex *in_c;
-	static double *win;
-	gfloat mag;
-	double avg, pwr_offset;
-	static fftw_complex *out;
-	static fftw_plan plan_forward;
-	static int cached_fft_size = -1;
-
-	unsigned int maxx[MAX_MARKERS + 1];
-	gfloat maxY[MAX_MARKERS + 1];
+	unsigned int i;
+	double offset;
+	enum fft_avg_mode avg_mode;
+	unsigned int avg;
 
 	static GtkTextBuffer *tbuf = NULL;
-	GtkTextIter iter;
-	char text[256];
-
-	if ((cached_fft_size == -1) || (cached_fft_size != fft_size) ||
-		(cached_num_active_channels != num_active_channels)) {
-
-		if (cached_fft_size != -1) {
-			fftw_destroy_plan(plan_forward);
-			fftw_free(win);
-			fftw_free(out);
-			if (in != NULL)
-				fftw_free(in);
-			if (in_c != NULL)
-				fftw_free(in_c);
-			in_c = NULL;
-			in = NULL;
-		}
-
-		win = fftw_malloc(sizeof(double) * fft_size);
-
-		if (num_active_channels == 2) {
-			m = fft_size;
-			in_c = fftw_malloc(sizeof(fftw_complex) * fft_size);
-			in = NULL;
-			out = fftw_malloc(sizeof(fftw_complex) * (m + 1));
-			plan_forward = fftw_plan_dft_1d(fft_size, in_c, out, FFTW_FORWARD, FFTW_ESTIMATE);
-
-		} else {
-			m = fft_size / 2;
-			out = fftw_malloc(sizeof(fftw_complex) * (m + 1));
-			in_c = NULL;
-			in = fftw_malloc(sizeof(double) * fft_size);
-			plan_forward = fftw_plan_dft_r2c_1d(fft_size, in, out, FFTW_ESTIMATE);
-		}
-
-		for (i = 0; i < fft_size; i ++)
-			win[i] = win_hanning(i, fft_size);
-
-		cached_fft_size = fft_size;
-		cached_num_active_channels = num_active_channels;
-	}
-
-	if (num_active_channels == 2) {
-		for (cnt = 0, i = 0; cnt < fft_size; cnt++) {
-			/* normalization and scaling see fft_corr */
-			in_c[cnt][0] = ((int16_t *)(buf->data))[i++] * win[cnt];
-			in_c[cnt][1] = ((int16_t *)(buf->data))[i++] * win[cnt];
-		}
+	static GString *text;
+	guint64 t;
 
-	} else  {
-		for (cnt = 0, i = 0; i < fft_size; i++) {
-			/* normalization and scaling see fft_corr */
-			in[cnt] = ((int16_t *)(buf->data))[i] * win[cnt];
-			cnt++;
-		}
+	for (i = 0; i < num_spectra; i++) {
+		if (fft_setup(&spectra[i].fft, num_samples,
+					fft_iq || zoom_decimation ? 2 : 1) < 0)
+			return;
+		if (zoom_decimation && ddc_setup(&spectra[i].ddc, fft_iq ? 2 : 1,
+					zoom_center / adc_freq, zoom_decimation,
+					num_samples) < 0)
+			return;
 	}
 
-	fftw_execute(plan_forward);
-	avg = gtk_spin_button_get_value(GTK_SPIN_BUTTON(fft_avg_widget));
-	if (avg && avg != 128 )
-		avg = 1.0f / avg;
-
-	pwr_offset = gtk_spin_button_get_value(GTK_SPIN_BUTTON(fft_pwr_offset_widget));
-
-	for (j = 0; j <= MAX_MARKERS; j++) {
-		maxx[j] = 0;
-		maxY[j] = -100.0f;
+	avg_mode = gtk_combo_box_get_active(GTK_COMBO_BOX(fft_avg_mode_widget));
+	avg = gtk_spin_button_get_value_as_int(GTK_SPIN_BUTTON(fft_avg_widget));
+	if (avg_mode == FFT_AVG_WELCH)
+		avg = MIN(avg, fft_segments);
+	offset = fft_corr + plugin_fft_corr +
+		gtk_spin_button_get_value(GTK_SPIN_BUTTON(fft_pwr_offset_widget));
+
+	/* a spectrum per channel, or per I/Q pair, all at once */
+	for (i = 0; i < num_spectra; i++) {
+		fft_jobs[i].fft = &spectra[i].fft;
+		fft_jobs[i].data = (const int16_t *)data + i * (fft_iq ? 2 : 1);
+		fft_jobs[i].stride = num_active_channels;
+		fft_jobs[i].spectrum = spectra[i].data;
+		fft_jobs[i].offset = offset;
+		fft_jobs[i].avg_mode = avg_mode;
+		fft_jobs[i].avg_n = avg;
+		fft_jobs[i].ddc = zoom_decimation ? &spectra[i].ddc : NULL;
 	}
 
-	for (i = 0; i < m; ++i) {
-
-		if (num_active_channels == 2) {
-			if (i < (m / 2))
-				j = i + (m / 2);
-			else
-				j = i - (m / 2);
-		} else {
-			j = i;
-		}
-
-		mag = 10 * log10((out[j][0] * out[j][0] +
-				out[j][1] * out[j][1]) / (m * m)) +
-			fft_corr + pwr_offset + plugin_fft_corr;
-
-		/* it's better for performance to have seperate loops,
-		 * rather than do these tests inside the loop, but it makes
-		 * the code harder to understand... Oh well...
-		 ***/
-		if (fft_channel[i] == FLT_MAX) {
-			/* Don't average the first iterration */
-			 fft_channel[i] = mag;
-		} else if (!avg) {
-			/* keep peaks */
-			if (fft_channel[i] <= mag)
-				fft_channel[i] = mag;
-		} else if (avg == 128) {
-			/* keep min */
-			if (fft_channel[i] >= mag)
-				fft_channel[i] = mag;
-		} else {
-			/* do an average */
-			fft_channel[i] = ((1 - avg) * fft_channel[i]) + (avg * mag);
-		}
-
-		if (MAX_MARKERS && (marker_type == MARKER_PEAK ||
-				    marker_type == MARKER_ONE_TONE ||
-				    marker_type == MARKER_IMAGE)) {
-			if (i == 0) {
-				maxx[0] = 0;
-				maxY[0] = fft_channel[0];
-			} else {
-				for (j = 0; j <= MAX_MARKERS && markers[j].active; j++) {
-					if  ((fft_channel[i - 1] > maxY[j]) &&
-						((!((fft_channel[i - 2] > fft_channel[i - 1]) &&
-						 (fft_channel[i - 1] > fft_channel[i]))) &&
-						 (!((fft_channel[i - 2] < fft_channel[i - 1]) &&
-						 (fft_channel[i - 1] < fft_channel[i]))))) {
-						if (marker_type == MARKER_PEAK) {
-							for (k = MAX_MARKERS; k > j; k--) {
-								maxY[k] = maxY[k - 1];
-								maxx[k] = maxx[k - 1];
-							}
-						}
-						maxY[j] = fft_channel[i - 1];
-						maxx[j] = i - 1;
-						break;
-					}
-				}
-			}
-		}
-	}
+	t = stats_now();
+	fft_transform_jobs(fft_jobs, num_spectra);
+	t = stats_record(STATS_FFT, t);
+	fft_average_jobs(fft_jobs, num_spectra);
+	t = stats_record(STATS_AVERAGE, t);
 
 	if (tbuf == NULL) {
 		tbuf = gtk_text_buffer_new(NULL);
 		gtk_text_view_set_buffer(GTK_TEXT_VIEW(marker_label), tbuf);
+		text = g_string_new(NULL);
 	}
-
-	if ((marker_type == MARKER_ONE_TONE || marker_type == MARKER_IMAGE) &&
-			((num_active_channels == 1 && maxx[0] == 0) ||
-			 (num_active_channels == 2 && maxx[0] == m/2))) {
-		unsigned int max_tmp;
-
-		max_tmp = maxx[1];
-		maxx[1] = maxx[0];
-		maxx[0] = max_tmp;
-	}
+	g_string_truncate(text, 0);
 
 	if (MAX_MARKERS && marker_type != MARKER_OFF) {
-		for (j = 0; j <= MAX_MARKERS && markers[j].active; j++) {
-			if (marker_type == MARKER_PEAK) {
-				markers[j].x = (gfloat)X[maxx[j]];
-				markers[j].y = (gfloat)fft_channel[maxx[j]];
-				markers[j].bin = maxx[j];
-			} else if (marker_type == MARKER_FIXED) {
-				markers[j].x = (gfloat)X[markers[j].bin];
-				markers[j].y = (gfloat)fft_channel[markers[j].bin];
-			} else if (marker_type == MARKER_ONE_TONE) {
-				/* assume peak is the tone */
-				if (j == 0) {
-					markers[j].bin = maxx[j];
-					i = 1;
-				} else if (j == 1) {
-					/* keep DC */
-					if (num_active_channels == 2)
-						markers[j].bin = m / 2;
-					else
-						markers[j].bin = 0;
-				} else {
-					/* where should the spurs be? */
-					i++;
-					if (num_active_channels == 2) {
-						markers[j].bin = (markers[0].bin - (m / 2)) * i + (m / 2);
-						if (markers[j].bin > m)
-							markers[j].bin -= 2 * (markers[j].bin - m);
-						if (markers[j].bin < ( m/2 ))
-							markers[j].bin += 2 * ((m / 2) - markers[j].bin);
-					} else {
-						markers[j].bin = markers[0].bin * i;
-						if (markers[j].bin > (m))
-							markers[j].bin -=  2 * (markers[j].bin - (m));
-						if (markers[j].bin < 0)
-							markers[j].bin += -markers[j].bin;
-					}
-				}
-				/* make sure we don't need to nudge things one way or the other */
-				k = markers[j].bin;
-				while (fft_channel[k] < fft_channel[k + 1]) {
-					k++;
-				}
-
-				while (markers[j].bin != 0 &&
-						fft_channel[markers[j].bin] < fft_channel[markers[j].bin - 1]) {
-					markers[j].bin--;
-				}
-
-				if (fft_channel[k] > fft_channel[markers[j].bin])
-					markers[j].bin = k;
-
-				markers[j].x = (gfloat)X[markers[j].bin];
-				markers[j].y = (gfloat)fft_channel[markers[j].bin];
-			} else if (marker_type == MARKER_IMAGE) {
-				/* keep DC, fundamental, and image
-				 * num_active_channels always needs to be 2 for images */
-				if (j == 0) {
-					/* Fundamental */
-					markers[j].bin = maxx[j];
-				} else if (j == 1) {
-					/* DC */
-					markers[j].bin = m / 2;
-				} else if (j == 2) {
-					/* Image */
-					markers[j].bin = m / 2 - (markers[0].bin - m/2);
-				} else
-					continue;
-				markers[j].x = (gfloat)X[markers[j].bin];
-				markers[j].y = (gfloat)fft_channel[markers[j].bin];
+		for (i = 0; i < num_spectra; i++)
+			fft_markers_update(&spectra[i], i, text);
+	} else {
+		for (i = 1; i < num_spectra; i++)
+			fft_markers_sync(spectra[i].markers);
+		g_string_assign(text, "No markers active");
+	}
+	t = stats_record(STATS_MARKERS, t);
 
-			}
+	/* all at once, every change to the buffer means a relayout */
+	gtk_text_buffer_set_text(tbuf, text->str, text->len);
+	stats_record(STATS_TEXT, t);
+}
 
-			sprintf(text, "M%i: %2.2f dBFS @ %2.3f %sHz%c",
-					j, markers[j].y, lo_freq + markers[j].x, adc_scale,
-					j != MAX_MARKERS ? '\n' : '\0');
 
-			if (j == 0) {
-				gtk_text_buffer_set_text(tbuf, text, -1);
-				gtk_text_buffer_get_iter_at_line(tbuf, &iter, 1);
-			} else {
-				gtk_text_buffer_insert(tbuf, &iter, text, -1);
-			}
+/* The spectra and markers of a frame just shown, for the subscribers */
+static void fft_frame_publish(const struct frame *captured)
+{
+	unsigned int i, wanted;
+	struct osc_frame *frame;
+	float **bufs;
+
+	wanted = frame_bus_wanted(frame_bus, capture_ctx.device,
+			captured->timestamp);
+
+	if (wanted & OSC_FRAME_MASK(OSC_FRAME_SPECTRUM)) {
+		frame = frame_bus_frame_new(frame_bus, OSC_FRAME_SPECTRUM,
+				num_spectra, num_samples_ploted, sizeof(float));
+		if (frame) {
+			bufs = frame_bus_frame_bufs(frame);
+			for (i = 0; i < num_spectra; i++)
+				memcpy(bufs[i], spectra[i].data,
+						num_samples_ploted * sizeof(float));
+			frame->seq = captured->seq;
+			frame->timestamp = captured->timestamp;
+			frame_bus_publish(frame_bus, capture_ctx.device, frame);
 		}
-		if (markers_copy) {
-			memcpy(markers_copy, &markers, sizeof(struct marker_type) * MAX_MARKERS);
-			markers_copy = NULL;
-			G_UNLOCK(markers_copy);
+	}
+
+	if ((wanted & OSC_FRAME_MASK(OSC_FRAME_MARKERS)) &&
+			MAX_MARKERS && marker_type != MARKER_OFF) {
+		frame = frame_bus_frame_new(frame_bus, OSC_FRAME_MARKERS, 1,
+				MAX_MARKERS, sizeof(struct marker_type));
+		if (frame) {
+			memcpy(frame_bus_frame_bufs(frame)[0], markers,
+					sizeof(struct marker_type) * MAX_MARKERS);
+			frame->seq = captured->seq;
+			frame->timestamp = captured->timestamp;
+			frame_bus_publish(frame_bus, capture_ctx.device, frame);
 		}
-	} else {
-		gtk_text_buffer_set_text(tbuf, "No markers active", 17);
 	}
 }
 
-#endif
-
 static gboolean fft_capture_func(GtkDatabox *box)
 {
-	int ret;
+	struct frame *frame;
 
-	ret = sample_iio_data(&data_buffer);
-	if (ret < 0) {
-		abort_sampling();
-		fprintf(stderr, "Failed to capture samples: %d\n", ret);
+	if (capture_failed())
 		return FALSE;
-	}
-	if (data_buffer.available == data_buffer.size) {
-		do_fft(&data_buffer);
-		data_buffer.available = 0;
-		auto_scale_databox(box);
-		gtk_widget_queue_draw(GTK_WIDGET(box));
-	}
 
-	usleep(5000);
+	frame = frame_ring_read_latest(capture_ctx.ring, &display_seq);
+	if (!frame)
+		return TRUE;
+
+	do_fft(frame->data);
+	fft_frame_publish(frame);
+	frame_ring_read_end(capture_ctx.ring, frame);
+	waterfall_update();
+
+	auto_scale_databox(box);
+	gtk_widget_queue_draw(GTK_WIDGET(box));
 
 	fps_counter();
+	capture_stats_update();
 
 	return TRUE;
 }
 
 static void fft_update_scale(bool force_update)
 {
-	double corr;
-	int i;
+	double corr, left, right, step;
+	unsigned int i, j;
 
-	if (num_active_channels == 2) {
-		corr =  adc_freq / 2;
+	if (zoom_decimation) {
+		step = adc_freq / zoom_decimation / num_samples;
+		for (i = 0; i < num_samples_ploted; i++)
+			X[i] = zoom_center + ((int)i - (int)num_samples / 2) * step;
+		left = X[0];
+		right = X[num_samples_ploted - 1];
 	} else {
-		corr = 0;
-	}
+		if (fft_iq) {
+			corr =  adc_freq / 2;
+		} else {
+			corr = 0;
+		}
 
-	for (i = 0; i < num_samples_ploted; i++)
-	{
-		X[i] = (i * adc_freq / num_samples) - corr;
-		fft_channel[i] = FLT_MAX;
+		for (i = 0; i < num_samples_ploted; i++)
+			X[i] = (i * adc_freq / num_samples) - corr;
+		left = -5.0 - corr;
+		right = adc_freq / 2.0 + 5.0;
 	}
 
+	for (j = 0; j < num_spectra; j++)
+		for (i = 0; i < num_samples_ploted; i++)
+			spectra[j].data[i] = FLT_MAX;
+
 	if (!gtk_toggle_button_get_active(GTK_TOGGLE_BUTTON(enable_auto_scale)) && force_update == FALSE)
 		return;
 	if (profile_loaded_scale)
 		return;
-	gtk_databox_set_total_limits(GTK_DATABOX(databox), -5.0 - corr, adc_freq / 2.0 + 5.0, 0.0, -100.0);
+	gtk_databox_set_total_limits(GTK_DATABOX(databox), left, right, 0.0, -100.0);
 	do_a_rescale_flag = 1;
 
 }
 
+/* Zoom in on the part of the spectrum the plot shows */
+static void fft_zoom_toggled(GtkToggleButton *btn, gpointer data)
+{
+	gfloat left, right, top, bottom;
+
+	if (!gtk_toggle_button_get_active(btn) || !is_fft_mode)
+		return;
+
+	gtk_databox_get_visible_limits(GTK_DATABOX(databox),
+			&left, &right, &top, &bottom);
+	zoom_center = (left + right) / 2;
+	zoom_span = fabs(right - left);
+}
+
 #define OFF_MRK    "Markers Off"
 #define PEAK_MRK   "Peak Markers"
 #define FIX_MRK    "Fixed Markers"
@@ -1041,12 +1290,7 @@ static void marker_menu (gchar *buf)
 
 static gint moved_fixed(GtkDatabox *box, GdkEventMotion *event, int mark)
 {
-	unsigned int max_size;
-
-	if (num_active_channels == 2)
-		max_size = num_samples;
-	else
-		max_size = num_samples / 2;
+	unsigned int max_size = num_samples_ploted - 1;
 
 	while((gfloat)X[markers[mark].bin] < gtk_databox_pixel_to_value_x(box, event->x) &&
 			markers[mark].bin < max_size)
@@ -1179,7 +1423,7 @@ static gint marker_button (GtkDatabox *box, GdkEventButton *event)
 	i++;
 */
 
-	if (num_active_channels == 2) {
+	if (fft_iq) {
 		menuitem = gtk_check_menu_item_new_with_label(IMAGE_MRK);
 		gtk_menu_attach(GTK_MENU(popupmenu), menuitem, 0, 1, i, i + 1);
 		gtk_check_menu_item_set_active(GTK_CHECK_MENU_ITEM(menuitem),
@@ -1213,11 +1457,38 @@ static gint marker_button (GtkDatabox *box, GdkEventButton *event)
 
 static int prev_num_active_ch = 0;
 
+static void fft_spectra_free(void)
+{
+	unsigned int i;
+	int j;
+
+	for (i = 0; i < num_spectra; i++) {
+		fft_free(&spectra[i].fft);
+		ddc_free(&spectra[i].ddc);
+		if (!i)
+			continue;
+		for (j = 0; j <= MAX_MARKERS; j++)
+			if (spectra[i].markers[j].graph)
+				g_object_unref(spectra[i].markers[j].graph);
+		g_free(spectra[i].markers);
+		g_free(spectra[i].data);
+	}
+
+	g_free(spectra);
+	spectra = NULL;
+	g_free(fft_jobs);
+	fft_jobs = NULL;
+	num_spectra = 0;
+}
+
 static int fft_capture_setup(void)
 {
-	int i;
+	struct marker_type *mk;
+	int i, j;
 	char buf[10];
 
+	plot_lod_free();
+
 	if (channel_data) {
 		for (i = 0; i < prev_num_active_ch; i++)
 			g_free(channel_data[i]);
@@ -1227,17 +1498,51 @@ static int fft_capture_setup(void)
 
 	num_samples = atoi(gtk_combo_box_text_get_active_text(GTK_COMBO_BOX_TEXT(fft_size_widget)));
 
-	data_buffer.size = num_samples * bytes_per_sample * num_active_channels;
-	data_buffer.data = g_renew(int8_t, data_buffer.data, data_buffer.size);
-	data_buffer.data_copy = NULL;
-	markers_copy = NULL;
+	zoom_decimation = 0;
+	if (gtk_toggle_button_get_active(GTK_TOGGLE_BUTTON(fft_zoom_widget)) &&
+			zoom_span > 0 && adc_freq > 0)
+		zoom_decimation = ddc_decimation(adc_freq / zoom_span);
+
+	fft_segments = 1;
+	if (!zoom_decimation && gtk_combo_box_get_active(GTK_COMBO_BOX(fft_avg_mode_widget)) == FFT_AVG_WELCH) {
+		fft_segments = gtk_spin_button_get_value_as_int(GTK_SPIN_BUTTON(fft_avg_widget));
+		if (num_samples < FFT_CAPTURE_MAX)
+			fft_segments = MIN(fft_segments,
+				(FFT_CAPTURE_MAX - num_samples) / (num_samples / 2) + 1);
+		else
+			fft_segments = 1;
+	}
+
+	/* bytes_per_sample is a whole scan */
+	if (zoom_decimation)
+		capture_ctx.buffer.size = ddc_input_len(zoom_decimation,
+				num_samples) * bytes_per_sample;
+	else
+		capture_ctx.buffer.size = fft_welch_len(num_samples,
+				fft_segments) * bytes_per_sample;
 
-	num_samples_ploted = num_samples * num_active_channels / 2;
+	fft_spectra_free();
+	fft_iq = num_active_channels % 2 == 0;
+	num_spectra = fft_iq ? num_active_channels / 2 : num_active_channels;
+	num_samples_ploted = fft_iq || zoom_decimation ? num_samples : num_samples / 2;
 
 	X = g_renew(gfloat, X, num_samples_ploted);
 	fft_channel = g_renew(gfloat, fft_channel, num_samples_ploted);
 
+	spectra = g_new0(struct fft_spectrum, num_spectra);
+	fft_jobs = g_new0(struct fft_job, num_spectra);
+	for (i = 0; i < num_spectra; i++) {
+		if (i) {
+			spectra[i].data = g_new(gfloat, num_samples_ploted);
+			spectra[i].markers = g_new0(struct marker_type, MAX_MARKERS + 2);
+		} else {
+			spectra[i].data = fft_channel;
+			spectra[i].markers = markers;
+		}
+	}
+
 	fft_update_scale(FORCE_UPDATE);
+	waterfall_clear(&waterfall);
 
 	is_fft_mode = true;
 
@@ -1269,17 +1574,40 @@ static int fft_capture_setup(void)
 		}
 		if (marker_type != MARKER_OFF)
 			set_marker_labels(NULL, marker_type);
+
+		/* the other spectra get their markers in their own colour */
+		for (i = 1; i < num_spectra; i++) {
+			mk = spectra[i].markers;
+			for (j = 0; j <= MAX_MARKERS; j++) {
+				mk[j].y = -100.0f;
+				mk[j].graph = gtk_databox_markers_new(1, &mk[j].x, &mk[j].y,
+						&color_graph[i % G_N_ELEMENTS(color_graph)],
+						10, GTK_DATABOX_MARKERS_TRIANGLE);
+				gtk_databox_graph_add(GTK_DATABOX(databox), mk[j].graph);
+
+				sprintf(buf, "%i.%i", i, j);
+				gtk_databox_markers_set_label(GTK_DATABOX_MARKERS(mk[j].graph), 0,
+						GTK_DATABOX_MARKERS_TEXT_N, buf, FALSE);
+				gtk_databox_graph_set_hide(mk[j].graph, TRUE);
+			}
+		}
 	}
 
-	fft_graph = gtk_databox_lines_new(num_samples_ploted, X, fft_channel, &color_graph[0], line_thickness);
-	gtk_databox_graph_add(GTK_DATABOX(databox), fft_graph);
+	for (i = 0; i < num_spectra; i++) {
+		spectra[i].graph = gtk_databox_lines_new(num_samples_ploted, X,
+				spectra[i].data, &color_graph[i % G_N_ELEMENTS(color_graph)],
+				line_thickness);
+		gtk_databox_graph_add(GTK_DATABOX(databox), spectra[i].graph);
+	}
+	fft_graph = spectra[0].graph;
 
 	return 0;
 }
 
 static void fft_capture_start(void)
 {
-	capture_function = g_idle_add((GSourceFunc) fft_capture_func, databox);
+	capture_function = g_timeout_add(display_interval_ms,
+			(GSourceFunc) fft_capture_func, databox);
 }
 
 static void detach_plugin(GtkToolButton *btn, gpointer data);
@@ -1458,24 +1786,50 @@ const void * plugin_get_device_by_reference(const char * device_name)
 int plugin_data_capture_size(const char *device)
 {
 	if ((device && !strcmp(current_device, device)) || !device)
-		return data_buffer.size;
+		return capture_ctx.buffer.size;
 
 	return 0;
 }
 
+static struct capture_context * extra_capture_find(const char *device)
+{
+	struct capture_context *ctx;
+	GSList *node;
+
+	for (node = extra_captures; node; node = g_slist_next(node)) {
+		ctx = node->data;
+		if (!strcmp(ctx->device, device))
+			return ctx;
+	}
+
+	return NULL;
+}
+
 int plugin_data_capture_num_active_channels(const char *device)
 {
+	struct capture_context *ctx;
+
 	if (!strcmp(current_device, device))
 		return num_active_channels;
 
+	ctx = extra_capture_find(device);
+	if (ctx)
+		return ctx->num_active_channels;
+
 	return 0;
 }
 
 int plugin_data_capture_bytes_per_sample(const char *device)
 {
+	struct capture_context *ctx;
+
 	if (!strcmp(current_device, device))
 		return bytes_per_sample;
 
+	ctx = extra_capture_find(device);
+	if (ctx)
+		return ctx->bytes_per_sample;
+
 	return 0;
 }
 
@@ -1501,20 +1855,149 @@ gdouble plugin_get_fft_avg(const char *device)
 	return 0;
 }
 
+/*
+ * plugin_data_capture() waits for as long as the capture runs, looking
+ * every PLUGIN_CAPTURE_POLL_MS whether it still does.
+ */
+#define PLUGIN_CAPTURE_POLL_MS	100
+
+static int plugin_capture_wait(struct frame_sub *sub,
+		enum osc_frame_type type, gint64 after,
+		const struct osc_frame **frame)
+{
+	int ret;
+
+	do {
+		ret = frame_bus_wait(sub, type, after, PLUGIN_CAPTURE_POLL_MS,
+				NULL, frame);
+	} while (ret == -ETIMEDOUT && g_atomic_pointer_get(&capture_ctx.ring));
+
+	/* stopped in between, same as if it had been interrupted */
+	return ret == -ETIMEDOUT ? -EINTR : ret;
+}
+
+/*
+ * What plugin_data_capture() keeps per calling thread: its subscription,
+ * parked in between the calls so nothing is made for it then, and the
+ * buffers it last handed out. Those are only reallocated when the shape
+ * of the capture changes, in the steady state a call doesn't allocate.
+ */
+struct plugin_capture {
+	struct frame_sub *sub;
+	char *device;
+
+	void *buf;
+	unsigned int buf_size;
+	gfloat **cooked;
+	unsigned int num_channels;
+	unsigned int len;
+	struct marker_type *markers;
+};
+
+static void plugin_capture_release(struct plugin_capture *pc)
+{
+	/* once the bus is gone, so are its subscriptions */
+	if (frame_bus)
+		frame_bus_unsubscribe(pc->sub);
+	g_free(pc->device);
+	memset(pc, 0, sizeof(*pc));
+}
+
+static void plugin_capture_free(gpointer data)
+{
+	plugin_capture_release(data);
+	g_free(data);
+}
+
+static GPrivate plugin_capture_key = G_PRIVATE_INIT(plugin_capture_free);
+
+static struct plugin_capture * plugin_capture_get(const char *device,
+		unsigned int types)
+{
+	struct plugin_capture *pc = g_private_get(&plugin_capture_key);
+
+	if (!pc) {
+		pc = g_new0(struct plugin_capture, 1);
+		g_private_set(&plugin_capture_key, pc);
+	}
+
+	if (pc->sub && !strcmp(pc->device, device)) {
+		frame_bus_set_types(pc->sub, types);
+		return pc;
+	}
+
+	if (frame_bus)
+		frame_bus_unsubscribe(pc->sub);
+	g_free(pc->device);
+	pc->device = g_strdup(device);
+	pc->sub = frame_bus_subscribe(frame_bus, device, types, 0, NULL, NULL);
+
+	return pc->sub ? pc : NULL;
+}
+
+/*
+ * The cooked arrays handed out are sized for the whole buffer, as they
+ * always were, while only the first len samples of each are data. The
+ * rest is zeroed once here and never written after that.
+ */
+static int plugin_cooked_alloc(struct plugin_capture *pc,
+		gfloat ***cooked_data, unsigned int num_channels,
+		unsigned int len)
+{
+	unsigned int i, old;
+
+	len = MAX(len, capture_ctx.buffer.size / bytes_per_sample);
+
+	if (*cooked_data && *cooked_data == pc->cooked &&
+			pc->num_channels == num_channels && pc->len == len)
+		return 0;
+
+	if (*cooked_data) {
+		old = *cooked_data == pc->cooked ? pc->num_channels :
+			num_active_channels;
+		for (i = 0; i < old; i++)
+			g_free((*cooked_data)[i]);
+	}
+	pc->cooked = NULL;
+
+	*cooked_data = g_renew(gfloat *, *cooked_data, num_channels);
+	if (!*cooked_data)
+		return -ENOMEM;
+
+	for (i = 0; i < num_channels; i++) {
+		(*cooked_data)[i] = g_new0(gfloat, len);
+		if (!(*cooked_data)[i])
+			return -ENOMEM;
+	}
+
+	pc->cooked = *cooked_data;
+	pc->num_channels = num_channels;
+	pc->len = len;
+
+	return 0;
+}
+
 int plugin_data_capture(const char *device, void **buf, gfloat ***cooked_data,
 			struct marker_type **markers_cp)
 {
-	int i, j;
-	bool new = FALSE;
+	const struct osc_frame *raw = NULL, *cooked = NULL, *frame;
+	struct plugin_capture *pc = NULL;
+	unsigned int types = 0;
+	gint64 after = 0;
+	int i, ret = 0;
 
 	/* if there isn't anything to send, clear everything */
-	if (data_buffer.size == 0 || device == NULL) {
+	if (capture_ctx.buffer.size == 0 || device == NULL) {
+		pc = g_private_get(&plugin_capture_key);
 		if (buf && *buf) {
 			g_free(*buf);
 			*buf = NULL;
 		}
 		if (cooked_data && *cooked_data) {
-			for (i = 0; i < num_active_channels; i++)
+			int num = pc && pc->cooked == *cooked_data ?
+				pc->num_channels : num_active_channels;
+
+			for (i = 0; i < num; i++)
 				g_free((*cooked_data)[i]);
 			g_free(*cooked_data);
 			*cooked_data = NULL;
@@ -1523,124 +2006,258 @@ int plugin_data_capture(const char *device, void **buf, gfloat ***cooked_data,
 			g_free(*markers_cp);
 			*markers_cp = NULL;
 		}
+		if (pc)
+			plugin_capture_release(pc);
 		return -ENXIO;
 	}
 
 	if (strcmp(current_device, device))
 		return -ENXIO;
 
-	if (buf) {
-		/* One consumer at a time */
-		if (data_buffer.data_copy)
-			return -EBUSY;
-
-		/* make sure space is allocated */
-		if (*buf)
-			*buf = g_renew(int8_t, *buf, data_buffer.size);
-		else
-			*buf = g_new(int8_t, data_buffer.size);
+	if (markers_cp && !is_fft_mode && *markers_cp) {
+		g_free(*markers_cp);
+		*markers_cp = NULL;
+	}
 
-		if (!*buf)
-			goto capture_malloc_fail;
+	if (buf)
+		types |= OSC_FRAME_MASK(OSC_FRAME_RAW);
+	if (buf && cooked_data)
+		types |= OSC_FRAME_MASK(OSC_FRAME_COOKED);
+	if (markers_cp && is_fft_mode)
+		types |= OSC_FRAME_MASK(OSC_FRAME_MARKERS);
+	if (!types)
+		return 0;
 
-		/* where to put the copy */
-		data_buffer.data_copy = *buf;
+	pc = plugin_capture_get(device, types);
+	if (!pc)
+		goto capture_malloc_fail;
 
-		/* Wait til the buffer is full */
-		G_LOCK(buffer_full);
+	if (buf) {
+		ret = plugin_capture_wait(pc->sub, OSC_FRAME_RAW, 0, &raw);
 
-		/* if the lock is released, but the copy is still there
-		 * that's because someone else broke the lock
+		/*
+		 * The cooked frame of a capture is published right after its
+		 * raw one, with the same seq and timestamp. Catch up with
+		 * whichever of the two is behind until they match.
 		 */
-		if (data_buffer.data_copy) {
-			data_buffer.data_copy = NULL;
-			return -EINTR;
-		}
-
-		if (cooked_data) {
-			/* make sure space is allocated */
-			if (*cooked_data) {
-				*cooked_data = g_renew(gfloat *, *cooked_data,
-							num_active_channels);
-				new = FALSE;
+		if (!ret && cooked_data)
+			ret = plugin_capture_wait(pc->sub, OSC_FRAME_COOKED,
+					raw->timestamp - 1, &cooked);
+		while (!ret && cooked && cooked->seq != raw->seq) {
+			if (cooked->seq < raw->seq) {
+				after = raw->timestamp - 1;
+				osc_frame_unref(cooked);
+				ret = plugin_capture_wait(pc->sub,
+						OSC_FRAME_COOKED, after, &cooked);
 			} else {
-				*cooked_data = g_new(gfloat *, num_active_channels);
-				new = TRUE;
+				after = cooked->timestamp - 1;
+				osc_frame_unref(raw);
+				ret = plugin_capture_wait(pc->sub,
+						OSC_FRAME_RAW, after, &raw);
 			}
+		}
+		if (ret < 0)
+			goto out;
+
+		after = raw->timestamp;
+		if (*buf != pc->buf || pc->buf_size != raw->len) {
+			*buf = g_renew(int8_t, *buf, raw->len);
+			pc->buf = *buf;
+			pc->buf_size = raw->len;
+		}
+		memcpy(*buf, raw->data, raw->len);
 
-			if (!*cooked_data)
+		if (cooked_data) {
+			/* the pool frame is shaped after the real channel layout */
+			if (plugin_cooked_alloc(pc, cooked_data,
+					cooked->num_channels, cooked->len) < 0)
 				goto capture_malloc_fail;
 
-			for (i = 0; i < num_active_channels; i++) {
-				if (new)
-					(*cooked_data)[i] = g_new(gfloat,
-							data_buffer.size / bytes_per_sample);
-				else
-					(*cooked_data)[i] = g_renew(gfloat,
-							(*cooked_data)[i],
-							data_buffer.size / bytes_per_sample);
-
-				if (!(*cooked_data)[i])
-					goto capture_malloc_fail;
-
-				for (j = 0; j < data_buffer.size / bytes_per_sample; j++)
-					(*cooked_data)[i][j] = 0.0f;
-			}
-
-			/* Now that we have the space, process it */
-			 demux_data_stream(*buf, *cooked_data,
-					data_buffer.size / 4, 0, data_buffer.size / 4,
-					channels, num_active_channels);
+			for (i = 0; i < (int)cooked->num_channels; i++)
+				memcpy((*cooked_data)[i], cooked->channel[i],
+						cooked->len * sizeof(gfloat));
 		}
 	}
 
-	if (markers_cp) {
-		if (!is_fft_mode) {
-			if (*markers_cp) {
-				g_free(*markers_cp);
-				*markers_cp = NULL;
-			}
-			return 0;
+	if (types & OSC_FRAME_MASK(OSC_FRAME_MARKERS)) {
+		/* the markers of that frame, or of a later one */
+		ret = plugin_capture_wait(pc->sub, OSC_FRAME_MARKERS, after,
+				&frame);
+		if (ret < 0)
+			goto out;
+
+		if (*markers_cp != pc->markers || !*markers_cp) {
+			*markers_cp = g_renew(struct marker_type, *markers_cp,
+					MAX_MARKERS + 2);
+			pc->markers = *markers_cp;
 		}
+		memcpy(*markers_cp, frame->markers,
+				sizeof(struct marker_type) * MAX_MARKERS);
+		osc_frame_unref(frame);
+	}
 
-		/* One consumer at a time */
-		if (markers_copy)
-			return -EBUSY;
+out:
+	osc_frame_unref(raw);
+	osc_frame_unref(cooked);
+	frame_bus_set_types(pc->sub, 0);
+	return ret;
 
-		/* make sure space is allocated */
-		if (*markers_cp)
-			*markers_cp = g_renew(struct marker_type, *markers_cp, MAX_MARKERS + 2);
-		else
-			*markers_cp = g_new(struct marker_type, MAX_MARKERS + 2);
+capture_malloc_fail:
+	printf("%s:%s malloc failed\n", __FILE__, __func__);
+	osc_frame_unref(raw);
+	osc_frame_unref(cooked);
+	if (pc)
+		frame_bus_set_types(pc->sub, 0);
+	return -ENOMEM;
+}
 
-		if (!*markers_cp)
-			goto capture_malloc_fail;
+/*
+ * The next frame of type of the device, handed out by reference rather
+ * than copied: it's the capture's own buffer, which goes back to its pool
+ * for the next capture once the caller drops it with osc_frame_unref().
+ */
+int plugin_data_capture_frame(const char *device, enum osc_frame_type type,
+		const struct osc_frame **frame)
+{
+	struct plugin_capture *pc;
+	int ret;
 
-		/* where to put the copy */
-		markers_copy = *markers_cp;
+	*frame = NULL;
+	if (capture_ctx.buffer.size == 0 || !device ||
+			strcmp(current_device, device))
+		return -ENXIO;
+	if (type >= OSC_FRAME_NUM_TYPES)
+		return -EINVAL;
 
-		/* Wait til the copy is complete */
-		G_LOCK(markers_copy);
+	pc = plugin_capture_get(device, OSC_FRAME_MASK(type));
+	if (!pc)
+		return -ENOMEM;
 
-		/* if the lock is released, but the copy is still there
-		 * that's because someone else broke the lock
-		 */
-		if (markers_copy) {
-			markers_copy = NULL;
-			return -EINTR;
-		}
+	ret = plugin_capture_wait(pc->sub, type, 0, frame);
+	frame_bus_set_types(pc->sub, 0);
+
+	return ret;
+}
+
+struct frame_sub * plugin_subscribe(const char *device, unsigned int types,
+		double max_rate, osc_frame_func func, void *user_data)
+{
+	return frame_bus_subscribe(frame_bus, device, types, max_rate,
+			func, user_data);
+}
+
+void plugin_unsubscribe(struct frame_sub *sub)
+{
+	frame_bus_unsubscribe(sub);
+}
+
+void plugin_subscribe_types(struct frame_sub *sub, unsigned int types)
+{
+	frame_bus_set_types(sub, types);
+}
+
+const struct osc_frame * plugin_frame_get(struct frame_sub *sub,
+		enum osc_frame_type type)
+{
+	return frame_bus_take(sub, type);
+}
+
+int plugin_frame_wait(struct frame_sub *sub, enum osc_frame_type type,
+		gint64 after, int timeout_ms, struct frame_cancel *cancel,
+		const struct osc_frame **frame)
+{
+	return frame_bus_wait(sub, type, after, timeout_ms, cancel, frame);
+}
+
+struct frame_cancel * plugin_cancel_new(void)
+{
+	return frame_cancel_new(frame_bus);
+}
+
+void plugin_cancel_free(struct frame_cancel *cancel)
+{
+	frame_cancel_free(cancel);
+}
+
+static void extra_capture_free(struct capture_context *ctx)
+{
+	capture_context_stop(ctx);
+	free_channel_array(ctx->channels, ctx->num_channels);
+	g_free((char *)ctx->device);
+	g_free(ctx);
+}
+
+/*
+ * Capture a device other than the one in the main window, in parallel
+ * with it, using the channels currently enabled in its scan_elements.
+ * Its frames go out on the frame bus like those of the main capture, all
+ * timestamped with the monotonic clock: to pair them up, subscribe to
+ * both devices, take a frame of one and wait for the other with after
+ * set just before its timestamp.
+ */
+int plugin_capture_start(const char *device, unsigned int num_samples)
+{
+	struct capture_context *ctx;
+	struct iio_channel_info *chn;
+	unsigned int num;
+	int ret;
+
+	if (extra_capture_find(device) ||
+			(capture_ctx.ring && !strcmp(capture_ctx.device, device)))
+		return -EBUSY;
+
+	ret = set_dev_paths(device);
+	if (ret < 0)
+		return ret;
+
+	ret = build_channel_array(dev_name_dir(), &chn, &num);
+	if (ret < 0)
+		goto restore_paths;
+
+	ctx = g_new0(struct capture_context, 1);
+	capture_context_init(ctx, g_strdup(device), chn, num);
+	if (!ctx->num_active_channels) {
+		ret = -EINVAL;
+		goto err_free;
 	}
-	return 0;
 
+	ctx->buffer.size = num_samples * ctx->bytes_per_sample;
+	ctx->frame_done = capture_frame_done;
+	ret = capture_context_start(ctx, num_samples);
+	if (ret < 0)
+		goto err_free;
+
+	extra_captures = g_slist_append(extra_captures, ctx);
+	goto restore_paths;
+
+err_free:
+	extra_capture_free(ctx);
+restore_paths:
+	/* the main thread's paths are expected to point at current_device */
+	if (current_device)
+		set_dev_paths(current_device);
+	return ret;
+}
+
+void plugin_capture_stop(const char *device)
+{
+	struct capture_context *ctx = extra_capture_find(device);
 
-capture_malloc_fail:
-	printf("%s:%s malloc failed\n", __FILE__, __func__);
-	return -ENOMEM;
+	if (!ctx)
+		return;
+
+	/* wake up whoever waits for its frames, and only them */
+	frame_bus_interrupt_device(frame_bus, device);
+	extra_captures = g_slist_remove(extra_captures, ctx);
+	extra_capture_free(ctx);
+
+	if (current_device)
+		set_dev_paths(current_device);
 }
 
 static int time_capture_setup(void)
 {
-	gboolean is_constellation;
+	gboolean is_constellation, is_lines;
 	unsigned int i, j;
 
 	is_constellation = gtk_combo_box_get_active(GTK_COMBO_BOX(plot_domain)) == XY_PLOT;
@@ -1648,11 +2265,7 @@ static int time_capture_setup(void)
 	gtk_databox_graph_remove_all(GTK_DATABOX(databox));
 
 	num_samples = gtk_spin_button_get_value(GTK_SPIN_BUTTON(sample_count_widget));
-	data_buffer.size = num_samples * bytes_per_sample;
-
-	data_buffer.data = g_renew(int8_t, data_buffer.data, data_buffer.size);
-	data_buffer.data_copy = NULL;
-	markers_copy = NULL;
+	capture_ctx.buffer.size = num_samples * bytes_per_sample;
 
 	X = g_renew(gfloat, X, num_samples);
 
@@ -1675,10 +2288,24 @@ static int time_capture_setup(void)
 
 	prev_num_active_ch = num_active_channels;
 
+	is_lines = !strcmp(gtk_combo_box_text_get_active_text(GTK_COMBO_BOX_TEXT(plot_type)), "Lines");
+
+	/*
+	 * Constellation lines connect consecutive samples, so there is nothing
+	 * to drop there; everything else draws the reduced copy.
+	 */
+	if (is_constellation && is_lines)
+		plot_lod_free();
+	else if (is_constellation)
+		plot_lod_alloc(1, num_samples, true);
+	else
+		plot_lod_alloc(num_active_channels,
+				MIN(num_samples, 2 * LOD_MAX_COLUMNS), false);
+
 	if (is_constellation) {
-		if (strcmp(gtk_combo_box_text_get_active_text(GTK_COMBO_BOX_TEXT(plot_type)), "Lines"))
-			fft_graph = gtk_databox_points_new(num_samples, channel_data[0],
-					channel_data[1], &color_graph[0], 3);
+		if (!is_lines)
+			fft_graph = gtk_databox_points_new(lod_points, lod_x[0],
+					lod_y[0], &color_graph[0], 3);
 		else
 			fft_graph = gtk_databox_lines_new(num_samples, channel_data[0],
 					channel_data[1], &color_graph[0], line_thickness);
@@ -1689,12 +2316,12 @@ static int time_capture_setup(void)
 			if (!channels[i].enabled)
 				continue;
 
-			if (strcmp(gtk_combo_box_text_get_active_text(GTK_COMBO_BOX_TEXT(plot_type)), "Lines"))
-				channel_graph[j] = gtk_databox_points_new(num_samples, X,
-					channel_data[j], &color_graph[i], 3);
+			if (!is_lines)
+				channel_graph[j] = gtk_databox_points_new(lod_points, lod_x[j],
+					lod_y[j], &color_graph[i], 3);
 			else
-				channel_graph[j] = gtk_databox_lines_new(num_samples, X,
-					channel_data[j], &color_graph[i], line_thickness);
+				channel_graph[j] = gtk_databox_lines_new(lod_points, lod_x[j],
+					lod_y[j], &color_graph[i], line_thickness);
 
 			gtk_databox_graph_add(GTK_DATABOX(databox), channel_graph[j]);
 			j++;
@@ -1714,31 +2341,118 @@ static int time_capture_setup(void)
 
 static void time_capture_start()
 {
-	capture_function = g_idle_add((GSourceFunc) time_capture_func, databox);
+	capture_function = g_timeout_add(display_interval_ms,
+			(GSourceFunc) time_capture_func, databox);
+}
+
+static void soft_trigger_get_config(struct soft_trigger_config *cfg)
+{
+	cfg->mode = gtk_combo_box_get_active(GTK_COMBO_BOX(trigger_mode_widget));
+	cfg->type = gtk_combo_box_get_active(GTK_COMBO_BOX(trigger_type_widget));
+	cfg->falling = gtk_combo_box_get_active(GTK_COMBO_BOX(trigger_edge_widget)) == 1;
+	cfg->channel = gtk_spin_button_get_value(GTK_SPIN_BUTTON(trigger_channel_widget));
+	cfg->level = gtk_spin_button_get_value(GTK_SPIN_BUTTON(trigger_level_widget));
+	cfg->hysteresis = gtk_spin_button_get_value(GTK_SPIN_BUTTON(trigger_hysteresis_widget));
+	cfg->pretrigger = gtk_spin_button_get_value(GTK_SPIN_BUTTON(trigger_pretrigger_widget));
+	cfg->holdoff = gtk_spin_button_get_value(GTK_SPIN_BUTTON(trigger_holdoff_widget));
+}
+
+static void soft_trigger_changed(GtkWidget *widget, gpointer data)
+{
+	GtkToggleToolButton *btn = GTK_TOGGLE_TOOL_BUTTON(capture_button);
+	struct soft_trigger_config cfg;
+	bool triggered;
+
+	soft_trigger_get_config(&cfg);
+	capture_context_set_trigger(&capture_ctx, &cfg);
+
+	if (!gtk_toggle_tool_button_get_active(btn) || !capture_ctx.device)
+		return;
+
+	/* Switching between free running and triggered needs a restart */
+	triggered = cfg.mode != SOFT_TRIGGER_OFF &&
+		!capture_is_oneshot(capture_ctx.device);
+	if (triggered != capture_ctx.triggered) {
+		gtk_toggle_tool_button_set_active(btn, FALSE);
+		gtk_toggle_tool_button_set_active(btn, TRUE);
+	}
+}
+
+static void soft_trigger_arm_clicked(GtkButton *btn, gpointer data)
+{
+	capture_context_trigger_rearm(&capture_ctx);
+}
+
+static double read_sampling_frequency(void);
+
+static void record_button_toggled(GtkToggleToolButton *btn, gpointer data)
+{
+	struct recorder_info info;
+	struct recorder *rec;
+	GtkWidget *dialog;
+	char *filename = NULL, *name;
+
+	if (!gtk_toggle_tool_button_get_active(btn)) {
+		record_stop();
+		return;
+	}
+
+	if (!capture_ctx.thread) {
+		gtk_toggle_tool_button_set_active(btn, FALSE);
+		return;
+	}
+
+	dialog = gtk_file_chooser_dialog_new("Record raw data to",
+			GTK_WINDOW(gtk_widget_get_toplevel(GTK_WIDGET(btn))),
+			GTK_FILE_CHOOSER_ACTION_SAVE,
+			GTK_STOCK_CANCEL, GTK_RESPONSE_CANCEL,
+			GTK_STOCK_MEDIA_RECORD, GTK_RESPONSE_ACCEPT,
+			NULL);
+	gtk_file_chooser_set_do_overwrite_confirmation(GTK_FILE_CHOOSER(dialog), TRUE);
+	gtk_file_chooser_set_current_folder(GTK_FILE_CHOOSER(dialog), getenv("HOME"));
+	name = g_strdup_printf("%s.iiorec", current_device);
+	gtk_file_chooser_set_current_name(GTK_FILE_CHOOSER(dialog), name);
+	g_free(name);
+
+	if (gtk_dialog_run(GTK_DIALOG(dialog)) == GTK_RESPONSE_ACCEPT)
+		filename = gtk_file_chooser_get_filename(GTK_FILE_CHOOSER(dialog));
+	gtk_widget_destroy(dialog);
+
+	if (!filename) {
+		gtk_toggle_tool_button_set_active(btn, FALSE);
+		return;
+	}
+
+	info.device = capture_ctx.device;
+	info.channels = capture_ctx.channels;
+	info.num_channels = capture_ctx.num_channels;
+	info.sample_rate = read_sampling_frequency();
+	info.lo_freq = lo_freq * 1000000.0;
+
+	rec = recorder_new(filename, &info, capture_ctx.buffer.size);
+	g_free(filename);
+	if (!rec) {
+		gtk_toggle_tool_button_set_active(btn, FALSE);
+		return;
+	}
+
+	capture_context_set_recorder(&capture_ctx, rec);
 }
 
 static void capture_button_clicked(GtkToggleToolButton *btn, gpointer data)
 {
-	unsigned int i;
+	struct soft_trigger_config trigger_cfg;
 	int ret;
 	char buf[10];
 
 	if (gtk_toggle_tool_button_get_active(btn)) {
 		gtk_databox_graph_remove_all(GTK_DATABOX(databox));
 
-		G_TRYLOCK(buffer_full);
-		G_TRYLOCK(markers_copy);
-
-		data_buffer.available = 0;
-		current_sample = 0;
-		num_active_channels = 0;
-		bytes_per_sample = 0;
-		for (i = 0; i < num_channels; i++) {
-			if (channels[i].enabled) {
-				bytes_per_sample += channels[i].bytes;
-				num_active_channels++;
-			}
-		}
+		capture_context_init(&capture_ctx, current_device,
+				channels, num_channels);
+		capture_ctx.frame_done = capture_frame_done;
+		num_active_channels = capture_ctx.num_active_channels;
+		bytes_per_sample = capture_ctx.bytes_per_sample;
 
 		if (gtk_combo_box_get_active(GTK_COMBO_BOX(plot_domain)) == FFT_PLOT) {
 			sprintf(buf, "%sHz", adc_scale);
@@ -1754,11 +2468,12 @@ static void capture_button_clicked(GtkToggleToolButton *btn, gpointer data)
 		if (ret)
 			goto play_err;
 
-		if (!is_oneshot_mode()) {
-			buffer_fd = buffer_open(num_samples, O_NONBLOCK);
-			if (buffer_fd < 0)
-				goto play_err;
-		}
+		soft_trigger_get_config(&trigger_cfg);
+		capture_context_set_trigger(&capture_ctx, &trigger_cfg);
+
+		if (capture_context_start(&capture_ctx,
+					capture_ctx.buffer.size / bytes_per_sample))
+			goto play_err;
 
 		add_grid();
 		gtk_widget_queue_draw(GTK_WIDGET(databox));
@@ -1770,24 +2485,19 @@ static void capture_button_clicked(GtkToggleToolButton *btn, gpointer data)
 			time_capture_start();
 
 	} else {
-		G_TRYLOCK(buffer_full);
-		G_UNLOCK(buffer_full);
-		G_TRYLOCK(markers_copy);
-		G_UNLOCK(markers_copy);
+		frame_bus_interrupt(frame_bus);
 
 		if (capture_function > 0) {
 			g_source_remove(capture_function);
 			capture_function = 0;
 		}
-		if (buffer_fd >= 0) {
-			buffer_close(buffer_fd);
-			buffer_fd = -1;
-		}
+		capture_stop();
 	}
 
 	return;
 
 play_err:
+	capture_stop();
 	gtk_toggle_tool_button_set_active(btn, FALSE);
 }
 
@@ -1807,9 +2517,13 @@ static void enable_auto_scale_cb(GtkToggleButton *btn, gpointer data)
 
 static double read_sampling_frequency(void)
 {
+	struct replay_source *replay = replay_find(current_device);
 	double freq = 1.0;
 	int ret;
 
+	if (replay)
+		return replay->sample_rate;
+
 	if (set_dev_paths(current_device) < 0)
 		return -1.0f;
 
@@ -1856,6 +2570,9 @@ void rx_update_labels(void)
 {
 	char buf[20];
 
+	/* something changed the device setup */
+	capture_session_invalidate();
+
 	adc_freq = read_sampling_frequency();
 	adc_freq_raw = adc_freq;
 	time_interval_adjust();
@@ -1876,7 +2593,9 @@ void rx_update_labels(void)
 
 	gtk_label_set_text(GTK_LABEL(adc_freq_label), buf);
 
-	if (!set_dev_paths("adf4351-rx-lpc"))
+	if (replay_is_device(current_device))
+		lo_freq = replay_find(current_device)->lo_freq;
+	else if (!set_dev_paths("adf4351-rx-lpc"))
 		read_devattr_double("out_altvoltage0_frequency", &lo_freq);
 	else if (!set_dev_paths("ad9361-phy"));
 		read_devattr_double("out_altvoltage0_RX_LO_frequency", &lo_freq);
@@ -2082,6 +2801,8 @@ static void close_plugins(void)
 		plugin = node->data;
 		if (plugin) {
 			printf("Closing plugin: %s\n", plugin->name);
+			if (plugin->destroy)
+				plugin->destroy();
 			dlclose(plugin->handle);
 		}
 	}
@@ -2269,6 +2990,8 @@ static void device_list_cb(GtkWidget *widget, gpointer data)
 	if (num_channels)
 		free_channel_array(channels, num_channels);
 
+	capture_session_invalidate();
+
 	current_device = gtk_combo_box_text_get_active_text(GTK_COMBO_BOX_TEXT(device_list_widget));
 
 	trigger_update_current_device();
@@ -2276,12 +2999,19 @@ static void device_list_cb(GtkWidget *widget, gpointer data)
 	if (!current_device)
 		return;
 
-	set_dev_paths(current_device);
-	plugin_setup_validation_fct = find_setup_check_fct_by_devname(current_device);
-
-	ret = build_channel_array(dev_name_dir(), &channels, &num_channels);
-	if (ret)
+	if (replay_is_device(current_device)) {
+		plugin_setup_validation_fct = NULL;
+		ret = replay_build_channel_array(replay_find(current_device),
+				&channels, &num_channels);
+	} else {
+		set_dev_paths(current_device);
+		plugin_setup_validation_fct = find_setup_check_fct_by_devname(current_device);
+		ret = build_channel_array(dev_name_dir(), &channels, &num_channels);
+	}
+	if (ret) {
+		num_channels = 0;
 		return;
+	}
 
 	for (i = 0; i < num_channels; i++) {
 		if (strncmp("in", channels[i].name, 2) == 0 &&
@@ -2295,10 +3025,15 @@ static void device_list_cb(GtkWidget *widget, gpointer data)
 
 }
 
+/* Replay files given on the command line, added to the device list */
+static GSList *replay_files;
+
 static void init_device_list(void)
 {
 	char *devices = NULL, *device;
+	const char *name;
 	unsigned int num;
+	GSList *node;
 
 	g_signal_connect(device_list_widget, "changed",
 			G_CALLBACK(device_list_cb), NULL);
@@ -2314,13 +3049,58 @@ static void init_device_list(void)
 			device += strlen(device) + 1;
 		}
 		free(devices);
+	}
 
-		gtk_combo_box_set_active(GTK_COMBO_BOX(device_list_widget), 0);
+	for (node = replay_files; node; node = g_slist_next(node)) {
+		name = replay_add(node->data);
+		if (name)
+			gtk_combo_box_text_append_text(GTK_COMBO_BOX_TEXT(device_list_widget),
+					name);
 	}
 
+	gtk_combo_box_set_active(GTK_COMBO_BOX(device_list_widget), 0);
+
 	device_list_cb(device_list_widget, NULL);
 }
 
+static int comboboxtext_set_active_by_string(GtkComboBox *combo_box, const char *name);
+
+static void replay_open_cb(GtkMenuItem *item, gpointer data)
+{
+	GtkWidget *dialog;
+	char *filename = NULL;
+	const char *name;
+
+	dialog = gtk_file_chooser_dialog_new("Open file for replay",
+			NULL, GTK_FILE_CHOOSER_ACTION_OPEN,
+			GTK_STOCK_CANCEL, GTK_RESPONSE_CANCEL,
+			GTK_STOCK_OPEN, GTK_RESPONSE_ACCEPT,
+			NULL);
+	gtk_file_chooser_set_current_folder(GTK_FILE_CHOOSER(dialog),
+			OSC_WAVEFORM_FILE_PATH);
+
+	if (gtk_dialog_run(GTK_DIALOG(dialog)) == GTK_RESPONSE_ACCEPT)
+		filename = gtk_file_chooser_get_filename(GTK_FILE_CHOOSER(dialog));
+	gtk_widget_destroy(dialog);
+
+	if (!filename)
+		return;
+
+	name = replay_add(filename);
+	g_free(filename);
+	if (!name) {
+		create_blocking_popup(GTK_MESSAGE_ERROR, GTK_BUTTONS_CLOSE,
+				"Replay", "The file is neither a recording nor a waveform.");
+		return;
+	}
+
+	if (!comboboxtext_set_active_by_string(GTK_COMBO_BOX(device_list_widget), name)) {
+		gtk_combo_box_text_append_text(GTK_COMBO_BOX_TEXT(device_list_widget),
+				name);
+		comboboxtext_set_active_by_string(GTK_COMBO_BOX(device_list_widget), name);
+	}
+}
+
 void channel_toggled(GtkCellRendererToggle* renderer, gchar* pathStr, gpointer data)
 {
 	GtkTreePath* path = gtk_tree_path_new_from_string(pathStr);
@@ -2331,12 +3111,20 @@ void channel_toggled(GtkCellRendererToggle* renderer, gchar* pathStr, gpointer d
 	FILE *f;
 	int ret;
 
-	set_dev_paths(current_device);
-
 	gtk_tree_model_get_iter(GTK_TREE_MODEL (data), &iter, path);
 	gtk_tree_model_get(GTK_TREE_MODEL (data), &iter, 1, &enabled, 2, &channel, -1);
 	enabled = !enabled;
 
+	/* replay sources leave out disabled channels themselves */
+	if (replay_is_device(current_device)) {
+		channel->enabled = enabled;
+		gtk_list_store_set(GTK_LIST_STORE (data), &iter, 1, enabled, -1);
+		gtk_tree_path_free(path);
+		return;
+	}
+
+	set_dev_paths(current_device);
+
 	snprintf(buf, sizeof(buf), "%s/scan_elements/%s_en", dev_name_dir(), channel->name);
 	f = fopen(buf, "w");
 	if (f) {
@@ -2353,6 +3141,8 @@ void channel_toggled(GtkCellRendererToggle* renderer, gchar* pathStr, gpointer d
 
 	channel->enabled = enabled;
 	gtk_list_store_set(GTK_LIST_STORE (data), &iter, 1, enabled, -1);
+
+	capture_session_invalidate();
 }
 
 static gboolean capture_button_icon_transform(GBinding *binding,
@@ -2415,8 +3205,8 @@ static gboolean check_valid_setup()
 
 	/* Basic validation rules */
 	if (gtk_combo_box_get_active(GTK_COMBO_BOX(plot_domain)) == FFT_PLOT) {
-		if (j != 2 && j != 1) {
-			gtk_widget_set_tooltip_text(capture_button, "FFT needs 2 channels or less");
+		if (j == 0) {
+			gtk_widget_set_tooltip_text(capture_button, "FFT needs at least one channel");
 			goto capture_button_err;
 		}
 	} else if (gtk_combo_box_get_active(GTK_COMBO_BOX(plot_domain)) == XY_PLOT) {
@@ -2541,9 +3331,18 @@ void capture_profile_save(const char *filename)
 	tmp_int = gtk_spin_button_get_value(GTK_SPIN_BUTTON(fft_avg_widget));
 	fprintf(inifp, "fft_avg=%d\n", tmp_int);
 
+	tmp_string = gtk_combo_box_text_get_active_text(GTK_COMBO_BOX_TEXT(fft_avg_mode_widget));
+	fprintf(inifp, "fft_avg_type=%s\n", tmp_string);
+	g_free(tmp_string);
+
 	tmp_float = gtk_spin_button_get_value(GTK_SPIN_BUTTON(fft_pwr_offset_widget));
 	fprintf(inifp, "fft_pwr_offset=%f\n", tmp_float);
 
+	tmp_int = gtk_toggle_button_get_active(GTK_TOGGLE_BUTTON(fft_zoom_widget));
+	fprintf(inifp, "fft_zoom=%d\n", tmp_int);
+	fprintf(inifp, "fft_zoom_center=%f\n", zoom_center);
+	fprintf(inifp, "fft_zoom_span=%f\n", zoom_span);
+
 	tmp_string = gtk_combo_box_text_get_active_text(GTK_COMBO_BOX_TEXT(plot_type));
 	fprintf(inifp, "graph_type=%s\n", tmp_string);
 	g_free(tmp_string);
@@ -2551,6 +3350,9 @@ void capture_profile_save(const char *filename)
 	tmp_int = gtk_toggle_button_get_active(GTK_TOGGLE_BUTTON(show_grid));
 	fprintf(inifp, "show_grid=%d\n", tmp_int);
 
+	tmp_int = gtk_toggle_button_get_active(GTK_TOGGLE_BUTTON(show_waterfall));
+	fprintf(inifp, "show_waterfall=%d\n", tmp_int);
+
 	tmp_int = gtk_toggle_button_get_active(GTK_TOGGLE_BUTTON(enable_auto_scale));
 	fprintf(inifp, "enable_auto_scale=%d\n", tmp_int);
 
@@ -2728,15 +3530,40 @@ int capture_profile_handler(const char* name, const char *value)
 				if (ret == 0)
 					printf("found invalid fft size in .ini file\n");
 			} else if (MATCH_NAME("fft_avg")) {
-				gtk_spin_button_set_value(GTK_SPIN_BUTTON(fft_avg_widget), atoi(value));
+				/* older profiles had the holds as 0 and 128 */
+				i = atoi(value);
+				if (i == 0)
+					gtk_combo_box_set_active(GTK_COMBO_BOX(fft_avg_mode_widget),
+							FFT_AVG_PEAK_HOLD);
+				else if (i == 128)
+					gtk_combo_box_set_active(GTK_COMBO_BOX(fft_avg_mode_widget),
+							FFT_AVG_MIN_HOLD);
+				gtk_spin_button_set_value(GTK_SPIN_BUTTON(fft_avg_widget), i);
+			} else if (MATCH_NAME("fft_avg_type")) {
+				ret = comboboxtext_set_active_by_string(GTK_COMBO_BOX(fft_avg_mode_widget), value);
+				if (ret == 0)
+					printf("found invalid fft average type in .ini file\n");
 			} else if (MATCH_NAME("fft_pwr_offset")) {
 				gtk_spin_button_set_value(GTK_SPIN_BUTTON(fft_pwr_offset_widget), atof(value));
+			} else if (MATCH_NAME("fft_zoom")) {
+				/* the profile has the center and span, not the plot */
+				g_signal_handlers_block_by_func(fft_zoom_widget,
+						fft_zoom_toggled, NULL);
+				gtk_toggle_button_set_active(GTK_TOGGLE_BUTTON(fft_zoom_widget), atoi(value));
+				g_signal_handlers_unblock_by_func(fft_zoom_widget,
+						fft_zoom_toggled, NULL);
+			} else if (MATCH_NAME("fft_zoom_center")) {
+				zoom_center = atof(value);
+			} else if (MATCH_NAME("fft_zoom_span")) {
+				zoom_span = atof(value);
 			} else if (MATCH_NAME("graph_type")) {
 				ret = comboboxtext_set_active_by_string(GTK_COMBO_BOX(plot_type), value);
 				if (ret == 0)
 					printf("found invalid graph type in .ini file\n");
 			} else if (MATCH_NAME("show_grid")) {
 				gtk_toggle_button_set_active(GTK_TOGGLE_BUTTON(show_grid), atoi(value));
+			} else if (MATCH_NAME("show_waterfall")) {
+				gtk_toggle_button_set_active(GTK_TOGGLE_BUTTON(show_waterfall), atoi(value));
 			} else if (MATCH_NAME("enable_auto_scale")) {
 				gtk_toggle_button_set_active(GTK_TOGGLE_BUTTON(enable_auto_scale), atoi(value));
 			} else if (MATCH_NAME("x_axis_min")) {
@@ -2882,16 +3709,18 @@ void application_quit (void)
 	if (capture_function > 0) {
 		g_source_remove(capture_function);
 		capture_function = 0;
-		G_TRYLOCK(buffer_full);
-		G_UNLOCK(buffer_full);
-		G_TRYLOCK(markers_copy);
-		G_UNLOCK(markers_copy);
+		frame_bus_interrupt(frame_bus);
 	}
-	if (buffer_fd >= 0) {
-		buffer_close(buffer_fd);
-		buffer_fd = -1;
+	capture_stop();
+	while (extra_captures) {
+		extra_capture_free(extra_captures->data);
+		extra_captures = g_slist_delete_link(extra_captures, extra_captures);
 	}
 	free_setup_check_fct_list();
+	replay_remove_all();
+	stats_server_stop();
+	fft_plans_cleanup();
+	waterfall_free(&waterfall);
 
 	if (gtk_main_level())
 		gtk_main_quit();
@@ -2901,6 +3730,8 @@ void application_quit (void)
 	 */
 	close_plugins();
 	g_slist_free(dplugin_list);
+	frame_bus_free(frame_bus);
+	frame_bus = NULL;
 }
 
 void sigterm (int signum)
@@ -3037,19 +3868,32 @@ static void init_application (void)
 	sample_count_widget = GTK_WIDGET(gtk_builder_get_object(builder, "sample_count"));
 	fft_size_widget = GTK_WIDGET(gtk_builder_get_object(builder, "fft_size"));
 	fft_avg_widget = GTK_WIDGET(gtk_builder_get_object(builder, "fft_avg"));
+	fft_avg_mode_widget = GTK_WIDGET(gtk_builder_get_object(builder, "fft_avg_type"));
 	fft_pwr_offset_widget = GTK_WIDGET(gtk_builder_get_object(builder, "pwr_offset"));
+	fft_zoom_widget = GTK_WIDGET(gtk_builder_get_object(builder, "fft_zoom"));
 	plot_domain = GTK_WIDGET(gtk_builder_get_object(builder, "capture_domains"));
 	adc_freq_label = GTK_WIDGET(gtk_builder_get_object(builder, "adc_freq_label"));
 	rx_lo_freq_label = GTK_WIDGET(gtk_builder_get_object(builder, "rx_lo_freq_label"));
+	capture_stats_label = GTK_WIDGET(gtk_builder_get_object(builder, "capture_stats_label"));
 	show_grid = GTK_WIDGET(gtk_builder_get_object(builder, "show_grid"));
+	show_waterfall = GTK_WIDGET(gtk_builder_get_object(builder, "show_waterfall"));
 	enable_auto_scale = GTK_WIDGET(gtk_builder_get_object(builder, "auto_scale"));
 	notebook = GTK_WIDGET(gtk_builder_get_object(builder, "notebook"));
 	device_list_widget = GTK_WIDGET(gtk_builder_get_object(builder, "input_device_list"));
 	capture_button = GTK_WIDGET(gtk_builder_get_object(builder, "capture_button"));
+	record_button = GTK_WIDGET(gtk_builder_get_object(builder, "record_button"));
 	hor_scale = GTK_WIDGET(gtk_builder_get_object(builder, "hor_scale"));
 	marker_label = GTK_WIDGET(gtk_builder_get_object(builder, "marker_info"));
 	plot_type = GTK_WIDGET(gtk_builder_get_object(builder, "plot_type"));
 	time_unit_lbl = GTK_WIDGET(gtk_builder_get_object(builder, "time_unit_label"));
+	trigger_mode_widget = GTK_WIDGET(gtk_builder_get_object(builder, "trigger_mode"));
+	trigger_type_widget = GTK_WIDGET(gtk_builder_get_object(builder, "trigger_type"));
+	trigger_edge_widget = GTK_WIDGET(gtk_builder_get_object(builder, "trigger_edge"));
+	trigger_channel_widget = GTK_WIDGET(gtk_builder_get_object(builder, "trigger_channel"));
+	trigger_level_widget = GTK_WIDGET(gtk_builder_get_object(builder, "trigger_level"));
+	trigger_hysteresis_widget = GTK_WIDGET(gtk_builder_get_object(builder, "trigger_hysteresis"));
+	trigger_pretrigger_widget = GTK_WIDGET(gtk_builder_get_object(builder, "trigger_pretrigger"));
+	trigger_holdoff_widget = GTK_WIDGET(gtk_builder_get_object(builder, "trigger_holdoff"));
 
 	channel_list_store = GTK_LIST_STORE(gtk_builder_get_object(builder, "channel_list"));
 	g_builder_connect_signal(builder, "channel_toggle", "toggled",
@@ -3058,7 +3902,7 @@ static void init_application (void)
 	dialogs_init(builder);
 	trigger_dialog_init(builder);
 
-	gtk_combo_box_set_active(GTK_COMBO_BOX(fft_size_widget), 2);
+	gtk_combo_box_set_active(GTK_COMBO_BOX(fft_size_widget), 6);
 
 	/* Bind the plot mode radio buttons to the sensitivity of the sample count
 	 * and FFT size widgets */
@@ -3073,6 +3917,12 @@ static void init_application (void)
 			0, domain_is_fft, NULL, NULL, NULL);
 	g_object_bind_property_full(plot_domain, "active", fft_avg_widget, "visible",
 			0, domain_is_fft, NULL, NULL, NULL);
+	g_object_bind_property_full(plot_domain, "active", fft_avg_mode_widget, "visible",
+			0, domain_is_fft, NULL, NULL, NULL);
+	g_object_bind_property_full(plot_domain, "active", fft_zoom_widget, "visible",
+			0, domain_is_fft, NULL, NULL, NULL);
+	g_signal_connect(fft_zoom_widget, "toggled",
+			G_CALLBACK(fft_zoom_toggled), NULL);
 
 	tmp = GTK_WIDGET(gtk_builder_get_object(builder, "pwr_offset_label"));
 	g_object_bind_property_full(plot_domain, "active", tmp, "visible",
@@ -3115,8 +3965,19 @@ static void init_application (void)
 				G_CALLBACK(marker_button), NULL);
 	g_signal_connect(GTK_DATABOX(databox), "button_release_event",
 				G_CALLBACK(marker_button), NULL);
+	g_signal_connect(GTK_DATABOX(databox), "expose-event",
+				G_CALLBACK(redraw_begin), NULL);
+	g_signal_connect_after(GTK_DATABOX(databox), "expose-event",
+				G_CALLBACK(redraw_end), NULL);
+	g_signal_connect(GTK_DATABOX(databox), "zoomed",
+				G_CALLBACK(plot_lod_view_changed), NULL);
+	g_signal_connect(gtk_databox_get_adjustment_x(GTK_DATABOX(databox)),
+				"value-changed", G_CALLBACK(plot_lod_view_changed), NULL);
+	g_signal_connect(gtk_databox_get_adjustment_y(GTK_DATABOX(databox)),
+				"value-changed", G_CALLBACK(plot_lod_view_changed), NULL);
 	gtk_box_pack_start(GTK_BOX(capture_graph), table, TRUE, TRUE, 0);
 	gtk_widget_modify_bg(databox, GTK_STATE_NORMAL, &color_background);
+	waterfall_create();
 
 	if (MAX_MARKERS) {
 		marker_type = MARKER_OFF;
@@ -3144,6 +4005,29 @@ static void init_application (void)
 	g_signal_connect(plot_domain, "changed",
 		G_CALLBACK(check_valid_setup), NULL);
 
+	g_signal_connect(trigger_mode_widget, "changed",
+		G_CALLBACK(soft_trigger_changed), NULL);
+	g_signal_connect(trigger_type_widget, "changed",
+		G_CALLBACK(soft_trigger_changed), NULL);
+	g_signal_connect(trigger_edge_widget, "changed",
+		G_CALLBACK(soft_trigger_changed), NULL);
+	g_signal_connect(trigger_channel_widget, "value-changed",
+		G_CALLBACK(soft_trigger_changed), NULL);
+	g_signal_connect(trigger_level_widget, "value-changed",
+		G_CALLBACK(soft_trigger_changed), NULL);
+	g_signal_connect(trigger_hysteresis_widget, "value-changed",
+		G_CALLBACK(soft_trigger_changed), NULL);
+	g_signal_connect(trigger_pretrigger_widget, "value-changed",
+		G_CALLBACK(soft_trigger_changed), NULL);
+	g_signal_connect(trigger_holdoff_widget, "value-changed",
+		G_CALLBACK(soft_trigger_changed), NULL);
+	g_builder_connect_signal(builder, "trigger_arm", "clicked",
+		G_CALLBACK(soft_trigger_arm_clicked), NULL);
+	g_builder_connect_signal(builder, "replay_menu", "activate",
+		G_CALLBACK(replay_open_cb), NULL);
+	g_builder_connect_signal(builder, "diagnostics_menu", "activate",
+		G_CALLBACK(diagnostics_show), NULL);
+
 	g_builder_connect_signal(builder, "channel_list_view", "button_release_event",
 		G_CALLBACK(check_valid_setup), NULL);
 	g_builder_connect_signal(builder, "channel_list_view", "key-release-event",
@@ -3151,12 +4035,16 @@ static void init_application (void)
 
 	capture_button_hid = g_signal_connect(capture_button, "toggled",
 		G_CALLBACK(capture_button_clicked), NULL);
+	g_signal_connect(record_button, "toggled",
+		G_CALLBACK(record_button_toggled), NULL);
 
 	g_signal_connect(G_OBJECT(window), "delete-event",
 			G_CALLBACK(application_quit), NULL);
 
 	g_builder_bind_property(builder, "capture_button", "active",
 			"channel_list_view", "sensitive", G_BINDING_INVERT_BOOLEAN);
+	g_builder_bind_property(builder, "capture_button", "active",
+			"record_button", "sensitive", 0);
 	g_builder_bind_property(builder, "capture_button", "active",
 			"input_device_list", "sensitive", G_BINDING_INVERT_BOOLEAN);
 
@@ -3164,6 +4052,8 @@ static void init_application (void)
 			"capture_domains", "sensitive", G_BINDING_INVERT_BOOLEAN);
 	g_builder_bind_property(builder, "capture_button", "active",
 			"fft_size", "sensitive", G_BINDING_INVERT_BOOLEAN);
+	g_builder_bind_property(builder, "capture_button", "active",
+			"fft_zoom", "sensitive", G_BINDING_INVERT_BOOLEAN);
 	g_builder_bind_property(builder, "capture_button", "active",
 			"plot_type", "sensitive", G_BINDING_INVERT_BOOLEAN);
 	g_builder_bind_property(builder, "capture_button", "active",
@@ -3176,12 +4066,14 @@ static void init_application (void)
 	g_object_bind_property_full(time_interval_widget, "value", sample_count_widget,
 		"value", G_BINDING_BIDIRECTIONAL, time_to_samples, samples_to_time, NULL, NULL);
 
+	frame_bus = frame_bus_new();
 	init_device_list();
 	load_plugins(notebook);
 	plugin_setup_validation_fct = find_setup_check_fct_by_devname(current_device);
 	gtk_spin_button_set_value(GTK_SPIN_BUTTON(sample_count_widget), 500);
 	check_valid_setup();
 	rx_update_labels();
+	fft_plans_start();
 
 	gtk_widget_show(window);
 	gtk_widget_show_all(capture_graph);
@@ -3198,25 +4090,56 @@ void usage (char *program)
 
 	/* please keep this list sorted in alphabetal order */
 	printf( "Command line options:\n"
-		"\t-p\tload specific profile\n");
+		"\t-p\tload specific profile\n"
+		"\t-r\tmaximum display rate, in frames per second (default %d)\n"
+		"\t-R\tadd a recording or waveform file as a replay device\n"
+		"\t-F\treplay as fast as possible, not at the sample rate\n"
+		"\t-S\tserve the latency statistics on this Unix socket\n"
+		"\t-W\twaterfall history, in thousands of rows (default %d)\n",
+		DISPLAY_RATE_DEFAULT, WATERFALL_KILOROWS_DEFAULT);
 
 	printf("\nEnvironmental variables:\n"
-		"\tOSC_FORCE_PLUGIN\tforce loading of a specfic plugin\n");
+		"\tOSC_FORCE_PLUGIN\tforce loading of a specfic plugin\n"
+		"\tOSC_ONESHOT_REOPEN\treopen the buffer of oneshot devices for every frame\n"
+		"\tOSC_IIO_ROOT\tlook for the IIO sysfs, debugfs and device nodes under this directory\n"
+		"\tOSC_FFTW_PATIENT\tplan the FFTs with FFTW_PATIENT rather than FFTW_MEASURE\n");
 
 	exit(-1);
 }
 
 gint main(gint argc, char *argv[])
 {
-	int c;
+	int c, rate;
 	char *profile = NULL;
+	const char *stats_socket = NULL;
 
 	opterr = 0;
-	while ((c = getopt (argc, argv, "p:")) != -1)
+	while ((c = getopt (argc, argv, "p:r:R:FS:W:")) != -1)
 	switch (c) {
 		case 'p':
 			profile = strdup(optarg);
 			break;
+		case 'r':
+			rate = atoi(optarg);
+			if (rate <= 0 || rate > 1000)
+				usage(argv[0]);
+			display_interval_ms = 1000 / rate;
+			break;
+		case 'R':
+			replay_files = g_slist_append(replay_files, optarg);
+			break;
+		case 'F':
+			replay_fast = true;
+			break;
+		case 'S':
+			stats_socket = optarg;
+			break;
+		case 'W':
+			rate = atoi(optarg);
+			if (rate <= 0 || rate > WATERFALL_KILOROWS_MAX)
+				usage(argv[0]);
+			waterfall_kilorows = rate;
+			break;
 		case '?':
 			usage(argv[0]);
 			break;
@@ -3226,6 +4149,13 @@ gint main(gint argc, char *argv[])
 			break;
 	}
 
+	/* Compare against the old per frame buffer setup (see FPS output) */
+	capture_oneshot_reopen = getenv("OSC_ONESHOT_REOPEN") != NULL;
+
+	/* e.g. a tree built by iio_sim, to run without hardware */
+	if (getenv("OSC_IIO_ROOT"))
+		iio_set_root(getenv("OSC_IIO_ROOT"));
+
 	g_thread_init (NULL);
 	gdk_threads_init ();
 	gtk_init(&argc, &argv);
@@ -3234,6 +4164,13 @@ gint main(gint argc, char *argv[])
 	signal(SIGINT, sigterm);
 	signal(SIGHUP, sigterm);
 
+	if (stats_socket) {
+		c = stats_server_start(stats_socket);
+		if (c < 0)
+			fprintf(stderr, "Failed to serve statistics on %s: %s\n",
+					stats_socket, strerror(-c));
+	}
+
 	gdk_threads_enter();
 	init_application();
 	c = load_default_profile(profile);
@@ -67,6 +67,8 @@ int plugin_data_capture_bytes_per_sample(const char *device);
 enum marker_types plugin_get_marker_type(const char *device);
 void plugin_set_marker_type(const char *device, enum marker_types type);
 gdouble plugin_get_fft_avg(const char *device);
+int plugin_capture_start(const char *device, unsigned int num_samples);
+void plugin_capture_stop(const char *device);
 
 void capture_profile_save(const char *filename);
 int capture_profile_handler(const char* name, const char *value);
@@ -0,0 +1,977 @@
+/**
+ * Copyright (C) 2013 Analog Devices, Inc.
+ *
+ * Licensed under the GPL-2.
+ *
+ * Headless benchmark for the capture data path, no hardware needed.
+ * Results go to stdout as JSON.
+ **/
+
+#include <errno.h>
+#include <float.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "iio_utils.h"
+#include "demux.h"
+#include "envelope.h"
+#include "fft.h"
+#include "ddc.h"
+#include "frame_bus.h"
+#include "int_fft.h"
+#include "peaks.h"
+
+#define BENCH_SAMPLES	(1 << 16)
+#define BENCH_MIN_NS	200000000ULL
+
+/* Per pipeline case */
+#define BENCH_PIPE_MIN_NS	100000000ULL
+#define BENCH_PIPE_MIN_FRAMES	16
+#define BENCH_STREAM_FRAMES	4
+
+/* What the GUI does with the default settings */
+#define BENCH_MARKERS	5
+#define BENCH_AVG_MODE	FFT_AVG_EXPONENTIAL
+#define BENCH_AVG	1
+#define BENCH_COLUMNS	1024
+
+struct demux_layout {
+	const char *name;
+	unsigned int num_channels;
+	unsigned int bits;
+	unsigned int shift;
+};
+
+static const struct demux_layout demux_layouts[] = {
+	{ "1x int16", 1, 16, 0 },
+	{ "2x int16 I/Q", 2, 16, 0 },
+	{ "4x int16", 4, 16, 0 },
+	{ "2x 12-bit in 16", 2, 12, 0 },
+	{ "4x 14-bit in 16", 4, 14, 2 },
+};
+
+/* Same as the FFT size combo box in osc.glade */
+static const unsigned int fft_sizes[] = {
+	1048576, 524288, 262144, 131072, 65536, 32768, 16384, 8192, 4096, 2048, 1024, 512, 256, 128, 64, 32,
+};
+
+enum bench_stage {
+	STAGE_DEMUX,
+	STAGE_FFT,
+	STAGE_MARKERS,
+	STAGE_PLOT,
+	NUM_STAGES,
+};
+
+static const char * const stage_names[NUM_STAGES] = {
+	"demux", "fft", "markers", "plot",
+};
+
+/*
+ * Count every allocation, libfftw3's included, by standing in for the
+ * allocator. The real one is reached through glibc's __libc_ entry points.
+ */
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void *__libc_memalign(size_t alignment, size_t size);
+
+static unsigned long bench_allocs;
+
+void *malloc(size_t size)
+{
+	bench_allocs++;
+	return __libc_malloc(size);
+}
+
+void *calloc(size_t nmemb, size_t size)
+{
+	bench_allocs++;
+	return __libc_calloc(nmemb, size);
+}
+
+void *realloc(void *ptr, size_t size)
+{
+	bench_allocs++;
+	return __libc_realloc(ptr, size);
+}
+
+void *memalign(size_t alignment, size_t size)
+{
+	bench_allocs++;
+	return __libc_memalign(alignment, size);
+}
+
+void *aligned_alloc(size_t alignment, size_t size)
+{
+	bench_allocs++;
+	return __libc_memalign(alignment, size);
+}
+
+int posix_memalign(void **ptr, size_t alignment, size_t size)
+{
+	void *p;
+
+	bench_allocs++;
+	p = __libc_memalign(alignment, size);
+	if (!p)
+		return ENOMEM;
+	*ptr = p;
+	return 0;
+}
+
+static unsigned long long now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static double bench_demux_run(const struct demux *d, const void *in,
+		float **out)
+{
+	unsigned long long start, elapsed;
+	unsigned long iterations = 0;
+
+	start = now_ns();
+	do {
+		demux_run(d, in, out, BENCH_SAMPLES, 0, BENCH_SAMPLES);
+		iterations++;
+		elapsed = now_ns() - start;
+	} while (elapsed < BENCH_MIN_NS);
+
+	return (double)iterations * BENCH_SAMPLES * 1e9 / elapsed;
+}
+
+static void bench_channels_init(struct iio_channel_info *channels,
+		unsigned int num, unsigned int bits, unsigned int shift)
+{
+	unsigned int i;
+
+	memset(channels, 0, num * sizeof(*channels));
+	for (i = 0; i < num; i++) {
+		channels[i].enabled = 1;
+		channels[i].bytes = 2;
+		channels[i].bits_used = bits;
+		channels[i].shift = shift;
+		channels[i].mask = (1u << bits) - 1;
+		channels[i].is_signed = 1;
+		channels[i].endianness = IIO_LE;
+	}
+}
+
+/* The specialized demux kernels against the generic one */
+static void bench_demux(void)
+{
+	struct iio_channel_info channels[4];
+	struct demux generic, special;
+	int16_t *in;
+	float *out[4];
+	double generic_rate, special_rate;
+	unsigned int i;
+
+	in = malloc(BENCH_SAMPLES * 4 * sizeof(*in));
+	for (i = 0; i < BENCH_SAMPLES * 4; i++)
+		in[i] = rand();
+	for (i = 0; i < 4; i++)
+		out[i] = malloc(BENCH_SAMPLES * sizeof(float));
+
+	printf("\t\"demux\": [\n");
+
+	for (i = 0; i < sizeof(demux_layouts) / sizeof(demux_layouts[0]); i++) {
+		const struct demux_layout *l = &demux_layouts[i];
+
+		bench_channels_init(channels, l->num_channels, l->bits, l->shift);
+		demux_init_generic(&generic, channels, l->num_channels);
+		demux_init(&special, channels, l->num_channels);
+
+		generic_rate = bench_demux_run(&generic, in, out);
+		special_rate = bench_demux_run(&special, in, out);
+
+		printf("\t\t{ \"layout\": \"%s\", \"kernel\": \"%s\", "
+				"\"generic_msps\": %.1f, \"kernel_msps\": %.1f }%s\n",
+				l->name, special.name,
+				generic_rate / 1e6, special_rate / 1e6,
+				i + 1 < sizeof(demux_layouts) / sizeof(demux_layouts[0]) ?
+				"," : "");
+	}
+
+	printf("\t],\n");
+
+	for (i = 0; i < 4; i++)
+		free(out[i]);
+	free(in);
+}
+
+/*
+ * A tone a bit off a bin plus some noise, so the marker search and the
+ * averaging have something real to chew on.
+ */
+static void bench_stream_fill(int16_t *stream, unsigned int num_scans,
+		unsigned int num_channels)
+{
+	unsigned int i, j;
+	double phase;
+
+	for (i = 0; i < num_scans; i++) {
+		phase = 2 * M_PI * 0.1234 * i;
+		for (j = 0; j < num_channels; j++)
+			stream[i * num_channels + j] = (int16_t)(
+					16000 * cos(phase - j * M_PI / 2) +
+					(rand() % 64) - 32);
+	}
+}
+
+/*
+ * Push a fixed stream through the same steps the GUI takes for every FFT
+ * frame: demux to float, FFT with averaging, the marker search and the
+ * plot reduction, timing each one.
+ */
+static void bench_pipeline_case(unsigned int size, unsigned int num_channels,
+		bool last)
+{
+	struct iio_channel_info channels[2];
+	unsigned long long stage_ns[NUM_STAGES], t[NUM_STAGES + 1], total_ns;
+	unsigned long frames, allocs;
+	struct peak peaks[BENCH_MARKERS];
+	unsigned int points, i, j;
+	struct fft_state fft;
+	struct demux demux;
+	int16_t *stream;
+	const int16_t *frame;
+	float *out[2], *spectrum, *lod_x, *lod_y;
+
+	bench_channels_init(channels, num_channels, 16, 0);
+	demux_init(&demux, channels, num_channels);
+
+	stream = malloc(BENCH_STREAM_FRAMES * size * num_channels *
+			sizeof(*stream));
+	bench_stream_fill(stream, BENCH_STREAM_FRAMES * size, num_channels);
+
+	for (i = 0; i < num_channels; i++)
+		out[i] = malloc(size * sizeof(float));
+
+	points = size < 2 * BENCH_COLUMNS ? size : 2 * BENCH_COLUMNS;
+	lod_x = malloc(points * sizeof(float));
+	lod_y = malloc(points * sizeof(float));
+
+	memset(&fft, 0, sizeof(fft));
+	if (fft_setup(&fft, size, num_channels) < 0) {
+		fprintf(stderr, "FFT setup failed for size %u\n", size);
+		exit(EXIT_FAILURE);
+	}
+
+	spectrum = malloc(fft.m * sizeof(float));
+	for (i = 0; i < fft.m; i++)
+		spectrum[i] = FLT_MAX;
+
+	memset(stage_ns, 0, sizeof(stage_ns));
+	total_ns = 0;
+	frames = 0;
+	allocs = bench_allocs;
+
+	do {
+		frame = stream + (frames % BENCH_STREAM_FRAMES) * size * num_channels;
+
+		t[0] = now_ns();
+		demux_run(&demux, frame, out, size, 0, size);
+		t[1] = now_ns();
+		fft_compute(&fft, frame, spectrum, 0.0, BENCH_AVG_MODE,
+				BENCH_AVG);
+		t[2] = now_ns();
+		peaks_find(spectrum, fft.m, peaks, BENCH_MARKERS);
+		t[3] = now_ns();
+		for (j = 0; j < num_channels; j++)
+			envelope_minmax(out[j], 0, size, BENCH_COLUMNS, points,
+					lod_x, lod_y);
+		t[4] = now_ns();
+
+		for (j = 0; j < NUM_STAGES; j++)
+			stage_ns[j] += t[j + 1] - t[j];
+		total_ns += t[NUM_STAGES] - t[0];
+		frames++;
+	} while (total_ns < BENCH_PIPE_MIN_NS || frames < BENCH_PIPE_MIN_FRAMES);
+
+	allocs = bench_allocs - allocs;
+
+	printf("\t\t{ \"fft_size\": %u, \"channels\": %u, \"frames\": %lu, "
+			"\"frames_per_s\": %.1f, \"ns_per_sample\": %.3f, "
+			"\"allocs_per_frame\": %.3f, \"peak_bin\": %u,\n",
+			size, num_channels, frames, frames * 1e9 / total_ns,
+			(double)total_ns / ((double)frames * size),
+			(double)allocs / frames, peaks[0].bin);
+	printf("\t\t  \"stages\": {");
+	for (j = 0; j < NUM_STAGES; j++)
+		printf(" \"%s\": { \"ns_per_frame\": %.1f, \"ns_per_sample\": %.3f }%s",
+				stage_names[j], (double)stage_ns[j] / frames,
+				(double)stage_ns[j] / ((double)frames * size),
+				j + 1 < NUM_STAGES ? "," : "");
+	printf(" } }%s\n", last ? "" : ",");
+
+	fft_free(&fft);
+	free(spectrum);
+	free(lod_x);
+	free(lod_y);
+	for (i = 0; i < num_channels; i++)
+		free(out[i]);
+	free(stream);
+}
+
+static void bench_pipeline(void)
+{
+	unsigned int i, num = sizeof(fft_sizes) / sizeof(fft_sizes[0]);
+
+	printf("\t\"pipeline\": [\n");
+	for (i = 0; i < num; i++) {
+		bench_pipeline_case(fft_sizes[i], 1, false);
+		bench_pipeline_case(fft_sizes[i], 2, i + 1 == num);
+	}
+	printf("\t]\n");
+}
+
+/* N of the exponential and linear averages */
+#define BENCH_AVG_N	16
+
+static const char * const avg_mode_names[FFT_AVG_NUM_MODES] = {
+	[FFT_AVG_EXPONENTIAL] = "exponential",
+	[FFT_AVG_LINEAR] = "linear",
+	[FFT_AVG_PEAK_HOLD] = "peak_hold",
+	[FFT_AVG_MIN_HOLD] = "min_hold",
+};
+
+/*
+ * fft_average() on its own for every mode, from one transform. That is the
+ * dB conversion, which is the same for all of them, plus the mode's kernel.
+ * Welch averages within a frame, it has its own section.
+ */
+static void bench_average_case(unsigned int size, bool last)
+{
+	unsigned long long start, elapsed;
+	unsigned long frames;
+	struct fft_state fft;
+	int16_t *stream;
+	float *spectrum;
+	unsigned int i, mode;
+
+	stream = malloc(size * sizeof(*stream));
+	bench_stream_fill(stream, size, 1);
+
+	memset(&fft, 0, sizeof(fft));
+	if (fft_setup(&fft, size, 1) < 0) {
+		fprintf(stderr, "FFT setup failed for size %u\n", size);
+		exit(EXIT_FAILURE);
+	}
+	fft_transform(&fft, stream, 1);
+
+	spectrum = malloc(fft.m * sizeof(float));
+
+	printf("\t\t{ \"fft_size\": %u, \"bins\": %u, \"n\": %u,",
+			size, fft.m, BENCH_AVG_N);
+	for (mode = 0; mode < FFT_AVG_WELCH; mode++) {
+		for (i = 0; i < fft.m; i++)
+			spectrum[i] = FLT_MAX;
+
+		frames = 0;
+		start = now_ns();
+		do {
+			fft_average(&fft, spectrum, 0.0, mode, BENCH_AVG_N);
+			frames++;
+			elapsed = now_ns() - start;
+		} while (elapsed < BENCH_PIPE_MIN_NS / 4 ||
+				frames < BENCH_PIPE_MIN_FRAMES);
+
+		printf(" \"%s_ns_per_bin\": %.3f%s", avg_mode_names[mode],
+				(double)elapsed / ((double)frames * fft.m),
+				mode + 1 < FFT_AVG_WELCH ? "," : "");
+	}
+	printf(" }%s\n", last ? "" : ",");
+
+	fft_free(&fft);
+	free(spectrum);
+	free(stream);
+}
+
+static void bench_average(void)
+{
+	unsigned int i, num = sizeof(fft_sizes) / sizeof(fft_sizes[0]);
+
+	printf("\t\"averaging\": [\n");
+	for (i = 0; i < num; i++)
+		bench_average_case(fft_sizes[i], i + 1 == num);
+	printf("\t],\n");
+}
+
+/* How the marker search scales with the number of markers */
+static const unsigned int peak_counts[] = { 1, 10, 100, 1000 };
+
+static void bench_peaks(void)
+{
+	unsigned int size = fft_sizes[0], num = sizeof(peak_counts) /
+		sizeof(peak_counts[0]), i, found = 0;
+	unsigned long long start, elapsed;
+	unsigned long frames;
+	struct fft_state fft;
+	struct peak *peaks;
+	int16_t *stream;
+	float *spectrum;
+
+	stream = malloc(size * sizeof(*stream));
+	bench_stream_fill(stream, size, 1);
+
+	memset(&fft, 0, sizeof(fft));
+	if (fft_setup(&fft, size, 1) < 0) {
+		fprintf(stderr, "FFT setup failed for size %u\n", size);
+		exit(EXIT_FAILURE);
+	}
+
+	spectrum = malloc(fft.m * sizeof(float));
+	spectrum[0] = FLT_MAX;
+	fft_compute(&fft, stream, spectrum, 0.0, FFT_AVG_EXPONENTIAL, 1);
+
+	peaks = malloc(peak_counts[num - 1] * sizeof(*peaks));
+
+	printf("\t\"peaks\": [\n");
+	for (i = 0; i < num; i++) {
+		frames = 0;
+		start = now_ns();
+		do {
+			found = peaks_find(spectrum, fft.m, peaks, peak_counts[i]);
+			frames++;
+			elapsed = now_ns() - start;
+		} while (elapsed < BENCH_PIPE_MIN_NS / 4 ||
+				frames < BENCH_PIPE_MIN_FRAMES);
+
+		printf("\t\t{ \"bins\": %u, \"markers\": %u, \"found\": %u, "
+				"\"ns_per_frame\": %.1f, \"ns_per_bin\": %.3f }%s\n",
+				fft.m, peak_counts[i], found,
+				(double)elapsed / frames,
+				(double)elapsed / ((double)frames * fft.m),
+				i + 1 < num ? "," : "");
+	}
+	printf("\t],\n");
+
+	fft_free(&fft);
+	free(peaks);
+	free(spectrum);
+	free(stream);
+}
+
+/*
+ * A spectrum per I/Q pair of a frame with up to 8 channels, one after the
+ * other and then spread over the cores by fft_compute_jobs().
+ */
+#define BENCH_MAX_SPECTRA	4
+
+static unsigned long long bench_multi_run(struct fft_job *jobs,
+		unsigned int num, bool parallel, unsigned long *frames)
+{
+	unsigned long long start, elapsed;
+	unsigned int i;
+
+	*frames = 0;
+	start = now_ns();
+	do {
+		if (parallel) {
+			fft_compute_jobs(jobs, num);
+		} else {
+			for (i = 0; i < num; i++)
+				fft_compute_jobs(&jobs[i], 1);
+		}
+		(*frames)++;
+		elapsed = now_ns() - start;
+	} while (elapsed < BENCH_PIPE_MIN_NS || *frames < BENCH_PIPE_MIN_FRAMES);
+
+	return elapsed;
+}
+
+static void bench_multi_case(unsigned int size, unsigned int num, bool last)
+{
+	struct fft_state fft[BENCH_MAX_SPECTRA];
+	struct fft_job jobs[BENCH_MAX_SPECTRA];
+	unsigned long long serial_ns, parallel_ns;
+	unsigned long serial_frames, parallel_frames;
+	unsigned int i, j;
+	int16_t *stream;
+
+	stream = malloc(size * 2 * num * sizeof(*stream));
+	bench_stream_fill(stream, size, 2 * num);
+
+	memset(fft, 0, sizeof(fft));
+	for (i = 0; i < num; i++) {
+		if (fft_setup(&fft[i], size, 2) < 0) {
+			fprintf(stderr, "FFT setup failed for size %u\n", size);
+			exit(EXIT_FAILURE);
+		}
+		jobs[i].fft = &fft[i];
+		jobs[i].data = stream + 2 * i;
+		jobs[i].stride = 2 * num;
+		jobs[i].spectrum = malloc(fft[i].m * sizeof(float));
+		for (j = 0; j < fft[i].m; j++)
+			jobs[i].spectrum[j] = FLT_MAX;
+		jobs[i].offset = 0.0;
+		jobs[i].avg_mode = BENCH_AVG_MODE;
+		jobs[i].avg_n = BENCH_AVG;
+		jobs[i].ddc = NULL;
+	}
+
+	serial_ns = bench_multi_run(jobs, num, false, &serial_frames);
+	parallel_ns = bench_multi_run(jobs, num, true, &parallel_frames);
+
+	printf("\t\t{ \"fft_size\": %u, \"channels\": %u, \"spectra\": %u, "
+			"\"serial_frames_per_s\": %.1f, "
+			"\"parallel_frames_per_s\": %.1f }%s\n",
+			size, 2 * num, num, serial_frames * 1e9 / serial_ns,
+			parallel_frames * 1e9 / parallel_ns, last ? "" : ",");
+
+	for (i = 0; i < num; i++) {
+		free(jobs[i].spectrum);
+		fft_free(&fft[i]);
+	}
+	free(stream);
+}
+
+static void bench_multi(void)
+{
+	printf("\t\"multichannel\": [\n");
+	bench_multi_case(65536, 2, false);
+	bench_multi_case(65536, 4, false);
+	bench_multi_case(8192, 2, false);
+	bench_multi_case(8192, 4, true);
+	printf("\t],\n");
+}
+
+/*
+ * Welch over more and more segments of one I/Q frame: the time a frame
+ * takes and how much the noise floor, in the quarter of the spectrum away
+ * from the tone, still wanders (standard deviation over the bins, in dB).
+ */
+#define BENCH_WELCH_SIZE	8192
+
+static const unsigned int welch_segments[] = { 1, 4, 16, 64 };
+
+static void bench_welch_case(unsigned int segments, bool last)
+{
+	unsigned long long start, elapsed;
+	unsigned long frames = 0;
+	unsigned int i, num_scans = fft_welch_len(BENCH_WELCH_SIZE, segments);
+	struct fft_state fft;
+	struct fft_job job;
+	double sum = 0.0, sum2 = 0.0, mean;
+	int16_t *stream;
+
+	stream = malloc(num_scans * 2 * sizeof(*stream));
+	bench_stream_fill(stream, num_scans, 2);
+
+	memset(&fft, 0, sizeof(fft));
+	if (fft_setup(&fft, BENCH_WELCH_SIZE, 2) < 0) {
+		fprintf(stderr, "FFT setup failed for size %u\n",
+				BENCH_WELCH_SIZE);
+		exit(EXIT_FAILURE);
+	}
+
+	job.fft = &fft;
+	job.data = stream;
+	job.stride = 2;
+	job.spectrum = malloc(fft.m * sizeof(float));
+	job.offset = 0.0;
+	job.avg_mode = FFT_AVG_WELCH;
+	job.avg_n = segments;
+	job.ddc = NULL;
+
+	start = now_ns();
+	do {
+		fft_compute_jobs(&job, 1);
+		frames++;
+		elapsed = now_ns() - start;
+	} while (elapsed < BENCH_PIPE_MIN_NS || frames < BENCH_PIPE_MIN_FRAMES);
+
+	for (i = 0; i < fft.m / 4; i++) {
+		sum += job.spectrum[i];
+		sum2 += (double)job.spectrum[i] * job.spectrum[i];
+	}
+	mean = sum / (fft.m / 4);
+
+	printf("\t\t{ \"fft_size\": %u, \"segments\": %u, \"scans\": %u, "
+			"\"ms_per_frame\": %.3f, \"floor_std_db\": %.2f }%s\n",
+			BENCH_WELCH_SIZE, segments, num_scans,
+			elapsed / 1e6 / frames,
+			sqrt(sum2 / (fft.m / 4) - mean * mean), last ? "" : ",");
+
+	free(job.spectrum);
+	fft_free(&fft);
+	free(stream);
+}
+
+static void bench_welch(void)
+{
+	unsigned int i, num = sizeof(welch_segments) / sizeof(welch_segments[0]);
+
+	printf("\t\"welch\": [\n");
+	for (i = 0; i < num; i++)
+		bench_welch_case(welch_segments[i], i + 1 == num);
+	printf("\t],\n");
+}
+
+/*
+ * The same resolution over a narrow band two ways: a full band FFT of
+ * decimation * size points, or the down-converter and an FFT of size. The
+ * tone of bench_stream_fill() is at 0.1234 of the sample rate, the zoom is
+ * centered next to it and the peak found has to be the tone.
+ */
+#define BENCH_ZOOM_SIZE		1024
+#define BENCH_ZOOM_CENTER	0.1233
+
+static const unsigned int zoom_decimations[] = { 16, 64, 256 };
+
+static double bench_zoom_run(struct fft_job *job, unsigned long *frames)
+{
+	unsigned long long start, elapsed;
+
+	*frames = 0;
+	start = now_ns();
+	do {
+		fft_compute_jobs(job, 1);
+		(*frames)++;
+		elapsed = now_ns() - start;
+	} while (elapsed < BENCH_PIPE_MIN_NS || *frames < BENCH_PIPE_MIN_FRAMES);
+
+	return elapsed / 1e6 / *frames;
+}
+
+static void bench_zoom_case(unsigned int decimation, bool last)
+{
+	unsigned int full_size = decimation * BENCH_ZOOM_SIZE;
+	unsigned int num_scans = ddc_input_len(decimation, BENCH_ZOOM_SIZE);
+	struct fft_state fft, full_fft;
+	struct fft_job job, full_job;
+	unsigned long frames;
+	double zoom_ms, full_ms, tone;
+	struct peak peak;
+	struct ddc ddc;
+	int16_t *stream;
+
+	if (num_scans < full_size)
+		num_scans = full_size;
+	stream = malloc(num_scans * 2 * sizeof(*stream));
+	bench_stream_fill(stream, num_scans, 2);
+
+	memset(&fft, 0, sizeof(fft));
+	memset(&full_fft, 0, sizeof(full_fft));
+	memset(&ddc, 0, sizeof(ddc));
+	if (fft_setup(&fft, BENCH_ZOOM_SIZE, 2) < 0 ||
+			fft_setup(&full_fft, full_size, 2) < 0 ||
+			ddc_setup(&ddc, 2, BENCH_ZOOM_CENTER, decimation,
+				BENCH_ZOOM_SIZE) < 0) {
+		fprintf(stderr, "Zoom setup failed for decimation %u\n",
+				decimation);
+		exit(EXIT_FAILURE);
+	}
+
+	job.fft = &fft;
+	job.data = stream;
+	job.stride = 2;
+	job.spectrum = malloc(fft.m * sizeof(float));
+	job.offset = 0.0;
+	job.avg_mode = BENCH_AVG_MODE;
+	job.avg_n = BENCH_AVG;
+	job.ddc = &ddc;
+	full_job = job;
+	full_job.fft = &full_fft;
+	full_job.spectrum = malloc(full_fft.m * sizeof(float));
+	full_job.ddc = NULL;
+
+	zoom_ms = bench_zoom_run(&job, &frames);
+	full_ms = bench_zoom_run(&full_job, &frames);
+
+	/* where the zoomed spectrum has the tone, over the sample rate */
+	peaks_find(job.spectrum, fft.m, &peak, 1);
+	tone = BENCH_ZOOM_CENTER + ((double)peak.bin + peak.offset -
+			BENCH_ZOOM_SIZE / 2) / ((double)decimation * BENCH_ZOOM_SIZE);
+
+	printf("\t\t{ \"decimation\": %u, \"fft_size\": %u, \"scans\": %u, "
+			"\"zoom_ms_per_frame\": %.3f, \"full_fft_size\": %u, "
+			"\"full_ms_per_frame\": %.3f, \"tone_error_bins\": %.3f }%s\n",
+			decimation, BENCH_ZOOM_SIZE, num_scans, zoom_ms, full_size,
+			full_ms, (tone - 0.1234) * decimation * BENCH_ZOOM_SIZE,
+			last ? "" : ",");
+
+	free(job.spectrum);
+	free(full_job.spectrum);
+	ddc_free(&ddc);
+	fft_free(&fft);
+	fft_free(&full_fft);
+	free(stream);
+}
+
+static void bench_zoom(void)
+{
+	unsigned int i, num = sizeof(zoom_decimations) / sizeof(zoom_decimations[0]);
+
+	printf("\t\"zoom\": [\n");
+	for (i = 0; i < num; i++)
+		bench_zoom_case(zoom_decimations[i], i + 1 == num);
+	printf("\t],\n");
+}
+
+/*
+ * Cooked data for a plugin, per frame: the way plugin_data_capture() used
+ * to get it, reallocating, zeroing and demuxing its own arrays on every
+ * call, against a frame of the bus pool, demuxed once by the capture,
+ * handed to the plugin by reference and then recycled.
+ */
+static const unsigned int plugin_frame_sizes[] = { 1024, 65536, 1048576 };
+
+static void bench_plugin_frames_case(unsigned int size, bool last)
+{
+	unsigned long long start = 0, legacy_ns, bus_ns;
+	unsigned long frames, legacy_frames, legacy_allocs = 0, bus_allocs = 0;
+	struct iio_channel_info channels[2];
+	const struct osc_frame *frame;
+	struct osc_frame *f;
+	struct frame_bus *bus;
+	struct frame_sub *sub;
+	struct demux demux;
+	float **cooked = NULL;
+	int16_t *stream;
+	unsigned int i, j;
+	double sum = 0.0;
+
+	bench_channels_init(channels, 2, 16, 0);
+	demux_init(&demux, channels, 2);
+	stream = malloc(BENCH_STREAM_FRAMES * size * 2 * sizeof(*stream));
+	bench_stream_fill(stream, BENCH_STREAM_FRAMES * size, 2);
+
+	/* the arrays were sized for the whole buffer, both channels */
+	frames = 0;
+	do {
+		if (frames == 1) {
+			legacy_allocs = bench_allocs;
+			start = now_ns();
+		}
+		cooked = g_renew(float *, cooked, 2);
+		if (frames == 0)
+			cooked[0] = cooked[1] = NULL;
+		for (i = 0; i < 2; i++) {
+			cooked[i] = g_renew(float, cooked[i], 2 * size);
+			for (j = 0; j < 2 * size; j++)
+				cooked[i][j] = 0.0f;
+		}
+		demux_run(&demux, stream + (frames % BENCH_STREAM_FRAMES) *
+				size * 2, cooked, size, 0, size);
+		sum += cooked[1][frames % size];
+		frames++;
+		legacy_ns = now_ns() - start;
+	} while (frames < 2 || legacy_ns < BENCH_PIPE_MIN_NS ||
+			frames < BENCH_PIPE_MIN_FRAMES);
+	legacy_allocs = bench_allocs - legacy_allocs;
+	legacy_frames = frames - 1;
+
+	for (i = 0; i < 2; i++)
+		g_free(cooked[i]);
+	g_free(cooked);
+
+	bus = frame_bus_new();
+	sub = frame_bus_subscribe(bus, "bench", OSC_FRAME_MASK(OSC_FRAME_COOKED),
+			0, NULL, NULL);
+	frames = 0;
+	do {
+		if (frames == 1) {
+			bus_allocs = bench_allocs;
+			start = now_ns();
+		}
+		if (frame_bus_wanted(bus, "bench", frames + 2) &
+				OSC_FRAME_MASK(OSC_FRAME_COOKED)) {
+			f = frame_bus_frame_new(bus, OSC_FRAME_COOKED, 2, size,
+					sizeof(float));
+			demux_run(&demux, stream + (frames % BENCH_STREAM_FRAMES) *
+					size * 2, frame_bus_frame_bufs(f), size,
+					0, size);
+			f->seq = frames;
+			f->timestamp = frames + 2;
+			frame_bus_publish(bus, "bench", f);
+		}
+		if (frame_bus_wait(sub, OSC_FRAME_COOKED, frames + 1, 0, NULL,
+					&frame) < 0) {
+			fprintf(stderr, "No frame from the bus\n");
+			exit(EXIT_FAILURE);
+		}
+		sum += frame->channel[1][frames % size];
+		osc_frame_unref(frame);
+		frames++;
+		bus_ns = now_ns() - start;
+	} while (frames < 2 || bus_ns < BENCH_PIPE_MIN_NS ||
+			frames < BENCH_PIPE_MIN_FRAMES);
+	bus_allocs = bench_allocs - bus_allocs;
+	frames--;
+
+	frame_bus_unsubscribe(sub);
+	frame_bus_free(bus);
+
+	printf("\t\t{ \"samples\": %u, \"channels\": 2, "
+			"\"legacy_us_per_frame\": %.1f, "
+			"\"legacy_allocs_per_frame\": %.3f, "
+			"\"bus_us_per_frame\": %.1f, "
+			"\"bus_allocs_per_frame\": %.3f, \"check\": %.0f }%s\n",
+			size, legacy_ns / 1e3 / legacy_frames,
+			(double)legacy_allocs / legacy_frames,
+			bus_ns / 1e3 / frames, (double)bus_allocs / frames,
+			sum, last ? "" : ",");
+
+	free(stream);
+}
+
+static void bench_plugin_frames(void)
+{
+	unsigned int i, num = sizeof(plugin_frame_sizes) /
+		sizeof(plugin_frame_sizes[0]);
+
+	printf("\t\"plugin_frames\": [\n");
+	for (i = 0; i < num; i++)
+		bench_plugin_frames_case(plugin_frame_sizes[i], i + 1 == num);
+	printf("\t],\n");
+}
+
+#if !NO_FFTW
+/*
+ * The fixed-point FFT of the builds without FFTW against FFTW, on the same
+ * frame: the time for each, and how far the int_fft spectrum is from the
+ * FFTW one, overall (SNR) and in the worst bin (below the tone, in dB).
+ */
+static const unsigned int int_fft_sizes[] = { 1024, 8192, 65536 };
+
+static void bench_int_fft_case(unsigned int size, bool complex, bool last)
+{
+	unsigned int i, num_channels = complex ? 2 : 1, num_bins;
+	unsigned long long start, elapsed, int_elapsed;
+	unsigned long frames = 0, int_frames = 0;
+	double d, err = 0.0, err_max = 0.0, sig = 0.0, peak = 0.0;
+	struct fft_state fft;
+	struct int_fft f;
+	int16_t *stream, *work;
+	float *out, *ref;
+
+	stream = malloc(size * num_channels * sizeof(*stream));
+	bench_stream_fill(stream, size, num_channels);
+
+	memset(&fft, 0, sizeof(fft));
+	if (fft_setup(&fft, size, num_channels) < 0 ||
+			int_fft_setup(&f, size, complex) < 0) {
+		fprintf(stderr, "FFT setup failed for size %u\n", size);
+		exit(EXIT_FAILURE);
+	}
+	num_bins = complex ? fft.m : fft.m + 1;
+	work = malloc(INT_FFT_WORK_LEN(&f) * sizeof(*work));
+	out = malloc(2 * (fft.m + 1) * sizeof(*out));
+
+	start = now_ns();
+	do {
+		fft_transform(&fft, stream, num_channels);
+		frames++;
+		elapsed = now_ns() - start;
+	} while (elapsed < BENCH_PIPE_MIN_NS || frames < BENCH_PIPE_MIN_FRAMES);
+
+	start = now_ns();
+	do {
+		int_fft_run(&f, stream, num_channels, work, out,
+				1.0f / fft.m);
+		int_frames++;
+		int_elapsed = now_ns() - start;
+	} while (int_elapsed < BENCH_PIPE_MIN_NS ||
+			int_frames < BENCH_PIPE_MIN_FRAMES);
+
+	ref = (float *)fft.out;
+	for (i = 0; i < 2 * num_bins; i += 2) {
+		d = (double)ref[i] * ref[i] + (double)ref[i + 1] * ref[i + 1];
+		sig += d;
+		if (d > peak)
+			peak = d;
+		d = (double)(out[i] - ref[i]) * (out[i] - ref[i]) +
+			(double)(out[i + 1] - ref[i + 1]) * (out[i + 1] - ref[i + 1]);
+		err += d;
+		if (d > err_max)
+			err_max = d;
+	}
+
+	printf("\t\t{ \"fft_size\": %u, \"input\": \"%s\", "
+			"\"fftw_us_per_frame\": %.1f, \"int_us_per_frame\": %.1f, "
+			"\"snr_db\": %.1f, \"worst_bin_db\": %.1f }%s\n",
+			size, complex ? "complex" : "real",
+			elapsed / 1e3 / frames, int_elapsed / 1e3 / int_frames,
+			10 * log10(sig / err), 10 * log10(peak / err_max),
+			last ? "" : ",");
+
+	free(out);
+	free(work);
+	int_fft_free(&f);
+	fft_free(&fft);
+	free(stream);
+}
+
+static void bench_int_fft(void)
+{
+	unsigned int i, num = sizeof(int_fft_sizes) / sizeof(int_fft_sizes[0]);
+
+	printf("\t\"int_fft\": [\n");
+	for (i = 0; i < 2 * num; i++)
+		bench_int_fft_case(int_fft_sizes[i / 2], i & 1,
+				i + 1 == 2 * num);
+	printf("\t],\n");
+}
+#endif
+
+static void usage(const char *program)
+{
+	fprintf(stderr, "usage: %s [-m]\n"
+			"\t-m\tuse measured FFT plans, as the GUI does once they are ready\n",
+			program);
+	exit(EXIT_FAILURE);
+}
+
+int main(int argc, char **argv)
+{
+	bool measure = false;
+	int c;
+
+	while ((c = getopt(argc, argv, "m")) != -1) {
+		switch (c) {
+		case 'm':
+			measure = true;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+
+#if NO_FFTW
+	fft_plans_init(NULL, 0);
+#else
+	fft_plans_init(NULL, FFTW_MEASURE);
+#endif
+	if (measure)
+		fft_plans_prepare(fft_sizes,
+				sizeof(fft_sizes) / sizeof(fft_sizes[0]), false);
+
+	printf("{\n");
+	printf("\t\"fft_plans\": \"%s\",\n", measure ? "measured" : "estimated");
+	bench_demux();
+	bench_average();
+	bench_peaks();
+	bench_multi();
+	bench_welch();
+	bench_zoom();
+	bench_plugin_frames();
+#if !NO_FFTW
+	bench_int_fft();
+#endif
+	bench_pipeline();
+	printf("}\n");
+
+	fft_plans_cleanup();
+
+	return 0;
+}
@@ -10,6 +10,8 @@
 
 #include <gtk/gtk.h>
 
+#include "frame_bus.h"
+
 struct osc_plugin {
 	void *handle;
 	const char *name;
@@ -19,6 +21,7 @@ struct osc_plugin {
 			      const char *value);
 	const char **save_restore_attribs;
 	void (*update_active_page)(gint active_page, gboolean is_detached);
+	void (*destroy)(void);
 };
 
 void osc_plugin_register(const struct osc_plugin *plugin);
@@ -26,6 +29,41 @@ void * plugin_dlsym(const char *name, const char *symbol);
 bool plugin_installed(const char *name);
 extern GSList *plugin_list;
 
+/*
+ * Frames of a device as they are captured, at most max_rate a second (0
+ * for every one). types is a mask of OSC_FRAME_MASK() bits; with func NULL
+ * the newest frame of each type is kept for plugin_frame_get(). Any number
+ * of plugins can subscribe, none of them holds up the others or the plot.
+ */
+struct frame_sub * plugin_subscribe(const char *device, unsigned int types,
+		double max_rate, osc_frame_func func, void *user_data);
+void plugin_unsubscribe(struct frame_sub *sub);
+/* Change the types of a subscription, 0 parks it until it is set again */
+void plugin_subscribe_types(struct frame_sub *sub, unsigned int types);
+const struct osc_frame * plugin_frame_get(struct frame_sub *sub,
+		enum osc_frame_type type);
+
+/*
+ * Block until a frame of type comes in: the first one captured after the
+ * time after (g_get_monotonic_time()), or with after 0 the next one. It
+ * returns -ETIMEDOUT after timeout_ms (< 0 for no timeout), -ECANCELED
+ * once cancel (from plugin_cancel_new(), may be NULL) is set with
+ * frame_cancel_set(), and -EINTR when the capture is stopped.
+ */
+int plugin_frame_wait(struct frame_sub *sub, enum osc_frame_type type,
+		gint64 after, int timeout_ms, struct frame_cancel *cancel,
+		const struct osc_frame **frame);
+struct frame_cancel * plugin_cancel_new(void);
+void plugin_cancel_free(struct frame_cancel *cancel);
+
+/*
+ * The next frame of type of the device, by reference: no copy and no
+ * allocation, drop it with osc_frame_unref(). Waits like
+ * plugin_data_capture(), returns -EINTR if the capture stops.
+ */
+int plugin_data_capture_frame(const char *device, enum osc_frame_type type,
+		const struct osc_frame **frame);
+
 #define MATCH_ATTRIB(s) (strcmp(attrib, s) == 0)
 
 #endif
@@ -0,0 +1,193 @@
+/**
+ * Copyright (C) 2013 Analog Devices, Inc.
+ *
+ * Licensed under the GPL-2.
+ *
+ **/
+
+#include <float.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#include <xmmintrin.h>
+#elif defined(__ARM_NEON__) || defined(__ARM_NEON)
+#include <arm_neon.h>
+#define HAVE_NEON 1
+#endif
+
+#include "peaks.h"
+
+/*
+ * The best num_peaks so far are kept in a min-heap on the level, so the
+ * lowest of them, the one to beat, is always peaks[0].
+ */
+struct peak_heap {
+	struct peak *peaks;
+	unsigned int num;
+	unsigned int size;
+};
+
+static void heap_sift_down(struct peak *p, unsigned int num, unsigned int i)
+{
+	struct peak tmp = p[i];
+	unsigned int child;
+
+	while ((child = 2 * i + 1) < num) {
+		if (child + 1 < num && p[child + 1].level < p[child].level)
+			child++;
+		if (p[child].level >= tmp.level)
+			break;
+		p[i] = p[child];
+		i = child;
+	}
+	p[i] = tmp;
+}
+
+static void heap_sift_up(struct peak *p, unsigned int i)
+{
+	struct peak tmp = p[i];
+	unsigned int parent;
+
+	while (i) {
+		parent = (i - 1) / 2;
+		if (p[parent].level <= tmp.level)
+			break;
+		p[i] = p[parent];
+		i = parent;
+	}
+	p[i] = tmp;
+}
+
+/* What a level has to be above to get in */
+static inline float heap_threshold(const struct peak_heap *h)
+{
+	return h->num < h->size ? -FLT_MAX : h->peaks[0].level;
+}
+
+static void heap_offer(struct peak_heap *h, unsigned int bin, float level)
+{
+	if (h->num < h->size) {
+		h->peaks[h->num].bin = bin;
+		h->peaks[h->num].level = level;
+		heap_sift_up(h->peaks, h->num++);
+	} else if (level > h->peaks[0].level) {
+		h->peaks[0].bin = bin;
+		h->peaks[0].level = level;
+		heap_sift_down(h->peaks, h->num, 0);
+	}
+}
+
+/* Check the bins in [first, last), all of which have two neighbours */
+static void peaks_scan(const float *s, unsigned int first, unsigned int last,
+		struct peak_heap *h)
+{
+	unsigned int i = first;
+#if defined(__SSE2__)
+	__m128 c, thr = _mm_set1_ps(heap_threshold(h));
+	unsigned int mask;
+
+	for (; i + 4 <= last; i += 4) {
+		c = _mm_loadu_ps(s + i);
+		mask = _mm_movemask_ps(_mm_and_ps(_mm_cmpgt_ps(c, thr),
+				_mm_and_ps(_mm_cmpgt_ps(c, _mm_loadu_ps(s + i - 1)),
+					_mm_cmpge_ps(c, _mm_loadu_ps(s + i + 1)))));
+		if (!mask)
+			continue;
+
+		for (; mask; mask &= mask - 1)
+			heap_offer(h, i + __builtin_ctz(mask),
+					s[i + __builtin_ctz(mask)]);
+		thr = _mm_set1_ps(heap_threshold(h));
+	}
+#elif HAVE_NEON
+	float32x4_t c, thr = vdupq_n_f32(heap_threshold(h));
+	uint32x4_t mask;
+	uint32x2_t any;
+	unsigned int j;
+
+	for (; i + 4 <= last; i += 4) {
+		c = vld1q_f32(s + i);
+		mask = vandq_u32(vcgtq_f32(c, thr),
+				vandq_u32(vcgtq_f32(c, vld1q_f32(s + i - 1)),
+					vcgeq_f32(c, vld1q_f32(s + i + 1))));
+		any = vorr_u32(vget_low_u32(mask), vget_high_u32(mask));
+		if (!vget_lane_u32(vpmax_u32(any, any), 0))
+			continue;
+
+		for (j = i; j < i + 4; j++)
+			if (s[j] > s[j - 1] && s[j] >= s[j + 1])
+				heap_offer(h, j, s[j]);
+		thr = vdupq_n_f32(heap_threshold(h));
+	}
+#endif
+	for (; i < last; i++)
+		if (s[i] > s[i - 1] && s[i] >= s[i + 1])
+			heap_offer(h, i, s[i]);
+}
+
+static void peak_interpolate(const float *s, unsigned int num, struct peak *p)
+{
+	float l, c, r, den;
+
+	p->offset = 0.0f;
+	if (p->bin == 0 || p->bin + 1 >= num)
+		return;
+
+	l = s[p->bin - 1];
+	c = s[p->bin];
+	r = s[p->bin + 1];
+	den = l - 2 * c + r;
+	if (den >= 0.0f)
+		return;
+
+	p->offset = 0.5f * (l - r) / den;
+	if (p->offset > 0.5f)
+		p->offset = 0.5f;
+	else if (p->offset < -0.5f)
+		p->offset = -0.5f;
+	p->level = c - 0.25f * (l - r) * p->offset;
+}
+
+/*
+ * Find the num_peaks highest peaks of spectrum and put them in peaks,
+ * highest first. Returns how many there are, which can be less than
+ * num_peaks. One pass over the spectrum, most of it only compared to
+ * the lowest peak kept, so asking for more peaks costs little.
+ */
+unsigned int peaks_find(const float *spectrum, unsigned int num,
+		struct peak *peaks, unsigned int num_peaks)
+{
+	struct peak_heap h;
+	struct peak tmp;
+	unsigned int i;
+
+	if (!num || !num_peaks)
+		return 0;
+
+	h.peaks = peaks;
+	h.num = 0;
+	h.size = num_peaks;
+
+	if (num == 1) {
+		heap_offer(&h, 0, spectrum[0]);
+	} else {
+		if (spectrum[0] >= spectrum[1])
+			heap_offer(&h, 0, spectrum[0]);
+		peaks_scan(spectrum, 1, num - 1, &h);
+		if (spectrum[num - 1] > spectrum[num - 2])
+			heap_offer(&h, num - 1, spectrum[num - 1]);
+	}
+
+	/* heap sort, the lowest go to the end */
+	for (i = h.num; i > 1; i--) {
+		tmp = peaks[0];
+		peaks[0] = peaks[i - 1];
+		peaks[i - 1] = tmp;
+		heap_sift_down(peaks, i - 1, 0);
+	}
+
+	for (i = 0; i < h.num; i++)
+		peak_interpolate(spectrum, num, &peaks[i]);
+
+	return h.num;
+}
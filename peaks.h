@@ -0,0 +1,27 @@
+/**
+ * Copyright (C) 2013 Analog Devices, Inc.
+ *
+ * Licensed under the GPL-2.
+ *
+ **/
+
+#ifndef __PEAKS_H__
+#define __PEAKS_H__
+
+/*
+ * Peak search for the spectrum markers. A peak is a local maximum (the
+ * first bin of a flat top counts), the two ends of the spectrum included.
+ * The position and level are interpolated between the bins: a parabola
+ * through the peak and its neighbours in dB, which is a Gaussian fit of
+ * the magnitudes.
+ */
+struct peak {
+	unsigned int bin;
+	float offset;	/* from bin to the real peak, -0.5 to 0.5 */
+	float level;	/* at the real peak */
+};
+
+unsigned int peaks_find(const float *spectrum, unsigned int num,
+		struct peak *peaks, unsigned int num_peaks);
+
+#endif
@@ -85,7 +85,7 @@ static int buffer_open(unsigned int length)
 	write_devattr("trigger/current_trigger", "hrtimer-1");
 	write_devattr("scan_elements/out_voltage0_en", "1");
 
-	fd = iio_buffer_open(false, 0);
+	fd = iio_buffer_open(false, O_NONBLOCK);
 	if (fd < 0) {
 		ret = -errno;
 		fprintf(stderr, "Failed to open buffer: %d\n", ret);
@@ -259,28 +259,65 @@ static void generateWavePeriod(void)
 	gtk_databox_set_total_limits(GTK_DATABOX(databox), -0.2, (i - 1), 3.5, -0.2);
 }
 
-static gboolean fillBuffer(void)
+/*
+ * How long to back off when the buffer says it has room but takes nothing:
+ * a driver without poll() support always reports G_IO_OUT.
+ */
+#define FILL_RETRY_MS 10
+
+static void startWaveGeneration(void);
+
+static gboolean fillRetry(gpointer data)
+{
+	startWaveGeneration();
+	return FALSE;
+}
+
+/* Called from the main loop whenever the buffer has room again */
+static gboolean fillBuffer(GIOChannel *source, GIOCondition condition,
+		gpointer data)
 {
 	int samplesToSend;
 	int ret;
 
+	if (condition & (G_IO_ERR | G_IO_HUP | G_IO_NVAL)) {
+		printf("Error occured while waiting for the buffer\n");
+		fill_buffer_function = 0;
+		return FALSE;
+	}
+
 	samplesToSend = buffer_size - current_sample;
 	ret = write(buffer_fd, soft_buffer_ch0 + current_sample, samplesToSend);
-	if (ret < 0)
-		printf("Error occured while writing to buffer: %d\n", errno);
-	else {
+	if (ret < 0) {
+		if (errno != EAGAIN) {
+			printf("Error occured while writing to buffer: %d\n", errno);
+		} else {
+			/* Don't spin on the watch, try again in a while */
+			fill_buffer_function = g_timeout_add(FILL_RETRY_MS,
+					fillRetry, NULL);
+			return FALSE;
+		}
+	} else {
 		current_sample += ret;
 		if (current_sample >= buffer_size)
 			current_sample = 0;
 	}
-	usleep(10000);
 
 	return TRUE;
 }
 
 static void startWaveGeneration(void)
 {
-	fill_buffer_function = g_idle_add((GSourceFunc)fillBuffer, NULL);
+	GIOChannel *channel;
+
+	if (buffer_fd < 0)
+		return;
+
+	channel = g_io_channel_unix_new(buffer_fd);
+	fill_buffer_function = g_io_add_watch(channel,
+			G_IO_OUT | G_IO_ERR | G_IO_HUP | G_IO_NVAL,
+			fillBuffer, NULL);
+	g_io_channel_unref(channel);
 }
 
 static void tx_update_values(void)
@@ -303,7 +340,9 @@ static void wave_param_changed(GtkRange *range, gpointer user_data)
 static void save_button_clicked(GtkButton *btn, gpointer data)
 {
 	if (buffer_fd) {
-		g_source_remove(fill_buffer_function);
+		if (fill_buffer_function)
+			g_source_remove(fill_buffer_function);
+		fill_buffer_function = 0;
 		buffer_close(buffer_fd);
 		buffer_fd = -1;
 	}
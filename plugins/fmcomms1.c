@@ -100,6 +100,8 @@ static struct marker_type *rx_marker = NULL;
 static GtkWidget *ad9122_temp;
 
 static int kill_thread;
+/* set along with kill_thread, wakes display_cal() up if it waits for data */
+static struct frame_cancel *cal_cancel;
 static int fmcomms1_cal_eeprom(void);
 
 static struct s_cal_eeprom_v1 {
@@ -608,6 +610,20 @@ static double find_min(GtkSpinButton *spin_button, int marker, gfloat min, gfloa
 	return min_value;
 }
 
+static void cal_threads_start(void)
+{
+	kill_thread = 0;
+	if (cal_cancel)
+		frame_cancel_reset(cal_cancel);
+}
+
+static void cal_threads_stop(void)
+{
+	kill_thread = 1;
+	if (cal_cancel)
+		frame_cancel_set(cal_cancel);
+}
+
 static void tx_thread_cal(void *ptr)
 {
 	gdouble min_i, min_q, tmp, min_fsi, min_fsq, noise;
@@ -685,7 +701,7 @@ static void tx_thread_cal(void *ptr)
 	scpi_rx_trigger_sweep();
 	scpi_rx_trigger_sweep();
 
-	kill_thread = 1;
+	cal_threads_stop();
 }
 
 static GThread * cal_tx_button_clicked(void)
@@ -763,13 +779,41 @@ static void display_temp(void *ptr)
 
 #define RX_CAL_THRESHOLD -75
 
+/* How often display_cal() looks at kill_thread while there is no data */
+#define CAL_FRAME_TIMEOUT_MS 200
+
+/*
+ * Wait for a frame of type captured after the time after, or with after 0
+ * for the next one. The reference to the previous one in *frame is
+ * dropped. Returns 0 or -ECANCELED, -EINTR when the capture stops.
+ * The subscription only takes frames of type for the wait and is parked
+ * again afterwards, so the capture doesn't demux for it in between.
+ */
+static int cal_frame_wait(struct frame_sub *sub, enum osc_frame_type type,
+		gint64 after, const struct osc_frame **frame)
+{
+	int ret;
+
+	osc_frame_unref(*frame);
+	*frame = NULL;
+
+	plugin_subscribe_types(sub, OSC_FRAME_MASK(type));
+	do {
+		ret = plugin_frame_wait(sub, type, after, CAL_FRAME_TIMEOUT_MS,
+				cal_cancel, frame);
+	} while (ret == -ETIMEDOUT && !kill_thread);
+	plugin_subscribe_types(sub, 0);
+
+	return ret;
+}
+
 static void display_cal(void *ptr)
 {
 	int size, channels, num_samples, i;
-	int8_t *buf = NULL;
-	gfloat **cooked_data = NULL;
-	struct marker_type *markers = NULL;
-	gfloat *channel_I, *channel_Q;
+	const struct osc_frame *cooked = NULL, *mk_frame = NULL;
+	const struct marker_type *markers = NULL;
+	struct frame_sub *sub = NULL;
+	const gfloat *channel_I, *channel_Q;
 	gfloat max_x, min_x, avg_x;
 	gfloat max_y, min_y, avg_y;
 	gfloat max_r, min_r, max_theta, min_theta, rad;
@@ -781,11 +825,19 @@ static void display_cal(void *ptr)
 	bool show = false;
 	const char *device_ref;
 	int ret, attempt = 0;
+	gint64 knob_time;
 
 	device_ref = plugin_get_device_by_reference("cf-ad9643-core-lpc");
 	if (!device_ref)
 		goto display_call_ret;
 
+	sub = plugin_subscribe(device_ref, OSC_FRAME_MASK(OSC_FRAME_COOKED) |
+			OSC_FRAME_MASK(OSC_FRAME_MARKERS), 0, NULL, NULL);
+	if (!sub)
+		goto display_call_ret;
+	/* cal_frame_wait() takes it out of the park when it needs a frame */
+	plugin_subscribe_types(sub, 0);
+
 	if (!rx_marker) {
 		rx_marker = g_new(struct marker_type, 3);
 		rx_marker[0].active = false;
@@ -813,26 +865,29 @@ static void display_cal(void *ptr)
 				gtk_widget_hide(cal_rx);
 			gdk_threads_leave();
 
-			/* grab the data */
-			if (cal_rx_flag && cal_rx_level && plugin_get_marker_type(device_ref) == MARKER_IMAGE) {
-				do {
-					ret = plugin_data_capture(device_ref, (void **)&buf, &cooked_data, &markers);
-				} while ((ret == -EBUSY) && !kill_thread);
-			} else {
-				do {
-					ret = plugin_data_capture(device_ref, (void **)&buf, &cooked_data, NULL);
-				} while ((ret == -EBUSY) && !kill_thread);
+			/* grab the data, and the markers of the same capture */
+			ret = cal_frame_wait(sub, OSC_FRAME_COOKED, 0, &cooked);
+			if (!ret && cal_rx_flag && cal_rx_level && plugin_get_marker_type(device_ref) == MARKER_IMAGE) {
+				ret = cal_frame_wait(sub, OSC_FRAME_MARKERS,
+						cooked->timestamp - 1, &mk_frame);
+				if (!ret)
+					markers = mk_frame->markers;
 			}
 
-			/* If the lock is broken, then die nicely */
+			/* If the capture stopped, then die nicely */
 			if (kill_thread || ret != 0) {
 				size = 0;
 				kill_thread = 1;
 				break;
 			}
 
-			channel_I = cooked_data[0];
-			channel_Q = cooked_data[1];
+			/* the channels were changed under us, look again */
+			if (cooked->num_channels != 2)
+				continue;
+
+			num_samples = cooked->len;
+			channel_I = cooked->channel[0];
+			channel_Q = cooked->channel[1];
 			avg_x = avg_y = 0.0;
 			max_x = max_y = -MAXFLOAT;
 			min_x = min_y = MAXFLOAT;
@@ -942,11 +997,12 @@ static void display_cal(void *ptr)
 
 				if (attempt == 0) {
 					/* if the current value is OK, we leave it alone */
-					do {
-						ret = plugin_data_capture(device_ref, NULL, NULL, &markers);
-					} while ((ret == -EBUSY) && !kill_thread);
+					ret = cal_frame_wait(sub, OSC_FRAME_MARKERS,
+							0, &mk_frame);
+					if (!ret)
+						markers = mk_frame->markers;
 
-					/* If the lock is broken, then die nicely */
+					/* If the capture stopped, then die nicely */
 					if (kill_thread || ret != 0) {
 						size = 0;
 						kill_thread = 1;
@@ -977,14 +1033,16 @@ static void display_cal(void *ptr)
 					gdk_threads_enter();
 					gtk_spin_button_set_value(knob, knob_value);
 					gdk_threads_leave();
+					knob_time = g_get_monotonic_time();
 					usleep(delay);
 
-					/* grab the data */
-					do {
-						ret = plugin_data_capture(device_ref, NULL, NULL, &markers);
-					} while ((ret == -EBUSY) && !kill_thread);
+					/* grab the data, captured with the new setting */
+					ret = cal_frame_wait(sub, OSC_FRAME_MARKERS,
+							knob_time, &mk_frame);
+					if (!ret)
+						markers = mk_frame->markers;
 
-					/* If the lock is broken, then die nicely */
+					/* If the capture stopped, then die nicely */
 					if (kill_thread || ret != 0) {
 						size = 0;
 						kill_thread = 1;
@@ -1041,9 +1099,9 @@ skip_rx_cal:
 	}
 
 display_call_ret:
-	/* free the buffers */
-	if (buf || cooked_data || markers)
-		plugin_data_capture(NULL, (void **)&buf, &cooked_data, &markers);
+	osc_frame_unref(cooked);
+	osc_frame_unref(mk_frame);
+	plugin_unsubscribe(sub);
 
 	kill_thread = 1;
 	g_thread_exit(NULL);
@@ -1349,7 +1407,7 @@ G_MODULE_EXPORT void cal_dialog(GtkButton *btn, Dialogs *data)
 	char *filename = NULL;
 	GThread *thid_rx = NULL, *thid_tmp = NULL;
 
-	kill_thread = 0;
+	cal_threads_start();
 
 	/* Only start the thread if the LO is set */
 	if (gtk_toggle_button_get_active(GTK_TOGGLE_BUTTON(rx_widgets[rx_lo_powerdown].widget)))
@@ -1411,7 +1469,7 @@ G_MODULE_EXPORT void cal_dialog(GtkButton *btn, Dialogs *data)
 		 ret != GTK_RESPONSE_DELETE_EVENT);	/* Clicked on the close icon */
 
 	if (thid_rx) {
-		kill_thread = 1;
+		cal_threads_stop();
 		iio_thread_clear(thid_rx);
 	}
 
@@ -2282,6 +2340,8 @@ static int fmcomms1_init(GtkWidget *notebook)
 	rx_update_values();
 	cal_update_values();
 
+	cal_cancel = plugin_cancel_new();
+
 	gtk_notebook_append_page(GTK_NOTEBOOK(notebook), fmcomms1_panel, NULL);
 	gtk_notebook_set_tab_label_text(GTK_NOTEBOOK(notebook), fmcomms1_panel, "FMComms1");
 	gtk_file_chooser_set_current_folder (GTK_FILE_CHOOSER(dac_buffer), OSC_WAVEFORM_FILE_PATH);
@@ -2329,7 +2389,7 @@ static char *handle_item(struct osc_plugin *plugin, const char *attrib,
 	} else if (MATCH_ATTRIB("calibrate_rx")) {
 		if (value && atoi(value) == 1) {
 			gtk_widget_show(dialogs.calibrate);
-			kill_thread = 0;
+			cal_threads_start();
 			cal_rx_button_clicked();
 			thr = g_thread_new("Display_thread", (void *) &display_cal, (gpointer *)1);
 			while (i <= 20) {
@@ -2345,7 +2405,7 @@ static char *handle_item(struct osc_plugin *plugin, const char *attrib,
 		if (value && atoi(value) == 1) {
 			scpi_connect_functions();
 			gtk_widget_show(dialogs.calibrate);
-			kill_thread = 0;
+			cal_threads_start();
 			thid = cal_tx_button_clicked();
 			thr = g_thread_new("Display_thread", (void *) &display_cal, (gpointer *)1);
 			while (i <= 20) {
@@ -2416,11 +2476,18 @@ static bool fmcomms1_identify(void)
 	return !set_dev_paths("cf-ad9122-core-lpc");
 }
 
+static void fmcomms1_destroy(void)
+{
+	cal_threads_stop();
+	plugin_cancel_free(cal_cancel);
+	cal_cancel = NULL;
+}
+
 struct osc_plugin plugin = {
 	.name = "FMComms1",
 	.identify = fmcomms1_identify,
 	.init = fmcomms1_init,
 	.save_restore_attribs = fmcomms1_sr_attribs,
 	.handle_item = handle_item,
-
+	.destroy = fmcomms1_destroy,
 };
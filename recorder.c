@@ -0,0 +1,293 @@
+/**
+ * Copyright (C) 2013 Analog Devices, Inc.
+ *
+ * Licensed under the GPL-2.
+ *
+ **/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <glib.h>
+
+#include "recorder.h"
+
+/* O_DIRECT wants the memory, offsets and sizes aligned to the block size */
+#define RECORDER_ALIGN 4096
+
+int recorder_header_format(char *buf, size_t len,
+		const struct recorder_info *info)
+{
+	struct iio_channel_info *chn;
+	unsigned int i, scan_size = 0, num_enabled = 0;
+	size_t pos;
+
+	for (i = 0; i < info->num_channels; i++) {
+		if (info->channels[i].enabled) {
+			scan_size += info->channels[i].bytes;
+			num_enabled++;
+		}
+	}
+
+	pos = snprintf(buf, len, RECORDER_MAGIC "\n"
+			"device=%s\n"
+			"sample_rate=%f\n"
+			"lo_freq=%f\n"
+			"scan_size=%u\n"
+			"channels=%u\n",
+			info->device, info->sample_rate, info->lo_freq,
+			scan_size, num_enabled);
+
+	for (i = 0; i < info->num_channels && pos < len; i++) {
+		chn = &info->channels[i];
+		if (!chn->enabled)
+			continue;
+		pos += snprintf(buf + pos, len - pos,
+				"channel=%s index=%u bytes=%u bits=%u shift=%u signed=%u endian=%s\n",
+				chn->name, chn->index, chn->bytes, chn->bits_used,
+				chn->shift, chn->is_signed,
+				chn->endianness == IIO_BE ? "be" : "le");
+	}
+
+	/* keep room for the terminating NUL */
+	if (pos >= len)
+		return -E2BIG;
+
+	memset(buf + pos, 0, len - pos);
+
+	return 0;
+}
+
+static int write_all(int fd, const void *data, size_t len)
+{
+	const char *p = data;
+	ssize_t ret;
+
+	while (len) {
+		ret = write(fd, p, len);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			return -errno;
+		}
+		p += ret;
+		len -= ret;
+	}
+
+	return 0;
+}
+
+static gpointer recorder_thread_func(gpointer data)
+{
+	struct recorder *rec = data;
+	int idx, ret;
+
+	g_mutex_lock(&rec->lock);
+	for (;;) {
+		while (rec->pending < 0 && !rec->stop)
+			g_cond_wait(&rec->cond, &rec->lock);
+		if (rec->pending < 0)
+			break;
+
+		idx = rec->pending;
+		g_mutex_unlock(&rec->lock);
+
+		ret = rec->error ? rec->error : write_all(rec->fd,
+				rec->buffers[idx], rec->buffer_size);
+
+		g_mutex_lock(&rec->lock);
+		if (ret < 0) {
+			if (!rec->error)
+				fprintf(stderr, "Failed to write %s: %s\n",
+						rec->path, strerror(-ret));
+			rec->error = ret;
+			rec->dropped += rec->buffer_size;
+		} else {
+			rec->written += rec->buffer_size;
+		}
+		rec->pending = -1;
+	}
+	g_mutex_unlock(&rec->lock);
+
+	return NULL;
+}
+
+/*
+ * Create the file and write the header. max_write is the biggest chunk
+ * recorder_write() will be given, the buffers are made big enough to
+ * always take one.
+ */
+struct recorder * recorder_new(const char *path,
+		const struct recorder_info *info, unsigned int max_write)
+{
+	struct recorder *rec;
+	char *header;
+	unsigned int i;
+	int ret;
+
+	rec = g_new0(struct recorder, 1);
+	rec->fd = -1;
+	rec->pending = -1;
+	rec->path = g_strdup(path);
+
+	rec->buffer_size = RECORDER_BUFFER_SIZE;
+	if (rec->buffer_size < max_write)
+		rec->buffer_size = (max_write + RECORDER_ALIGN - 1) &
+			~(RECORDER_ALIGN - 1);
+
+	for (i = 0; i < RECORDER_NUM_BUFFERS; i++) {
+		if (posix_memalign(&rec->buffers[i], RECORDER_ALIGN,
+					rec->buffer_size)) {
+			rec->buffers[i] = NULL;
+			ret = -ENOMEM;
+			goto err_free;
+		}
+	}
+
+	/* Not every filesystem can do O_DIRECT, tmpfs for one */
+	rec->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_DIRECT, 0644);
+	rec->direct = rec->fd >= 0;
+	if (rec->fd < 0 && errno == EINVAL)
+		rec->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (rec->fd < 0) {
+		ret = -errno;
+		goto err_free;
+	}
+
+	/* the first buffer is free yet, the header goes out through it */
+	header = rec->buffers[0];
+	ret = recorder_header_format(header, RECORDER_HEADER_SIZE, info);
+	if (ret < 0)
+		goto err_free;
+
+	ret = write_all(rec->fd, header, RECORDER_HEADER_SIZE);
+	if (ret < 0)
+		goto err_free;
+
+	g_mutex_init(&rec->lock);
+	g_cond_init(&rec->cond);
+	rec->start_time = g_get_monotonic_time();
+	rec->thread = g_thread_new("Recorder thread", recorder_thread_func, rec);
+
+	printf("Recording to %s%s\n", path, rec->direct ? " (O_DIRECT)" : "");
+
+	return rec;
+
+err_free:
+	fprintf(stderr, "Failed to record to %s: %s\n", path, strerror(-ret));
+	if (rec->fd >= 0)
+		close(rec->fd);
+	for (i = 0; i < RECORDER_NUM_BUFFERS; i++)
+		free(rec->buffers[i]);
+	g_free(rec->path);
+	g_free(rec);
+	return NULL;
+}
+
+/*
+ * Flush what's left and close the file. Must not race with
+ * recorder_write(), the caller detaches the recorder from the capture
+ * first.
+ */
+void recorder_free(struct recorder *rec)
+{
+	unsigned int i;
+	int ret;
+
+	if (!rec)
+		return;
+
+	g_mutex_lock(&rec->lock);
+	rec->stop = true;
+	g_cond_signal(&rec->cond);
+	g_mutex_unlock(&rec->lock);
+	g_thread_join(rec->thread);
+
+	/* The tail isn't block sized, that one can't go out with O_DIRECT */
+	if (rec->used && !rec->error) {
+		if (rec->direct)
+			fcntl(rec->fd, F_SETFL,
+					fcntl(rec->fd, F_GETFL) & ~O_DIRECT);
+		ret = write_all(rec->fd, rec->buffers[rec->fill], rec->used);
+		if (ret < 0) {
+			rec->error = ret;
+			rec->dropped += rec->used;
+		} else {
+			rec->written += rec->used;
+		}
+	}
+
+	printf("Recorded %" G_GUINT64_FORMAT " bytes to %s, %"
+			G_GUINT64_FORMAT " bytes dropped\n",
+			rec->written, rec->path, rec->dropped);
+
+	close(rec->fd);
+	g_mutex_clear(&rec->lock);
+	g_cond_clear(&rec->cond);
+	for (i = 0; i < RECORDER_NUM_BUFFERS; i++)
+		free(rec->buffers[i]);
+	g_free(rec->path);
+	g_free(rec);
+}
+
+/*
+ * Called from the capture thread with every chunk of raw data. A chunk is
+ * either taken completely or dropped completely, so a recording never
+ * ends up with half a scan in it.
+ */
+void recorder_write(struct recorder *rec, const void *data, unsigned int len)
+{
+	unsigned int n;
+	bool writer_busy;
+
+	g_mutex_lock(&rec->lock);
+	writer_busy = rec->pending >= 0;
+	if (rec->error || len > rec->buffer_size - rec->used +
+			(writer_busy ? 0 : rec->buffer_size)) {
+		rec->dropped += len;
+		g_mutex_unlock(&rec->lock);
+		return;
+	}
+	g_mutex_unlock(&rec->lock);
+
+	n = rec->buffer_size - rec->used;
+	if (n > len)
+		n = len;
+	memcpy((char *)rec->buffers[rec->fill] + rec->used, data, n);
+	rec->used += n;
+
+	if (rec->used < rec->buffer_size)
+		return;
+
+	/* full, hand it over to the writer and go on with the other one */
+	g_mutex_lock(&rec->lock);
+	if (rec->pending >= 0) {
+		/* filled up exactly, it goes out with the next chunk */
+		g_mutex_unlock(&rec->lock);
+		return;
+	}
+	rec->pending = rec->fill;
+	g_cond_signal(&rec->cond);
+	g_mutex_unlock(&rec->lock);
+
+	rec->fill = (rec->fill + 1) % RECORDER_NUM_BUFFERS;
+	rec->used = len - n;
+	memcpy(rec->buffers[rec->fill], (const char *)data + n, rec->used);
+}
+
+void recorder_get_stats(struct recorder *rec, struct recorder_stats *stats)
+{
+	gint64 elapsed;
+
+	g_mutex_lock(&rec->lock);
+	stats->written = rec->written;
+	stats->dropped = rec->dropped;
+	stats->error = rec->error;
+	g_mutex_unlock(&rec->lock);
+
+	elapsed = g_get_monotonic_time() - rec->start_time;
+	stats->rate = elapsed > 0 ? stats->written * 1e6 / elapsed : 0.0;
+}
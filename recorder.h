@@ -0,0 +1,79 @@
+/**
+ * Copyright (C) 2013 Analog Devices, Inc.
+ *
+ * Licensed under the GPL-2.
+ *
+ **/
+
+#ifndef __RECORDER_H__
+#define __RECORDER_H__
+
+#include <stdbool.h>
+#include <glib.h>
+
+#include "iio_utils.h"
+
+/*
+ * A recording is a text header, NUL padded to RECORDER_HEADER_SIZE, followed
+ * by the raw interleaved scans exactly as the device delivered them. The
+ * header has one key=value per line; the first line is RECORDER_MAGIC and
+ * there is one "channel=" line for every enabled channel, in scan order.
+ */
+#define RECORDER_MAGIC "IIOREC 1"
+#define RECORDER_HEADER_SIZE 4096
+
+#define RECORDER_BUFFER_SIZE (4 * 1024 * 1024)
+#define RECORDER_NUM_BUFFERS 2
+
+struct recorder_info {
+	const char *device;
+	struct iio_channel_info *channels;
+	unsigned int num_channels;
+	double sample_rate;
+	double lo_freq;
+};
+
+struct recorder_stats {
+	guint64 written;	/* bytes on disk, header not included */
+	guint64 dropped;	/* bytes which came in while the disk was behind */
+	double rate;		/* bytes/s since the recording started */
+	int error;
+};
+
+/*
+ * The capture thread copies into one buffer while the writer thread puts
+ * the other one on disk. If both are busy, incoming data is dropped (and
+ * counted), the capture thread never waits for the disk.
+ */
+struct recorder {
+	int fd;
+	bool direct;
+	char *path;
+	void *buffers[RECORDER_NUM_BUFFERS];
+	unsigned int buffer_size;
+	unsigned int fill;
+	unsigned int used;
+
+	GThread *thread;
+	GMutex lock;
+	GCond cond;
+	int pending;
+	bool stop;
+
+	guint64 written;
+	guint64 dropped;
+	gint64 start_time;
+	int error;
+};
+
+int recorder_header_format(char *buf, size_t len,
+		const struct recorder_info *info);
+
+struct recorder * recorder_new(const char *path,
+		const struct recorder_info *info, unsigned int max_write);
+void recorder_free(struct recorder *rec);
+
+void recorder_write(struct recorder *rec, const void *data, unsigned int len);
+void recorder_get_stats(struct recorder *rec, struct recorder_stats *stats);
+
+#endif
@@ -0,0 +1,371 @@
+/**
+ * Copyright (C) 2013 Analog Devices, Inc.
+ *
+ * Licensed under the GPL-2.
+ *
+ **/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <glib.h>
+
+#include "replay.h"
+#include "recorder.h"
+
+bool replay_fast;
+
+static GSList *replay_sources;
+
+static void replay_source_free(struct replay_source *src)
+{
+	unsigned int i;
+
+	for (i = 0; i < src->num_channels; i++)
+		g_free(src->channels[i].name);
+	g_free(src->channels);
+	if (src->map)
+		munmap(src->map, src->map_len);
+	else
+		g_free(src->data);
+	g_free(src->name);
+	g_free(src->path);
+	g_free(src);
+}
+
+static int replay_parse_header(struct replay_source *src, const char *header)
+{
+	struct iio_channel_info *chn;
+	unsigned int scan_size = 0, num = 0, i;
+	unsigned int index, bytes, bits, shift, is_signed;
+	char **lines, **line, name[64], endian[3];
+	int ret = 0;
+
+	lines = g_strsplit(header, "\n", 0);
+	for (line = lines; *line; line++) {
+		if (sscanf(*line, "sample_rate=%lf", &src->sample_rate) == 1)
+			continue;
+		if (sscanf(*line, "lo_freq=%lf", &src->lo_freq) == 1)
+			continue;
+		if (sscanf(*line, "scan_size=%u", &scan_size) == 1)
+			continue;
+		if (sscanf(*line, "channels=%u", &num) == 1) {
+			src->channels = g_new0(struct iio_channel_info, num);
+			continue;
+		}
+		if (strncmp(*line, "channel=", 8))
+			continue;
+
+		if (sscanf(*line, "channel=%63s index=%u bytes=%u bits=%u shift=%u signed=%u endian=%2s",
+					name, &index, &bytes, &bits, &shift,
+					&is_signed, endian) != 7 ||
+				src->num_channels == num || !bytes || bits > 64) {
+			ret = -EINVAL;
+			break;
+		}
+
+		chn = &src->channels[src->num_channels++];
+		chn->name = g_strdup(name);
+		chn->index = index;
+		chn->bytes = bytes;
+		chn->bits_used = bits;
+		chn->shift = shift;
+		chn->mask = bits == 64 ? ~0ULL : (1ULL << bits) - 1;
+		chn->is_signed = is_signed;
+		chn->endianness = strcmp(endian, "be") ? IIO_LE : IIO_BE;
+		chn->scale = 1.0f;
+		chn->enabled = 1;
+		src->scan_size += bytes;
+	}
+	g_strfreev(lines);
+
+	if (ret == 0 && (!src->num_channels || src->num_channels != num ||
+				src->scan_size != scan_size))
+		ret = -EINVAL;
+
+	return ret;
+}
+
+static int replay_load_recording(struct replay_source *src, int fd)
+{
+	char header[RECORDER_HEADER_SIZE];
+	struct stat st;
+	int ret;
+
+	if (fstat(fd, &st) < 0)
+		return -errno;
+
+	ret = pread(fd, header, sizeof(header), 0);
+	if (ret != sizeof(header))
+		return -EINVAL;
+	header[sizeof(header) - 1] = '\0';
+
+	ret = replay_parse_header(src, header);
+	if (ret < 0)
+		return ret;
+
+	src->num_scans = (st.st_size - RECORDER_HEADER_SIZE) / src->scan_size;
+	if (!src->num_scans)
+		return -ENODATA;
+
+	/* recordings can be much bigger than memory, let the kernel page them */
+	src->map_len = st.st_size;
+	src->map = mmap(NULL, src->map_len, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (src->map == MAP_FAILED) {
+		src->map = NULL;
+		return -errno;
+	}
+	madvise(src->map, src->map_len, MADV_SEQUENTIAL);
+	src->data = (char *)src->map + RECORDER_HEADER_SIZE;
+
+	return 0;
+}
+
+/*
+ * The TEXT waveforms, as used by the DAC plugins: two or four columns
+ * (I/Q pairs) per line, scaled to 16 bits unless the file says TEXTU.
+ * Each column becomes a signed 16 bit channel.
+ */
+static int replay_load_waveform(struct replay_source *src, FILE *f)
+{
+	double val[4], max = 0.0, scale = 0.0;
+	unsigned int i, cols = 0, n = 0, size = 0;
+	char line[256];
+	double *tmp = NULL;
+	int16_t *data;
+	int ret;
+
+	if (!fgets(line, sizeof(line), f) || strncmp(line, "TEXT", 4))
+		return -EINVAL;
+	if (strncmp(line, "TEXTU", 5) == 0)
+		scale = 1.0;
+
+	while (fgets(line, sizeof(line), f)) {
+		ret = sscanf(line, "%lf%*[, \t]%lf%*[, \t]%lf%*[, \t]%lf",
+				&val[0], &val[1], &val[2], &val[3]);
+		if (ret <= 0)
+			continue;
+		if (ret != 2 && ret != 4)
+			break;
+		if (!cols)
+			cols = ret;
+		if ((unsigned int)ret != cols)
+			break;
+
+		if (n + cols > size) {
+			size = size ? size * 2 : 4096;
+			tmp = g_renew(double, tmp, size);
+		}
+		for (i = 0; i < cols; i++) {
+			tmp[n++] = val[i];
+			if (fabs(val[i]) > max)
+				max = fabs(val[i]);
+		}
+	}
+
+	if (!n) {
+		g_free(tmp);
+		return -ENODATA;
+	}
+
+	if (scale == 0.0)
+		scale = max > 0.0 ? 32767.0 / max : 1.0;
+
+	data = g_new(int16_t, n);
+	for (i = 0; i < n; i++)
+		data[i] = (int16_t)lrint(tmp[i] * scale);
+	g_free(tmp);
+
+	src->data = data;
+	src->num_scans = n / cols;
+	src->num_channels = cols;
+	src->scan_size = cols * sizeof(int16_t);
+	src->channels = g_new0(struct iio_channel_info, cols);
+	for (i = 0; i < cols; i++) {
+		src->channels[i].name = g_strdup_printf("in_voltage%u", i);
+		src->channels[i].index = i;
+		src->channels[i].bytes = 2;
+		src->channels[i].bits_used = 16;
+		src->channels[i].mask = 0xffff;
+		src->channels[i].is_signed = 1;
+		src->channels[i].endianness = IIO_LE;
+		src->channels[i].scale = 1.0f;
+		src->channels[i].enabled = 1;
+	}
+
+	return 0;
+}
+
+struct replay_source * replay_find(const char *device)
+{
+	struct replay_source *src;
+	GSList *node;
+
+	if (!device)
+		return NULL;
+
+	for (node = replay_sources; node; node = g_slist_next(node)) {
+		src = node->data;
+		if (!strcmp(src->name, device))
+			return src;
+	}
+
+	return NULL;
+}
+
+bool replay_is_device(const char *device)
+{
+	return device && !strncmp(device, REPLAY_PREFIX, strlen(REPLAY_PREFIX));
+}
+
+/*
+ * Load a recording or waveform file. Returns the device name to use for
+ * it, NULL if it can't be played back.
+ */
+const char * replay_add(const char *path)
+{
+	struct replay_source *src;
+	char magic[sizeof(RECORDER_MAGIC)], *base;
+	GSList *node;
+	FILE *f;
+	int ret;
+
+	for (node = replay_sources; node; node = g_slist_next(node)) {
+		src = node->data;
+		if (!strcmp(src->path, path))
+			return src->name;
+	}
+
+	f = fopen(path, "r");
+	if (!f) {
+		fprintf(stderr, "Failed to open %s: %s\n", path, strerror(errno));
+		return NULL;
+	}
+
+	src = g_new0(struct replay_source, 1);
+	src->path = g_strdup(path);
+
+	if (fread(magic, 1, sizeof(magic), f) == sizeof(magic) &&
+			!strncmp(magic, RECORDER_MAGIC "\n", sizeof(magic))) {
+		ret = replay_load_recording(src, fileno(f));
+	} else {
+		rewind(f);
+		ret = replay_load_waveform(src, f);
+	}
+	fclose(f);
+
+	if (ret < 0) {
+		fprintf(stderr, "Failed to load %s for replay: %s\n",
+				path, strerror(-ret));
+		replay_source_free(src);
+		return NULL;
+	}
+
+	if (src->sample_rate <= 0.0)
+		src->sample_rate = REPLAY_DEFAULT_RATE;
+
+	base = g_path_get_basename(path);
+	src->name = g_strconcat(REPLAY_PREFIX, base, NULL);
+	g_free(base);
+	while (replay_find(src->name)) {
+		base = src->name;
+		src->name = g_strconcat(base, "'", NULL);
+		g_free(base);
+	}
+
+	replay_sources = g_slist_append(replay_sources, src);
+
+	printf("Replaying %s as %s: %u channels, %zu scans at %.0f SPS\n",
+			path, src->name, src->num_channels, src->num_scans,
+			src->sample_rate);
+
+	return src->name;
+}
+
+void replay_remove_all(void)
+{
+	g_slist_free_full(replay_sources, (GDestroyNotify)replay_source_free);
+	replay_sources = NULL;
+}
+
+/* Same as build_channel_array() does for a real device */
+int replay_build_channel_array(struct replay_source *src,
+		struct iio_channel_info **channels, unsigned int *num_channels)
+{
+	struct iio_channel_info *chn;
+	unsigned int i;
+
+	chn = malloc(src->num_channels * sizeof(*chn));
+	if (!chn)
+		return -ENOMEM;
+
+	memcpy(chn, src->channels, src->num_channels * sizeof(*chn));
+	for (i = 0; i < src->num_channels; i++) {
+		chn[i].name = strdup(src->channels[i].name);
+		chn[i].generic_name = NULL;
+	}
+
+	*channels = chn;
+	*num_channels = src->num_channels;
+
+	return 0;
+}
+
+/*
+ * Copy num_scans scans into dst, starting at scan *pos and wrapping around
+ * at the end of the file. Only the channels enabled in channels (which is
+ * a replay_build_channel_array() copy) end up in dst, packed just like the
+ * device would if only those were enabled. Returns the number of scans.
+ */
+unsigned int replay_read(struct replay_source *src,
+		const struct iio_channel_info *channels, size_t *pos,
+		void *dst, unsigned int num_scans)
+{
+	const uint8_t *in;
+	uint8_t *out = dst;
+	unsigned int i, j, n, offset, done = 0;
+	bool all = true;
+
+	for (i = 0; i < src->num_channels; i++)
+		all &= !!channels[i].enabled;
+
+	while (done < num_scans) {
+		if (*pos >= src->num_scans)
+			*pos = 0;
+
+		n = num_scans - done;
+		if (n > src->num_scans - *pos)
+			n = src->num_scans - *pos;
+
+		in = (const uint8_t *)src->data + *pos * src->scan_size;
+		if (all) {
+			memcpy(out, in, n * src->scan_size);
+			out += n * src->scan_size;
+		} else {
+			for (j = 0; j < n; j++) {
+				offset = 0;
+				for (i = 0; i < src->num_channels; i++) {
+					if (channels[i].enabled) {
+						memcpy(out, in + offset,
+								src->channels[i].bytes);
+						out += src->channels[i].bytes;
+					}
+					offset += src->channels[i].bytes;
+				}
+				in += src->scan_size;
+			}
+		}
+
+		*pos += n;
+		done += n;
+	}
+
+	return done;
+}
@@ -0,0 +1,58 @@
+/**
+ * Copyright (C) 2013 Analog Devices, Inc.
+ *
+ * Licensed under the GPL-2.
+ *
+ **/
+
+#ifndef __REPLAY_H__
+#define __REPLAY_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "iio_utils.h"
+
+/*
+ * A replay source stands in for an IIO device: it plays back a recording
+ * (see recorder.h) or a TEXT waveform file, in a loop. It shows up in the
+ * device list as REPLAY_PREFIX followed by the file name.
+ */
+#define REPLAY_PREFIX "replay:"
+
+/* Used when the file doesn't say, e.g. for waveforms */
+#define REPLAY_DEFAULT_RATE 1000000.0
+
+struct replay_source {
+	char *name;
+	char *path;
+
+	/* every channel in the file, in scan order */
+	struct iio_channel_info *channels;
+	unsigned int num_channels;
+	unsigned int scan_size;
+	double sample_rate;
+	double lo_freq;
+
+	void *data;
+	size_t num_scans;
+	void *map;
+	size_t map_len;
+};
+
+/* Play back as fast as possible rather than at the sample rate */
+extern bool replay_fast;
+
+const char * replay_add(const char *path);
+void replay_remove_all(void);
+struct replay_source * replay_find(const char *device);
+bool replay_is_device(const char *device);
+
+int replay_build_channel_array(struct replay_source *src,
+		struct iio_channel_info **channels, unsigned int *num_channels);
+
+unsigned int replay_read(struct replay_source *src,
+		const struct iio_channel_info *channels, size_t *pos,
+		void *dst, unsigned int num_scans);
+
+#endif
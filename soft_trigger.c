@@ -0,0 +1,161 @@
+/**
+ * Copyright (C) 2013 Analog Devices, Inc.
+ *
+ * Licensed under the GPL-2.
+ *
+ **/
+
+#if defined(__SSE2__)
+#include <xmmintrin.h>
+#elif defined(__ARM_NEON__) || defined(__ARM_NEON)
+#include <arm_neon.h>
+#define HAVE_NEON 1
+#endif
+
+#include "soft_trigger.h"
+
+/*
+ * The search runs over blocks: a branch free min/max pass decides whether
+ * anything in the block could change the trigger state, and only those
+ * blocks go through the sample by sample state machine. On a signal that
+ * isn't near the level, that's nearly all of them skipped.
+ */
+#define SOFT_TRIGGER_BLOCK 64
+
+static void block_minmax(const float *data, unsigned int num,
+		float *min, float *max)
+{
+	float lo = data[0], hi = data[0];
+	unsigned int i = 0;
+#if defined(__SSE2__)
+	float tmp[4];
+	__m128 vlo = _mm_set1_ps(lo), vhi = vlo, v;
+
+	for (; i + 4 <= num; i += 4) {
+		v = _mm_loadu_ps(data + i);
+		vlo = _mm_min_ps(vlo, v);
+		vhi = _mm_max_ps(vhi, v);
+	}
+	_mm_storeu_ps(tmp, vlo);
+	lo = tmp[0] < tmp[1] ? tmp[0] : tmp[1];
+	lo = tmp[2] < lo ? tmp[2] : lo;
+	lo = tmp[3] < lo ? tmp[3] : lo;
+	_mm_storeu_ps(tmp, vhi);
+	hi = tmp[0] > tmp[1] ? tmp[0] : tmp[1];
+	hi = tmp[2] > hi ? tmp[2] : hi;
+	hi = tmp[3] > hi ? tmp[3] : hi;
+#elif HAVE_NEON
+	float32x4_t vlo = vdupq_n_f32(lo), vhi = vlo, v;
+	float32x2_t p;
+
+	for (; i + 4 <= num; i += 4) {
+		v = vld1q_f32(data + i);
+		vlo = vminq_f32(vlo, v);
+		vhi = vmaxq_f32(vhi, v);
+	}
+	p = vpmin_f32(vget_low_f32(vlo), vget_high_f32(vlo));
+	p = vpmin_f32(p, p);
+	lo = vget_lane_f32(p, 0);
+	p = vpmax_f32(vget_low_f32(vhi), vget_high_f32(vhi));
+	p = vpmax_f32(p, p);
+	hi = vget_lane_f32(p, 0);
+#endif
+	for (; i < num; i++) {
+		if (data[i] < lo)
+			lo = data[i];
+		if (data[i] > hi)
+			hi = data[i];
+	}
+
+	*min = lo;
+	*max = hi;
+}
+
+void soft_trigger_reset(struct soft_trigger *trig,
+		const struct soft_trigger_config *cfg)
+{
+	trig->cfg = *cfg;
+	trig->armed = false;
+	trig->have_prev = false;
+	trig->prev = 0.0f;
+	trig->holdoff_left = 0;
+}
+
+/*
+ * Look for the next trigger in data, continuing from the state left by
+ * the previous call, so a stream can be fed in pieces. Returns the index
+ * of the trigger sample, or -1. After a trigger, the next call is
+ * expected to start right after it.
+ */
+int soft_trigger_search(struct soft_trigger *trig, const float *data,
+		unsigned int num)
+{
+	const struct soft_trigger_config *cfg = &trig->cfg;
+	float diff[SOFT_TRIGGER_BLOCK];
+	float sign = cfg->falling ? -1.0f : 1.0f;
+	float level = sign * cfg->level;
+	float arm_level = level - cfg->hysteresis;
+	float min, max, vmin, vmax, v;
+	const float *src;
+	unsigned int i = 0, k, n;
+
+	if (!num)
+		return -1;
+
+	if (trig->holdoff_left) {
+		n = trig->holdoff_left < num ? trig->holdoff_left : num;
+		trig->holdoff_left -= n;
+		trig->prev = data[n - 1];
+		trig->have_prev = true;
+		i = n;
+	}
+
+	while (i < num) {
+		n = num - i;
+		if (n > SOFT_TRIGGER_BLOCK)
+			n = SOFT_TRIGGER_BLOCK;
+
+		src = data + i;
+		if (cfg->type == SOFT_TRIGGER_SLOPE) {
+			diff[0] = trig->have_prev ? src[0] - trig->prev : 0.0f;
+			for (k = 1; k < n; k++)
+				diff[k] = src[k] - src[k - 1];
+			src = diff;
+		}
+		trig->prev = data[i + n - 1];
+		trig->have_prev = true;
+
+		block_minmax(src, n, &min, &max);
+		vmin = cfg->falling ? -max : min;
+		vmax = cfg->falling ? -min : max;
+
+		if (cfg->type == SOFT_TRIGGER_LEVEL || trig->armed) {
+			if (vmax < level) {
+				i += n;
+				continue;
+			}
+		} else if (vmin >= arm_level) {
+			i += n;
+			continue;
+		}
+
+		for (k = 0; k < n; k++) {
+			v = sign * src[k];
+			if (cfg->type != SOFT_TRIGGER_LEVEL && !trig->armed) {
+				if (v < arm_level)
+					trig->armed = true;
+				continue;
+			}
+			if (v >= level) {
+				trig->armed = false;
+				trig->holdoff_left = cfg->holdoff;
+				trig->prev = data[i + k];
+				return i + k;
+			}
+		}
+
+		i += n;
+	}
+
+	return -1;
+}
@@ -0,0 +1,55 @@
+/**
+ * Copyright (C) 2013 Analog Devices, Inc.
+ *
+ * Licensed under the GPL-2.
+ *
+ **/
+
+#ifndef __SOFT_TRIGGER_H__
+#define __SOFT_TRIGGER_H__
+
+#include <stdbool.h>
+
+enum soft_trigger_mode {
+	SOFT_TRIGGER_OFF,
+	SOFT_TRIGGER_AUTO,
+	SOFT_TRIGGER_NORMAL,
+	SOFT_TRIGGER_SINGLE,
+};
+
+/*
+ * LEVEL fires whenever the signal is past the level, EDGE only when it
+ * crosses the level after having been at least hysteresis away on the
+ * other side, SLOPE is EDGE applied to the sample to sample difference.
+ */
+enum soft_trigger_type {
+	SOFT_TRIGGER_LEVEL,
+	SOFT_TRIGGER_EDGE,
+	SOFT_TRIGGER_SLOPE,
+};
+
+struct soft_trigger_config {
+	enum soft_trigger_mode mode;
+	enum soft_trigger_type type;
+	bool falling;
+	unsigned int channel;		/* index among the enabled channels */
+	float level;
+	float hysteresis;
+	unsigned int pretrigger;	/* percent of the frame before the trigger */
+	unsigned int holdoff;		/* samples ignored after a trigger */
+};
+
+struct soft_trigger {
+	struct soft_trigger_config cfg;
+	bool armed;
+	bool have_prev;
+	float prev;
+	unsigned int holdoff_left;
+};
+
+void soft_trigger_reset(struct soft_trigger *trig,
+		const struct soft_trigger_config *cfg);
+int soft_trigger_search(struct soft_trigger *trig, const float *data,
+		unsigned int num);
+
+#endif
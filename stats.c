@@ -0,0 +1,278 @@
+/**
+ * Copyright (C) 2013 Analog Devices, Inc.
+ *
+ * Licensed under the GPL-2.
+ *
+ **/
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#include "stats.h"
+
+struct stats_hist {
+	guint64 count;
+	guint64 sum;
+	guint64 min;
+	guint64 max;
+	guint32 buckets[STATS_NUM_BUCKETS];
+};
+
+static const char * const stage_names[STATS_NUM_STAGES] = {
+	[STATS_READ] = "read",
+	[STATS_DEMUX] = "demux",
+	[STATS_FFT] = "fft",
+	[STATS_AVERAGE] = "average",
+	[STATS_MARKERS] = "markers",
+	[STATS_TEXT] = "text",
+	[STATS_REDRAW] = "redraw",
+};
+
+static const char * const counter_names[STATS_NUM_COUNTERS] = {
+	[STATS_FRAMES] = "frames",
+	[STATS_OVERRUNS] = "overruns",
+	[STATS_SHORT_READS] = "short_reads",
+};
+
+/* Recorded from the capture threads and the GUI, read from anywhere */
+static struct stats_hist hists[STATS_NUM_STAGES];
+static volatile gint counters[STATS_NUM_COUNTERS];
+G_LOCK_DEFINE_STATIC(stats);
+
+static int server_fd = -1;
+static char *server_path;
+static GThread *server_thread;
+
+guint64 stats_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static unsigned int stats_bucket(guint64 ns)
+{
+	unsigned int e;
+
+	if (ns < STATS_SUB_BUCKETS)
+		return ns;
+
+	e = 63 - __builtin_clzll(ns);
+	return (e - STATS_SUB_BITS + 1) * STATS_SUB_BUCKETS +
+		((ns >> (e - STATS_SUB_BITS)) & (STATS_SUB_BUCKETS - 1));
+}
+
+/* The middle of what ends up in a bucket */
+static guint64 stats_bucket_value(unsigned int idx)
+{
+	unsigned int e, sub;
+
+	if (idx < STATS_SUB_BUCKETS)
+		return idx;
+
+	e = idx / STATS_SUB_BUCKETS + STATS_SUB_BITS - 1;
+	sub = idx % STATS_SUB_BUCKETS;
+	return ((guint64)(STATS_SUB_BUCKETS + sub) << (e - STATS_SUB_BITS)) +
+		((1ULL << (e - STATS_SUB_BITS)) >> 1);
+}
+
+/*
+ * Account for the time since start (from stats_now()) to stage. Returns
+ * the current time, which can be the start of the next stage.
+ */
+guint64 stats_record(enum stats_stage stage, guint64 start)
+{
+	struct stats_hist *h = &hists[stage];
+	guint64 now = stats_now(), ns = now - start;
+
+	G_LOCK(stats);
+	if (!h->count || ns < h->min)
+		h->min = ns;
+	if (ns > h->max)
+		h->max = ns;
+	h->count++;
+	h->sum += ns;
+	h->buckets[stats_bucket(ns)]++;
+	G_UNLOCK(stats);
+
+	return now;
+}
+
+void stats_count(enum stats_counter counter)
+{
+	g_atomic_int_inc(&counters[counter]);
+}
+
+unsigned int stats_get_counter(enum stats_counter counter)
+{
+	return g_atomic_int_get(&counters[counter]);
+}
+
+void stats_reset(void)
+{
+	unsigned int i;
+
+	G_LOCK(stats);
+	memset(hists, 0, sizeof(hists));
+	G_UNLOCK(stats);
+
+	for (i = 0; i < STATS_NUM_COUNTERS; i++)
+		g_atomic_int_set(&counters[i], 0);
+}
+
+static guint64 stats_percentile(const struct stats_hist *h, double q)
+{
+	guint64 target, seen = 0;
+	unsigned int i;
+
+	target = (guint64)(q * h->count + 0.5);
+	if (!target)
+		target = 1;
+
+	for (i = 0; i < STATS_NUM_BUCKETS; i++) {
+		seen += h->buckets[i];
+		if (seen >= target)
+			return CLAMP(stats_bucket_value(i), h->min, h->max);
+	}
+
+	return h->max;
+}
+
+void stats_get_summary(enum stats_stage stage, struct stats_summary *sum)
+{
+	const struct stats_hist *h = &hists[stage];
+
+	memset(sum, 0, sizeof(*sum));
+
+	G_LOCK(stats);
+	if (h->count) {
+		sum->count = h->count;
+		sum->min = h->min;
+		sum->max = h->max;
+		sum->mean = h->sum / h->count;
+		sum->p50 = stats_percentile(h, 0.5);
+		sum->p90 = stats_percentile(h, 0.9);
+		sum->p99 = stats_percentile(h, 0.99);
+		sum->p999 = stats_percentile(h, 0.999);
+	}
+	G_UNLOCK(stats);
+}
+
+/* One line per stage, times in us, then one line per counter */
+size_t stats_format(char *buf, size_t len)
+{
+	struct stats_summary sum;
+	size_t pos;
+	unsigned int i;
+
+	pos = snprintf(buf, len, "%-8s %10s %9s %9s %9s %9s %9s %9s %9s\n",
+			"stage", "count", "min", "mean", "p50", "p90", "p99",
+			"p99.9", "max");
+
+	for (i = 0; i < STATS_NUM_STAGES && pos < len; i++) {
+		stats_get_summary(i, &sum);
+		pos += snprintf(buf + pos, len - pos,
+				"%-8s %10" G_GUINT64_FORMAT
+				" %9.1f %9.1f %9.1f %9.1f %9.1f %9.1f %9.1f\n",
+				stage_names[i], sum.count,
+				sum.min / 1e3, sum.mean / 1e3, sum.p50 / 1e3,
+				sum.p90 / 1e3, sum.p99 / 1e3, sum.p999 / 1e3,
+				sum.max / 1e3);
+	}
+
+	for (i = 0; i < STATS_NUM_COUNTERS && pos < len; i++)
+		pos += snprintf(buf + pos, len - pos, "%s %u\n",
+				counter_names[i], stats_get_counter(i));
+
+	return pos < len ? pos : len - 1;
+}
+
+/* Every client gets the current stats as text, then the socket is closed */
+static gpointer stats_server_func(gpointer data)
+{
+	char buf[2048];
+	size_t len, done;
+	ssize_t ret;
+	int fd;
+
+	for (;;) {
+		fd = accept(server_fd, NULL, NULL);
+		if (fd < 0) {
+			if (errno == EINTR || errno == ECONNABORTED)
+				continue;
+			break;
+		}
+
+		len = stats_format(buf, sizeof(buf));
+		for (done = 0; done < len; done += ret) {
+			ret = send(fd, buf + done, len - done, MSG_NOSIGNAL);
+			if (ret <= 0)
+				break;
+		}
+		close(fd);
+	}
+
+	return NULL;
+}
+
+/* Serve the stats on a Unix socket, e.g. for "socat - UNIX:path" */
+int stats_server_start(const char *path)
+{
+	struct sockaddr_un addr;
+	struct stat st;
+	int ret;
+
+	if (server_fd >= 0)
+		return -EBUSY;
+
+	if (strlen(path) >= sizeof(addr.sun_path))
+		return -ENAMETOOLONG;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, path);
+
+	/* a socket left behind by an earlier run */
+	if (lstat(path, &st) == 0 && S_ISSOCK(st.st_mode))
+		unlink(path);
+
+	server_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (server_fd < 0)
+		return -errno;
+
+	if (bind(server_fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+			listen(server_fd, 4) < 0) {
+		ret = -errno;
+		close(server_fd);
+		server_fd = -1;
+		return ret;
+	}
+
+	server_path = g_strdup(path);
+	server_thread = g_thread_new("Stats server", stats_server_func, NULL);
+
+	return 0;
+}
+
+void stats_server_stop(void)
+{
+	if (server_fd < 0)
+		return;
+
+	/* wakes up accept() */
+	shutdown(server_fd, SHUT_RDWR);
+	g_thread_join(server_thread);
+	close(server_fd);
+	server_fd = -1;
+
+	unlink(server_path);
+	g_free(server_path);
+	server_path = NULL;
+}
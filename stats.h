@@ -0,0 +1,61 @@
+/**
+ * Copyright (C) 2013 Analog Devices, Inc.
+ *
+ * Licensed under the GPL-2.
+ *
+ **/
+
+#ifndef __STATS_H__
+#define __STATS_H__
+
+#include <stddef.h>
+#include <glib.h>
+
+/*
+ * Where the time of a frame goes, from the buffer read to the redraw.
+ * Every stage keeps a log-linear histogram of its latency: values below
+ * STATS_SUB_BUCKETS ns are exact, above that every power of two is split in
+ * STATS_SUB_BUCKETS buckets, so a percentile is within 1/STATS_SUB_BUCKETS
+ * of the real value whatever the range.
+ */
+#define STATS_SUB_BITS		4
+#define STATS_SUB_BUCKETS	(1 << STATS_SUB_BITS)
+#define STATS_NUM_BUCKETS	((64 - STATS_SUB_BITS + 1) * STATS_SUB_BUCKETS)
+
+enum stats_stage {
+	STATS_READ,
+	STATS_DEMUX,
+	STATS_FFT,
+	STATS_AVERAGE,
+	STATS_MARKERS,
+	STATS_TEXT,
+	STATS_REDRAW,
+	STATS_NUM_STAGES,
+};
+
+enum stats_counter {
+	STATS_FRAMES,
+	STATS_OVERRUNS,
+	STATS_SHORT_READS,
+	STATS_NUM_COUNTERS,
+};
+
+struct stats_summary {
+	guint64 count;
+	guint64 min, max, mean;
+	guint64 p50, p90, p99, p999;
+};
+
+guint64 stats_now(void);
+guint64 stats_record(enum stats_stage stage, guint64 start);
+void stats_count(enum stats_counter counter);
+void stats_reset(void);
+
+void stats_get_summary(enum stats_stage stage, struct stats_summary *sum);
+unsigned int stats_get_counter(enum stats_counter counter);
+size_t stats_format(char *buf, size_t len);
+
+int stats_server_start(const char *path);
+void stats_server_stop(void);
+
+#endif
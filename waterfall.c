@@ -0,0 +1,181 @@
+/**
+ * Copyright (C) 2013 Analog Devices, Inc.
+ *
+ * Licensed under the GPL-2.
+ *
+ **/
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "waterfall.h"
+
+/* Colours from the bottom of the range to the top */
+static const unsigned char lut_stops[][3] = {
+	{ 0, 0, 0 },
+	{ 0, 0, 160 },
+	{ 0, 160, 255 },
+	{ 0, 220, 0 },
+	{ 255, 255, 0 },
+	{ 255, 0, 0 },
+};
+
+#define NUM_STOPS	(sizeof(lut_stops) / sizeof(lut_stops[0]))
+
+static void waterfall_lut_init(uint32_t *lut)
+{
+	unsigned int i, s, c, rgb[3];
+	float pos, f;
+
+	for (i = 0; i < WATERFALL_LUT_SIZE; i++) {
+		pos = (float)i * (NUM_STOPS - 1) / (WATERFALL_LUT_SIZE - 1);
+		s = (unsigned int)pos;
+		if (s >= NUM_STOPS - 1)
+			s = NUM_STOPS - 2;
+		f = pos - s;
+
+		for (c = 0; c < 3; c++)
+			rgb[c] = (unsigned int)(lut_stops[s][c] +
+					f * (lut_stops[s + 1][c] - lut_stops[s][c]) + 0.5f);
+
+		/* CAIRO_FORMAT_RGB24 */
+		lut[i] = rgb[0] << 16 | rgb[1] << 8 | rgb[2];
+	}
+}
+
+/* All the memory the history will ever use is taken here */
+int waterfall_init(struct waterfall *wf, unsigned int width,
+		unsigned int depth)
+{
+	memset(wf, 0, sizeof(*wf));
+
+	if (!width || !depth)
+		return -EINVAL;
+
+	wf->pixels = calloc((size_t)width * depth, sizeof(*wf->pixels));
+	if (!wf->pixels)
+		return -ENOMEM;
+
+	wf->surface = cairo_image_surface_create_for_data(
+			(unsigned char *)wf->pixels, CAIRO_FORMAT_RGB24,
+			width, depth, width * sizeof(*wf->pixels));
+	if (cairo_surface_status(wf->surface) != CAIRO_STATUS_SUCCESS) {
+		cairo_surface_destroy(wf->surface);
+		free(wf->pixels);
+		memset(wf, 0, sizeof(*wf));
+		return -ENOMEM;
+	}
+
+	wf->width = width;
+	wf->depth = depth;
+	waterfall_lut_init(wf->lut);
+
+	return 0;
+}
+
+void waterfall_free(struct waterfall *wf)
+{
+	if (wf->surface)
+		cairo_surface_destroy(wf->surface);
+	free(wf->pixels);
+	memset(wf, 0, sizeof(*wf));
+}
+
+void waterfall_clear(struct waterfall *wf)
+{
+	if (!wf->pixels)
+		return;
+
+	cairo_surface_flush(wf->surface);
+	memset(wf->pixels, 0, (size_t)wf->width * wf->depth *
+			sizeof(*wf->pixels));
+	cairo_surface_mark_dirty(wf->surface);
+	wf->head = 0;
+	wf->rows = 0;
+}
+
+/*
+ * Add spectrum[first, last) as the newest row, min and max being the
+ * levels at the two ends of the colour map. When there are more bins than
+ * columns, a column shows the highest of its bins so narrow signals don't
+ * get lost.
+ */
+void waterfall_add(struct waterfall *wf, const float *spectrum,
+		unsigned int first, unsigned int last, float min, float max)
+{
+	unsigned int c, b, end, num = last - first;
+	float scale, v;
+	uint32_t *row;
+	int idx;
+
+	if (!wf->pixels || last <= first || max <= min)
+		return;
+
+	scale = (WATERFALL_LUT_SIZE - 1) / (max - min);
+
+	cairo_surface_flush(wf->surface);
+
+	wf->head = wf->head ? wf->head - 1 : wf->depth - 1;
+	if (wf->rows < wf->depth)
+		wf->rows++;
+	row = wf->pixels + (size_t)wf->head * wf->width;
+
+	for (c = 0; c < wf->width; c++) {
+		end = first + (unsigned int)((unsigned long long)(c + 1) *
+				num / wf->width);
+		b = first + (unsigned int)((unsigned long long)c * num / wf->width);
+
+		v = spectrum[b];
+		for (b++; b < end; b++)
+			if (spectrum[b] > v)
+				v = spectrum[b];
+
+		idx = (int)((v - min) * scale);
+		if (idx < 0)
+			idx = 0;
+		else if (idx >= WATERFALL_LUT_SIZE)
+			idx = WATERFALL_LUT_SIZE - 1;
+		row[c] = wf->lut[idx];
+	}
+
+	cairo_surface_mark_dirty_rectangle(wf->surface, 0, wf->head,
+			wf->width, 1);
+}
+
+/*
+ * Draw height rows of the history, starting row rows back from the
+ * newest, at the top of cr and stretched to width.
+ */
+void waterfall_draw(struct waterfall *wf, cairo_t *cr, double width,
+		unsigned int row, unsigned int height)
+{
+	unsigned int start, len, y = 0;
+
+	if (!wf->pixels || row >= wf->depth)
+		return;
+
+	if (height > wf->depth - row)
+		height = wf->depth - row;
+
+	cairo_save(cr);
+	cairo_scale(cr, width / wf->width, 1.0);
+
+	start = (wf->head + row) % wf->depth;
+	while (height) {
+		len = wf->depth - start;
+		if (len > height)
+			len = height;
+
+		cairo_set_source_surface(cr, wf->surface, 0, (double)y - start);
+		cairo_pattern_set_filter(cairo_get_source(cr), CAIRO_FILTER_FAST);
+		cairo_rectangle(cr, 0, y, wf->width, len);
+		cairo_fill(cr);
+
+		y += len;
+		height -= len;
+		start = 0;
+	}
+
+	cairo_restore(cr);
+}
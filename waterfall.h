@@ -0,0 +1,44 @@
+/**
+ * Copyright (C) 2013 Analog Devices, Inc.
+ *
+ * Licensed under the GPL-2.
+ *
+ **/
+
+#ifndef __WATERFALL_H__
+#define __WATERFALL_H__
+
+#include <stdint.h>
+#include <cairo.h>
+
+/*
+ * Spectrogram history: one row of pixels per spectrum, newest first. The
+ * rows live in a ring allocated once, a new one is written in front of the
+ * last and the ring start moves, so nothing is copied to scroll. The ring
+ * is drawn straight from memory as a cairo image, in two pieces when it
+ * wraps around.
+ */
+#define WATERFALL_LUT_SIZE	256
+
+struct waterfall {
+	unsigned int width;		/* columns */
+	unsigned int depth;		/* rows */
+	unsigned int head;		/* newest row */
+	unsigned int rows;		/* written so far, up to depth */
+
+	uint32_t *pixels;
+	cairo_surface_t *surface;
+	uint32_t lut[WATERFALL_LUT_SIZE];
+};
+
+int waterfall_init(struct waterfall *wf, unsigned int width,
+		unsigned int depth);
+void waterfall_free(struct waterfall *wf);
+void waterfall_clear(struct waterfall *wf);
+
+void waterfall_add(struct waterfall *wf, const float *spectrum,
+		unsigned int first, unsigned int last, float min, float max);
+void waterfall_draw(struct waterfall *wf, cairo_t *cr, double width,
+		unsigned int row, unsigned int height);
+
+#endif